@@ -46,7 +46,7 @@
 
 #define AMBRO_LIKELY(x) (x)
 #define AMBRO_UNLIKELY(x) (x)
-#define AMBRO_ALWAYS_INLINE
+#define AMBRO_ALWAYS_INLINE inline
 #define APRINTER_NO_INLINE
 #define APRINTER_NO_RETURN
 #define APRINTER_RESTRICT
@@ -24,9 +24,9 @@
 
 // This is made to be included from Preprocessor.h, don't include directly.
 
-#define APRINTER_AS_NUM_MACRO_ARGS(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER1(__VA_ARGS__, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define APRINTER_AS_NUM_MACRO_ARGS(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER1(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
 #define APRINTER_AS_NUM_MACRO_ARGS_HELPER1(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER2(__VA_ARGS__)
-#define APRINTER_AS_NUM_MACRO_ARGS_HELPER2(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, N, ...) N
+#define APRINTER_AS_NUM_MACRO_ARGS_HELPER2(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
 
 #define APRINTER_NUM_TUPLE_ARGS(tuple) APRINTER_AS_NUM_MACRO_ARGS tuple
 
@@ -52,6 +52,16 @@
 #define APRINTER_AS_GET_20(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, ...) p20
 #define APRINTER_AS_GET_21(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, ...) p21
 #define APRINTER_AS_GET_22(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, ...) p22
+#define APRINTER_AS_GET_23(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, ...) p23
+#define APRINTER_AS_GET_24(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, ...) p24
+#define APRINTER_AS_GET_25(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, ...) p25
+#define APRINTER_AS_GET_26(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, ...) p26
+#define APRINTER_AS_GET_27(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, ...) p27
+#define APRINTER_AS_GET_28(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, ...) p28
+#define APRINTER_AS_GET_29(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, ...) p29
+#define APRINTER_AS_GET_30(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, ...) p30
+#define APRINTER_AS_GET_31(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, ...) p31
+#define APRINTER_AS_GET_32(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31, p32, ...) p32
 
 #define  APRINTER_AS_MAP_1(f, del, arg, pars)                                                  f(arg,  APRINTER_AS_GET_1 pars)
 #define  APRINTER_AS_MAP_2(f, del, arg, pars)  APRINTER_AS_MAP_1(f, del, arg, pars) del(dummy) f(arg,  APRINTER_AS_GET_2 pars)
@@ -75,6 +85,16 @@
 #define APRINTER_AS_MAP_20(f, del, arg, pars) APRINTER_AS_MAP_19(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_20 pars)
 #define APRINTER_AS_MAP_21(f, del, arg, pars) APRINTER_AS_MAP_20(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_21 pars)
 #define APRINTER_AS_MAP_22(f, del, arg, pars) APRINTER_AS_MAP_21(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_22 pars)
+#define APRINTER_AS_MAP_23(f, del, arg, pars) APRINTER_AS_MAP_22(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_23 pars)
+#define APRINTER_AS_MAP_24(f, del, arg, pars) APRINTER_AS_MAP_23(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_24 pars)
+#define APRINTER_AS_MAP_25(f, del, arg, pars) APRINTER_AS_MAP_24(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_25 pars)
+#define APRINTER_AS_MAP_26(f, del, arg, pars) APRINTER_AS_MAP_25(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_26 pars)
+#define APRINTER_AS_MAP_27(f, del, arg, pars) APRINTER_AS_MAP_26(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_27 pars)
+#define APRINTER_AS_MAP_28(f, del, arg, pars) APRINTER_AS_MAP_27(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_28 pars)
+#define APRINTER_AS_MAP_29(f, del, arg, pars) APRINTER_AS_MAP_28(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_29 pars)
+#define APRINTER_AS_MAP_30(f, del, arg, pars) APRINTER_AS_MAP_29(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_30 pars)
+#define APRINTER_AS_MAP_31(f, del, arg, pars) APRINTER_AS_MAP_30(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_31 pars)
+#define APRINTER_AS_MAP_32(f, del, arg, pars) APRINTER_AS_MAP_31(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_32 pars)
 
 #define APRINTER_AS_MAP(f, del, arg, pars) APRINTER_JOIN(APRINTER_AS_MAP_, APRINTER_NUM_TUPLE_ARGS(pars))(f, del, arg, pars)
 
@@ -31,6 +31,8 @@
 #include <inttypes.h>
 
 #include <aprinter/meta/ChooseInt.h>
+#include <aprinter/meta/BitsInInt.h>
+#include <aprinter/meta/PowerOfTwo.h>
 #include <aprinter/meta/StructIf.h>
 #include <aprinter/meta/FunctionIf.h>
 #include <aprinter/meta/BasicMetaUtils.h>
@@ -67,10 +69,11 @@ public:
     static int const NumIoUnits      = Arg::NumIoUnits;
     static int const MaxIoBlocks     = Arg::MaxIoBlocks;
     static bool const Writable       = Arg::Writable;
+    static bool const IndexedLookup  = Arg::IndexedLookup;
     
 private:
     static_assert(NumCacheEntries > 0, "");
-    static_assert(NumCacheEntries <= 64, "");
+    static_assert(NumCacheEntries <= (IndexedLookup ? 1024 : 64), "");
     static_assert(NumIoUnits > 0 && NumIoUnits <= NumCacheEntries, "");
     static_assert(MaxIoBlocks > 0 && MaxIoBlocks <= NumCacheEntries, "");
     static_assert(MaxIoBlocks <= TheBlockAccess::MaxIoBlocks, "");
@@ -79,6 +82,7 @@ private:
     class CacheEntry;
     class IoDispatcher;
     class IoUnit;
+    struct EntryCandidates;
     
     using TheDebugObject = DebugObject<Context, Object>;
     
@@ -109,7 +113,9 @@ public:
         
         o->io_queue.init();
         o->io_queue_event.init(c, APRINTER_CB_STATFUNC_T(&BlockCache::io_queue_event_handler));
+        o->io_stats = IoStats{};
         writable_init(c);
+        IndexFeature::init(c);
         
         for (CacheEntry &entry : o->cache_entries) {
             entry.init(c);
@@ -142,11 +148,127 @@ public:
     
     static BlockIndexType hintBlocks (Context c, BlockIndexType protect_block, BlockIndexType start_block, BlockIndexType end_block, BlockIndexType write_stride, uint8_t write_count)
     {
-        auto *o = Object::self(c);
         TheDebugObject::access(c);
         AMBRO_ASSERT(protect_block <= start_block)
         AMBRO_ASSERT(start_block <= end_block)
         
+        return hint_blocks(c, protect_block, start_block, end_block, write_stride, write_count, nullptr);
+    }
+    
+    struct IoStats {
+        uint32_t read_ios;
+        uint32_t read_blocks;
+        uint32_t write_ios;
+        uint32_t write_blocks;
+    };
+    
+    static IoStats getIoStats (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return o->io_stats;
+    }
+    
+    static void resetIoStats (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        o->io_stats = IoStats{};
+    }
+    
+    static bool isBlockCached (Context c, BlockIndexType block)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        CacheEntryIndexType entry_index = IndexFeature::lookup_block(c, block);
+        return entry_index != -1 && o->cache_entries[entry_index].isInitialized(c);
+    }
+    
+    // Tracks the block ranges hinted ahead of a sequential reader which the
+    // reader has not reached yet. Further hints through the same window will
+    // not reassign the entries holding these blocks.
+    class ReadAheadWindow {
+        friend BlockCache;
+        
+    public:
+        static int const MaxExtents = 8;
+        
+        void init (Context c)
+        {
+            m_num_extents = 0;
+        }
+        
+        void reset (Context c)
+        {
+            m_num_extents = 0;
+        }
+        
+        BlockIndexType hint (Context c, BlockIndexType start_block, BlockIndexType end_block)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(start_block <= end_block)
+            
+            bool extends_last = m_num_extents > 0 && m_extents[m_num_extents - 1].end == start_block;
+            if (!extends_last && m_num_extents == MaxExtents) {
+                return start_block;
+            }
+            
+            BlockIndexType hinted_end = hint_blocks(c, start_block, start_block, end_block, 0, 1, this);
+            if (hinted_end > start_block) {
+                if (extends_last) {
+                    m_extents[m_num_extents - 1].end = hinted_end;
+                } else {
+                    m_extents[m_num_extents++] = Extent{start_block, hinted_end};
+                }
+            }
+            return hinted_end;
+        }
+        
+        // The reader has reached this block; it and everything hinted
+        // before it no longer need protecting.
+        void consume (Context c, BlockIndexType block)
+        {
+            for (auto i : LoopRange<uint8_t>(m_num_extents)) {
+                if (block >= m_extents[i].start && block < m_extents[i].end) {
+                    m_extents[i].start = block + 1;
+                    uint8_t num_drop = i + (m_extents[i].start == m_extents[i].end);
+                    for (auto j : LoopRange<uint8_t>(num_drop, m_num_extents)) {
+                        m_extents[j - num_drop] = m_extents[j];
+                    }
+                    m_num_extents -= num_drop;
+                    return;
+                }
+            }
+        }
+        
+    private:
+        struct Extent {
+            BlockIndexType start;
+            BlockIndexType end;
+        };
+        
+        bool covers (BlockIndexType block)
+        {
+            for (auto i : LoopRange<uint8_t>(m_num_extents)) {
+                if (block >= m_extents[i].start && block < m_extents[i].end) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        Extent m_extents[MaxExtents];
+        uint8_t m_num_extents;
+    };
+    
+private:
+    static BlockIndexType hint_blocks (Context c, BlockIndexType protect_block, BlockIndexType start_block, BlockIndexType end_block, BlockIndexType write_stride, uint8_t write_count, ReadAheadWindow *window)
+    {
+        auto *o = Object::self(c);
+        
         // Create two lists, of:
         // 1) Block indices in the given range which are already in the cache.
         // 2) Indices of cache entries which we may use to assign the blocks.
@@ -169,6 +291,9 @@ public:
                     // so prevent it from being reassigned now to another hinted block.
                     continue;
                 }
+                if (window && window->covers(block)) {
+                    continue;
+                }
             }
             if (!e->isBeingReleased(c) && !e->isReferencedIncludingWeak(c) && (!e->isAssigned(c) || e->canReassign(c))) {
                 free_entries[num_free_entries++] = i;
@@ -205,6 +330,7 @@ public:
         return block;
     }
     
+public:
     template <typename Dummy=void>
     class FlushRequest : private SimpleDebugObject<Context> {
         friend BlockCache;
@@ -676,39 +802,32 @@ private:
         return res;
     }
     
+    // Entries which get_entry_for_block_core may use when the requested
+    // block is not in the cache, as found by IndexFeature::find_entries.
+    struct EntryCandidates {
+        CacheEntryIndexType free_entry;
+        CacheEntryIndexType evictable_entry;
+        CacheEntryIndexType releasing_entry;
+    };
+    
     static CacheEntryIndexType get_entry_for_block_core (Context c, BlockIndexType block)
     {
         auto *o = Object::self(c);
         
-        CacheEntryIndexType free_entry = -1;
-        CacheEntryIndexType evictable_entry = -1;
-        CacheEntryIndexType releasing_entry = -1;
+        EntryCandidates cand = {-1, -1, -1};
+        CacheEntryIndexType block_entry = IndexFeature::find_entries(c, block, &cand);
         
-        for (auto entry_index : LoopRange<CacheEntryIndexType>(NumCacheEntries)) {
-            CacheEntry *ce = &o->cache_entries[entry_index];
-            
-            if (ce->isAssigned(c) && ce->getBlock(c) == block) {
-                return ce->isBeingReleased(c) ? -1 : entry_index;
-            }
-            
-            if (!ce->isBeingReleased(c)) {
-                if (!ce->isAssigned(c)) {
-                    free_entry = entry_index;
-                }
-                else if (!Writable ? ce->canReassign(c) : (ce->isAssigned(c) && !ce->isReferenced(c))) {
-                    if (evictable_entry == -1 || eviction_lesser_than(c, ce, &o->cache_entries[evictable_entry])) {
-                        evictable_entry = entry_index;
-                    }
-                }
-            } else {
-                releasing_entry = entry_index;
-            }
+        if (block_entry != -1) {
+            return o->cache_entries[block_entry].isBeingReleased(c) ? -1 : block_entry;
         }
         
-        if (free_entry != -1) {
-            return free_entry;
+        if (cand.free_entry != -1) {
+            return cand.free_entry;
         }
         
+        CacheEntryIndexType evictable_entry = cand.evictable_entry;
+        CacheEntryIndexType releasing_entry = cand.releasing_entry;
+        
         if (evictable_entry != -1) {
             CacheEntry *ee = &o->cache_entries[evictable_entry];
             
@@ -819,6 +938,20 @@ private:
     
     enum class DirtState : uint8_t {CLEAN, DIRTY, WRITING};
     
+    // Lists of entries maintained by IndexFeature. Entries which can be
+    // evicted are in the list for their eviction preference (see
+    // eviction_lesser_than), and others are in no list.
+    enum IndexList : uint8_t {
+        INDEX_LIST_FREE,
+        INDEX_LIST_CLEAN,
+        INDEX_LIST_DIRTY,
+        INDEX_LIST_WEAK_CLEAN,
+        INDEX_LIST_WEAK_DIRTY,
+        INDEX_LIST_RELEASING,
+        NumIndexLists,
+        INDEX_LIST_NONE = NumIndexLists
+    };
+    
     APRINTER_STRUCT_IF_TEMPLATE(CacheEntryWritableMemebers) {
         typename Context::EventLoop::QueuedEvent m_write_event;
         bool m_releasing;
@@ -833,7 +966,14 @@ private:
         BufferIndexType m_writing_buffer;
     };
     
-    class CacheEntry : private CacheEntryWritableMemebers<Writable> {
+    APRINTER_STRUCT_IF_TEMPLATE(CacheEntryIndexMembers) {
+        DoubleEndedListNode<CacheEntry> m_index_list_node;
+        CacheEntryIndexType m_hash_next;
+        uint8_t m_index_list;
+        bool m_hashed;
+    };
+    
+    class CacheEntry : private CacheEntryWritableMemebers<Writable>, public CacheEntryIndexMembers<IndexedLookup> {
         friend class IoDispatcher;
         friend class IoUnit;
         
@@ -847,6 +987,8 @@ private:
             m_state = State::INVALID;
             IoQueue::markRemoved(this);
             writable_entry_init(c);
+            IndexFeature::init_entry(c, this);
+            update_index(c);
         }
         
         void deinit (Context c)
@@ -979,6 +1121,7 @@ private:
                 
                 break_weak_refs(c);
                 
+                IndexFeature::unlink_block(c, this, m_block);
                 m_block = block;
                 writable_assign(c, write_stride, write_count);
                 
@@ -997,6 +1140,8 @@ private:
                 m_cache_users_list.prepend(user);
                 m_num_hard_refs++;
             }
+            
+            update_index(c);
         }
         
         enum class DetachMode {HARD_TO_WEAK, DETACH_HARD, DETACH_WEAK};
@@ -1011,6 +1156,8 @@ private:
             if (mode != DetachMode::DETACH_WEAK) {
                 m_num_hard_refs--;
             }
+            
+            update_index(c);
         }
         
         void hardenWeakUser (Context c, CacheRef *user)
@@ -1020,6 +1167,7 @@ private:
             AMBRO_ASSERT(!isBeingReleased(c))
             
             m_num_hard_refs++;
+            update_index(c);
         }
         
         APRINTER_FUNCTION_IF(Writable, void, markDirty (Context c))
@@ -1057,6 +1205,7 @@ private:
             break_weak_refs(c);
             
             this->m_releasing = true;
+            update_index(c);
             if (m_state == State::IDLE) {
                 scheduleWriting(c);
             }
@@ -1066,9 +1215,33 @@ private:
         {
             AMBRO_ASSERT(this->m_releasing)
             this->m_releasing = false;
+            update_index(c);
+        }
+        
+        uint8_t getIndexList (Context c)
+        {
+            if (isBeingReleased(c)) {
+                return INDEX_LIST_RELEASING;
+            }
+            if (!isAssigned(c)) {
+                return INDEX_LIST_FREE;
+            }
+            if (Writable ? isReferenced(c) : !canReassign(c)) {
+                return INDEX_LIST_NONE;
+            }
+            bool dirty = isInitialized(c) && get_dirt_state() != DirtState::CLEAN;
+            if (isReferencedIncludingWeak(c)) {
+                return dirty ? INDEX_LIST_WEAK_DIRTY : INDEX_LIST_WEAK_CLEAN;
+            }
+            return dirty ? INDEX_LIST_DIRTY : INDEX_LIST_CLEAN;
         }
         
     private:
+        void update_index (Context c)
+        {
+            IndexFeature::update_entry(c, this, m_block);
+        }
+        
         CacheEntryIndexType get_entry_index (Context c)
         {
             auto *o = Object::self(c);
@@ -1163,9 +1336,11 @@ private:
                 APRINTER_BLOCKCACHE_MSG("c RD %" PRIu32 " e%d", (uint32_t)m_block, (int)error);
                 if (isBeingReleased(c)) {
                     m_state = State::INVALID;
+                    update_index(c);
                     return schedule_allocations_check(c);
                 }
                 m_state = error ? State::INVALID : State::IDLE;
+                update_index(c);
                 raise_read_completed(c, error);
                 AMBRO_ASSERT(!error || !isReferencedIncludingWeak(c))
             }
@@ -1238,6 +1413,7 @@ private:
             this->m_last_write_failed = error;
             this->m_flush_write_failed = error;
             this->m_dirt_state = (!error && this->m_dirt_state == DirtState::WRITING) ? DirtState::CLEAN : DirtState::DIRTY;
+            update_index(c);
             
             if (!error && this->m_dirt_state == DirtState::DIRTY && (!o->waiting_flush_requests.isEmpty() || this->m_releasing)) {
                 return write_event_handler(c);
@@ -1250,6 +1426,7 @@ private:
                 } else {
                     AMBRO_ASSERT(this->m_dirt_state == DirtState::CLEAN)
                     m_state = State::INVALID;
+                    update_index(c);
                     schedule_allocations_check(c);
                 }
             }
@@ -1357,13 +1534,21 @@ private:
             BlockIndexType start_block = first_e->get_io_block_index();
             bool is_write = (Writable && first_e->m_state == CacheEntry::State::WRITING);
             
-            // The first entry in the chain will be the one requesting this I/O.
+            // Unless extended, the I/O is just for the requested block.
             m_num_blocks = 1;
             m_entry_indices[0] = (first_e - o->cache_entries);
             
-            // Try to extend the I/O operation into the blocks that follow the requested block.
+            // Try to extend the I/O operation into the blocks around the requested block.
             if (MaxIoBlocks > 1) {
-                extend_io(c, first_e, start_block);
+                extend_io(c, first_e, &start_block);
+            }
+            
+            if (is_write) {
+                o->io_stats.write_ios++;
+                o->io_stats.write_blocks += m_num_blocks;
+            } else {
+                o->io_stats.read_ios++;
+                o->io_stats.read_blocks += m_num_blocks;
             }
             
             // Build transfer descriptors.
@@ -1385,7 +1570,7 @@ private:
             m_block_user.setLocker(c, APRINTER_CB_OBJFUNC_T(&IoUnit::block_user_locker<>, this));
         }
         
-        void extend_io (Context c, CacheEntry *first_e, BlockIndexType start_block)
+        void extend_io (Context c, CacheEntry *first_e, BlockIndexType *start_block)
         {
             auto *o = Object::self(c);
             
@@ -1396,10 +1581,15 @@ private:
                 return;
             }
             
-            // Clear entry indices for the remainder of the block sequence (needed for next step).
-            for (auto i : LoopRange<IoBlockIndexType>(1, MaxIoBlocks)) {
-                m_entry_indices[i] = -1;
+            // Candidate entries for the blocks up to MaxIoBlocks-1 before or after the
+            // requested block, which is at position FirstPos.
+            static int const NumPositions = 2 * MaxIoBlocks - 1;
+            static int const FirstPos = MaxIoBlocks - 1;
+            CacheEntryIndexType candidates[NumPositions];
+            for (auto i : LoopRange<int>(NumPositions)) {
+                candidates[i] = -1;
             }
+            candidates[FirstPos] = m_entry_indices[0];
             
             // Find candidate blocks to add to the sequence.
             for (CacheEntry &this_e : o->cache_entries) {
@@ -1410,8 +1600,17 @@ private:
                 
                 // Check if the entry has a place in the sequence.
                 BlockIndexType block_index = this_e.get_io_block_index();
-                if (!(block_index > start_block && block_index - start_block < MaxIoBlocks)) {
-                    continue;
+                int pos;
+                if (block_index >= *start_block) {
+                    if (block_index - *start_block >= MaxIoBlocks) {
+                        continue;
+                    }
+                    pos = FirstPos + (int)(block_index - *start_block);
+                } else {
+                    if (*start_block - block_index >= MaxIoBlocks) {
+                        continue;
+                    }
+                    pos = FirstPos - (int)(*start_block - block_index);
                 }
                 
                 // See above...
@@ -1434,29 +1633,42 @@ private:
                 // The entry is a candidate, add it to the list.
                 // Unless some other entry is already in this place - but the only way this can
                 // happen if the user caused a conflict with the write strides.
-                IoBlockIndexType io_index = block_index - start_block;
-                if (m_entry_indices[io_index] == -1) {
-                    m_entry_indices[io_index] = (&this_e - o->cache_entries);
+                if (candidates[pos] == -1) {
+                    candidates[pos] = (&this_e - o->cache_entries);
                 }
             }
             
-            // Extend the chain into the candidate entries as much as possible,
-            // keeping it contiguous. Update these entries to reflect start of I/O.
-            while (m_num_blocks < MaxIoBlocks && m_entry_indices[m_num_blocks] != -1) {
-                CacheEntry *this_e = &o->cache_entries[m_entry_indices[m_num_blocks]];
+            // Extend the chain into the candidate entries as much as possible, keeping it
+            // contiguous, first back from the requested block and then forward from it.
+            int start_pos = FirstPos;
+            while (start_pos > 0 && candidates[start_pos - 1] != -1) {
+                start_pos--;
+            }
+            int end_pos = FirstPos + 1;
+            while (end_pos - start_pos < MaxIoBlocks && end_pos < NumPositions && candidates[end_pos] != -1) {
+                end_pos++;
+            }
+            
+            // Update these entries to reflect start of I/O.
+            m_num_blocks = 0;
+            for (auto pos : LoopRange<int>(start_pos, end_pos)) {
+                CacheEntry *this_e = &o->cache_entries[candidates[pos]];
                 
-                if (this_e->isIoActive(c)) {
-                    // It was queued, so remove it from the I/O queue.
-                    o->io_queue.remove(this_e);
-                    CacheEntry::IoQueue::markRemoved(this_e);
-                } else {
-                    // It was idle, notify it that writing has started.
-                    AMBRO_ASSERT(Writable)
-                    this_e->write_starting(c);
+                if (pos != FirstPos) {
+                    if (this_e->isIoActive(c)) {
+                        // It was queued, so remove it from the I/O queue.
+                        o->io_queue.remove(this_e);
+                        CacheEntry::IoQueue::markRemoved(this_e);
+                    } else {
+                        // It was idle, notify it that writing has started.
+                        AMBRO_ASSERT(Writable)
+                        this_e->write_starting(c);
+                    }
                 }
                 
-                m_num_blocks++;
+                m_entry_indices[m_num_blocks++] = candidates[pos];
             }
+            *start_block -= FirstPos - start_pos;
         }
         
         APRINTER_FUNCTION_IF(Writable, void, block_user_locker (Context c, bool lock_else_unlock))
@@ -1501,6 +1713,195 @@ private:
         State m_state;
     };
     
+    /**
+     * Lookup of entries for get_entry_for_block_core.
+     * 
+     * With IndexedLookup, entries are found by block index through a hash
+     * table, and entries which can be used for another block are kept in
+     * lists by their eviction preference (see IndexList), so that a lookup
+     * does not need to look at all entries. Entries update their place in the
+     * table and lists with update_index whenever their state changes. Only
+     * dirty entries need to be compared to find the one dirty for the longest
+     * time, since when they become unreferenced their dirt time can be anything.
+     * 
+     * Otherwise, all entries are simply scanned for each lookup.
+     */
+    AMBRO_STRUCT_IF(IndexFeature, IndexedLookup) {
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            for (auto i : LoopRange<size_t>(NumIndexHashBuckets)) {
+                o->hash_buckets[i] = -1;
+            }
+            for (auto i : LoopRange<int>(NumIndexLists)) {
+                o->index_lists[i].init();
+            }
+        }
+        
+        static void init_entry (Context c, CacheEntry *e)
+        {
+            e->m_index_list = INDEX_LIST_NONE;
+            e->m_hashed = false;
+        }
+        
+        static void update_entry (Context c, CacheEntry *e, BlockIndexType block)
+        {
+            auto *o = Object::self(c);
+            
+            if (e->isAssigned(c) != e->m_hashed) {
+                if (e->m_hashed) {
+                    unlink_block(c, e, block);
+                } else {
+                    size_t bucket = hash_block(block);
+                    e->m_hash_next = o->hash_buckets[bucket];
+                    o->hash_buckets[bucket] = e - o->cache_entries;
+                    e->m_hashed = true;
+                }
+            }
+            
+            uint8_t list = e->getIndexList(c);
+            if (list != e->m_index_list) {
+                if (e->m_index_list != INDEX_LIST_NONE) {
+                    o->index_lists[e->m_index_list].remove(e);
+                }
+                if (list != INDEX_LIST_NONE) {
+                    o->index_lists[list].append(e);
+                }
+                e->m_index_list = list;
+            }
+        }
+        
+        // Called before an assigned entry gets a new block.
+        static void unlink_block (Context c, CacheEntry *e, BlockIndexType block)
+        {
+            auto *o = Object::self(c);
+            
+            if (!e->m_hashed) {
+                return;
+            }
+            
+            CacheEntryIndexType entry_index = e - o->cache_entries;
+            CacheEntryIndexType *link = &o->hash_buckets[hash_block(block)];
+            while (*link != entry_index) {
+                AMBRO_ASSERT(*link != -1)
+                link = &o->cache_entries[*link].m_hash_next;
+            }
+            *link = e->m_hash_next;
+            e->m_hashed = false;
+        }
+        
+        static CacheEntryIndexType lookup_block (Context c, BlockIndexType block)
+        {
+            auto *o = Object::self(c);
+            
+            CacheEntryIndexType entry_index = o->hash_buckets[hash_block(block)];
+            while (entry_index != -1) {
+                CacheEntry *ce = &o->cache_entries[entry_index];
+                if (ce->getBlock(c) == block) {
+                    break;
+                }
+                entry_index = ce->m_hash_next;
+            }
+            return entry_index;
+        }
+        
+        static CacheEntryIndexType find_entries (Context c, BlockIndexType block, EntryCandidates *cand)
+        {
+            CacheEntryIndexType entry_index = lookup_block(c, block);
+            if (entry_index != -1) {
+                return entry_index;
+            }
+            
+            cand->free_entry = first_in_list(c, INDEX_LIST_FREE);
+            cand->releasing_entry = first_in_list(c, INDEX_LIST_RELEASING);
+            
+            for (auto list : LoopRange<int>(INDEX_LIST_CLEAN, INDEX_LIST_RELEASING)) {
+                bool dirty = (list == INDEX_LIST_DIRTY || list == INDEX_LIST_WEAK_DIRTY);
+                cand->evictable_entry = dirty ? oldest_dirty_in_list(c, list) : first_in_list(c, list);
+                if (cand->evictable_entry != -1) {
+                    break;
+                }
+            }
+            
+            return -1;
+        }
+        
+    private:
+        static size_t hash_block (BlockIndexType block)
+        {
+            return (size_t)(block ^ (block >> IndexHashBits)) & (NumIndexHashBuckets - 1);
+        }
+        
+        static CacheEntryIndexType first_in_list (Context c, int list)
+        {
+            auto *o = Object::self(c);
+            
+            CacheEntry *e = o->index_lists[list].first();
+            return e ? (CacheEntryIndexType)(e - o->cache_entries) : -1;
+        }
+        
+        static CacheEntryIndexType oldest_dirty_in_list (Context c, int list)
+        {
+            auto *o = Object::self(c);
+            
+            CacheEntry *best = nullptr;
+            for (CacheEntry *e = o->index_lists[list].first(); e; e = o->index_lists[list].next(e)) {
+                if (!best || eviction_lesser_than(c, e, best)) {
+                    best = e;
+                }
+            }
+            return best ? (CacheEntryIndexType)(best - o->cache_entries) : -1;
+        }
+    }
+    AMBRO_STRUCT_ELSE(IndexFeature) {
+        static void init (Context c) {}
+        static void init_entry (Context c, CacheEntry *e) {}
+        static void update_entry (Context c, CacheEntry *e, BlockIndexType block) {}
+        static void unlink_block (Context c, CacheEntry *e, BlockIndexType block) {}
+        
+        static CacheEntryIndexType lookup_block (Context c, BlockIndexType block)
+        {
+            auto *o = Object::self(c);
+            
+            for (auto entry_index : LoopRange<CacheEntryIndexType>(NumCacheEntries)) {
+                CacheEntry *ce = &o->cache_entries[entry_index];
+                if (ce->isAssigned(c) && ce->getBlock(c) == block) {
+                    return entry_index;
+                }
+            }
+            return -1;
+        }
+        
+        static CacheEntryIndexType find_entries (Context c, BlockIndexType block, EntryCandidates *cand)
+        {
+            auto *o = Object::self(c);
+            
+            for (auto entry_index : LoopRange<CacheEntryIndexType>(NumCacheEntries)) {
+                CacheEntry *ce = &o->cache_entries[entry_index];
+                
+                if (ce->isAssigned(c) && ce->getBlock(c) == block) {
+                    return entry_index;
+                }
+                
+                if (!ce->isBeingReleased(c)) {
+                    if (!ce->isAssigned(c)) {
+                        cand->free_entry = entry_index;
+                    }
+                    else if (!Writable ? ce->canReassign(c) : (ce->isAssigned(c) && !ce->isReferenced(c))) {
+                        if (cand->evictable_entry == -1 || eviction_lesser_than(c, ce, &o->cache_entries[cand->evictable_entry])) {
+                            cand->evictable_entry = entry_index;
+                        }
+                    }
+                } else {
+                    cand->releasing_entry = entry_index;
+                }
+            }
+            
+            return -1;
+        }
+    };
+    
     APRINTER_STRUCT_IF_TEMPLATE(CacheWritableMembers) {
         typename Context::EventLoop::QueuedEvent allocations_event;
         DirtTimeType current_dirt_time;
@@ -1509,14 +1910,23 @@ private:
         bool buffer_usage[NumBuffers];
     };
     
+    static int const IndexHashBits = BitsInInt<NumCacheEntries - 1>::Value;
+    static size_t const NumIndexHashBuckets = PowerOfTwo<size_t, IndexHashBits>::Value;
+    
+    APRINTER_STRUCT_IF_TEMPLATE(CacheIndexMembers) {
+        CacheEntryIndexType hash_buckets[NumIndexHashBuckets];
+        DoubleEndedListForBase<CacheEntry, CacheEntryIndexMembers<true>, &CacheEntryIndexMembers<true>::m_index_list_node> index_lists[NumIndexLists];
+    };
+    
 public:
     struct Object : public ObjBase<BlockCache, ParentObject, MakeTypeList<
         TheDebugObject
-    >>, public CacheWritableMembers<Writable> {
+    >>, public CacheWritableMembers<Writable>, public CacheIndexMembers<IndexedLookup> {
         CacheEntry cache_entries[NumCacheEntries];
         IoUnit io_units[NumIoUnits];
         typename CacheEntry::IoQueue io_queue;
         typename Context::EventLoop::QueuedEvent io_queue_event;
+        IoStats io_stats;
         DataWordType buffers[NumBuffers][BlockSizeInWords];
     };
 };
@@ -1528,7 +1938,8 @@ APRINTER_ALIAS_STRUCT_EXT(BlockCacheArg, (
     APRINTER_AS_VALUE(int, NumCacheEntries),
     APRINTER_AS_VALUE(int, NumIoUnits),
     APRINTER_AS_VALUE(int, MaxIoBlocks),
-    APRINTER_AS_VALUE(bool, Writable)
+    APRINTER_AS_VALUE(bool, Writable),
+    APRINTER_AS_VALUE(bool, IndexedLookup)
 ), (
     APRINTER_DEF_INSTANCE(BlockCacheArg, BlockCache)
 ))
@@ -25,6 +25,7 @@
 #ifndef APRINTER_BUFFERED_FILE_H
 #define APRINTER_BUFFERED_FILE_H
 
+#include <stdint.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -44,10 +45,11 @@ private:
     
     enum class State {
         IDLE,
-        OPEN_ACCESS, OPEN_BASEDIR, OPEN_OPEN, OPEN_OPENWR,
+        OPEN_ACCESS, OPEN_BASEDIR, OPEN_OPEN, OPEN_OPENWR, OPEN_PREALLOC,
         READY,
         WRITE_EVENT, WRITE_WRITE, WRITE_TRUNCATE, WRITE_FLUSH,
-        READ_EVENT, READ_READ
+        READ_EVENT, READ_READ,
+        ABORT_EVENT
     };
     
 public:
@@ -65,6 +67,8 @@ public:
         m_have_opener = false;
         m_have_file = false;
         m_have_flush = false;
+        m_aborting = false;
+        m_write_error = false;
     }
     
     void deinit (Context c)
@@ -74,20 +78,27 @@ public:
         m_event.deinit(c);
     }
     
+    // Releases the file at once. A file being written is not truncated, so
+    // clusters preallocated for it would remain allocated; startAbort should
+    // be used to abandon a write.
     void reset (Context c)
     {
         reset_internal(c);
     }
     
-    void startOpen (Context c, char const *filename, bool in_current_dir, OpenMode mode, char const *basedir=nullptr)
+    // When opening for writing, a nonzero preallocate_size gives the file
+    // consecutive clusters for that many bytes before any data is written.
+    void startOpen (Context c, char const *filename, bool in_current_dir, OpenMode mode, char const *basedir=nullptr, uint32_t preallocate_size=0)
     {
         AMBRO_ASSERT(m_state == State::IDLE)
         AMBRO_ASSERT(filename)
         AMBRO_ASSERT(mode == OpenMode::OPEN_READ || mode == OpenMode::OPEN_WRITE)
+        AMBRO_ASSERT(mode == OpenMode::OPEN_WRITE || preallocate_size == 0)
         
         m_state = State::OPEN_ACCESS;
         m_filename = filename;
         m_basedir = basedir;
+        m_preallocate_size = preallocate_size;
         m_in_current_dir = in_current_dir;
         m_write_mode = (mode == OpenMode::OPEN_WRITE);
         m_access_client.requestAccess(c, m_write_mode);
@@ -129,6 +140,29 @@ public:
         m_event.prependNowNotAlready(c);
     }
     
+    // Abandons the file, waiting for any operation in progress first, and
+    // reports completion to the handler. A file being written is truncated
+    // after the data written so far, as on startWriteEof, which releases any
+    // clusters preallocated beyond it.
+    void startAbort (Context c)
+    {
+        AMBRO_ASSERT(m_state != State::IDLE)
+        AMBRO_ASSERT(!m_aborting)
+        
+        m_aborting = true;
+        
+        if (m_state == State::READY || m_state == State::WRITE_EVENT || m_state == State::READ_EVENT) {
+            if (m_write_mode) {
+                m_write_eof = true;
+                m_write_length = 0;
+                m_state = State::WRITE_EVENT;
+            } else {
+                m_state = State::ABORT_EVENT;
+            }
+            m_event.prependNow(c);
+        }
+    }
+    
     bool isReady (Context c)
     {
         return (m_state == State::READY);
@@ -152,6 +186,8 @@ private:
         m_access_client.reset(c);
         m_event.unset(c);
         m_state = State::IDLE;
+        m_aborting = false;
+        m_write_error = false;
     }
     
     void reset_and_complete (Context c, Error error)
@@ -169,6 +205,10 @@ private:
             return reset_and_complete(c, Error::OTHER_ERROR);
         }
         
+        if (m_aborting) {
+            return reset_and_complete(c, Error::NO_ERROR);
+        }
+        
         auto dir_entry = m_in_current_dir ? m_access_client.getCurrentDirectory(c) : TheFs::getRootEntry(c);
         if (m_basedir) {
             m_state = State::OPEN_BASEDIR;
@@ -191,6 +231,10 @@ private:
             return reset_and_complete(c, user_error);
         }
         
+        if (m_aborting) {
+            return reset_and_complete(c, Error::NO_ERROR);
+        }
+        
         m_fs_opener.deinit(c);
         
         if (m_state == State::OPEN_BASEDIR) {
@@ -217,20 +261,41 @@ private:
     
     void fs_file_handler (Context c, bool io_error, size_t read_length)
     {
-        AMBRO_ASSERT(m_state == State::OPEN_OPENWR || m_state == State::WRITE_WRITE || m_state == State::READ_READ || m_state == State::WRITE_TRUNCATE)
+        AMBRO_ASSERT(m_state == State::OPEN_OPENWR || m_state == State::OPEN_PREALLOC || m_state == State::WRITE_WRITE || m_state == State::READ_READ || m_state == State::WRITE_TRUNCATE)
         AMBRO_ASSERT(m_have_file)
         
         if (io_error) {
+            // Once the file is writable, still truncate it, so that clusters
+            // preallocated beyond the written data are released.
+            if (m_state == State::OPEN_PREALLOC || m_state == State::WRITE_WRITE) {
+                m_write_error = true;
+                return start_truncate(c);
+            }
             return reset_and_complete(c, Error::OTHER_ERROR);
         }
         
-        if (m_state == State::OPEN_OPENWR) {
+        if (m_aborting && (m_state == State::OPEN_OPENWR || m_state == State::READ_READ)) {
+            return reset_and_complete(c, Error::NO_ERROR);
+        }
+        
+        if (m_state == State::OPEN_OPENWR && m_preallocate_size > 0) {
+            m_state = State::OPEN_PREALLOC;
+            m_fs_file.startPreallocate(c, m_preallocate_size);
+        }
+        else if (m_state == State::OPEN_OPENWR || m_state == State::OPEN_PREALLOC) {
+            if (m_aborting) {
+                return start_truncate(c);
+            }
             m_state = State::READY;
             m_write_eof = false;
             m_write_buffer_pos = TheFs::BlockSize;
             return m_completion_handler(c, Error::NO_ERROR, 0);
         }
         else if (m_state == State::WRITE_WRITE) {
+            if (m_aborting) {
+                m_fs_file.finishWrite(c, 0);
+                return start_truncate(c);
+            }
             m_state = State::WRITE_EVENT;
             m_write_buffer_pos = 0;
             m_event.prependNowNotAlready(c);
@@ -261,18 +326,28 @@ private:
     {
         AMBRO_ASSERT(m_state == State::WRITE_FLUSH)
         
-        Error user_error = error ? Error::OTHER_ERROR : Error::NO_ERROR;
+        Error user_error = (error || m_write_error) ? Error::OTHER_ERROR : Error::NO_ERROR;
         return reset_and_complete(c, user_error);
     }
     
+    void start_truncate (Context c)
+    {
+        m_state = State::WRITE_TRUNCATE;
+        m_fs_file.startTruncate(c);
+    }
+    
     void event_handler (Context c)
     {
         if (m_state == State::WRITE_EVENT) {
             handle_event_write(c);
-        } else {
-            AMBRO_ASSERT(m_state == State::READ_EVENT)
+        }
+        else if (m_state == State::READ_EVENT) {
             handle_event_read(c);
         }
+        else {
+            AMBRO_ASSERT(m_state == State::ABORT_EVENT)
+            reset_and_complete(c, Error::NO_ERROR);
+        }
     }
     
     void handle_event_write (Context c)
@@ -281,9 +356,7 @@ private:
             if (m_write_buffer_pos < TheFs::BlockSize) {
                 m_fs_file.finishWrite(c, m_write_buffer_pos);
             }
-            m_fs_file.startTruncate(c);
-            m_state = State::WRITE_TRUNCATE;
-            return;
+            return start_truncate(c);
         }
         
         size_t to_copy = MinValue(m_write_length, (size_t)(TheFs::BlockSize - m_write_buffer_pos));
@@ -350,10 +423,13 @@ private:
     bool m_write_mode : 1;
     bool m_in_current_dir : 1;
     bool m_write_eof : 1;
+    bool m_aborting : 1;
+    bool m_write_error : 1;
     union {
         struct {
             char const *m_filename;
             char const *m_basedir;
+            uint32_t m_preallocate_size;
         };
         union {
             struct {
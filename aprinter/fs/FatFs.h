@@ -63,14 +63,17 @@ public:
     struct Object;
     static bool const FsWritable = Params::Writable;
     static bool const EnableReadHinting = Params::EnableReadHinting;
+    static bool const EnableFreeSummary = FsWritable && Params::FreeSummarySlots > 0;
     static int const MaxFileNameSize = Params::MaxFileNameSize;
     
 private:
     static_assert(Params::NumCacheEntries >= 1, "");
     static_assert(Params::MaxFileNameSize >= 12, "");
+    static_assert(!EnableReadHinting || (Params::ReadAheadMaxBlocks >= 1 && Params::ReadAheadMaxBlocks <= Params::NumCacheEntries), "");
+    static_assert(Params::FreeSummarySlots >= 0, "");
     
     using TheDebugObject = DebugObject<Context, Object>;
-    APRINTER_MAKE_INSTANCE(TheBlockCache, (BlockCacheArg<Context, Object, TheBlockAccess, Params::NumCacheEntries, Params::NumIoUnits, Params::MaxIoBlocks, FsWritable>))
+    APRINTER_MAKE_INSTANCE(TheBlockCache, (BlockCacheArg<Context, Object, TheBlockAccess, Params::NumCacheEntries, Params::NumIoUnits, Params::MaxIoBlocks, FsWritable, Params::CacheIndexedLookup>))
     
     using BlockAccessUser = typename TheBlockAccess::User;
     using BlockIndexType = typename TheBlockAccess::BlockIndexType;
@@ -86,6 +89,7 @@ private:
     
     static size_t const FatEntriesPerBlock = BlockSize / 4;
     static size_t const DirEntriesPerBlock = BlockSize / 32;
+    static size_t const AllocSearchMaxFatBlocks = 16;
     
     using ClusterIndexType = uint32_t;
     using ClusterBlockIndexType = uint16_t;
@@ -110,7 +114,8 @@ private:
     
     enum class FsState : uint8_t {INIT, READY, FAILED};
     enum class WriteMountState : uint8_t {NOT_MOUNTED, MOUNT_META, MOUNT_FSINFO, MOUNT_FLUSH, MOUNTED, UMOUNT_FLUSH1, UMOUNT_META, UMOUNT_FLUSH2};
-    enum class AllocationState : uint8_t {IDLE, CHECK_EVENT, REQUESTING_BLOCK};
+    enum class AllocationState : uint8_t {IDLE, CHECK_EVENT, REQUESTING_BLOCK, MARK_EVENT, MARK_REQUESTING_BLOCK};
+    enum class FreeSummaryState : uint8_t {NONE, BUILDING, READY};
     
     template <bool Writable> class ClusterChain;
     template <bool Writable> class DirEntryRef;
@@ -190,6 +195,22 @@ public:
         return entry;
     }
     
+    using CacheIoStats = typename TheBlockCache::IoStats;
+    
+    static CacheIoStats getCacheIoStats (Context c)
+    {
+        TheDebugObject::access(c);
+        
+        return TheBlockCache::getIoStats(c);
+    }
+    
+    static void resetCacheIoStats (Context c)
+    {
+        TheDebugObject::access(c);
+        
+        TheBlockCache::resetIoStats(c);
+    }
+    
     APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, startWriteMount (Context c))
     {
         auto *o = Object::self(c);
@@ -214,6 +235,8 @@ public:
         // implies
         AMBRO_ASSERT(o->alloc_state == AllocationState::IDLE)
         
+        FreeSummaryFeature::stop(c);
+        
         o->write_mount_state = WriteMountState::UMOUNT_FLUSH1;
         o->flush_request.requestFlush(c);
     }
@@ -394,10 +417,22 @@ public:
         DirEntriesPerBlockType m_dir_entry_block_offset;
         bool m_no_need_to_read_for_write;
         WriteReference<true> m_write_ref;
+        ClusterIndexType m_prealloc_clusters;
     };
     
+    enum class ReadAheadState : uint8_t {IDLE, ACTIVE, REQUESTING, REQUESTING_STALE, END};
+    
+    using ReadAheadSizeType = ChooseIntForMax<Params::ReadAheadMaxBlocks, false>;
+    
     APRINTER_STRUCT_IF_TEMPLATE(FileHintingMembers) {
-        BlockIndexType m_hint_block_pos;
+        ClusterChain<false> m_ra_chain;
+        typename TheBlockCache::ReadAheadWindow m_ra_window;
+        uint32_t m_ra_reader_block;
+        uint32_t m_ra_cluster_block;
+        uint32_t m_ra_block;
+        ReadAheadSizeType m_ra_size;
+        ReadAheadSizeType m_ra_hits;
+        ReadAheadState m_ra_state;
     };
     
     template <bool Writable>
@@ -409,7 +444,8 @@ public:
             READ_EVENT, READ_NEXT_CLUSTER, READ_BLOCK, READ_READY,
             OPENWR_EVENT, OPENWR_DIR_ENTRY,
             WRITE_EVENT, WRITE_NEXT_CLUSTER, WRITE_BLOCK, WRITE_READY,
-            TRUNC_EVENT, TRUNC_CHAIN
+            TRUNC_EVENT, TRUNC_CHAIN,
+            PREALLOC_EVENT, PREALLOC_TRUNC, PREALLOC_NEXT, PREALLOC_NEW
         };
         
     public:
@@ -442,6 +478,7 @@ public:
             m_block_in_cluster = o->blocks_per_cluster;
             
             writable_init(c, file_entry);
+            hinting_init(c, file_entry);
         }
         
         // NOTE: Not allowed when reader is busy, except when deiniting the whole FatFs and underlying storage!
@@ -449,6 +486,7 @@ public:
         {
             TheDebugObject::access(c);
             
+            hinting_deinit(c);
             writable_deinit(c);
             
             if (m_io_mode == IoMode::USER_BUFFER) {
@@ -470,6 +508,7 @@ public:
             m_chain.rewind(c);
             m_file_pos = 0;
             m_block_in_cluster = o->blocks_per_cluster;
+            reset_read_ahead(c);
         }
         
         void startReadUserBuf (Context c, DataWordType *buf)
@@ -539,6 +578,7 @@ public:
             AMBRO_ASSERT(m_io_mode == IoMode::FS_BUFFER)
             
             this->m_no_need_to_read_for_write = no_need_to_read;
+            reset_read_ahead(c);
             m_state = State::WRITE_EVENT;
             m_event.prependNowNotAlready(c);
         }
@@ -573,10 +613,30 @@ public:
             TheDebugObject::access(c);
             AMBRO_ASSERT(m_state == State::IDLE)
             
+            reset_read_ahead(c);
             m_state = State::TRUNC_EVENT;
             m_event.prependNowNotAlready(c);
         }
         
+        // Empties the file and gives it a chain of consecutive clusters which
+        // can hold the given length, or the longest run of free clusters if
+        // there is none that long, so that writing the data needs no further
+        // allocations. Must be done at the start of the file. Clusters which
+        // remain unused are released by the truncation after writing.
+        APRINTER_FUNCTION_IF(Writable, void, startPreallocate (Context c, uint32_t length))
+        {
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(m_file_pos == 0)
+            
+            uint32_t cluster_size = (uint32_t)o->blocks_per_cluster * BlockSize;
+            this->m_prealloc_clusters = length / cluster_size + (length % cluster_size != 0);
+            reset_read_ahead(c);
+            m_state = State::PREALLOC_EVENT;
+            m_event.prependNowNotAlready(c);
+        }
+        
     private:
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, writable_init (Context c, FsEntry file_entry))
         {
@@ -593,6 +653,22 @@ public:
             this->m_dir_entry.deinit(c);
         }
         
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, hinting_init (Context c, FsEntry file_entry))
+        {
+            auto *o = Object::self(c);
+            
+            this->m_ra_chain.init(c, file_entry.cluster_index, APRINTER_CB_OBJFUNC_T(&File::ra_chain_handler<>, this));
+            this->m_ra_window.init(c);
+            this->m_ra_size = MinValue((uint32_t)Params::ReadAheadMaxBlocks, (uint32_t)o->blocks_per_cluster);
+            this->m_ra_hits = 0;
+            this->m_ra_state = ReadAheadState::IDLE;
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, hinting_deinit (Context c))
+        {
+            this->m_ra_chain.deinit(c);
+        }
+        
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, handle_event_openwr (Context c))
         {
             if (!this->m_write_ref.take(c)) {
@@ -622,26 +698,119 @@ public:
                 m_user_buffer_mode.block_user.startReadOrWrite(c, false, abs_block_idx, 1, TransferVector<DataWordType>{&m_user_buffer_mode.transfer_desc, 1});
             } else {
                 m_fs_buffer_mode.block_ref.requestBlock(c, abs_block_idx, 0, 1, CacheBlockRef::FLAG_NO_IMMEDIATE_COMPLETION);
-                do_read_hinting(c, abs_block_idx);
             }
+            do_read_hinting(c, abs_block_idx);
         }
         
+        // Read-ahead follows the cluster chain with its own iterator, up to
+        // m_ra_size blocks past the block being read, so that FAT entries are
+        // resolved before the reader gets to a cluster boundary. When reading
+        // through the cache, the data blocks in this window are hinted too.
+        // The window then doubles whenever the reader finds its block not yet
+        // in the cache, and shrinks by one after a full window of hits.
         APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, do_read_hinting (Context c, BlockIndexType abs_block_idx))
+        {
+            if (m_io_mode == IoMode::FS_BUFFER) {
+                if (TheBlockCache::isBlockCached(c, abs_block_idx)) {
+                    if (++this->m_ra_hits >= this->m_ra_size) {
+                        this->m_ra_hits = 0;
+                        if (this->m_ra_size > 1) {
+                            this->m_ra_size--;
+                        }
+                    }
+                } else {
+                    this->m_ra_hits = 0;
+                    this->m_ra_size = MinValue((uint32_t)Params::ReadAheadMaxBlocks, (uint32_t)(2 * this->m_ra_size));
+                }
+                this->m_ra_window.consume(c, abs_block_idx);
+            }
+            
+            this->m_ra_reader_block = m_file_pos / BlockSize;
+            
+            if (this->m_ra_state == ReadAheadState::IDLE || (this->m_ra_state == ReadAheadState::ACTIVE && this->m_ra_block <= this->m_ra_reader_block)) {
+                this->m_ra_chain.restartAt(c, m_chain.getCurrentCluster(c));
+                this->m_ra_window.reset(c);
+                this->m_ra_cluster_block = this->m_ra_reader_block - m_block_in_cluster;
+                this->m_ra_block = this->m_ra_reader_block + 1;
+                this->m_ra_state = ReadAheadState::ACTIVE;
+            }
+            
+            if (this->m_ra_state == ReadAheadState::ACTIVE) {
+                advance_read_ahead(c);
+            }
+        }
+        
+        APRINTER_FUNCTION_IF(EnableReadHinting, void, advance_read_ahead (Context c))
         {
             auto *o = Object::self(c);
+            AMBRO_ASSERT(this->m_ra_state == ReadAheadState::ACTIVE)
             
-            if (m_block_in_cluster == 0 || abs_block_idx >= this->m_hint_block_pos) {
-                BlockIndexType cluster_start_block = abs_block_idx - m_block_in_cluster;
-                BlockIndexType cluster_end_block = cluster_start_block + o->blocks_per_cluster;
-                if (m_block_in_cluster == 0) {
-                    this->m_hint_block_pos = cluster_start_block + 1;
+            uint32_t file_blocks = m_file_size / BlockSize + (m_file_size % BlockSize != 0);
+            uint32_t target_block = MinValue(file_blocks, (uint32_t)(this->m_ra_reader_block + 1 + this->m_ra_size));
+            
+            while (this->m_ra_block < target_block) {
+                uint32_t cluster_end_block = this->m_ra_cluster_block + o->blocks_per_cluster;
+                if (this->m_ra_block == cluster_end_block) {
+                    this->m_ra_state = ReadAheadState::REQUESTING;
+                    this->m_ra_chain.requestNext(c);
+                    return;
+                }
+                
+                ClusterIndexType cluster = this->m_ra_chain.getCurrentCluster(c);
+                if (!is_cluster_idx_valid_for_data(c, cluster)) {
+                    this->m_ra_state = ReadAheadState::END;
+                    return;
+                }
+                
+                uint32_t count = MinValue(target_block, cluster_end_block) - this->m_ra_block;
+                if (m_io_mode == IoMode::USER_BUFFER) {
+                    this->m_ra_block += count;
+                    continue;
                 }
-                if (m_block_in_cluster == 0 || abs_block_idx >= this->m_hint_block_pos) {
-                    this->m_hint_block_pos = TheBlockCache::hintBlocks(c, this->m_hint_block_pos, this->m_hint_block_pos, cluster_end_block, 0, 1);
+                
+                BlockIndexType start_block = get_cluster_data_abs_block_index(c, cluster, this->m_ra_block - this->m_ra_cluster_block);
+                BlockIndexType hinted_end_block = this->m_ra_window.hint(c, start_block, start_block + count);
+                this->m_ra_block += hinted_end_block - start_block;
+                
+                // Out of free cache entries or window extents, continue
+                // when the reader requests its next block.
+                if (hinted_end_block - start_block < count) {
+                    return;
                 }
             }
         }
         
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, reset_read_ahead (Context c))
+        {
+            this->m_ra_window.reset(c);
+            if (this->m_ra_state == ReadAheadState::REQUESTING) {
+                this->m_ra_state = ReadAheadState::REQUESTING_STALE;
+            }
+            else if (this->m_ra_state != ReadAheadState::REQUESTING_STALE) {
+                this->m_ra_state = ReadAheadState::IDLE;
+            }
+        }
+        
+        APRINTER_FUNCTION_IF(EnableReadHinting, void, ra_chain_handler (Context c, bool error, bool first_cluster_changed))
+        {
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(this->m_ra_state == ReadAheadState::REQUESTING || this->m_ra_state == ReadAheadState::REQUESTING_STALE)
+            AMBRO_ASSERT(!first_cluster_changed)
+            
+            if (this->m_ra_state == ReadAheadState::REQUESTING_STALE) {
+                this->m_ra_state = ReadAheadState::IDLE;
+                return;
+            }
+            if (error || this->m_ra_chain.endReached(c)) {
+                this->m_ra_state = ReadAheadState::END;
+                return;
+            }
+            this->m_ra_cluster_block += o->blocks_per_cluster;
+            this->m_ra_state = ReadAheadState::ACTIVE;
+            advance_read_ahead(c);
+        }
+        
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, handle_event_write (Context c))
         {
             auto *o = Object::self(c);
@@ -670,6 +839,8 @@ public:
         
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, handle_event_trunc (Context c))
         {
+            auto *o = Object::self(c);
+            
             if (!this->m_write_ref.isTaken(c)) {
                 return complete_request(c, true);
             }
@@ -677,7 +848,30 @@ public:
                 m_file_size = m_file_pos;
                 this->m_dir_entry.setFileSize(c, m_file_size);
             }
+            // When writing has moved to a cluster but not written to it yet,
+            // that cluster is beyond the truncation point too.
+            bool keep_current = (m_block_in_cluster > 0);
+            if (!keep_current) {
+                m_block_in_cluster = o->blocks_per_cluster;
+            }
             m_state = State::TRUNC_CHAIN;
+            m_chain.startTruncate(c, keep_current);
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, handle_event_prealloc (Context c))
+        {
+            auto *o = Object::self(c);
+            
+            if (!this->m_write_ref.isTaken(c)) {
+                return complete_request(c, true);
+            }
+            m_chain.rewind(c);
+            m_block_in_cluster = o->blocks_per_cluster;
+            if (m_file_size > 0) {
+                m_file_size = 0;
+                this->m_dir_entry.setFileSize(c, m_file_size);
+            }
+            m_state = State::PREALLOC_TRUNC;
             m_chain.startTruncate(c);
         }
         
@@ -686,7 +880,7 @@ public:
             AMBRO_ASSERT(!first_cluster_changed || this->m_write_ref.isTaken(c))
             
             if (first_cluster_changed) {
-                AMBRO_ASSERT(m_state == State::WRITE_NEXT_CLUSTER || m_state == State::TRUNC_CHAIN)
+                AMBRO_ASSERT(m_state == State::WRITE_NEXT_CLUSTER || m_state == State::TRUNC_CHAIN || m_state == State::PREALLOC_TRUNC || m_state == State::PREALLOC_NEW)
                 this->m_dir_entry.setFirstCluster(c, m_chain.getFirstCluster(c));
             }
         }
@@ -719,6 +913,30 @@ public:
             m_event.prependNowNotAlready(c);
         }
         
+        APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, handle_chain_prealloc (Context c, bool error))
+        {
+            if (error) {
+                return complete_request(c, true);
+            }
+            if (m_state == State::PREALLOC_TRUNC) {
+                if (this->m_prealloc_clusters == 0) {
+                    return complete_request(c, false);
+                }
+                m_state = State::PREALLOC_NEXT;
+                m_chain.requestNext(c);
+            }
+            else if (m_state == State::PREALLOC_NEXT) {
+                AMBRO_ASSERT(m_chain.endReached(c))
+                m_state = State::PREALLOC_NEW;
+                m_chain.requestNew(c, this->m_prealloc_clusters);
+            }
+            else {
+                AMBRO_ASSERT(m_state == State::PREALLOC_NEW)
+                m_chain.rewind(c);
+                return complete_request(c, false);
+            }
+        }
+        
         void handle_block_read (Context c, bool error)
         {
             if (error) {
@@ -782,6 +1000,9 @@ public:
             else if (Writable && m_state == State::TRUNC_EVENT) {
                 handle_event_trunc(c);
             }
+            else if (Writable && m_state == State::PREALLOC_EVENT) {
+                handle_event_prealloc(c);
+            }
             else {
                 AMBRO_ASSERT(false);
             }
@@ -803,6 +1024,9 @@ public:
             else if (Writable && m_state == State::TRUNC_CHAIN) {
                 return complete_request(c, error);
             }
+            else if (Writable && (m_state == State::PREALLOC_TRUNC || m_state == State::PREALLOC_NEXT || m_state == State::PREALLOC_NEW)) {
+                handle_chain_prealloc(c, error);
+            }
             else {
                 AMBRO_ASSERT(false);
             }
@@ -895,11 +1119,13 @@ private:
         o->write_block_ref.init(c, APRINTER_CB_STATFUNC_T(&FatFs::write_block_ref_handler<>));
         o->fs_info_block_ref.init(c, APRINTER_CB_STATFUNC_T(&FatFs::fs_info_block_ref_handler<>));
         o->flush_request.init(c, APRINTER_CB_STATFUNC_T(&FatFs::flush_request_handler<>));
+        FreeSummaryFeature::init(c);
     }
     
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(FsWritable, static, void, fs_writable_deinit (Context c))
     {
         auto *o = Object::self(c);
+        FreeSummaryFeature::deinit(c);
         o->flush_request.deinit(c);
         o->fs_info_block_ref.deinit(c);
         o->write_block_ref.deinit(c);
@@ -924,7 +1150,7 @@ private:
                 return write_mount_metablock_ref_handler(c, error);
             } else if (o->write_mount_state == WriteMountState::UMOUNT_META) {
                 return write_unmount_metablock_ref_handler(c, error);
-            } else if (o->alloc_state == AllocationState::REQUESTING_BLOCK) {
+            } else if (o->alloc_state == AllocationState::REQUESTING_BLOCK || o->alloc_state == AllocationState::MARK_REQUESTING_BLOCK) {
                 return alloc_block_ref_handler(c, error);
             }
         }
@@ -1052,6 +1278,7 @@ private:
             o->write_mount_state = WriteMountState::NOT_MOUNTED;
         } else {
             o->write_mount_state = WriteMountState::MOUNTED;
+            FreeSummaryFeature::start(c);
         }
         return WriteMountHandler::call(c, error);
     }
@@ -1063,6 +1290,7 @@ private:
         o->flush_request.reset(c);
         if (error) {
             o->write_mount_state = WriteMountState::MOUNTED;
+            FreeSummaryFeature::start(c);
         } else {
             o->fs_info_block_ref.reset(c);
             o->write_mount_state = WriteMountState::NOT_MOUNTED;
@@ -1249,6 +1477,7 @@ private:
         }
         update_fat_entry_in_cache_block(c, block_ref, cluster_index, FreeClusterMarker);
         update_fs_info_free_clusters(c, true);
+        FreeSummaryFeature::update_free_clusters(c, cluster_index, true);
         return true;
     }
     
@@ -1360,6 +1589,10 @@ private:
         auto *o = Object::self(c);
         o->alloc_state = AllocationState::CHECK_EVENT;
         o->alloc_start = o->alloc_position;
+        o->alloc_want = o->allocating_chains_list.first()->m_alloc_clusters;
+        o->alloc_run_length = 0;
+        o->alloc_best_length = 0;
+        o->alloc_num_checked = 0;
         o->alloc_event.prependNowNotAlready(c);
     }
     
@@ -1389,14 +1622,34 @@ private:
         complete_request->allocation_result(c, error, cluster_index);
     }
     
+    // Allocation looks for a run of alloc_want consecutive free clusters,
+    // remembering the longest run seen, and takes the longest run if the
+    // search returns to where it started. So that a large preallocation on
+    // a fragmented file system does not read the whole FAT, the longest run
+    // is also taken once AllocSearchMaxFatBlocks blocks worth of FAT entries
+    // have been checked, if any free cluster was found. The run is then
+    // linked into a chain from its last cluster backwards, so that the first
+    // cluster is only handed out once the whole chain is in the FAT.
     APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, alloc_event_handler (Context c))
     {
         auto *o = Object::self(c);
         TheDebugObject::access(c);
-        AMBRO_ASSERT(o->alloc_state == AllocationState::CHECK_EVENT)
+        AMBRO_ASSERT(o->alloc_state == AllocationState::CHECK_EVENT || o->alloc_state == AllocationState::MARK_EVENT)
         AMBRO_ASSERT(o->write_mount_state == WriteMountState::MOUNTED)
         
+        if (o->alloc_state == AllocationState::MARK_EVENT) {
+            return mark_allocated_run(c);
+        }
+        
         while (true) {
+            ClusterIndexType prev_position = o->alloc_position;
+            if (!FreeSummaryFeature::skip_full_slots(c)) {
+                return finish_allocation_search(c);
+            }
+            if (o->alloc_position != prev_position) {
+                o->alloc_run_length = 0;
+            }
+            
             ClusterIndexType current_cluster = 2 + o->alloc_position;
             
             if (!request_fat_cache_block(c, &o->write_block_ref, current_cluster, false)) {
@@ -1404,37 +1657,292 @@ private:
                 return;
             }
             
+            ClusterIndexType fat_value = read_fat_entry_in_cache_block(c, &o->write_block_ref, current_cluster);
+            if (fat_value == FreeClusterMarker) {
+                if (o->alloc_run_length == 0) {
+                    o->alloc_run_start = o->alloc_position;
+                }
+                o->alloc_run_length++;
+                if (o->alloc_run_length > o->alloc_best_length) {
+                    o->alloc_best_start = o->alloc_run_start;
+                    o->alloc_best_length = o->alloc_run_length;
+                }
+            } else {
+                o->alloc_run_length = 0;
+            }
+            o->alloc_num_checked++;
+            
             o->alloc_position++;
             if (o->alloc_position == o->num_valid_clusters) {
                 o->alloc_position = 0;
+                o->alloc_run_length = 0;
+            }
+            
+            if (o->alloc_best_length == o->alloc_want || o->alloc_position == o->alloc_start ||
+                (o->alloc_best_length > 0 && o->alloc_num_checked >= AllocSearchMaxFatBlocks * FatEntriesPerBlock)
+            ) {
+                return finish_allocation_search(c);
+            }
+        }
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, finish_allocation_search (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        if (o->alloc_best_length == 0) {
+            return complete_allocation(c, true);
+        }
+        o->alloc_state = AllocationState::MARK_EVENT;
+        o->alloc_mark_position = o->alloc_best_start + o->alloc_best_length - 1;
+        return mark_allocated_run(c);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, mark_allocated_run (Context c))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->alloc_state == AllocationState::MARK_EVENT)
+        
+        ClusterIndexType run_end = o->alloc_best_start + o->alloc_best_length;
+        ClusterIndexType first_cluster;
+        
+        while (true) {
+            ClusterIndexType current_cluster = 2 + o->alloc_mark_position;
+            
+            if (!request_fat_cache_block(c, &o->write_block_ref, current_cluster, false)) {
+                o->alloc_state = AllocationState::MARK_REQUESTING_BLOCK;
+                return;
             }
             
+            // Only allocation takes free clusters, so the run is still free.
+            // Should it not be, keep the part of the run already linked.
             ClusterIndexType fat_value = read_fat_entry_in_cache_block(c, &o->write_block_ref, current_cluster);
-            if (fat_value == FreeClusterMarker) {
-                update_fat_entry_in_cache_block(c, &o->write_block_ref, current_cluster, EndOfChainMarker);
-                update_fs_info_free_clusters(c, false);
-                update_fs_info_allocated_cluster(c);
-                return complete_allocation(c, false, current_cluster);
+            if (fat_value != FreeClusterMarker) {
+                if (o->alloc_mark_position + 1 == run_end) {
+                    return complete_allocation(c, true);
+                }
+                first_cluster = current_cluster + 1;
+                break;
             }
             
-            if (o->alloc_position == o->alloc_start) {
-                return complete_allocation(c, true);
+            ClusterIndexType next_cluster = (o->alloc_mark_position + 1 == run_end) ? EndOfChainMarker : (current_cluster + 1);
+            update_fat_entry_in_cache_block(c, &o->write_block_ref, current_cluster, next_cluster);
+            update_fs_info_free_clusters(c, false);
+            FreeSummaryFeature::update_free_clusters(c, current_cluster, false);
+            
+            if (o->alloc_mark_position == o->alloc_best_start) {
+                first_cluster = current_cluster;
+                break;
             }
+            o->alloc_mark_position--;
         }
+        
+        o->alloc_position = (run_end == o->num_valid_clusters) ? 0 : run_end;
+        update_fs_info_allocated_cluster(c);
+        return complete_allocation(c, false, first_cluster);
     }
     
     APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, alloc_block_ref_handler (Context c, bool error))
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(o->alloc_state == AllocationState::REQUESTING_BLOCK)
+        AMBRO_ASSERT(o->alloc_state == AllocationState::REQUESTING_BLOCK || o->alloc_state == AllocationState::MARK_REQUESTING_BLOCK)
         
         if (error) {
             return complete_allocation(c, true);
         }
-        o->alloc_state = AllocationState::CHECK_EVENT;
+        o->alloc_state = (o->alloc_state == AllocationState::REQUESTING_BLOCK) ? AllocationState::CHECK_EVENT : AllocationState::MARK_EVENT;
         o->alloc_event.prependNowNotAlready(c);
     }
     
+    /**
+     * Summary of free clusters, kept as the number of free clusters in each
+     * group of consecutive FAT blocks (a slot). With enough slots there is one
+     * FAT block per slot.
+     * 
+     * The summary is built in the background after the filesystem is mounted
+     * for writing, by reading the FAT one block at a time. While building,
+     * allocations and releases are only accounted for in blocks which have
+     * already been scanned. Once complete, the FSInfo free cluster count is
+     * set to the exact total, and allocation skips over slots without free
+     * clusters instead of reading through their FAT blocks.
+     */
+    AMBRO_STRUCT_IF(FreeSummaryFeature, EnableFreeSummary) {
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->summary_event.init(c, APRINTER_CB_STATFUNC_T(&FreeSummaryFeature::summary_event_handler));
+            o->summary_block_ref.init(c, APRINTER_CB_STATFUNC_T(&FreeSummaryFeature::summary_block_ref_handler));
+            o->summary_state = FreeSummaryState::NONE;
+        }
+        
+        static void deinit (Context c)
+        {
+            auto *o = Object::self(c);
+            o->summary_block_ref.deinit(c);
+            o->summary_event.deinit(c);
+        }
+        
+        static void start (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->summary_state == FreeSummaryState::NONE)
+            
+            ClusterIndexType num_fat_blocks = (2 + o->num_valid_clusters - 1) / FatEntriesPerBlock + 1;
+            ClusterIndexType blocks_per_slot = (num_fat_blocks + (Params::FreeSummarySlots - 1)) / Params::FreeSummarySlots;
+            
+            o->summary_state = FreeSummaryState::BUILDING;
+            o->summary_blocks_per_slot = blocks_per_slot;
+            o->summary_num_slots = (num_fat_blocks + (blocks_per_slot - 1)) / blocks_per_slot;
+            o->summary_num_fat_blocks = num_fat_blocks;
+            o->summary_scan_block = 0;
+            o->summary_hint_end = 0;
+            o->summary_total_free = 0;
+            for (auto i : LoopRange<ClusterIndexType>(o->summary_num_slots)) {
+                o->summary_free[i] = 0;
+            }
+            o->summary_event.appendNowNotAlready(c);
+        }
+        
+        static void stop (Context c)
+        {
+            auto *o = Object::self(c);
+            o->summary_state = FreeSummaryState::NONE;
+            o->summary_event.unset(c);
+            o->summary_block_ref.reset(c);
+        }
+        
+        static void update_free_clusters (Context c, ClusterIndexType cluster_idx, bool inc_else_dec)
+        {
+            auto *o = Object::self(c);
+            
+            ClusterIndexType fat_block = cluster_idx / FatEntriesPerBlock;
+            if (o->summary_state == FreeSummaryState::NONE ||
+                (o->summary_state == FreeSummaryState::BUILDING && fat_block >= o->summary_scan_block))
+            {
+                return;
+            }
+            
+            ClusterIndexType *slot_free = &o->summary_free[fat_block / o->summary_blocks_per_slot];
+            if (inc_else_dec) {
+                (*slot_free)++;
+                o->summary_total_free++;
+            } else {
+                AMBRO_ASSERT(*slot_free > 0)
+                (*slot_free)--;
+                o->summary_total_free--;
+            }
+        }
+        
+        // Moves alloc_position to the start of the next slot with free clusters
+        // if the current slot has none. Returns false if the allocation is to
+        // fail, because there are no free clusters or because the search would
+        // pass the position where it started.
+        static bool skip_full_slots (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->summary_state != FreeSummaryState::READY) {
+                return true;
+            }
+            if (o->summary_total_free == 0) {
+                return false;
+            }
+            
+            ClusterIndexType slot = (2 + o->alloc_position) / FatEntriesPerBlock / o->summary_blocks_per_slot;
+            if (o->summary_free[slot] > 0) {
+                return true;
+            }
+            do {
+                slot = (slot + 1 == o->summary_num_slots) ? 0 : (slot + 1);
+            } while (o->summary_free[slot] == 0);
+            
+            ClusterIndexType new_position = MaxValue((ClusterIndexType)2, (ClusterIndexType)(slot * o->summary_blocks_per_slot * FatEntriesPerBlock)) - 2;
+            if (alloc_distance(c, new_position) < alloc_distance(c, o->alloc_position)) {
+                return false;
+            }
+            o->alloc_position = new_position;
+            return true;
+        }
+        
+        static ClusterIndexType alloc_distance (Context c, ClusterIndexType position)
+        {
+            auto *o = Object::self(c);
+            return (position >= o->alloc_start) ? (position - o->alloc_start) : (o->num_valid_clusters - o->alloc_start + position);
+        }
+        
+        static void summary_event_handler (Context c)
+        {
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(o->write_mount_state == WriteMountState::MOUNTED)
+            AMBRO_ASSERT(o->summary_state == FreeSummaryState::BUILDING)
+            AMBRO_ASSERT(o->summary_scan_block < o->summary_num_fat_blocks)
+            
+            ClusterIndexType fat_block = o->summary_scan_block;
+            ClusterIndexType block_first_cluster = fat_block * FatEntriesPerBlock;
+            
+            if (EnableReadHinting && fat_block >= o->summary_hint_end) {
+                BlockIndexType start_block = get_abs_block_index_for_fat_entry(c, block_first_cluster);
+                BlockIndexType count = MinValue((ClusterIndexType)Params::ReadAheadMaxBlocks, (ClusterIndexType)(o->summary_num_fat_blocks - fat_block));
+                BlockIndexType num_blocks_per_fat = o->num_fat_entries / FatEntriesPerBlock;
+                BlockIndexType hinted_end_block = TheBlockCache::hintBlocks(c, start_block, start_block, start_block + count, num_blocks_per_fat, o->num_fats);
+                o->summary_hint_end = fat_block + MaxValue((BlockIndexType)1, (BlockIndexType)(hinted_end_block - start_block));
+            }
+            
+            if (!request_fat_cache_block(c, &o->summary_block_ref, block_first_cluster, false)) {
+                return;
+            }
+            
+            ClusterIndexType count_start = MaxValue((ClusterIndexType)2, block_first_cluster);
+            ClusterIndexType count_end = MinValue((ClusterIndexType)(block_first_cluster + FatEntriesPerBlock), (ClusterIndexType)(2 + o->num_valid_clusters));
+            ClusterIndexType num_free = 0;
+            for (ClusterIndexType cluster_idx = count_start; cluster_idx < count_end; cluster_idx++) {
+                if (read_fat_entry_in_cache_block(c, &o->summary_block_ref, cluster_idx) == FreeClusterMarker) {
+                    num_free++;
+                }
+            }
+            o->summary_free[fat_block / o->summary_blocks_per_slot] += num_free;
+            o->summary_total_free += num_free;
+            o->summary_scan_block++;
+            
+            if (o->summary_scan_block < o->summary_num_fat_blocks) {
+                o->summary_event.appendNowNotAlready(c);
+                return;
+            }
+            
+            o->summary_block_ref.reset(c);
+            o->summary_state = FreeSummaryState::READY;
+            
+            char *buffer = o->fs_info_block_ref.getData(c, WrapBool<true>());
+            uint32_t free_clusters = ReadBinaryInt<uint32_t, BinaryLittleEndian>(buffer + FsInfoFreeClustersOffset);
+            if (free_clusters != o->summary_total_free) {
+                WriteBinaryInt<uint32_t, BinaryLittleEndian>(o->summary_total_free, buffer + FsInfoFreeClustersOffset);
+                o->fs_info_block_ref.markDirty(c);
+            }
+        }
+        
+        static void summary_block_ref_handler (Context c, bool error)
+        {
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(o->summary_state == FreeSummaryState::BUILDING)
+            
+            if (error) {
+                o->summary_state = FreeSummaryState::NONE;
+                return;
+            }
+            o->summary_event.appendNowNotAlready(c);
+        }
+    }
+    AMBRO_STRUCT_ELSE(FreeSummaryFeature) {
+        static void init (Context c) {}
+        static void deinit (Context c) {}
+        static void start (Context c) {}
+        static void stop (Context c) {}
+        static void update_free_clusters (Context c, ClusterIndexType cluster_idx, bool inc_else_dec) {}
+        static bool skip_full_slots (Context c) { return true; }
+    };
+    
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(FsWritable, static, void, set_fs_entry_extra (FsEntry *entry, BlockIndexType dir_entry_block_index, DirEntriesPerBlockType dir_entry_block_offset))
     {
         entry->dir_entry_block_index = dir_entry_block_index;
@@ -1445,6 +1953,7 @@ private:
         CacheBlockRef m_fat_cache_ref2;
         DoubleEndedListNode<ClusterChain<true>> m_allocating_chains_node;
         ClusterIndexType m_prev_cluster;
+        ClusterIndexType m_alloc_clusters;
     };
     
     template <bool Writable>
@@ -1505,6 +2014,16 @@ private:
             return m_iter_state == IterState::END;
         }
         
+        // Continue iteration from a cluster found by another iterator of the same chain.
+        APRINTER_FUNCTION_IF(!Writable, void, restartAt (Context c, ClusterIndexType cluster))
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(is_cluster_idx_normal(cluster))
+            
+            m_iter_state = IterState::CLUSTER;
+            m_current_cluster = cluster;
+        }
+        
         ClusterIndexType getCurrentCluster (Context c)
         {
             AMBRO_ASSERT(m_state == State::IDLE)
@@ -1513,13 +2032,18 @@ private:
             return m_current_cluster;
         }
         
-        APRINTER_FUNCTION_IF(Writable, void, requestNew (Context c))
+        // Appends up to num_clusters clusters, consecutive if possible, and
+        // moves to the first of them. Fewer clusters are appended if there is
+        // no long enough run of free clusters.
+        APRINTER_FUNCTION_IF(Writable, void, requestNew (Context c, ClusterIndexType num_clusters=1))
         {
             auto *o = Object::self(c);
             AMBRO_ASSERT(o->write_mount_state == WriteMountState::MOUNTED)
             AMBRO_ASSERT(m_state == State::IDLE)
             AMBRO_ASSERT(m_iter_state == IterState::END)
+            AMBRO_ASSERT(num_clusters >= 1)
             
+            this->m_alloc_clusters = num_clusters;
             m_state = State::NEW_CHECK;
             m_event.prependNowNotAlready(c);
         }
@@ -1531,10 +2055,21 @@ private:
             return m_first_cluster;
         }
         
-        APRINTER_FUNCTION_IF(Writable, void, startTruncate (Context c))
+        // Releases the clusters after the current one. If keep_current is
+        // false, the current cluster is released too, and the chain moves
+        // back to the previous cluster, or to the start.
+        APRINTER_FUNCTION_IF(Writable, void, startTruncate (Context c, bool keep_current=true))
         {
             AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(keep_current || m_iter_state == IterState::CLUSTER)
             
+            if (!keep_current) {
+                if (is_cluster_idx_normal(this->m_prev_cluster)) {
+                    m_current_cluster = this->m_prev_cluster;
+                } else {
+                    rewind_internal(c);
+                }
+            }
             m_state = State::TRUNCATE_CHECK;
             m_event.prependNowNotAlready(c);
         }
@@ -2125,14 +2660,34 @@ private:
         DoubleEndedListForBase<ClusterChain<true>, ClusterChainExtraMembers<true>, &ClusterChain<true>::m_allocating_chains_node> allocating_chains_list;
         ClusterIndexType alloc_position;
         ClusterIndexType alloc_start;
+        ClusterIndexType alloc_want;
+        ClusterIndexType alloc_run_start;
+        ClusterIndexType alloc_run_length;
+        ClusterIndexType alloc_best_start;
+        ClusterIndexType alloc_best_length;
+        ClusterIndexType alloc_num_checked;
+        ClusterIndexType alloc_mark_position;
         size_t num_write_references;
     };
     
+    APRINTER_STRUCT_IF_TEMPLATE(FreeSummaryMembers) {
+        typename Context::EventLoop::QueuedEvent summary_event;
+        CacheBlockRef summary_block_ref;
+        FreeSummaryState summary_state;
+        ClusterIndexType summary_blocks_per_slot;
+        ClusterIndexType summary_num_slots;
+        ClusterIndexType summary_num_fat_blocks;
+        ClusterIndexType summary_scan_block;
+        ClusterIndexType summary_hint_end;
+        ClusterIndexType summary_total_free;
+        ClusterIndexType summary_free[Params::FreeSummarySlots];
+    };
+    
 public:
     struct Object : public ObjBase<FatFs, ParentObject, MakeTypeList<
         TheDebugObject,
         TheBlockCache
-    >>, public FsWritableMembers<FsWritable> {
+    >>, public FsWritableMembers<FsWritable>, public FreeSummaryMembers<EnableFreeSummary> {
         BlockRange<BlockIndexType> block_range;
         FsState state;
         union {
@@ -2156,7 +2711,10 @@ APRINTER_ALIAS_STRUCT_EXT(FatFsService, (
     APRINTER_AS_VALUE(int, MaxIoBlocks),
     APRINTER_AS_VALUE(bool, CaseInsens),
     APRINTER_AS_VALUE(bool, Writable),
-    APRINTER_AS_VALUE(bool, EnableReadHinting)
+    APRINTER_AS_VALUE(bool, EnableReadHinting),
+    APRINTER_AS_VALUE(bool, CacheIndexedLookup),
+    APRINTER_AS_VALUE(int, ReadAheadMaxBlocks),
+    APRINTER_AS_VALUE(int, FreeSummarySlots)
 ), (
     APRINTER_ALIAS_STRUCT_EXT(Fs, (
         APRINTER_AS_TYPE(Context),
@@ -38,6 +38,7 @@
 #include <aprinter/base/DebugObject.h>
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/Preprocessor.h>
+#include <aprinter/base/Hints.h>
 #include <aprinter/base/LoopUtils.h>
 #include <aprinter/base/Callback.h>
 #include <aprinter/system/InterruptLock.h>
@@ -183,6 +184,9 @@ private:
                 // Call handlers for all expired timers.
                 for (auto i : LoopRangeAuto(MaxTimers)) {
                     if (o->m_timer_active[i] && TheClockUtils::timeGreaterOrEqual(now, o->m_timer_time[i])) {
+                        if (AMBRO_UNLIKELY(step_timing_enabled)) {
+                            record_step_timing(i, o->m_timer_time[i]);
+                        }
                         o->m_timer_handler[i](lock_c);
                     }
                 }
@@ -193,6 +197,18 @@ private:
         }
     }
     
+    static void record_step_timing (int timer_index, TimeType time)
+    {
+        // Measure the time from the start of the tick the timer was set for
+        // up to just before its handler is called.
+        struct timespec ts = getTimespec(Context());
+        TimeType now = timespecToTime(ts);
+        long tick_start_nsec = ((uint64_t)(now & SubSecondMask) * NsecInSec + SubSecondMask) >> SubSecondBits;
+        int64_t late_ns = (((uint64_t)TheClockUtils::timeDifference(now, time) * NsecInSec) >> SubSecondBits) + (ts.tv_nsec - tick_start_nsec);
+        
+        step_timing_record(timer_index, (uint64_t)ts.tv_sec * NsecInSec + ts.tv_nsec, late_ns);
+    }
+    
     static void configure_timerfd (AtomicContext<Context> c, struct timespec now_ts, TimeType now)
     {
         auto *o = Object::self(c);
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_SIM_CLOCK_H
+#define APRINTER_SIM_CLOCK_H
+
+#include <stdint.h>
+
+#include <time.h>
+
+#include <aprinter/platform/sim/sim_support.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/PowerOfTwo.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/LoopUtils.h>
+#include <aprinter/system/InterruptLock.h>
+#include <aprinter/misc/ClockUtils.h>
+
+namespace APrinter {
+
+template <typename>
+class SimClockInterruptTimer;
+
+/**
+ * Virtual clock for running the firmware in a host-side simulation.
+ * 
+ * Time only moves forward when the simulation says so: the event loop
+ * charges the (scaled) host time spent in handlers using chargeHostTime(),
+ * and skips idle periods using advanceTo(). Interrupt timers are fired
+ * from dispatchTimers(), which the event loop calls between handlers.
+ * 
+ * The CPU factor set by setCpuFactor() is the number of virtual seconds
+ * charged per host second of handler execution, i.e. how many times the
+ * simulated CPU is slower than the host. With a zero factor, handlers
+ * take no virtual time and the simulation is fully deterministic.
+ */
+template <typename Arg>
+class SimClock {
+    APRINTER_USE_TYPE1(Arg, Context)
+    APRINTER_USE_TYPE1(Arg, ParentObject)
+    
+    APRINTER_USE_VAL(Arg::Params, SubSecondBits)
+    APRINTER_USE_VAL(Arg::Params, MaxTimers)
+    
+    static_assert(SubSecondBits >= 10 && SubSecondBits <= 21, "");
+    static_assert(MaxTimers > 0 && MaxTimers <= 64, "");
+    
+    template <typename> friend class SimClockInterruptTimer;
+    
+public:
+    struct Object;
+    using TimeType = uint32_t;
+    
+    static constexpr double time_freq = PowerOfTwo<uint32_t, SubSecondBits>::Value;
+    static constexpr double time_unit = 1.0 / time_freq;
+    
+private:
+    using TheClockUtils = ClockUtilsForClock<SimClock>;
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        for (auto i : LoopRangeAuto(MaxTimers)) {
+            o->m_timer_active[i] = false;
+            o->m_timer_handler[i] = nullptr;
+        }
+        
+        o->m_time = 0;
+        o->m_cpu_factor = 0.0;
+        o->m_charge_frac = 0.0;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+    }
+    
+    template <typename ThisContext>
+    static TimeType getTime (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return (TimeType)o->m_time;
+    }
+    
+    static uint64_t getTotalTicks (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        return o->m_time;
+    }
+    
+    static void setCpuFactor (Context c, double cpu_factor)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(cpu_factor >= 0.0)
+        
+        o->m_cpu_factor = cpu_factor;
+    }
+    
+    static uint64_t getHostNanoseconds ()
+    {
+        struct timespec ts;
+        int res = clock_gettime(CLOCK_MONOTONIC, &ts);
+        AMBRO_ASSERT_FORCE(res == 0)
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    
+    static void chargeHostTime (Context c, uint64_t host_ns)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        double ticks = o->m_charge_frac + host_ns * (o->m_cpu_factor * 1e-9 * time_freq);
+        uint64_t whole_ticks = ticks;
+        o->m_charge_frac = ticks - whole_ticks;
+        o->m_time += whole_ticks;
+    }
+    
+    static void advanceTo (Context c, TimeType time)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        TimeType now = o->m_time;
+        if (TheClockUtils::timeGreaterOrEqual(time, now)) {
+            o->m_time += TheClockUtils::timeDifference(time, now);
+        }
+    }
+    
+    static bool getFirstTimerTime (Context c, TimeType *out_time)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        TimeType now = o->m_time;
+        bool have_first = false;
+        TimeType first_time;
+        
+        for (auto i : LoopRangeAuto(MaxTimers)) {
+            if (o->m_timer_active[i]) {
+                TimeType tmr_time = o->m_timer_time[i];
+                if (!TheClockUtils::timeGreaterOrEqual(tmr_time, now)) {
+                    tmr_time = now;
+                }
+                if (!have_first || !TheClockUtils::timeGreaterOrEqual(tmr_time, first_time)) {
+                    have_first = true;
+                    first_time = tmr_time;
+                }
+            }
+        }
+        
+        if (have_first) {
+            *out_time = first_time;
+        }
+        return have_first;
+    }
+    
+    static void dispatchTimers (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        while (true) {
+            // Find the expired timer which has been expired for the longest.
+            TimeType now = o->m_time;
+            int first_index = -1;
+            TimeType first_late = 0;
+            for (auto i : LoopRangeAuto(MaxTimers)) {
+                if (o->m_timer_active[i] && TheClockUtils::timeGreaterOrEqual(now, o->m_timer_time[i])) {
+                    TimeType late = TheClockUtils::timeDifference(now, o->m_timer_time[i]);
+                    if (first_index < 0 || late > first_late) {
+                        first_index = i;
+                        first_late = late;
+                    }
+                }
+            }
+            if (first_index < 0) {
+                break;
+            }
+            
+            uint64_t start_ns = getHostNanoseconds();
+            o->m_timer_handler[first_index](MakeAtomicContext(c));
+            chargeHostTime(c, getHostNanoseconds() - start_ns);
+        }
+    }
+    
+private:
+    using InternalTimerHandlerType = void (*) (AtomicContext<Context>);
+    
+public:
+    struct Object : public ObjBase<SimClock, ParentObject, MakeTypeList<TheDebugObject>> {
+        uint64_t m_time;
+        double m_cpu_factor;
+        double m_charge_frac;
+        bool m_timer_active[MaxTimers];
+        TimeType m_timer_time[MaxTimers];
+        InternalTimerHandlerType m_timer_handler[MaxTimers];
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SimClockService, (
+    APRINTER_AS_VALUE(int, SubSecondBits),
+    APRINTER_AS_VALUE(int, MaxTimers)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Clock, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(DummyTimersList)
+    ), (
+        using Params = SimClockService;
+        APRINTER_DEF_INSTANCE(Clock, SimClock)
+    ))
+))
+
+template <typename Arg>
+class SimClockInterruptTimer {
+    APRINTER_USE_TYPE1(Arg, Context)
+    APRINTER_USE_TYPE1(Arg, ParentObject)
+    APRINTER_USE_TYPE1(Arg, Handler)
+    APRINTER_USE_TYPE1(Arg, Params)
+    
+    APRINTER_USE_VAL(Params, Index)
+    
+public:
+    struct Object;
+    APRINTER_USE_TYPE1(Context, Clock)
+    APRINTER_USE_TYPE1(Clock, TimeType)
+    using HandlerContext = AtomicContext<Context>;
+    
+private:
+    static_assert(Index >= 0 && Index < Clock::MaxTimers, "");
+    
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *co = Clock::Object::self(c);
+        AMBRO_ASSERT(!co->m_timer_active[Index])
+        AMBRO_ASSERT(co->m_timer_handler[Index] == nullptr)
+        
+        co->m_timer_handler[Index] = SimClockInterruptTimer::timer_handler;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *co = Clock::Object::self(c);
+        TheDebugObject::deinit(c);
+        
+        co->m_timer_active[Index] = false;
+        co->m_timer_handler[Index] = nullptr;
+    }
+    
+    template <typename ThisContext>
+    static void setFirst (ThisContext c, TimeType time)
+    {
+        auto *co = Clock::Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!co->m_timer_active[Index])
+        
+        co->m_timer_time[Index] = time;
+        co->m_timer_active[Index] = true;
+    }
+    
+    static void setNext (HandlerContext c, TimeType time)
+    {
+        auto *co = Clock::Object::self(c);
+        AMBRO_ASSERT(co->m_timer_active[Index])
+        
+        co->m_timer_time[Index] = time;
+    }
+    
+    template <typename ThisContext>
+    static void unset (ThisContext c)
+    {
+        auto *co = Clock::Object::self(c);
+        TheDebugObject::access(c);
+        
+        co->m_timer_active[Index] = false;
+    }
+    
+    template <typename ThisContext>
+    static TimeType getLastSetTime (ThisContext c)
+    {
+        auto *co = Clock::Object::self(c);
+        
+        return co->m_timer_time[Index];
+    }
+    
+private:
+    static void timer_handler (AtomicContext<Context> c)
+    {
+        auto *co = Clock::Object::self(c);
+        AMBRO_ASSERT(co->m_timer_active[Index])
+        
+        if (!Handler::call(c)) {
+            co->m_timer_active[Index] = false;
+        }
+    }
+    
+public:
+    struct Object : public ObjBase<SimClockInterruptTimer, ParentObject, MakeTypeList<TheDebugObject>> {};
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SimClockInterruptTimerService, (
+    APRINTER_AS_VALUE(int, Index)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(InterruptTimer, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(Handler)
+    ), (
+        using Params = SimClockInterruptTimerService;
+        APRINTER_DEF_INSTANCE(InterruptTimer, SimClockInterruptTimer)
+    ))
+))
+
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_SIM_PINS_H
+#define APRINTER_SIM_PINS_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/LoopUtils.h>
+
+namespace APrinter {
+
+/**
+ * Pins for host-side simulations.
+ * 
+ * SimStepPin<N> and SimDirPin<N> are recorded: each rising edge of
+ * the step pin moves the position of stepper N in the direction given
+ * by the dir pin (high means positive). Any other pin type (e.g. StubPin)
+ * is accepted and ignored.
+ */
+template <int StepperIndex>
+struct SimStepPin {};
+
+template <int StepperIndex>
+struct SimDirPin {};
+
+struct SimPinInputMode {};
+struct SimPinOutputMode {};
+
+struct SimStepperRecord {
+    bool dir;
+    bool step;
+    bool have_step;
+    int32_t position;
+    uint32_t steps;
+    uint32_t last_step_time;
+    uint32_t min_step_interval;
+};
+
+template <typename Arg>
+class SimPins {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    using Params       = typename Arg::Params;
+    
+    static int const NumSteppers = Params::NumSteppers;
+    
+public:
+    struct Object;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        for (auto i : LoopRangeAuto(NumSteppers)) {
+            SimStepperRecord *rec = &o->m_steppers[i];
+            rec->dir = false;
+            rec->step = false;
+            rec->have_step = false;
+            rec->position = 0;
+            rec->steps = 0;
+            rec->last_step_time = 0;
+            rec->min_step_interval = UINT32_MAX;
+        }
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        TheDebugObject::deinit(c);
+    }
+    
+    template <typename Pin, typename Mode=SimPinInputMode, typename ThisContext>
+    static void setInput (ThisContext c)
+    {
+        TheDebugObject::access(c);
+    }
+    
+    template <typename Pin, typename Mode=SimPinOutputMode, typename ThisContext>
+    static void setOutput (ThisContext c)
+    {
+        TheDebugObject::access(c);
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static bool get (ThisContext c)
+    {
+        TheDebugObject::access(c);
+        return false;
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static void set (ThisContext c, bool x)
+    {
+        TheDebugObject::access(c);
+        
+        set_helper(c, (Pin *)nullptr, x);
+    }
+    
+    template <typename Pin>
+    static void emergencySet (bool x)
+    {
+    }
+    
+    static SimStepperRecord const * getStepperRecord (Context c, int stepper_index)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(stepper_index >= 0 && stepper_index < NumSteppers)
+        
+        return &o->m_steppers[stepper_index];
+    }
+    
+private:
+    template <typename ThisContext, typename Pin>
+    static void set_helper (ThisContext c, Pin *, bool x)
+    {
+    }
+    
+    template <typename ThisContext, int StepperIndex>
+    static void set_helper (ThisContext c, SimDirPin<StepperIndex> *, bool x)
+    {
+        static_assert(StepperIndex >= 0 && StepperIndex < NumSteppers, "");
+        auto *o = Object::self(c);
+        
+        o->m_steppers[StepperIndex].dir = x;
+    }
+    
+    template <typename ThisContext, int StepperIndex>
+    static void set_helper (ThisContext c, SimStepPin<StepperIndex> *, bool x)
+    {
+        static_assert(StepperIndex >= 0 && StepperIndex < NumSteppers, "");
+        auto *o = Object::self(c);
+        SimStepperRecord *rec = &o->m_steppers[StepperIndex];
+        
+        if (x && !rec->step) {
+            uint32_t now = Context::Clock::getTime(c);
+            if (rec->have_step && (uint32_t)(now - rec->last_step_time) < rec->min_step_interval) {
+                rec->min_step_interval = now - rec->last_step_time;
+            }
+            rec->have_step = true;
+            rec->last_step_time = now;
+            rec->position += rec->dir ? 1 : -1;
+            rec->steps++;
+        }
+        rec->step = x;
+    }
+    
+public:
+    struct Object : public ObjBase<SimPins, ParentObject, MakeTypeList<TheDebugObject>> {
+        SimStepperRecord m_steppers[NumSteppers];
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SimPinsService, (
+    APRINTER_AS_VALUE(int, NumSteppers)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Pins, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject)
+    ), (
+        using Params = SimPinsService;
+        APRINTER_DEF_INSTANCE(Pins, SimPins)
+    ))
+))
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_FAST_STR_TO_FLOAT_H
+#define AMBROLIB_FAST_STR_TO_FLOAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+
+#include <aprinter/base/Hints.h>
+#include <aprinter/math/FloatTools.h>
+
+namespace APrinter {
+
+namespace FastStrToFloatPrivate {
+    inline float pow10_float (int n)
+    {
+        static float const table[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+        return table[n];
+    }
+
+#if DBL_MANT_DIG >= 53
+    inline double pow10_double (int n)
+    {
+        static double const table[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        return table[n];
+    }
+#endif
+
+    template <typename T>
+    struct Helper;
+    
+    template <>
+    struct Helper<float> {
+        static bool compute (uint64_t mantissa, int decimals, float *result)
+        {
+            if (mantissa <= ((uint32_t)1 << 24) && decimals <= 10) {
+                *result = (float)(uint32_t)mantissa / pow10_float(decimals);
+                return true;
+            }
+#if DBL_MANT_DIG >= 53
+            if (mantissa <= ((uint64_t)1 << 53) && decimals <= 22) {
+                double d = (double)mantissa / pow10_double(decimals);
+                // The double is correctly rounded, so rounding it to float gives the
+                // correctly rounded float unless it ended up exactly on a float midpoint.
+                uint64_t bits;
+                memcpy(&bits, &d, sizeof(bits));
+                if ((bits & 0x1FFFFFFF) == 0x10000000) {
+                    return false;
+                }
+                *result = (float)d;
+                return true;
+            }
+#endif
+            return false;
+        }
+    };
+    
+    template <>
+    struct Helper<double> {
+        static bool compute (uint64_t mantissa, int decimals, double *result)
+        {
+#if DBL_MANT_DIG >= 53
+            if (mantissa <= ((uint64_t)1 << 53) && decimals <= 22) {
+                *result = (double)mantissa / pow10_double(decimals);
+                return true;
+            }
+            return false;
+#else
+            float float_result;
+            bool res = Helper<float>::compute(mantissa, decimals, &float_result);
+            *result = float_result;
+            return res;
+#endif
+        }
+    };
+    
+    template <typename T>
+    APRINTER_NO_INLINE
+    T fallback (char const *str, char const **endptr)
+    {
+        char *end;
+        T result = StrToFloat<T>(str, &end);
+        if (endptr) {
+            *endptr = end;
+        }
+        return result;
+    }
+}
+
+/**
+ * Parses a decimal number in the form [+-]digits[.digits] as used in G-code,
+ * without going through the C library.
+ * 
+ * The digits are accumulated into an integer mantissa and a power of ten,
+ * and the result is computed with a single correctly rounded division when
+ * both are exactly representable in the floating point type (up to 15 or 16
+ * significant digits with double arithmetic, 7 or 8 with float only, and at
+ * most 22 decimals or 10 for float). Anything else, including exponents,
+ * inf/nan and longer mantissas, is passed to StrToFloat(). The result is
+ * therefore always the correctly rounded value, same as from strtod/strtof,
+ * and the decimal point is always '.' regardless of locale.
+ * 
+ * If endptr is not null, it receives the end of the parsed number.
+ */
+template <typename T>
+T FastStrToFloat (char const *str, char const **endptr=nullptr)
+{
+    static_assert(IsFpType<T>::Value, "");
+    
+    char const *p = str;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+    
+    static int const MaxDigits = 19;
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int decimals = 0;
+    bool have_digits = false;
+    bool truncated = false;
+    
+    for (; (unsigned char)(*p - '0') < 10; p++) {
+        have_digits = true;
+        if (num_digits < MaxDigits) {
+            mantissa = 10 * mantissa + (*p - '0');
+            num_digits += (mantissa != 0);
+        } else {
+            truncated = true;
+        }
+    }
+    
+    if (*p == '.') {
+        p++;
+        for (; (unsigned char)(*p - '0') < 10; p++) {
+            have_digits = true;
+            if (num_digits < MaxDigits) {
+                mantissa = 10 * mantissa + (*p - '0');
+                num_digits += (mantissa != 0);
+                decimals++;
+            } else {
+                truncated = true;
+            }
+        }
+    }
+    
+    if (AMBRO_UNLIKELY(!have_digits || truncated || *p == 'e' || *p == 'E' || *p == 'x' || *p == 'X')) {
+        return FastStrToFloatPrivate::fallback<T>(str, endptr);
+    }
+    
+    T result;
+    if (!FastStrToFloatPrivate::Helper<T>::compute(mantissa, decimals, &result)) {
+        return FastStrToFloatPrivate::fallback<T>(str, endptr);
+    }
+    
+    if (endptr) {
+        *endptr = p;
+    }
+    return negative ? -result : result;
+}
+
+/**
+ * Parses a decimal unsigned integer like strtoul(str, endptr, 10), except that
+ * the result wraps modulo 2^32 on overflow. A leading '-' negates the result,
+ * like strtoul does.
+ */
+inline uint32_t StrToUint32 (char const *str, char const **endptr=nullptr)
+{
+    char const *p = str;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+    
+    uint32_t value = 0;
+    char const *digits_start = p;
+    for (; (unsigned char)(*p - '0') < 10; p++) {
+        value = 10 * value + (uint32_t)(*p - '0');
+    }
+    
+    if (endptr) {
+        *endptr = (p == digits_start) ? str : p;
+    }
+    return negative ? -value : value;
+}
+
+}
+
+#endif
@@ -0,0 +1,770 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_PRINT_FLOAT_H
+#define AMBROLIB_PRINT_FLOAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+
+#ifndef APRINTER_PRINT_FLOAT_FULL_TABLES
+#define APRINTER_PRINT_FLOAT_FULL_TABLES 0
+#endif
+
+#include <aprinter/base/Hints.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/math/PrintFloatTables.h>
+
+namespace APrinter {
+
+/*
+ * Float to decimal conversion using the Ryu algorithm (Ulf Adams, 2018).
+ * 
+ * The binary value is multiplied by a power of 5 from a table with enough
+ * bits that the floor of the result (and of the interval bounds) is exact,
+ * which gives the shortest decimal that rounds back to the same value
+ * using only integer arithmetic. The float path needs 64-bit products and
+ * 624 bytes of tables. The double path needs 128-bit products and by
+ * default uses small tables (about 600 bytes) from which the other powers
+ * are computed; defining APRINTER_PRINT_FLOAT_FULL_TABLES=1 uses complete
+ * tables (about 10.7 kB) instead. The tables are generated by
+ * tests/print_float_gen_tables.py.
+ */
+namespace PrintFloatPrivate {
+    struct Decimal {
+        uint64_t mantissa;
+        int exponent;
+    };
+    
+    // ceil(log2(5^e)), or 1 for e == 0
+    inline int pow5bits (int e)
+    {
+        return (int)((((uint32_t)e * 1217359) >> 19) + 1);
+    }
+    
+    // floor(log10(2^e))
+    inline int log10_pow2 (int e)
+    {
+        return (int)(((uint32_t)e * 78913) >> 18);
+    }
+    
+    // floor(log10(5^e))
+    inline int log10_pow5 (int e)
+    {
+        return (int)(((uint32_t)e * 732923) >> 20);
+    }
+    
+    template <typename T>
+    inline bool multiple_of_pow5 (T value, int p)
+    {
+        int count = 0;
+        while (value % 5 == 0) {
+            value /= 5;
+            count++;
+        }
+        return count >= p;
+    }
+    
+    template <typename T>
+    inline bool multiple_of_pow2 (T value, int p)
+    {
+        return p < (int)(8 * sizeof(T)) && (value & (((T)1 << p) - 1)) == 0;
+    }
+    
+    inline int decimal_length (uint64_t x)
+    {
+        int len = 1;
+        while (x >= 10) {
+            x /= 10;
+            len++;
+        }
+        return len;
+    }
+    
+    inline uint32_t mul_shift32 (uint32_t m, uint64_t factor, int shift)
+    {
+        uint64_t bits0 = (uint64_t)m * (uint32_t)factor;
+        uint64_t bits1 = (uint64_t)m * (uint32_t)(factor >> 32);
+        uint64_t sum = (bits0 >> 32) + bits1;
+        return (uint32_t)(sum >> (shift - 32));
+    }
+    
+    inline Decimal float_shortest (uint32_t ieee_mantissa, uint32_t ieee_exponent)
+    {
+        using namespace PrintFloatTables;
+        
+        int e2;
+        uint32_t m2;
+        if (ieee_exponent == 0) {
+            e2 = 1 - 127 - 23 - 2;
+            m2 = ieee_mantissa;
+        } else {
+            e2 = (int)ieee_exponent - 127 - 23 - 2;
+            m2 = ((uint32_t)1 << 23) | ieee_mantissa;
+        }
+        bool accept_bounds = (m2 & 1) == 0;
+        
+        uint32_t mv = 4 * m2;
+        uint32_t mp = 4 * m2 + 2;
+        uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+        uint32_t mm = 4 * m2 - 1 - mm_shift;
+        
+        uint32_t vr, vp, vm;
+        int e10;
+        bool vm_is_trailing_zeros = false;
+        bool vr_is_trailing_zeros = false;
+        uint8_t last_removed_digit = 0;
+        
+        if (e2 >= 0) {
+            int q = log10_pow2(e2);
+            e10 = q;
+            int k = FloatPow5InvBitcount + pow5bits(q) - 1;
+            int i = -e2 + q + k;
+            vr = mul_shift32(mv, FloatPow5InvSplit[q], i);
+            vp = mul_shift32(mp, FloatPow5InvSplit[q], i);
+            vm = mul_shift32(mm, FloatPow5InvSplit[q], i);
+            if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+                // The loop below will not remove a digit, but rounding needs it.
+                int l = FloatPow5InvBitcount + pow5bits(q - 1) - 1;
+                last_removed_digit = mul_shift32(mv, FloatPow5InvSplit[q - 1], -e2 + q - 1 + l) % 10;
+            }
+            if (q <= 9) {
+                // Only one of mp, mv and mm can be a multiple of 5, if any.
+                if (mv % 5 == 0) {
+                    vr_is_trailing_zeros = multiple_of_pow5(mv, q);
+                } else if (accept_bounds) {
+                    vm_is_trailing_zeros = multiple_of_pow5(mm, q);
+                } else {
+                    vp -= multiple_of_pow5(mp, q);
+                }
+            }
+        } else {
+            int q = log10_pow5(-e2);
+            e10 = q + e2;
+            int i = -e2 - q;
+            int k = pow5bits(i) - FloatPow5Bitcount;
+            int j = q - k;
+            vr = mul_shift32(mv, FloatPow5Split[i], j);
+            vp = mul_shift32(mp, FloatPow5Split[i], j);
+            vm = mul_shift32(mm, FloatPow5Split[i], j);
+            if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+                j = q - 1 - (pow5bits(i + 1) - FloatPow5Bitcount);
+                last_removed_digit = mul_shift32(mv, FloatPow5Split[i + 1], j) % 10;
+            }
+            if (q <= 1) {
+                // mv = 4 * m2 has at least two trailing zero bits, mp one,
+                // and mm one exactly if mm_shift == 1.
+                vr_is_trailing_zeros = true;
+                if (accept_bounds) {
+                    vm_is_trailing_zeros = mm_shift == 1;
+                } else {
+                    vp--;
+                }
+            } else if (q < 31) {
+                vr_is_trailing_zeros = multiple_of_pow2(mv, q - 1);
+            }
+        }
+        
+        int removed = 0;
+        uint32_t output;
+        if (AMBRO_UNLIKELY(vm_is_trailing_zeros || vr_is_trailing_zeros)) {
+            while (vp / 10 > vm / 10) {
+                vm_is_trailing_zeros &= vm % 10 == 0;
+                vr_is_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+            if (vm_is_trailing_zeros) {
+                while (vm % 10 == 0) {
+                    vr_is_trailing_zeros &= last_removed_digit == 0;
+                    last_removed_digit = vr % 10;
+                    vr /= 10;
+                    vp /= 10;
+                    vm /= 10;
+                    removed++;
+                }
+            }
+            if (vr_is_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+                // Exactly halfway, round to even.
+                last_removed_digit = 4;
+            }
+            output = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) || last_removed_digit >= 5);
+        } else {
+            while (vp / 10 > vm / 10) {
+                last_removed_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+            output = vr + (vr == vm || last_removed_digit >= 5);
+        }
+        
+        return Decimal{output, e10 + removed};
+    }
+
+#if DBL_MANT_DIG >= 53
+    inline uint64_t umul128 (uint64_t a, uint64_t b, uint64_t *product_hi)
+    {
+#if defined(__SIZEOF_INT128__)
+        unsigned __int128 product = (unsigned __int128)a * b;
+        *product_hi = (uint64_t)(product >> 64);
+        return (uint64_t)product;
+#else
+        uint64_t a_lo = (uint32_t)a;
+        uint64_t a_hi = a >> 32;
+        uint64_t b_lo = (uint32_t)b;
+        uint64_t b_hi = b >> 32;
+        uint64_t b00 = a_lo * b_lo;
+        uint64_t b01 = a_lo * b_hi;
+        uint64_t b10 = a_hi * b_lo;
+        uint64_t b11 = a_hi * b_hi;
+        uint64_t mid1 = b10 + (b00 >> 32);
+        uint64_t mid2 = b01 + (uint32_t)mid1;
+        *product_hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+        return (mid2 << 32) | (uint32_t)b00;
+#endif
+    }
+    
+    // (hi:lo) >> dist, for 0 < dist < 64
+    inline uint64_t shift_right128 (uint64_t lo, uint64_t hi, int dist)
+    {
+        return (hi << (64 - dist)) | (lo >> dist);
+    }
+    
+    // Computes m * mul >> 64 >> (j - 64), for m of at most 55 bits.
+    inline uint64_t mul_shift64 (uint64_t m, uint64_t const *mul, int j)
+    {
+        uint64_t high1;
+        uint64_t low1 = umul128(m, mul[1], &high1);
+        uint64_t high0;
+        umul128(m, mul[0], &high0);
+        uint64_t sum = high0 + low1;
+        if (sum < high0) {
+            high1++;
+        }
+        return shift_right128(sum, high1, j - 64);
+    }
+
+#if !APRINTER_PRINT_FLOAT_FULL_TABLES
+    inline void mul_pow5_small (uint64_t const *mul, int offset, int delta, uint32_t correction, uint64_t *result)
+    {
+        uint64_t m = PrintFloatTables::DoublePow5Small[offset];
+        uint64_t high1;
+        uint64_t low1 = umul128(m, mul[1], &high1);
+        uint64_t high0;
+        uint64_t low0 = umul128(m, mul[0], &high0);
+        uint64_t sum = high0 + low1;
+        if (sum < high0) {
+            high1++;
+        }
+        result[0] = shift_right128(low0, sum, delta) + correction;
+        result[1] = shift_right128(sum, high1, delta);
+    }
+#endif
+
+    // 5^i normalized to DoublePow5Bitcount bits
+    inline void double_pow5 (int i, uint64_t *result)
+    {
+        using namespace PrintFloatTables;
+#if APRINTER_PRINT_FLOAT_FULL_TABLES
+        result[0] = DoublePow5Split[i][0];
+        result[1] = DoublePow5Split[i][1];
+#else
+        int base = i / DoubleSmallStep;
+        int base2 = base * DoubleSmallStep;
+        uint64_t const *mul = DoublePow5SplitSmall[base];
+        if (i == base2) {
+            result[0] = mul[0];
+            result[1] = mul[1];
+            return;
+        }
+        uint32_t correction = (DoublePow5Offsets[i / 16] >> ((i % 16) * 2)) & 3;
+        mul_pow5_small(mul, i - base2, pow5bits(i) - pow5bits(base2), correction, result);
+#endif
+    }
+    
+    // 2^k / 5^i normalized to DoublePow5InvBitcount bits, rounded up
+    inline void double_pow5_inv (int i, uint64_t *result)
+    {
+        using namespace PrintFloatTables;
+#if APRINTER_PRINT_FLOAT_FULL_TABLES
+        result[0] = DoublePow5InvSplit[i][0];
+        result[1] = DoublePow5InvSplit[i][1];
+#else
+        int base = (i + DoubleSmallStep - 1) / DoubleSmallStep;
+        int base2 = base * DoubleSmallStep;
+        uint64_t const *mul = DoublePow5InvSplitSmall[base];
+        if (i == base2) {
+            result[0] = mul[0] + 1;
+            result[1] = mul[1];
+            return;
+        }
+        uint32_t correction = 1 + ((DoublePow5InvOffsets[i / 16] >> ((i % 16) * 2)) & 3);
+        mul_pow5_small(mul, base2 - i, pow5bits(base2) - pow5bits(i), correction, result);
+#endif
+    }
+    
+    struct DoubleScaled {
+        uint64_t mv;
+        int e2;
+        int q;
+        int e10;
+        uint64_t mul[2];
+        int shift;
+    };
+    
+    // Chooses the decimal exponent e10 such that floor(mv * 2^e2 / 10^e10)
+    // has 17 or more digits (for normal numbers) and the multiplier for it.
+    inline void double_scale (int e2, uint64_t m2, DoubleScaled *s)
+    {
+        using namespace PrintFloatTables;
+        
+        s->mv = 4 * m2;
+        s->e2 = e2;
+        if (e2 >= 0) {
+            s->q = log10_pow2(e2) - (e2 > 3);
+            s->e10 = s->q;
+            double_pow5_inv(s->q, s->mul);
+            s->shift = -e2 + s->q + DoublePow5InvBitcount + pow5bits(s->q) - 1;
+        } else {
+            s->q = log10_pow5(-e2) - (-e2 > 1);
+            s->e10 = s->q + e2;
+            int i = -e2 - s->q;
+            double_pow5(i, s->mul);
+            s->shift = s->q - (pow5bits(i) - DoublePow5Bitcount);
+        }
+    }
+    
+    inline void double_unpack (uint64_t ieee_mantissa, uint32_t ieee_exponent, int *e2, uint64_t *m2)
+    {
+        if (ieee_exponent == 0) {
+            *e2 = 1 - 1023 - 52 - 2;
+            *m2 = ieee_mantissa;
+        } else {
+            *e2 = (int)ieee_exponent - 1023 - 52 - 2;
+            *m2 = ((uint64_t)1 << 52) | ieee_mantissa;
+        }
+    }
+    
+    inline Decimal double_shortest (uint64_t ieee_mantissa, uint32_t ieee_exponent)
+    {
+        int e2;
+        uint64_t m2;
+        double_unpack(ieee_mantissa, ieee_exponent, &e2, &m2);
+        bool accept_bounds = (m2 & 1) == 0;
+        uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+        
+        DoubleScaled s;
+        double_scale(e2, m2, &s);
+        uint64_t mv = s.mv;
+        uint64_t vr = mul_shift64(mv, s.mul, s.shift);
+        uint64_t vp = mul_shift64(mv + 2, s.mul, s.shift);
+        uint64_t vm = mul_shift64(mv - 1 - mm_shift, s.mul, s.shift);
+        
+        bool vm_is_trailing_zeros = false;
+        bool vr_is_trailing_zeros = false;
+        if (e2 >= 0) {
+            if (s.q <= 21) {
+                // Only one of mp, mv and mm can be a multiple of 5, if any.
+                if (mv % 5 == 0) {
+                    vr_is_trailing_zeros = multiple_of_pow5(mv, s.q);
+                } else if (accept_bounds) {
+                    vm_is_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, s.q);
+                } else {
+                    vp -= multiple_of_pow5(mv + 2, s.q);
+                }
+            }
+        } else {
+            if (s.q <= 1) {
+                vr_is_trailing_zeros = true;
+                if (accept_bounds) {
+                    vm_is_trailing_zeros = mm_shift == 1;
+                } else {
+                    vp--;
+                }
+            } else if (s.q < 63) {
+                vr_is_trailing_zeros = multiple_of_pow2(mv, s.q);
+            }
+        }
+        
+        int removed = 0;
+        uint8_t last_removed_digit = 0;
+        uint64_t output;
+        if (AMBRO_UNLIKELY(vm_is_trailing_zeros || vr_is_trailing_zeros)) {
+            while (vp / 10 > vm / 10) {
+                vm_is_trailing_zeros &= vm % 10 == 0;
+                vr_is_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+            if (vm_is_trailing_zeros) {
+                while (vm % 10 == 0) {
+                    vr_is_trailing_zeros &= last_removed_digit == 0;
+                    last_removed_digit = vr % 10;
+                    vr /= 10;
+                    vp /= 10;
+                    vm /= 10;
+                    removed++;
+                }
+            }
+            if (vr_is_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+                last_removed_digit = 4;
+            }
+            output = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) || last_removed_digit >= 5);
+        } else {
+            // Remove two digits at a time while possible, the common case.
+            while (vp / 100 > vm / 100) {
+                last_removed_digit = (vr / 10) % 10;
+                vr /= 100;
+                vp /= 100;
+                vm /= 100;
+                removed += 2;
+            }
+            while (vp / 10 > vm / 10) {
+                last_removed_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+            output = vr + (vr == vm || last_removed_digit >= 5);
+        }
+        
+        return Decimal{output, s.e10 + removed};
+    }
+    
+    // The exact value correctly rounded (half to even) to the given number
+    // of significant digits, at most 17. For subnormal numbers, fewer digits
+    // may be available, in which case the result is truncated.
+    inline Decimal double_precision (uint64_t ieee_mantissa, uint32_t ieee_exponent, int precision)
+    {
+        int e2;
+        uint64_t m2;
+        double_unpack(ieee_mantissa, ieee_exponent, &e2, &m2);
+        
+        DoubleScaled s;
+        double_scale(e2, m2, &s);
+        uint64_t vr = mul_shift64(s.mv, s.mul, s.shift);
+        bool sticky = (e2 >= 0) ? !multiple_of_pow5(s.mv, s.q) : !multiple_of_pow2(s.mv, s.q);
+        
+        int e10 = s.e10;
+        int digits = decimal_length(vr);
+        uint8_t last_removed_digit = 0;
+        while (digits > precision) {
+            sticky |= last_removed_digit != 0;
+            last_removed_digit = vr % 10;
+            vr /= 10;
+            e10++;
+            digits--;
+        }
+        if (last_removed_digit > 5 || (last_removed_digit == 5 && (sticky || vr % 2 != 0))) {
+            vr++;
+            if (decimal_length(vr) > digits) {
+                vr /= 10;
+                e10++;
+            }
+        }
+        
+        return Decimal{vr, e10};
+    }
+#endif
+
+    // Rounds a shortest representation to fewer digits. This rounds twice
+    // and is only used where there is no 64-bit double.
+    inline Decimal round_decimal (Decimal d, int precision)
+    {
+        int digits = decimal_length(d.mantissa);
+        if (digits <= precision) {
+            return d;
+        }
+        uint64_t mantissa = d.mantissa;
+        int exponent = d.exponent;
+        bool sticky = false;
+        uint8_t last_removed_digit = 0;
+        while (digits > precision) {
+            sticky |= last_removed_digit != 0;
+            last_removed_digit = mantissa % 10;
+            mantissa /= 10;
+            exponent++;
+            digits--;
+        }
+        if (last_removed_digit > 5 || (last_removed_digit == 5 && (sticky || mantissa % 2 != 0))) {
+            mantissa++;
+            if (decimal_length(mantissa) > digits) {
+                mantissa /= 10;
+                exponent++;
+            }
+        }
+        return Decimal{mantissa, exponent};
+    }
+    
+    template <typename T>
+    struct Impl;
+    
+    template <>
+    struct Impl<float> {
+        struct Bits {
+            bool sign;
+            bool special;
+            bool zero;
+            uint32_t mantissa;
+            uint32_t exponent;
+        };
+        
+        static Bits unpack (float x)
+        {
+            uint32_t bits;
+            memcpy(&bits, &x, sizeof(bits));
+            Bits b;
+            b.sign = bits >> 31;
+            b.mantissa = bits & (((uint32_t)1 << 23) - 1);
+            b.exponent = (bits >> 23) & 0xFF;
+            b.special = b.exponent == 0xFF;
+            b.zero = b.exponent == 0 && b.mantissa == 0;
+            return b;
+        }
+        
+        static Decimal shortest (Bits b)
+        {
+            return float_shortest(b.mantissa, b.exponent);
+        }
+        
+        static Decimal precision (float x, Bits b, int precision)
+        {
+#if DBL_MANT_DIG >= 53
+            // Every float is a normal double, so all digits are exact.
+            uint64_t bits;
+            double d = x;
+            memcpy(&bits, &d, sizeof(bits));
+            return double_precision(bits & (((uint64_t)1 << 52) - 1), (bits >> 52) & 0x7FF, precision);
+#else
+            return round_decimal(shortest(b), precision);
+#endif
+        }
+    };
+
+#if DBL_MANT_DIG >= 53
+    template <>
+    struct Impl<double> {
+        struct Bits {
+            bool sign;
+            bool special;
+            bool zero;
+            uint64_t mantissa;
+            uint32_t exponent;
+        };
+        
+        static Bits unpack (double x)
+        {
+            uint64_t bits;
+            memcpy(&bits, &x, sizeof(bits));
+            Bits b;
+            b.sign = bits >> 63;
+            b.mantissa = bits & (((uint64_t)1 << 52) - 1);
+            b.exponent = (bits >> 52) & 0x7FF;
+            b.special = b.exponent == 0x7FF;
+            b.zero = b.exponent == 0 && b.mantissa == 0;
+            return b;
+        }
+        
+        static Decimal shortest (Bits b)
+        {
+            return double_shortest(b.mantissa, b.exponent);
+        }
+        
+        static Decimal precision (double x, Bits b, int precision)
+        {
+            return double_precision(b.mantissa, b.exponent, precision);
+        }
+    };
+#else
+    template <>
+    struct Impl<double> : public Impl<float> {};
+#endif
+
+    inline int print_exponent (int exponent, char *s)
+    {
+        int len = 0;
+        s[len++] = 'e';
+        if (exponent < 0) {
+            s[len++] = '-';
+            exponent = -exponent;
+        } else {
+            s[len++] = '+';
+        }
+        if (exponent >= 100) {
+            s[len++] = '0' + exponent / 100;
+            exponent %= 100;
+        }
+        s[len++] = '0' + exponent / 10;
+        s[len++] = '0' + exponent % 10;
+        return len;
+    }
+    
+    // Formats mantissa * 10^exponent like printf %g with the given precision,
+    // except that the precision is raised to the number of digits.
+    inline int format (bool sign, Decimal d, int precision, char *s)
+    {
+        uint64_t mantissa = d.mantissa;
+        int exponent = d.exponent;
+        while (mantissa % 10 == 0) {
+            mantissa /= 10;
+            exponent++;
+        }
+        
+        char digits[20];
+        int num_digits = 0;
+        do {
+            digits[19 - num_digits++] = '0' + mantissa % 10;
+            mantissa /= 10;
+        } while (mantissa > 0);
+        char const *first = digits + (20 - num_digits);
+        
+        int len = 0;
+        if (sign) {
+            s[len++] = '-';
+        }
+        
+        int sci_exponent = exponent + num_digits - 1;
+        if (precision < num_digits) {
+            precision = num_digits;
+        }
+        
+        if (sci_exponent < -4 || sci_exponent >= precision) {
+            s[len++] = first[0];
+            if (num_digits > 1) {
+                s[len++] = '.';
+                memcpy(s + len, first + 1, num_digits - 1);
+                len += num_digits - 1;
+            }
+            len += print_exponent(sci_exponent, s + len);
+        }
+        else if (sci_exponent >= 0) {
+            int int_digits = sci_exponent + 1;
+            if (num_digits <= int_digits) {
+                memcpy(s + len, first, num_digits);
+                len += num_digits;
+                memset(s + len, '0', int_digits - num_digits);
+                len += int_digits - num_digits;
+            } else {
+                memcpy(s + len, first, int_digits);
+                len += int_digits;
+                s[len++] = '.';
+                memcpy(s + len, first + int_digits, num_digits - int_digits);
+                len += num_digits - int_digits;
+            }
+        }
+        else {
+            s[len++] = '0';
+            s[len++] = '.';
+            memset(s + len, '0', -sci_exponent - 1);
+            len += -sci_exponent - 1;
+            memcpy(s + len, first, num_digits);
+            len += num_digits;
+        }
+        
+        return len;
+    }
+    
+    inline int format_special (bool sign, bool zero, bool nan, char *s)
+    {
+        int len = 0;
+        if (sign) {
+            s[len++] = '-';
+        }
+        char const *str = zero ? "0" : nan ? "nan" : "inf";
+        size_t str_len = strlen(str);
+        memcpy(s + len, str, str_len);
+        return len + str_len;
+    }
+}
+
+/**
+ * Maximum number of characters written by PrintFloatShortest and
+ * PrintFloatPrecision, e.g. "-2.2250738585072014e-308".
+ */
+static int const PrintFloatMaxChars = 24;
+
+/**
+ * Writes the shortest decimal representation of x which parses back
+ * to exactly x (with correct rounding, as by strtof/strtod), and returns
+ * the number of characters written. No null terminator is written.
+ * 
+ * The format is that of printf %g, with the precision being the
+ * larger of 6 and the number of digits, e.g. "0.1", "12.5", "1e+06",
+ * "1234567", "3.4028235e+38", "-0", "inf", "nan".
+ */
+template <typename T>
+int PrintFloatShortest (T x, char *s)
+{
+    static_assert(IsFpType<T>::Value, "");
+    using Impl = PrintFloatPrivate::Impl<T>;
+    
+    auto b = Impl::unpack(x);
+    if (AMBRO_UNLIKELY(b.special || b.zero)) {
+        return PrintFloatPrivate::format_special(b.sign, b.zero, b.special && b.mantissa != 0, s);
+    }
+    return PrintFloatPrivate::format(b.sign, Impl::shortest(b), 6, s);
+}
+
+/**
+ * Writes x with the given number of significant digits (1 to 17), the same
+ * as snprintf with "%.<precision>g", and returns the number of characters
+ * written. No null terminator is written.
+ * 
+ * The value is correctly rounded, except for subnormal doubles, which
+ * may get fewer digits, and where double is not a 64-bit type, where
+ * the shortest representation is rounded.
+ */
+template <typename T>
+int PrintFloatPrecision (T x, int precision, char *s)
+{
+    static_assert(IsFpType<T>::Value, "");
+    using Impl = PrintFloatPrivate::Impl<T>;
+    
+    if (precision < 1) {
+        precision = 1;
+    }
+    if (precision > 17) {
+        precision = 17;
+    }
+    
+    auto b = Impl::unpack(x);
+    if (AMBRO_UNLIKELY(b.special || b.zero)) {
+        return PrintFloatPrivate::format_special(b.sign, b.zero, b.special && b.mantissa != 0, s);
+    }
+    return PrintFloatPrivate::format(b.sign, Impl::precision(x, b, precision), precision, s);
+}
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_WORD_SCAN_H
+#define AMBROLIB_WORD_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <aprinter/base/Hints.h>
+
+namespace APrinter {
+
+/*
+ * Searching for characters a machine word at a time (SWAR).
+ * 
+ * A word is compared against all the characters of the set at once using
+ * the usual zero-byte test, (v - 0x01..01) & ~v & 0x80..80, which is nonzero
+ * exactly if some byte of v is zero. When a word contains a match, its bytes
+ * are examined one by one, so the result does not depend on endianness.
+ * Words are loaded with memcpy, so the data need not be aligned.
+ */
+namespace WordScanPrivate {
+    using Word = size_t;
+    
+    static Word const Ones = (Word)-1 / 0xFF;
+    static Word const Highs = Ones * 0x80;
+    
+    AMBRO_ALWAYS_INLINE
+    Word load_word (char const *ptr)
+    {
+        Word w;
+        memcpy(&w, ptr, sizeof(w));
+        return w;
+    }
+    
+    AMBRO_ALWAYS_INLINE
+    Word zero_bytes (Word w)
+    {
+        return (w - Ones) & ~w & Highs;
+    }
+    
+    template <char... Chars>
+    struct Matcher;
+    
+    template <>
+    struct Matcher<> {
+        AMBRO_ALWAYS_INLINE
+        static Word match_word (Word)
+        {
+            return 0;
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static bool match_char (char)
+        {
+            return false;
+        }
+    };
+    
+    template <char Char, char... Chars>
+    struct Matcher<Char, Chars...> {
+        AMBRO_ALWAYS_INLINE
+        static Word match_word (Word w)
+        {
+            return zero_bytes(w ^ (Ones * (unsigned char)Char)) | Matcher<Chars...>::match_word(w);
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static bool match_char (char ch)
+        {
+            return ch == Char || Matcher<Chars...>::match_char(ch);
+        }
+    };
+}
+
+/**
+ * Whether word scanning is worthwhile, i.e. words are at least 32 bits.
+ * Where it is not, the functions below still work but go byte by byte.
+ */
+static bool const WordScanEnabled = (sizeof(size_t) >= 4);
+
+/**
+ * Returns the index of the first character in data[0, len) which is one of
+ * Chars, or len if there is none.
+ */
+template <char... Chars>
+size_t WordScanFind (char const *data, size_t len)
+{
+    using namespace WordScanPrivate;
+    using TheMatcher = Matcher<Chars...>;
+    
+    size_t pos = 0;
+    if (WordScanEnabled) {
+        while (len - pos >= sizeof(Word) && !TheMatcher::match_word(load_word(data + pos))) {
+            pos += sizeof(Word);
+        }
+    }
+    while (pos < len && !TheMatcher::match_char(data[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+}
+
+#endif
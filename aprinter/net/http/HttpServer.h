@@ -1188,6 +1188,19 @@ private:
             return m_have_request_body;
         }
         
+        // Gives the request body length if it is known in advance,
+        // that is if it is given by Content-Length and not chunked.
+        bool getRequestBodyLength (Context c, uint64_t *out_length)
+        {
+            AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
+            
+            if (!m_have_content_length || m_have_chunked) {
+                return false;
+            }
+            *out_length = m_rem_req_body_length;
+            return true;
+        }
+        
         void setCallback (Context c, RequestUserCallback *callback)
         {
             AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
@@ -27,6 +27,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
 
 #include <alloca.h>
 #include <pthread.h>
@@ -35,15 +38,19 @@
 #include <getopt.h>
 #include <sys/mman.h>
 
+#include <atomic>
+
 #include "linux_support.h"
 
 #include <aprinter/base/Assert.h>
 
 LinuxCmdlineOptions cmdline_options;
 pthread_mutex_t interrupt_mutex;
+bool step_timing_enabled;
 
 static bool parse_options (int argc, char *argv[]);
 static void make_cpuset (int affinity, cpu_set_t *cpuset);
+static void step_timing_init ();
 
 static size_t const MainStackPrefaultSize = 16384;
 static size_t const RtThreadStackSize = PTHREAD_STACK_MIN;
@@ -102,6 +109,11 @@ void platform_init (int argc, char *argv[])
     act.sa_flags = 0;
     res = sigaction(SIGPIPE, &act, NULL);
     AMBRO_ASSERT_FORCE(res == 0)
+    
+    // Start the step timing analysis if requested.
+    if (cmdline_options.step_timing_file) {
+        step_timing_init();
+    }
 }
 
 static bool parse_options (int argc, char *argv[])
@@ -112,6 +124,8 @@ static bool parse_options (int argc, char *argv[])
     cmdline_options.rt_affinity = 0;
     cmdline_options.main_affinity = 0;
     cmdline_options.tap_dev = nullptr;
+    cmdline_options.step_timing_file = nullptr;
+    cmdline_options.step_timing_deadline_us = 100;
     
     static struct option const long_options[] = {
         {"lock-mem",      no_argument,       nullptr, 'l'},
@@ -120,12 +134,14 @@ static bool parse_options (int argc, char *argv[])
         {"rt-affinity",   required_argument, nullptr, 'a'},
         {"main-affinity", required_argument, nullptr, 'f'},
         {"tap-dev",       required_argument, nullptr, 't'},
+        {"step-timing",   required_argument, nullptr, 's'},
+        {"step-timing-deadline", required_argument, nullptr, 'd'},
         {}
     };
     
     while (true) {
         int option_index = 0;
-        int opt = getopt_long(argc, argv, "lc:p:a:f:t:", long_options, &option_index);
+        int opt = getopt_long(argc, argv, "lc:p:a:f:t:s:d:", long_options, &option_index);
         if (opt == -1) {
             break;
         }
@@ -182,6 +198,19 @@ static bool parse_options (int argc, char *argv[])
                 cmdline_options.tap_dev = optarg;
             } break;
             
+            case 's': {
+                cmdline_options.step_timing_file = optarg;
+            } break;
+            
+            case 'd': {
+                int val = atoi(optarg);
+                if (val <= 0) {
+                    fprintf(stderr, "Invalid step timing deadline\n");
+                    return false;
+                }
+                cmdline_options.step_timing_deadline_us = val;
+            } break;
+            
             default: {
                 return false;
             } break;
@@ -310,3 +339,193 @@ static void make_cpuset (int affinity, cpu_set_t *cpuset)
         CPU_SET((affinity - 1), cpuset);
     }
 }
+
+// Samples are passed from the timer thread to the step timing thread
+// through a single-producer single-consumer ring buffer per timer.
+static int const StepTimingMaxTimers = 64;
+static uint32_t const StepTimingRingSize = 4096;
+static long const StepTimingDrainIntervalNs = 10000000;
+
+static int const StepTimingNumBins = 11;
+static double const StepTimingBinLimitsUs[StepTimingNumBins - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+struct StepTimingSample {
+    uint64_t actual_ns;
+    int64_t late_ns;
+};
+
+struct StepTimingRing {
+    std::atomic<uint32_t> write_pos;
+    std::atomic<uint32_t> read_pos;
+    std::atomic<uint64_t> dropped;
+    StepTimingSample samples[StepTimingRingSize];
+};
+
+struct StepTimingStats {
+    uint64_t count;
+    uint64_t missed;
+    int64_t min_late_ns;
+    int64_t max_late_ns;
+    double sum_late_ns;
+    double sum_sq_late_ns;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t bins[StepTimingNumBins];
+};
+
+static StepTimingRing *step_timing_rings;
+static StepTimingStats step_timing_stats[StepTimingMaxTimers];
+static LinuxRtThread step_timing_thread;
+static sigset_t step_timing_signals;
+
+void step_timing_record (int timer_index, uint64_t actual_ns, int64_t late_ns)
+{
+    AMBRO_ASSERT(step_timing_enabled)
+    AMBRO_ASSERT(timer_index >= 0 && timer_index < StepTimingMaxTimers)
+    
+    StepTimingRing *ring = &step_timing_rings[timer_index];
+    uint32_t write_pos = ring->write_pos.load(std::memory_order_relaxed);
+    uint32_t read_pos = ring->read_pos.load(std::memory_order_acquire);
+    if (write_pos - read_pos >= StepTimingRingSize) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    StepTimingSample *sample = &ring->samples[write_pos % StepTimingRingSize];
+    sample->actual_ns = actual_ns;
+    sample->late_ns = late_ns;
+    ring->write_pos.store(write_pos + 1, std::memory_order_release);
+}
+
+static void step_timing_drain ()
+{
+    int64_t deadline_ns = (int64_t)cmdline_options.step_timing_deadline_us * 1000;
+    
+    for (int i = 0; i < StepTimingMaxTimers; i++) {
+        StepTimingRing *ring = &step_timing_rings[i];
+        StepTimingStats *st = &step_timing_stats[i];
+        
+        uint32_t read_pos = ring->read_pos.load(std::memory_order_relaxed);
+        uint32_t write_pos = ring->write_pos.load(std::memory_order_acquire);
+        
+        for (; read_pos != write_pos; read_pos++) {
+            StepTimingSample sample = ring->samples[read_pos % StepTimingRingSize];
+            int64_t late = sample.late_ns;
+            
+            if (st->count == 0) {
+                st->min_late_ns = late;
+                st->max_late_ns = late;
+                st->first_ns = sample.actual_ns;
+            }
+            st->count++;
+            st->min_late_ns = (late < st->min_late_ns) ? late : st->min_late_ns;
+            st->max_late_ns = (late > st->max_late_ns) ? late : st->max_late_ns;
+            st->sum_late_ns += late;
+            st->sum_sq_late_ns += (double)late * late;
+            st->last_ns = sample.actual_ns;
+            if (late > deadline_ns) {
+                st->missed++;
+            }
+            
+            int bin = 0;
+            while (bin < StepTimingNumBins - 1 && late >= StepTimingBinLimitsUs[bin] * 1000) {
+                bin++;
+            }
+            st->bins[bin]++;
+        }
+        
+        ring->read_pos.store(read_pos, std::memory_order_release);
+    }
+}
+
+static void step_timing_write_report ()
+{
+    FILE *f = fopen(cmdline_options.step_timing_file, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open step timing file %s\n", cmdline_options.step_timing_file);
+        return;
+    }
+    
+    fprintf(f, "# Lateness of interrupt timer handlers (step edges for axis timers) in us.\n");
+    fprintf(f, "# deadline_us %d\n", cmdline_options.step_timing_deadline_us);
+    fprintf(f, "# timer samples dropped rate_hz min max mean stddev jitter missed");
+    for (int j = 0; j < StepTimingNumBins; j++) {
+        if (j < StepTimingNumBins - 1) {
+            fprintf(f, " <%g", StepTimingBinLimitsUs[j]);
+        } else {
+            fprintf(f, " >=%g", StepTimingBinLimitsUs[j - 1]);
+        }
+    }
+    fprintf(f, "\n");
+    
+    for (int i = 0; i < StepTimingMaxTimers; i++) {
+        StepTimingStats *st = &step_timing_stats[i];
+        uint64_t dropped = step_timing_rings[i].dropped.load(std::memory_order_relaxed);
+        if (st->count == 0 && dropped == 0) {
+            continue;
+        }
+        
+        double mean = (st->count > 0) ? st->sum_late_ns / st->count : 0.0;
+        double var = (st->count > 0) ? st->sum_sq_late_ns / st->count - mean * mean : 0.0;
+        double span_s = (st->last_ns - st->first_ns) * 1e-9;
+        
+        fprintf(f, "%d %llu %llu %.0f %.2f %.2f %.2f %.2f %.2f %llu", i,
+                (unsigned long long)st->count, (unsigned long long)dropped,
+                (span_s > 0.0) ? (st->count - 1) / span_s : 0.0,
+                st->min_late_ns * 1e-3, st->max_late_ns * 1e-3, mean * 1e-3,
+                sqrt((var > 0.0) ? var : 0.0) * 1e-3,
+                (st->max_late_ns - st->min_late_ns) * 1e-3,
+                (unsigned long long)st->missed);
+        for (int j = 0; j < StepTimingNumBins; j++) {
+            fprintf(f, " %llu", (unsigned long long)st->bins[j]);
+        }
+        fprintf(f, "\n");
+    }
+    
+    fclose(f);
+}
+
+static void step_timing_thread_func ()
+{
+    struct timespec timeout = {0, StepTimingDrainIntervalNs};
+    
+    while (true) {
+        int sig = sigtimedwait(&step_timing_signals, nullptr, &timeout);
+        if (sig < 0) {
+            AMBRO_ASSERT_FORCE(errno == EAGAIN || errno == EINTR)
+            step_timing_drain();
+            continue;
+        }
+        
+        step_timing_drain();
+        step_timing_write_report();
+        
+        if (sig != SIGUSR1) {
+            // Terminate the process the same way the signal would have.
+            signal(sig, SIG_DFL);
+            pthread_sigmask(SIG_UNBLOCK, &step_timing_signals, nullptr);
+            raise(sig);
+        }
+    }
+}
+
+static void step_timing_init ()
+{
+    int res;
+    
+    step_timing_rings = (StepTimingRing *)calloc(StepTimingMaxTimers, sizeof(StepTimingRing));
+    AMBRO_ASSERT_FORCE_MSG(step_timing_rings, "calloc failed")
+    
+    // Block the report signals in the main thread, so that they are blocked
+    // in all threads started later and are only received via sigtimedwait.
+    sigemptyset(&step_timing_signals);
+    sigaddset(&step_timing_signals, SIGINT);
+    sigaddset(&step_timing_signals, SIGTERM);
+    sigaddset(&step_timing_signals, SIGUSR1);
+    res = pthread_sigmask(SIG_BLOCK, &step_timing_signals, nullptr);
+    AMBRO_ASSERT_FORCE(res == 0)
+    
+    step_timing_enabled = true;
+    
+    step_timing_thread.start(APRINTER_CB_STATFUNC(&step_timing_thread_func), -1, -1, 0);
+}
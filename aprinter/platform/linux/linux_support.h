@@ -26,6 +26,7 @@
 #define APRINTER_LINUX_SUPPORT_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <signal.h>
 
@@ -50,6 +51,8 @@ struct LinuxCmdlineOptions {
     int rt_affinity;
     int main_affinity;
     char const *tap_dev;
+    char const *step_timing_file;
+    int step_timing_deadline_us;
 };
 
 extern LinuxCmdlineOptions cmdline_options;
@@ -58,6 +61,15 @@ extern pthread_mutex_t interrupt_mutex;
 
 void platform_init (int argc, char *argv[]);
 
+// Step timing analysis, enabled with --step-timing=FILE. The clock reports
+// the lateness of each interrupt timer handler call with step_timing_record(),
+// from the timer thread only. The samples are collected by a separate thread,
+// which writes a report to FILE on SIGUSR1 and on SIGINT/SIGTERM (after which
+// the process is terminated).
+extern bool step_timing_enabled;
+
+void step_timing_record (int timer_index, uint64_t actual_ns, int64_t late_ns);
+
 inline static void cli (void)
 {
     int res = pthread_mutex_lock(&interrupt_mutex);
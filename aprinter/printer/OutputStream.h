@@ -35,6 +35,7 @@
 #include <aprinter/base/Hints.h>
 #include <aprinter/math/FloatTools.h>
 #include <aprinter/math/PrintInt.h>
+#include <aprinter/math/PrintFloat.h>
 
 namespace APrinter {
 
@@ -91,13 +92,14 @@ public:
     APRINTER_NO_INLINE
     void reply_append_fp (Context c, FpType x)
     {
-        char buf[30];
 #if defined(AMBROLIB_AVR)
+        char buf[30];
         uint8_t len = AMBRO_PGM_SPRINTF(buf, AMBRO_PSTR("%g"), x);
         reply_append_buffer(c, buf, len);
 #else
-        snprintf(buf, sizeof(buf), "%g", (double)x);
-        reply_append_buffer(c, buf, strlen(buf));
+        char buf[PrintFloatMaxChars];
+        int len = PrintFloatShortest<FpType>(x, buf);
+        reply_append_buffer(c, buf, len);
 #endif
     }
     
@@ -89,7 +89,11 @@ APRINTER_ALIAS_STRUCT(PrinterMainParams, (
     APRINTER_AS_VALUE(int, StepperSegmentBufferSize),
     APRINTER_AS_VALUE(int, LookaheadBufferSize),
     APRINTER_AS_VALUE(int, LookaheadCommitCount),
+    APRINTER_AS_TYPE(JunctionDeviationEnabled),
+    APRINTER_AS_TYPE(JunctionDeviation),
     APRINTER_AS_TYPE(ForceTimeout),
+    APRINTER_AS_VALUE(int, CommandBatchMaxCommands),
+    APRINTER_AS_TYPE(CommandBatchMaxTime),
     APRINTER_AS_TYPE(FpType),
     APRINTER_AS_TYPE(WatchdogService),
     APRINTER_AS_VALUE(bool, WatchdogDebugMode),
@@ -97,6 +101,7 @@ APRINTER_ALIAS_STRUCT(PrinterMainParams, (
     APRINTER_AS_TYPE(ConfigList),
     APRINTER_AS_TYPE(AxesList),
     APRINTER_AS_TYPE(TransformParams),
+    APRINTER_AS_TYPE(ArcParams),
     APRINTER_AS_TYPE(LasersList),
     APRINTER_AS_TYPE(ModulesList)
 ))
@@ -110,6 +115,9 @@ APRINTER_ALIAS_STRUCT(PrinterMainAxisParams, (
     APRINTER_AS_TYPE(DefaultMaxAccel),
     APRINTER_AS_TYPE(DefaultDistanceFactor),
     APRINTER_AS_TYPE(DefaultCorneringDistance),
+    APRINTER_AS_TYPE(DefaultPressureAdvance),
+    APRINTER_AS_TYPE(InputShaper),
+    APRINTER_AS_TYPE(JerkLimit),
     APRINTER_AS_TYPE(Homing),
     APRINTER_AS_VALUE(bool, IsCartesian),
     APRINTER_AS_VALUE(bool, IsExtruder),
@@ -134,6 +142,28 @@ APRINTER_ALIAS_STRUCT_EXT(PrinterMainHomingParams, (
     static bool const Enabled = true;
 ))
 
+struct PrinterMainNoInputShaperParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainInputShaperParams, (
+    APRINTER_AS_TYPE(ShaperType),
+    APRINTER_AS_TYPE(Frequency),
+    APRINTER_AS_TYPE(DampingRatio)
+), (
+    static bool const Enabled = true;
+))
+
+struct PrinterMainNoJerkLimitParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainJerkLimitParams, (
+    APRINTER_AS_TYPE(MaxJerk)
+), (
+    static bool const Enabled = true;
+))
+
 struct PrinterMainNoTransformParams {
     static const bool Enabled = false;
 };
@@ -147,6 +177,17 @@ APRINTER_ALIAS_STRUCT_EXT(PrinterMainTransformParams, (
     static bool const Enabled = true;
 ))
 
+struct PrinterMainNoArcParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainArcParams, (
+    APRINTER_AS_TYPE(Tolerance),
+    APRINTER_AS_TYPE(MinSegmentTime)
+), (
+    static bool const Enabled = true;
+))
+
 APRINTER_ALIAS_STRUCT(PrinterMainVirtualAxisParams, (
     APRINTER_AS_VALUE(char, Name),
     APRINTER_AS_TYPE(MinPos),
@@ -223,6 +264,7 @@ private:
     using ParamsAxesList = typename Params::AxesList;
     using ParamsLasersList = typename Params::LasersList;
     using TransformParams = typename Params::TransformParams;
+    using ArcParams = typename Params::ArcParams;
     using ParamsModulesList = typename Params::ModulesList;
     
     using TheDebugObject = DebugObject<Context, Object>;
@@ -258,6 +300,8 @@ public:
     
 private:
     using MaxStepsPerCycle = decltype(Config::e(Params::MaxStepsPerCycle::i()));
+    using JunctionDeviationEnabled = decltype(Config::e(Params::JunctionDeviationEnabled::i()));
+    using JunctionDeviation = decltype(Config::e(Params::JunctionDeviation::i()));
     
     using CInactiveTimeTicks = decltype(ExprCast<TimeType>(Config::e(Params::InactiveTime::i()) * TimeConversion()));
     using CForceTimeoutTicks = decltype(ExprCast<TimeType>(Config::e(Params::ForceTimeout::i()) * TimeConversion()));
@@ -302,11 +346,14 @@ public:
     static_assert(Params::ExtraSendBufClearance >= 60, "");
     static_assert(Params::MaxMsgSize >= 50, "");
     static_assert(Params::MaxMsgSize <= Params::ExtraSendBufClearance, "");
+    static_assert(Params::CommandBatchMaxCommands >= 1 && Params::CommandBatchMaxCommands <= 255, "");
     
     static size_t const ExpectedResponseLength = Params::ExpectedResponseLength;
     static size_t const ExtraSendBufClearance = Params::ExtraSendBufClearance;
     static size_t const CommandSendBufClearance = ExpectedResponseLength + ExtraSendBufClearance;
     static size_t const MaxMsgSize = Params::MaxMsgSize;
+    static int const CommandBatchMaxCommands = Params::CommandBatchMaxCommands;
+    static TimeType const CommandBatchMaxTimeTicks = Params::CommandBatchMaxTime::value() * Clock::time_freq;
     
 public:
     using TheOutputStream = OutputStream<Context, FpType>;
@@ -471,6 +518,39 @@ public:
             return !hasCommand(c);
         }
         
+        // Batched execution, for clients which are told about the next
+        // command by an event that is only dispatched in the next event loop
+        // iteration (like the serial receive fast event). The handler calls
+        // beginBatch() first. After each startCommand(), if continueBatch()
+        // returns true, the command has already finished, and the client may
+        // go on to the next command in the same handler. This is limited by
+        // the number of commands and the time since beginBatch(), so that
+        // other events are not held up. The batch state is shared by all
+        // streams since only one handler runs at a time.
+        void beginBatch (Context c)
+        {
+            auto *mo = Object::self(c);
+            
+            if (CommandBatchMaxCommands > 1) {
+                mo->batch_commands = 0;
+                mo->batch_start_time = Clock::getTime(c);
+            }
+        }
+        
+        bool continueBatch (Context c)
+        {
+            auto *mo = Object::self(c);
+            
+            if (CommandBatchMaxCommands <= 1 || m_cmd) {
+                return false;
+            }
+            mo->batch_commands++;
+            if (mo->batch_commands >= CommandBatchMaxCommands) {
+                return false;
+            }
+            return (TimeType)(Clock::getTime(c) - mo->batch_start_time) < CommandBatchMaxTimeTicks;
+        }
+        
         void reportSendBufEventDirectly (Context c)
         {
             AMBRO_ASSERT(m_state == COMMAND_WAITBUF || m_state == COMMAND_LOCKED)
@@ -1049,6 +1129,7 @@ private:
         static const char AxisName = AxisSpec::Name;
         static_assert(NameCharIsValid<AxisName, ReservedAxisNames>::Value, "Axis name not allowed");
         using WrappedAxisName = WrapInt<AxisName>;
+        static int const JunctionIndex = (AxisName >= 'X' && AxisName <= 'Z') ? (AxisName - 'X') : -1;
         using HomingSpec = typename AxisSpec::Homing;
         static bool const IsExtruder = AxisSpec::IsExtruder;
         
@@ -1064,6 +1145,7 @@ private:
         using DistConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()));
         using SpeedConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()) / TimeConversion());
         using AccelConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()) / (TimeConversion() * TimeConversion()));
+        using JerkConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()) / (TimeConversion() * TimeConversion() * TimeConversion()));
         
         using AbsStepFixedTypeMin = APRINTER_FP_CONST_EXPR(AbsStepFixedType::minValue().fpValueConstexpr());
         using AbsStepFixedTypeMax = APRINTER_FP_CONST_EXPR(AbsStepFixedType::maxValue().fpValueConstexpr());
@@ -1077,6 +1159,24 @@ private:
         template <typename ThePrinterMain=PrinterMain>
         static constexpr typename ThePrinterMain::PhysVirtAxisMaskType AxisMask () { return (PhysVirtAxisMaskType)1 << AxisIndex; }
         
+        AMBRO_STRUCT_IF(PlannerInputShaperHelper, AxisSpec::InputShaper::Enabled) {
+            using InputShaper = MotionPlannerInputShaper<
+                typename AxisSpec::InputShaper::ShaperType,
+                decltype(Config::e(AxisSpec::InputShaper::Frequency::i())),
+                decltype(Config::e(AxisSpec::InputShaper::DampingRatio::i()))
+            >;
+        } AMBRO_STRUCT_ELSE(PlannerInputShaperHelper) {
+            using InputShaper = MotionPlannerNoInputShaper;
+        };
+        
+        AMBRO_STRUCT_IF(PlannerJerkLimitHelper, AxisSpec::JerkLimit::Enabled) {
+            using JerkLimit = MotionPlannerJerkLimit<
+                decltype(ExprRec(Config::e(AxisSpec::JerkLimit::MaxJerk::i()) * JerkConversion()))
+            >;
+        } AMBRO_STRUCT_ELSE(PlannerJerkLimitHelper) {
+            using JerkLimit = MotionPlannerNoJerkLimit;
+        };
+        
         struct PlannerPrestepCallback;
         struct PlannerAxisSpec : public MotionPlannerAxisSpec<
             TheAxisDriver,
@@ -1085,6 +1185,10 @@ private:
             decltype(Config::e(AxisSpec::DefaultCorneringDistance::i())),
             PlannerMaxSpeedRec,
             PlannerMaxAccelRec,
+            AxisSpec::IsExtruder,
+            decltype(Config::e(AxisSpec::DefaultPressureAdvance::i())),
+            typename PlannerInputShaperHelper::InputShaper,
+            typename PlannerJerkLimitHelper::JerkLimit,
             PlannerPrestepCallback
         > {};
         
@@ -1301,6 +1405,16 @@ private:
             mycmd->x = move;
         }
         
+        template <typename PlannerCmd>
+        static void add_junction_component (Context c, PlannerCmd *cmd)
+        {
+            if (JunctionIndex >= 0) {
+                auto *mycmd = TupleGetElem<AxisIndex>(cmd->axes.axes());
+                FpType delta = mycmd->x.template fpValue<FpType>() * APRINTER_CFG(Config, CDistConversionRec, c);
+                cmd->axes.junction_vec[MaxValue(0, JunctionIndex)] = mycmd->dir ? delta : -delta;
+            }
+        }
+        
         template <typename PlannerCmd>
         static void limit_axis_move_speed (Context c, FpType time_freq_by_max_speed, PlannerCmd *cmd)
         {
@@ -1484,6 +1598,11 @@ private:
     using LasersList = IndexElemList<ParamsLasersList, Laser>;
     
 public:
+    static int const NumLasers = TypeListLength<ParamsLasersList>::Value;
+    
+    template <int LaserIndex>
+    using GetLaserName = WrapInt<TypeListGet<ParamsLasersList, LaserIndex>::Name>;
+    
     struct PlannerClient {
         virtual void pull_handler (Context c) = 0;
         virtual void finished_handler (Context c, bool aborted) = 0;
@@ -1629,12 +1748,60 @@ public:
                 time_freq_by_max_speed = base_max_v_rec / distance;
             }
             
-            o->splitter.start(c, distance, base_max_v_rec, time_freq_by_max_speed);
+            o->splitter.start(c, distance, base_max_v_rec, time_freq_by_max_speed, [&](FpType start_frac, FpType end_frac, FpType *out_deviation) {
+                return split_deviation(c, start_frac, end_frac, out_deviation);
+            });
             o->frac = 0.0f;
             
             return do_split(c);
         }
         
+        static void get_split_virt_pos (Context c, FpType frac, FpType *virt_pos)
+        {
+            ListFor<VirtAxesList>([&] APRINTER_TL(axis, axis::get_split_pos(c, frac, virt_pos)));
+            if (TheCorrectionService::CorrectionEnabled) {
+                FpType temp_virt_pos[NumVirtAxes];
+                TheCorrectionService::do_correction(c, ArraySrc{virt_pos}, ArrayDst{temp_virt_pos}, WrapBool<false>());
+                for (int i = 0; i < NumVirtAxes; i++) {
+                    virt_pos[i] = temp_virt_pos[i];
+                }
+            }
+        }
+        
+        // Computes how far from the straight line the midpoint of the part of the
+        // current move between the given fractions would be, if that part were
+        // not split further (i.e. the physical axes moved linearly).
+        static bool split_deviation (Context c, FpType start_frac, FpType end_frac, FpType *out_deviation)
+        {
+            FpType virt_pos[NumVirtAxes];
+            FpType start_phys_pos[NumVirtAxes];
+            FpType end_phys_pos[NumVirtAxes];
+            
+            get_split_virt_pos(c, start_frac, virt_pos);
+            if (!TheTransformAlg::virtToPhys(c, ArraySrc{virt_pos}, ArrayDst{start_phys_pos})) {
+                return false;
+            }
+            get_split_virt_pos(c, end_frac, virt_pos);
+            if (!TheTransformAlg::virtToPhys(c, ArraySrc{virt_pos}, ArrayDst{end_phys_pos})) {
+                return false;
+            }
+            
+            FpType mid_phys_pos[NumVirtAxes];
+            for (int i = 0; i < NumVirtAxes; i++) {
+                mid_phys_pos[i] = 0.5f * (start_phys_pos[i] + end_phys_pos[i]);
+            }
+            FpType actual_virt_pos[NumVirtAxes];
+            TheTransformAlg::physToVirt(c, ArraySrc{mid_phys_pos}, ArrayDst{actual_virt_pos});
+            
+            get_split_virt_pos(c, 0.5f * (start_frac + end_frac), virt_pos);
+            FpType deviation_squared = 0.0f;
+            for (int i = 0; i < NumVirtAxes; i++) {
+                deviation_squared += FloatSquare(actual_virt_pos[i] - virt_pos[i]);
+            }
+            *out_deviation = FloatSqrt(deviation_squared);
+            return !FloatIsNan(*out_deviation);
+        }
+        
         static void handle_transform_error (Context c)
         {
             auto *o = Object::self(c);
@@ -1727,6 +1894,10 @@ public:
             }
             ListFor<LasersList>([&] APRINTER_TL(laser, laser::write_planner_cmd(c, LaserSplitSrc{c, o->frac, prev_frac}, cmd)));
             cmd->axes.rel_max_v_rec = rel_max_v_rec;
+            if (ThePlanner::JunctionDeviationSupported) {
+                write_junction_vector(c, cmd);
+                ListFor<VirtAxesList>([&] APRINTER_TL(axis, axis::add_junction_component(c, cmd, o->frac - prev_frac)));
+            }
             
             ThePlanner::axesCommandDone(c);
             submitted_planner_command(c);
@@ -1788,6 +1959,7 @@ public:
             using VirtAxisParams = TypeListGet<ParamsVirtAxesList, VirtAxisIndex>;
             static char const AxisName = VirtAxisParams::Name;
             static_assert(NameCharIsValid<AxisName, ReservedAxisNames>::Value, "Virt-axis name not allowed");
+            static int const JunctionIndex = (AxisName >= 'X' && AxisName <= 'Z') ? (AxisName - 'X') : -1;
             static int const PhysAxisIndex = FindAxis<TypeListGet<ParamsPhysAxesList, VirtAxisIndex>::Value>::Value;
             using ThePhysAxis = Axis<PhysAxisIndex>;
             static_assert(!ThePhysAxis::AxisSpec::IsCartesian, "");
@@ -1854,6 +2026,21 @@ public:
                 o->m_req_pos = o->m_old_pos + (frac * o->m_delta);
             }
             
+            static void get_split_pos (Context c, FpType frac, FpType *data)
+            {
+                auto *o = Object::self(c);
+                data[VirtAxisIndex] = o->m_old_pos + (frac * o->m_delta);
+            }
+            
+            template <typename PlannerCmd>
+            static void add_junction_component (Context c, PlannerCmd *cmd, FpType frac_span)
+            {
+                auto *o = Object::self(c);
+                if (JunctionIndex >= 0) {
+                    cmd->axes.junction_vec[MaxValue(0, JunctionIndex)] = frac_span * o->m_delta;
+                }
+            }
+            
             static FpType limit_virt_axis_speed (FpType accum, Context c)
             {
                 auto *o = Object::self(c);
@@ -2108,6 +2295,290 @@ public:
     template <char AxisName>
     using GetPhysVirtAxisByName = PhysVirtAxisHelper<FindPhysVirtAxis<AxisName>::Value>;
     
+private:
+    AMBRO_STRUCT_IF(ArcFeature, ArcParams::Enabled) {
+        friend PrinterMain;
+        
+    public:
+        struct Object;
+        
+    private:
+        static int const XIndex = FindPhysVirtAxis<'X'>::Value;
+        static int const YIndex = FindPhysVirtAxis<'Y'>::Value;
+        static uint32_t const MaxSegments = UINT32_C(100000);
+        static uint32_t const CorrectionInterval = 16;
+        
+        using CTolerance = decltype(ExprCast<FpType>(Config::e(ArcParams::Tolerance::i())));
+        using CMinSegmentTimeTicks = decltype(ExprCast<FpType>(Config::e(ArcParams::MinSegmentTime::i()) * TimeConversion()));
+        
+    public:
+        using ConfigExprs = MakeTypeList<CTolerance, CMinSegmentTimeTicks>;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->active = false;
+        }
+        
+        static void work_arc_command (Context c, TheCommand *cmd, bool clockwise)
+        {
+            auto *o = Object::self(c);
+            
+            if (!o->active) {
+                if (!start_arc(c, cmd, clockwise)) {
+                    cmd->reportError(c, AMBRO_PSTR("BadArc"));
+                    return cmd->finishCommand(c);
+                }
+                o->active = true;
+            }
+            
+            return emit_segment(c, cmd);
+        }
+        
+    private:
+        static bool start_arc (Context c, TheCommand *cmd, bool clockwise)
+        {
+            auto *o = Object::self(c);
+            auto *ob = PrinterMain::Object::self(c);
+            
+            ListFor<ArcAxisList>([&] APRINTER_TL(axis, axis::save_start(c)));
+            o->axes = 0;
+            
+            bool have_ij = false;
+            bool have_r = false;
+            FpType offset_x = 0.0f;
+            FpType offset_y = 0.0f;
+            FpType radius = 0.0f;
+            FpType time_freq_by_max_speed = ob->time_freq_by_max_speed;
+            
+            for (auto i : LoopRangeAuto(cmd->getNumParts(c))) {
+                CommandPartRef part = cmd->getPart(c, i);
+                
+                if (!ListForBreak<ArcAxisList>([&] APRINTER_TL(axis, return axis::collect_target(c, cmd, part, ob->axis_relative)))) {
+                    continue;
+                }
+                
+                char code = cmd->getPartCode(c, part);
+                if (code == 'I') {
+                    offset_x = cmd->getPartFpValue(c, part);
+                    have_ij = true;
+                }
+                else if (code == 'J') {
+                    offset_y = cmd->getPartFpValue(c, part);
+                    have_ij = true;
+                }
+                else if (code == 'R') {
+                    radius = cmd->getPartFpValue(c, part);
+                    have_r = true;
+                }
+                else if (code == 'F') {
+                    time_freq_by_max_speed = (FpType)(TimeConversion::value() / Params::SpeedLimitMultiply::value()) / FloatMakePosOrPosZero(cmd->getPartFpValue(c, part));
+                    ob->time_freq_by_max_speed = time_freq_by_max_speed;
+                }
+            }
+            
+            if (have_ij == have_r) {
+                return false;
+            }
+            
+            FpType start_x = o->start[XIndex];
+            FpType start_y = o->start[YIndex];
+            FpType delta_x = o->target[XIndex] - start_x;
+            FpType delta_y = o->target[YIndex] - start_y;
+            
+            if (have_r) {
+                // Center is on the perpendicular bisector of the chord; a negative
+                // radius selects the arc greater than a half circle.
+                FpType chord_squared = delta_x * delta_x + delta_y * delta_y;
+                if (!(chord_squared > 0.0f)) {
+                    return false;
+                }
+                FpType h_squared = 4.0f * radius * radius - chord_squared;
+                if (h_squared < -0.001f * chord_squared) {
+                    return false;
+                }
+                FpType h_by_chord = FloatSqrt(FloatMakePosOrPosZero(h_squared)) / FloatSqrt(chord_squared);
+                if (clockwise == (radius < 0.0f)) {
+                    h_by_chord = -h_by_chord;
+                }
+                offset_x = 0.5f * (delta_x + delta_y * h_by_chord);
+                offset_y = 0.5f * (delta_y - delta_x * h_by_chord);
+            }
+            
+            o->center_x = start_x + offset_x;
+            o->center_y = start_y + offset_y;
+            o->rel_x = -offset_x;
+            o->rel_y = -offset_y;
+            FpType r = FloatSqrt(offset_x * offset_x + offset_y * offset_y);
+            if (!(r > 0.0f)) {
+                return false;
+            }
+            
+            FpType start_angle = FloatAtan2(o->rel_y, o->rel_x);
+            FpType end_angle = FloatAtan2(o->target[YIndex] - o->center_y, o->target[XIndex] - o->center_x);
+            FpType sweep = end_angle - start_angle;
+            if (clockwise) {
+                if (sweep >= -(FpType)ArcEpsilon::value()) {
+                    sweep -= (FpType)TwoPi::value();
+                }
+            } else {
+                if (sweep <= (FpType)ArcEpsilon::value()) {
+                    sweep += (FpType)TwoPi::value();
+                }
+            }
+            
+            // Chord length is given by the allowed deviation from the arc, but is
+            // not made shorter than what can be traversed in the minimum segment
+            // time at the requested speed, so the planner is not flooded.
+            FpType tolerance = FloatMin(APRINTER_CFG(Config, CTolerance, c), r);
+            FpType chord = 2.0f * FloatSqrt(FloatMakePosOrPosZero(tolerance * (2.0f * r - tolerance)));
+            FpType segment_time_freq_by_max_speed = time_freq_by_max_speed * ob->speed_ratio_rec;
+            if (segment_time_freq_by_max_speed > 0.0f) {
+                chord = FloatMax(chord, APRINTER_CFG(Config, CMinSegmentTimeTicks, c) / segment_time_freq_by_max_speed);
+            }
+            FpType arc_length = FloatAbs(sweep) * r;
+            FpType num_segments = FloatMin(FloatCeil(arc_length / chord), (FpType)MaxSegments);
+            o->num_segments = (num_segments >= 1.0f) ? (uint32_t)num_segments : 1;
+            o->segment = 0;
+            
+            FpType angle_step = sweep / o->num_segments;
+            o->angle_step = angle_step;
+            o->start_angle = start_angle;
+            o->cos_step = FloatCos(angle_step);
+            o->sin_step = FloatSin(angle_step);
+            o->radius = r;
+            o->time_freq_by_max_speed = time_freq_by_max_speed;
+            
+            return true;
+        }
+        
+        static void emit_segment (Context c, TheCommand *cmd)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->active)
+            AMBRO_ASSERT(o->segment < o->num_segments)
+            
+            o->segment++;
+            
+            move_begin(c);
+            
+            if (o->segment == o->num_segments) {
+                move_add_axis<XIndex>(c, o->target[XIndex]);
+                move_add_axis<YIndex>(c, o->target[YIndex]);
+            } else {
+                if (o->segment % CorrectionInterval == 0) {
+                    FpType angle = o->start_angle + o->segment * o->angle_step;
+                    o->rel_x = o->radius * FloatCos(angle);
+                    o->rel_y = o->radius * FloatSin(angle);
+                } else {
+                    FpType rel_x = o->rel_x * o->cos_step - o->rel_y * o->sin_step;
+                    o->rel_y = o->rel_x * o->sin_step + o->rel_y * o->cos_step;
+                    o->rel_x = rel_x;
+                }
+                move_add_axis<XIndex>(c, o->center_x + o->rel_x);
+                move_add_axis<YIndex>(c, o->center_y + o->rel_y);
+            }
+            
+            bool last = (o->segment == o->num_segments);
+            FpType frac = (FpType)o->segment / o->num_segments;
+            ListFor<ArcAxisList>([&] APRINTER_TL(axis, axis::add_linear(c, last, frac)));
+            
+            move_set_max_speed_opt(c, o->time_freq_by_max_speed);
+            
+            return move_end(c, cmd, ArcFeature::move_end_callback, false);
+        }
+        
+        static void move_end_callback (Context c, bool error)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->active)
+            
+            TheCommand *cmd = get_locked(c);
+            
+            if (error || o->segment == o->num_segments) {
+                o->active = false;
+                if (error) {
+                    cmd->reportError(c, nullptr);
+                }
+                return cmd->finishCommand(c);
+            }
+            
+            // The next segment is emitted when the planner asks for more,
+            // through work_command() and back to work_arc_command().
+            if (cmd->tryPlannedCommand(c)) {
+                return emit_segment(c, cmd);
+            }
+        }
+        
+        using TwoPi = APRINTER_FP_CONST_EXPR(6.283185307179586);
+        using ArcEpsilon = APRINTER_FP_CONST_EXPR(0.000001);
+        
+        template <int PhysVirtAxisIndex>
+        struct ArcAxis {
+            using Helper = PhysVirtAxisHelper<PhysVirtAxisIndex>;
+            static bool const IsPlaneAxis = (PhysVirtAxisIndex == XIndex || PhysVirtAxisIndex == YIndex);
+            
+            static void save_start (Context c)
+            {
+                auto *o = ArcFeature::Object::self(c);
+                o->start[PhysVirtAxisIndex] = Helper::get_position(c);
+                o->target[PhysVirtAxisIndex] = o->start[PhysVirtAxisIndex];
+            }
+            
+            static bool collect_target (Context c, TheCommand *cmd, CommandPartRef part, PhysVirtAxisMaskType axis_relative)
+            {
+                auto *o = ArcFeature::Object::self(c);
+                
+                if (AMBRO_UNLIKELY(cmd->getPartCode(c, part) == Helper::AxisName)) {
+                    FpType req = cmd->getPartFpValue(c, part);
+                    if ((axis_relative & Helper::AxisMask)) {
+                        req += o->start[PhysVirtAxisIndex];
+                    }
+                    o->target[PhysVirtAxisIndex] = req;
+                    o->axes |= Helper::AxisMask;
+                    return false;
+                }
+                return true;
+            }
+            
+            static void add_linear (Context c, bool last, FpType frac)
+            {
+                auto *o = ArcFeature::Object::self(c);
+                
+                if (!IsPlaneAxis && (o->axes & Helper::AxisMask)) {
+                    FpType start = o->start[PhysVirtAxisIndex];
+                    FpType target = o->target[PhysVirtAxisIndex];
+                    move_add_axis<PhysVirtAxisIndex>(c, last ? target : (start + frac * (target - start)));
+                }
+            }
+        };
+        using ArcAxisList = IndexElemListCount<NumPhysVirtAxes, ArcAxis>;
+        
+    public:
+        struct Object : public ObjBase<ArcFeature, typename PrinterMain::Object, EmptyTypeList> {
+            bool active;
+            PhysVirtAxisMaskType axes;
+            uint32_t num_segments;
+            uint32_t segment;
+            FpType center_x;
+            FpType center_y;
+            FpType rel_x;
+            FpType rel_y;
+            FpType radius;
+            FpType start_angle;
+            FpType angle_step;
+            FpType cos_step;
+            FpType sin_step;
+            FpType time_freq_by_max_speed;
+            FpType start[NumPhysVirtAxes];
+            FpType target[NumPhysVirtAxes];
+        };
+    } AMBRO_STRUCT_ELSE(ArcFeature) {
+        static void init (Context c) {}
+        static void work_arc_command (Context c, TheCommand *cmd, bool clockwise) {}
+        struct Object {};
+    };
+    
 private:
     using MotionPlannerChannelsDict = ListCollect<ModuleClassesList, MemberType_MotionPlannerChannels>;
     
@@ -2119,6 +2590,7 @@ public:
     APRINTER_MAKE_INSTANCE(ThePlanner, (MotionPlannerArg<
         Context, typename PlannerUnionPlanner::Object, Config, MotionPlannerAxes, Params::StepperSegmentBufferSize,
         Params::LookaheadBufferSize, Params::LookaheadCommitCount, FpType, MaxStepsPerCycle,
+        JunctionDeviationEnabled, JunctionDeviation,
         PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback,
         MotionPlannerChannels, MotionPlannerLasers
     >))
@@ -2242,11 +2714,13 @@ public:
         ListFor<AxesList>([&] APRINTER_TL(axis, axis::init(c)));
         ListFor<LasersList>([&] APRINTER_TL(laser, laser::init(c)));
         TransformFeature::init(c);
+        ArcFeature::init(c);
         ob->time_freq_by_max_speed = 0.0f;
         ob->speed_ratio_rec = 1.0f;
         ob->locked = false;
         ob->active = false;
         ob->planner_state = PLANNER_NONE;
+        ob->custom_planner_defer_virt_update = false;
         TheHookExecutor::init(c);
         ListFor<ModulesList>([&] APRINTER_TL(module, module::init(c)));
         
@@ -2510,8 +2984,7 @@ private:
                             }
                         }
                         else if (!is_dwell && code == 'T') {
-                            FpType nominal_time_ticks = FloatMakePosOrPosZero(cmd->getPartFpValue(c, part) * (FpType)TimeConversion::value() * ob->speed_ratio_rec);
-                            move_set_nominal_time(c, nominal_time_ticks);
+                            move_set_nominal_duration(c, cmd->getPartFpValue(c, part));
                             seen_t = true;
                         }
                         else if (is_dwell && (code == 'P' || code == 'S')) {
@@ -2531,6 +3004,17 @@ private:
                     return move_end(c, get_locked(c), PrinterMain::normal_move_end_callback, is_rapid_move);
                 } break;
                 
+                case 2:   // clockwise arc
+                case 3: { // counter-clockwise arc
+                    if (!ArcParams::Enabled) {
+                        goto unknown_command;
+                    }
+                    if (!cmd->tryPlannedCommand(c)) {
+                        return;
+                    }
+                    return ArcFeature::work_arc_command(c, cmd, cmd_number == 2);
+                } break;
+                
                 case 28: { // home axes
                     if (!cmd->tryUnplannedCommand(c)) {
                         return;
@@ -2778,6 +3262,16 @@ private:
     }
     struct PlannerUnderrunCallback : public AMBRO_WFUNC_TD(&PrinterMain::planner_underrun_callback) {};
     
+    // The X, Y and Z motion for junction deviation cornering in the planner.
+    // Virtual axes are added by TransformFeature::do_split.
+    static void write_junction_vector (Context c, PlannerSplitBuffer *cmd)
+    {
+        for (int i = 0; i < 3; i++) {
+            cmd->axes.junction_vec[i] = 0.0f;
+        }
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::add_junction_component(c, cmd)));
+    }
+    
 public:
     static void move_begin (Context c)
     {
@@ -2829,6 +3323,15 @@ public:
         cmd->axes.rel_max_v_rec = nominal_time_ticks;
     }
     
+    // The nominal time in seconds, as given by the T parameter of G0/G1,
+    // which is subject to the speed ratio.
+    static void move_set_nominal_duration (Context c, FpType nominal_time)
+    {
+        auto *o = Object::self(c);
+        
+        move_set_nominal_time(c, FloatMakePosOrPosZero(nominal_time * (FpType)TimeConversion::value() * o->speed_ratio_rec));
+    }
+    
     static void move_set_max_speed (Context c, FpType max_speed)
     {
         auto *o = Object::self(c);
@@ -2854,7 +3357,9 @@ public:
         
         if (!ListForBreak<ModulesList>([&] APRINTER_TL(module, return module::check_move_interlocks(c, err_output, ob->move_axes)))) {
             restore_all_pos_from_old(c);
-            TransformFeature::correct_after_aborted_move(c);
+            if (!ob->custom_planner_defer_virt_update) {
+                TransformFeature::correct_after_aborted_move(c);
+            }
             ThePlanner::emptyDone(c);
             submitted_planner_command(c);
             return callback(c, true);
@@ -2867,7 +3372,9 @@ public:
         PlannerSplitBuffer *cmd = ThePlanner::getBuffer(c);
         FpType distance_squared = 0.0f;
         ListFor<AxesList>([&] APRINTER_TL(axis, axis::do_move(c, true, &distance_squared, cmd)));
-        TransformFeature::do_pending_virt_update(c);
+        if (!ob->custom_planner_defer_virt_update) {
+            TransformFeature::do_pending_virt_update(c);
+        }
         if (ob->move_seen_cartesian) {
             FpType distance = FloatSqrt(distance_squared);
             cmd->axes.rel_max_v_rec = FloatMax(cmd->axes.rel_max_v_rec, distance * ob->move_time_freq_by_max_speed);
@@ -2876,6 +3383,9 @@ public:
             ListFor<AxesList>([&] APRINTER_TL(axis, axis::limit_axis_move_speed(c, ob->move_time_freq_by_max_speed, cmd)));
         }
         ListFor<LasersList>([&] APRINTER_TL(laser, laser::write_planner_cmd(c, LaserExtraSrc{c}, cmd)));
+        if (ThePlanner::JunctionDeviationSupported) {
+            write_junction_vector(c, cmd);
+        }
         ThePlanner::axesCommandDone(c);
         submitted_planner_command(c);
         return callback(c, false);
@@ -2943,7 +3453,10 @@ public:
         ob->force_timer.unset(c);
     }
     
-    static void custom_planner_init (Context c, PlannerClient *planner_client, bool enable_prestep_callback)
+    // With defer_virt_update, moves of physical axes (e.g. pre-planned
+    // segments) do not update the virtual axes each time; that is done once
+    // in custom_planner_deinit. Virtual positions are stale in between.
+    static void custom_planner_init (Context c, PlannerClient *planner_client, bool enable_prestep_callback, bool defer_virt_update=false)
     {
         auto *ob = Object::self(c);
         AMBRO_ASSERT(ob->locked)
@@ -2954,6 +3467,7 @@ public:
         ThePlanner::init(c, enable_prestep_callback);
         ob->m_planning_pull_pending = false;
         ob->custom_planner_deinit_allowed = true;
+        ob->custom_planner_defer_virt_update = defer_virt_update;
         now_active(c);
     }
     
@@ -2966,6 +3480,8 @@ public:
         
         ThePlanner::deinit(c);
         ob->planner_state = PLANNER_NONE;
+        ob->custom_planner_defer_virt_update = false;
+        TransformFeature::do_pending_virt_update(c);
         now_inactive(c);
     }
     
@@ -3071,6 +3587,7 @@ private:
                     MakeTypeList<
                         TheSteppers,
                         TransformFeature,
+                        ArcFeature,
                         PlannerUnion
                     >
                 >,
@@ -3092,6 +3609,7 @@ public:
             TheBlinker,
             TheSteppers,
             TransformFeature,
+            ArcFeature,
             PlannerUnion,
             TheHookExecutor
         >
@@ -3105,12 +3623,15 @@ public:
         FpType speed_ratio_rec;
         FpType move_time_freq_by_max_speed;
         size_t msg_length;
+        TimeType batch_start_time;
+        uint8_t batch_commands;
         bool locked : 1;
         bool active : 1;
         uint8_t planner_state : 3;
         bool m_planning_pull_pending : 1;
         bool move_seen_cartesian : 1;
         bool custom_planner_deinit_allowed : 1;
+        bool custom_planner_defer_virt_update : 1;
         bool homing_error : 1;
         bool homing_default : 1;
         PlannerClient *planner_client;
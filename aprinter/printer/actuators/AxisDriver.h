@@ -106,6 +106,7 @@ public:
     using AMulType = decltype(AXIS_STEPPER_AMUL_EXPR_HELPER(AXIS_STEPPER_DUMMY_VARS));
     using ADiscShiftedType = decltype(AccelFixedType().template shiftBits<(-discriminant_prec)>());
     using DelayParams = typename Params::DelayParams;
+    using BurstParams = typename Params::BurstParams;
     using StepContext = typename TimerInstance::HandlerContext;
     
 private:
@@ -427,61 +428,68 @@ private:
         TimeType next_time;
         
         if (!PreloadCommands || AMBRO_LIKELY(o->m_notend)) {
-            if (AMBRO_UNLIKELY(o->m_prestep_callback_enabled)) {
-                bool res = ListForOne<CallbackHelperList<>, 0, bool>(o->m_consumer_id, [&] APRINTER_TL(helper, return helper::call_prestep_callback(c)));
-                if (AMBRO_UNLIKELY(res)) {
-    #ifdef AMBROLIB_ASSERTIONS
-                    o->m_running = false;
-    #endif
-                    return false;
+            // In burst mode, further steps which are due soon after the one this
+            // interrupt was scheduled for are emitted right away (see BurstFeature).
+            typename BurstFeature::State burst;
+            BurstFeature::begin_burst(c, &burst);
+            
+            do {
+                if (AMBRO_UNLIKELY(o->m_prestep_callback_enabled)) {
+                    bool res = ListForOne<CallbackHelperList<>, 0, bool>(o->m_consumer_id, [&] APRINTER_TL(helper, return helper::call_prestep_callback(c)));
+                    if (AMBRO_UNLIKELY(res)) {
+        #ifdef AMBROLIB_ASSERTIONS
+                        o->m_running = false;
+        #endif
+                        return false;
+                    }
                 }
-            }
             
-            DelayFeature::wait_for_dir(c);
+                DelayFeature::wait_for_dir(c);
             
-            DelayFeature::wait_for_step_low(c);
-            Stepper::stepOn(c);
-            DelayFeature::set_step_timer_for_high(c);
+                DelayFeature::wait_for_step_low(c);
+                Stepper::stepOn(c);
+                DelayFeature::set_step_timer_for_high(c);
             
-            // We need to ensure that the step signal is sufficiently long for the stepper driver
-            // to register. To this end, we do the timely calculations in between stepOn and stepOff().
-            // But to prevent the compiler from moving upwards any significant part of the calculation,
-            // we do a volatile read of the discriminant (an input to the calculation).
+                // We need to ensure that the step signal is sufficiently long for the stepper driver
+                // to register. To this end, we do the timely calculations in between stepOn and stepOff().
+                // But to prevent the compiler from moving upwards any significant part of the calculation,
+                // we do a volatile read of the discriminant (an input to the calculation).
             
-            auto discriminant_bits = volatile_read(o->m_discriminant.m_bits.m_int);
-            o->m_discriminant.m_bits.m_int = discriminant_bits + AccelShiftMode::get_a_mul_for_step(c, current_command).m_bits.m_int;
-            AMBRO_ASSERT(o->m_discriminant.bitsValue() >= 0)
+                auto discriminant_bits = volatile_read(o->m_discriminant.m_bits.m_int);
+                o->m_discriminant.m_bits.m_int = discriminant_bits + AccelShiftMode::get_a_mul_for_step(c, current_command).m_bits.m_int;
+                AMBRO_ASSERT(o->m_discriminant.bitsValue() >= 0)
             
-            auto q = (o->m_v0 + FixedSquareRoot<true>(o->m_discriminant, OptionForceInline())).template shift<-1>();
+                auto q = (o->m_v0 + FixedSquareRoot<true>(o->m_discriminant, OptionForceInline())).template shift<-1>();
             
-            auto t_frac = FixedFracDivide<rel_t_extra_prec>(o->m_pos, q, OptionForceInline());
+                auto t_frac = FixedFracDivide<rel_t_extra_prec>(o->m_pos, q, OptionForceInline());
             
-            auto t_mul = TimeMulFixedType::importBits(TMulStored::retrieve(current_command->t_mul_stored));
-            TimeFixedType t = FixedResMultiply(t_mul, t_frac);
+                auto t_mul = TimeMulFixedType::importBits(TMulStored::retrieve(current_command->t_mul_stored));
+                TimeFixedType t = FixedResMultiply(t_mul, t_frac);
             
-            // Now make sure the calculations above happen before stepOff().
-            volatile_write(o->m_dummy, (uint8_t)t.bitsValue());
+                // Now make sure the calculations above happen before stepOff().
+                volatile_write(o->m_dummy, (uint8_t)t.bitsValue());
             
-            DelayFeature::wait_for_step_high(c);
-            Stepper::stepOff(c);
-            DelayFeature::set_step_timer_for_low(c);
+                DelayFeature::wait_for_step_high(c);
+                Stepper::stepOff(c);
+                DelayFeature::set_step_timer_for_low(c);
             
-            if (AMBRO_LIKELY(!o->m_notdecel)) {
-                if (AMBRO_LIKELY(o->m_pos == o->m_x)) {
-                    o->m_time += t_mul.template bitsTo<time_bits>().bitsValue();
-                    o->m_notend = false;
-                    next_time = o->m_time;
+                if (AMBRO_LIKELY(!o->m_notdecel)) {
+                    if (AMBRO_LIKELY(o->m_pos == o->m_x)) {
+                        o->m_time += t_mul.template bitsTo<time_bits>().bitsValue();
+                        o->m_notend = false;
+                        next_time = o->m_time;
+                    } else {
+                        o->m_pos.m_bits.m_int++;
+                        next_time = (o->m_time + t.bitsValue());
+                    }
                 } else {
-                    o->m_pos.m_bits.m_int++;
-                    next_time = (o->m_time + t.bitsValue());
+                    if (o->m_pos.bitsValue() == 0) {
+                        o->m_notend = false;
+                    }
+                    o->m_pos.m_bits.m_int--;
+                    next_time = (o->m_time - t.bitsValue());
                 }
-            } else {
-                if (o->m_pos.bitsValue() == 0) {
-                    o->m_notend = false;
-                }
-                o->m_pos.m_bits.m_int--;
-                next_time = (o->m_time - t.bitsValue());
-            }
+            } while (BurstFeature::continue_burst(c, &burst, next_time));
         } else {
             DelayFeature::wait_for_step_low(c);
         }
@@ -601,6 +609,48 @@ private:
         struct Object {};
     };
     
+    AMBRO_STRUCT_IF(BurstFeature, BurstParams::Enabled) {
+        static int const MaxSteps = BurstParams::MaxSteps;
+        static TimeType const ThresholdTicks = 1e-6 * BurstParams::Threshold::value() * Clock::time_freq;
+        
+        static_assert(MaxSteps >= 2 && MaxSteps <= 255, "");
+        static_assert(ThresholdTicks > 0, "Burst threshold is too small");
+        static_assert(DelayParams::Enabled, "Burst requires DelayParams, for the step low time within a burst");
+        
+        // Steps after the first in a burst are emitted ahead of their computed
+        // time, by at most ThresholdTicks since the burst starts at the time the
+        // timer was set for. Between the steps of a burst, only the DelayFeature
+        // waits keep the step signal low for long enough.
+        struct State {
+            TimeType start_time;
+            uint8_t steps;
+        };
+        
+        AMBRO_ALWAYS_INLINE
+        static void begin_burst (StepContext c, State *s)
+        {
+            s->start_time = TimerInstance::getLastSetTime(c);
+            s->steps = 1;
+        }
+        
+        AMBRO_ALWAYS_INLINE
+        static bool continue_burst (StepContext c, State *s, TimeType next_time)
+        {
+            auto *o = Object::self(c);
+            
+            if (!o->m_notend || s->steps >= MaxSteps || (TimeType)(next_time - s->start_time) > ThresholdTicks) {
+                return false;
+            }
+            s->steps++;
+            return true;
+        }
+    }
+    AMBRO_STRUCT_ELSE(BurstFeature) {
+        struct State {};
+        AMBRO_ALWAYS_INLINE static void begin_burst (StepContext c, State *s) {}
+        AMBRO_ALWAYS_INLINE static bool continue_burst (StepContext c, State *s, TimeType next_time) { return false; }
+    };
+    
 public:
     struct Object : public ObjBase<AxisDriver, ParentObject, MakeTypeList<
         TheDebugObject,
@@ -640,11 +690,23 @@ APRINTER_ALIAS_STRUCT_EXT(AxisDriverDelayParams, (
     static bool const Enabled = true;
 ))
 
+struct AxisDriverNoBurstParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AxisDriverBurstParams, (
+    APRINTER_AS_VALUE(int, MaxSteps),
+    APRINTER_AS_TYPE(Threshold)
+), (
+    static bool const Enabled = true;
+))
+
 APRINTER_ALIAS_STRUCT_EXT(AxisDriverService, (
     APRINTER_AS_TYPE(TimerService),
     APRINTER_AS_TYPE(PrecisionParams),
     APRINTER_AS_VALUE(bool, PreloadCommands),
-    APRINTER_AS_TYPE(DelayParams)
+    APRINTER_AS_TYPE(DelayParams),
+    APRINTER_AS_TYPE(BurstParams)
 ), (
     APRINTER_ALIAS_STRUCT_EXT(Driver, (
         APRINTER_AS_TYPE(Context),
@@ -51,6 +51,7 @@
 #include <aprinter/misc/StringTools.h>
 #include <aprinter/misc/IpAddrUtils.h>
 #include <aprinter/math/FloatTools.h>
+#include <aprinter/math/FastStrToFloat.h>
 #include <aprinter/printer/Configuration.h>
 #include <aprinter/printer/utils/JsonBuilder.h>
 
@@ -143,7 +144,7 @@ private:
         
         static void set_value_str (double *value, char const *in_str)
         {
-            *value = StrToFloat<double>(in_str, nullptr);
+            *value = FastStrToFloat<double>(in_str);
         }
     };
     
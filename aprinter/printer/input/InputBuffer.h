@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_INPUT_BUFFER_H
+#define AMBROLIB_INPUT_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Assert.h>
+
+namespace APrinter {
+
+/**
+ * Ring buffer between a block input (SdRawInput, SdFatInput) and a G-code
+ * parser, as used by SdCardModule.
+ * 
+ * Reads land directly in the buffer in whole blocks, and commands are parsed
+ * in place. So that a command crossing the end of the buffer is contiguous,
+ * the buffer is followed by an area where the start of the buffer is mirrored.
+ * This is only filled when a command actually crosses the end, and only with
+ * the bytes given to the parser.
+ * 
+ * A read is started when ReadChunkBlocks blocks are free (or all blocks up to
+ * the end of the buffer). For inputs which can read multiple blocks at once,
+ * this is up to half of the buffer, so one half is read in a single request
+ * while the commands in the other half are executed.
+ */
+template <typename DataWordType, size_t BlockSize, size_t BufferBaseSize, size_t MaxCommandSize, size_t MaxReadBlocks>
+class InputBuffer {
+    static_assert(BlockSize % sizeof(DataWordType) == 0, "");
+    static_assert(BufferBaseSize % BlockSize == 0, "Buffer size must be a multiple of block size");
+    static_assert(MaxCommandSize > 0, "");
+    static_assert(BufferBaseSize >= BlockSize + (MaxCommandSize - 1), "");
+    static_assert(BufferBaseSize <= SIZE_MAX / 2, "");
+    static_assert(MaxReadBlocks > 0, "");
+    
+    static size_t const BufferBlocks = BufferBaseSize / BlockSize;
+    static size_t const WrapExtraSize = MaxCommandSize - 1;
+    static size_t const TotalSizeWords = (BufferBaseSize + WrapExtraSize + (sizeof(DataWordType) - 1)) / sizeof(DataWordType);
+    
+public:
+    // Never more than can be free while the parser waits for the rest of a
+    // command, so that waiting for free blocks cannot stall the parser.
+    static size_t const ReadChunkBlocks = MinValue(MinValue(MaxReadBlocks, MaxValue((size_t)1, BufferBlocks / 2)), (BufferBaseSize - WrapExtraSize) / BlockSize);
+    
+    void init ()
+    {
+        m_start = 0;
+        m_length = 0;
+        m_mirror_length = 0;
+    }
+    
+    size_t getLength ()
+    {
+        return m_length;
+    }
+    
+    bool haveSpaceForRead ()
+    {
+        size_t free_blocks = (BufferBaseSize - m_length) / BlockSize;
+        return free_blocks >= MinValue(ReadChunkBlocks, blocks_to_end(write_offset()));
+    }
+    
+    // The data must not be used until the read is finished, but commands
+    // can continue to be parsed and consumed.
+    DataWordType * startRead (size_t *out_num_blocks)
+    {
+        AMBRO_ASSERT(haveSpaceForRead())
+        
+        size_t offset = write_offset();
+        AMBRO_ASSERT(offset % BlockSize == 0)
+        
+        *out_num_blocks = MinValue(MinValue((BufferBaseSize - m_length) / BlockSize, blocks_to_end(offset)), MaxReadBlocks);
+        if (offset < m_mirror_length) {
+            m_mirror_length = offset;
+        }
+        return m_buffer + offset / sizeof(DataWordType);
+    }
+    
+    void readFinished (size_t num_blocks, size_t bytes_read)
+    {
+        AMBRO_ASSERT(bytes_read <= num_blocks * BlockSize)
+        AMBRO_ASSERT(bytes_read <= BufferBaseSize - m_length)
+        
+        m_length += bytes_read;
+    }
+    
+    // Returns the start of the next command and the number of bytes of it
+    // which are available, at most MaxCommandSize, all contiguous.
+    char * getCommand (size_t *out_avail)
+    {
+        size_t avail = MinValue(MaxCommandSize, m_length);
+        if (avail > BufferBaseSize - m_start) {
+            size_t wrapped = avail - (BufferBaseSize - m_start);
+            AMBRO_ASSERT(wrapped <= WrapExtraSize)
+            if (wrapped > m_mirror_length) {
+                memcpy(data() + BufferBaseSize + m_mirror_length, data() + m_mirror_length, wrapped - m_mirror_length);
+                m_mirror_length = wrapped;
+            }
+        }
+        *out_avail = avail;
+        return data() + m_start;
+    }
+    
+    void consume (size_t length)
+    {
+        AMBRO_ASSERT(length <= m_length)
+        
+        m_start = buf_add(m_start, length);
+        m_length -= length;
+    }
+    
+private:
+    static size_t buf_add (size_t start, size_t count)
+    {
+        size_t x = start + count;
+        if (x >= BufferBaseSize) {
+            x -= BufferBaseSize;
+        }
+        return x;
+    }
+    
+    static size_t blocks_to_end (size_t offset)
+    {
+        return (BufferBaseSize - offset) / BlockSize;
+    }
+    
+    size_t write_offset ()
+    {
+        return buf_add(m_start, m_length);
+    }
+    
+    char * data ()
+    {
+        return (char *)m_buffer;
+    }
+    
+    size_t m_start;
+    size_t m_length;
+    size_t m_mirror_length;
+    DataWordType m_buffer[TotalSizeWords];
+};
+
+}
+
+#endif
@@ -110,6 +110,7 @@ private:
     
 public:
     static size_t const ReadBlockSize = BlockSize;
+    static size_t const MaxReadBlocks = 1;
     using DataWordType = typename TheBlockAccess::DataWordType;
     
     static void init (Context c)
@@ -187,13 +188,14 @@ public:
         return !o->file_eof;
     }
     
-    static void startRead (Context c, DataWordType *buf)
+    static void startRead (Context c, DataWordType *buf, size_t num_blocks)
     {
         auto *o = Object::self(c);
         auto *fs_o = UnionFsPart::Object::self(c);
         TheDebugObject::access(c);
         AMBRO_ASSERT(o->file_state == FILE_STATE_RUNNING)
         AMBRO_ASSERT(!o->file_eof)
+        AMBRO_ASSERT(num_blocks == 1)
         
         fs_o->file.startReadUserBuf(c, buf);
         o->file_state = FILE_STATE_READING;
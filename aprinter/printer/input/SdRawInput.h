@@ -59,6 +59,7 @@ private:
     
 public:
     static size_t const ReadBlockSize = BlockSize;
+    static size_t const MaxReadBlocks = TheSdCard::MaxIoBlocks;
     using DataWordType = typename TheSdCard::DataWordType;
     
     static void init (Context c)
@@ -132,15 +133,18 @@ public:
         return (o->block < TheSdCard::getCapacityBlocks(c));
     }
     
-    static void startRead (Context c, DataWordType *buf)
+    static void startRead (Context c, DataWordType *buf, size_t num_blocks)
     {
         auto *o = Object::self(c);
         TheDebugObject::access(c);
         AMBRO_ASSERT(o->state == STATE_READY)
         AMBRO_ASSERT(o->block < TheSdCard::getCapacityBlocks(c))
+        AMBRO_ASSERT(num_blocks > 0)
+        AMBRO_ASSERT(num_blocks <= MaxReadBlocks)
         
-        o->desc = TransferDescriptor<DataWordType>{buf, BlockSize/sizeof(DataWordType)};
-        TheSdCard::startReadOrWrite(c, false, o->block, 1, TransferVector<DataWordType>{&o->desc, 1});
+        o->num_blocks = MinValue(num_blocks, (size_t)(TheSdCard::getCapacityBlocks(c) - o->block));
+        o->desc = TransferDescriptor<DataWordType>{buf, o->num_blocks * (BlockSize/sizeof(DataWordType))};
+        TheSdCard::startReadOrWrite(c, false, o->block, o->num_blocks, TransferVector<DataWordType>{&o->desc, 1});
         o->state = STATE_READING;
     }
     
@@ -242,8 +246,8 @@ private:
         o->state = STATE_READY;
         size_t bytes = 0;
         if (!error) {
-            bytes = BlockSize;
-            o->block++;
+            bytes = o->num_blocks * BlockSize;
+            o->block += o->num_blocks;
         }
         return ClientParams::ReadHandler::call(c, error, bytes);
     }
@@ -266,6 +270,7 @@ public:
     >> {
         uint8_t state;
         uint32_t block;
+        size_t num_blocks;
         TransferDescriptor<DataWordType> desc;
     };
 };
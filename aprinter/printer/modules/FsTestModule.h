@@ -51,6 +51,7 @@ private:
     using TheDebugObject = DebugObject<Context, Object>;
     using TheFsAccess = typename ThePrinterMain::template GetFsAccess<>;
     using TheBufferedFile = BufferedFile<Context, TheFsAccess>;
+    using TheFs = typename TheFsAccess::TheFileSystem;
     
     enum class State : uint8_t {IDLE, WRITE_OPEN, WRITE_DATA, WRITE_EOF, READ_OPEN, READ_DATA};
     
@@ -102,6 +103,22 @@ private:
         cmd->finishCommand(c);
     }
     
+    static void report_io_stats (Context c)
+    {
+        auto *cmd = ThePrinterMain::get_locked(c);
+        auto stats = TheFs::getCacheIoStats(c);
+        
+        cmd->reply_append_pstr(c, AMBRO_PSTR("//CacheIo Reads="));
+        cmd->reply_append_uint32(c, stats.read_ios);
+        cmd->reply_append_pstr(c, AMBRO_PSTR(" ReadBlocks="));
+        cmd->reply_append_uint32(c, stats.read_blocks);
+        cmd->reply_append_pstr(c, AMBRO_PSTR(" Writes="));
+        cmd->reply_append_uint32(c, stats.write_ios);
+        cmd->reply_append_pstr(c, AMBRO_PSTR(" WriteBlocks="));
+        cmd->reply_append_uint32(c, stats.write_blocks);
+        cmd->reply_append_ch(c, '\n');
+    }
+    
     static void handle_read_write_command (Context c, typename ThePrinterMain::TheCommand *cmd, bool is_write)
     {
         auto *o = Object::self(c);
@@ -126,7 +143,8 @@ private:
         }
         
         auto mode = is_write ? TheBufferedFile::OpenMode::OPEN_WRITE : TheBufferedFile::OpenMode::OPEN_READ;
-        o->buffered_file.startOpen(c, open_file_name, true, mode);
+        uint32_t preallocate_size = (is_write && cmd->find_command_param(c, 'P', nullptr)) ? o->write_size : 0;
+        o->buffered_file.startOpen(c, open_file_name, true, mode, nullptr, preallocate_size);
         o->state = is_write ? State::WRITE_OPEN : State::READ_OPEN;
     }
     
@@ -141,6 +159,7 @@ private:
                 if (error != TheBufferedFile::Error::NO_ERROR) {
                     return complete_command(c, AMBRO_PSTR("Open"));
                 }
+                TheFs::resetCacheIoStats(c);
                 if (o->state == State::WRITE_OPEN) {
                     work_write(c);
                 } else {
@@ -159,6 +178,7 @@ private:
                 if (error != TheBufferedFile::Error::NO_ERROR) {
                     return complete_command(c, AMBRO_PSTR("WriteEof"));
                 }
+                report_io_stats(c);
                 return complete_command(c, nullptr);
             } break;
             
@@ -167,6 +187,7 @@ private:
                     return complete_command(c, AMBRO_PSTR("ReadData"));
                 }
                 if (read_length == 0) {
+                    report_io_stats(c);
                     return complete_command(c, nullptr);
                 }
                 work_read(c);
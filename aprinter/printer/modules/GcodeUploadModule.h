@@ -110,8 +110,11 @@ private:
             return cmd->finishCommand(c);
         }
         
+        // The expected upload size may be given to preallocate the file.
+        uint32_t preallocate_size = cmd->get_command_param_uint32(c, 'S', 0);
+        
         o->state = State::OPENING;
-        o->file.startOpen(c, filename, true, TheBufferedFile::OpenMode::OPEN_WRITE);
+        o->file.startOpen(c, filename, true, TheBufferedFile::OpenMode::OPEN_WRITE, nullptr, preallocate_size);
     }
     
     static void handle_stop_command (Context c, TheCommand *cmd)
@@ -229,6 +232,7 @@ private:
         o->state = State::CLOSING;
         o->closing_for_command = for_command;
         
+        // After a write error the file has already been truncated and released.
         if (!o->file.isReady(c)) {
             return complete_close(c, AMBRO_PSTR("FileNotReady"));
         }
@@ -36,12 +36,16 @@
 #include <aprinter/meta/TypeList.h>
 #include <aprinter/meta/TypeListUtils.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/ListForEach.h>
+#include <aprinter/meta/StructIf.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/Callback.h>
 #include <aprinter/base/ProgramMemory.h>
 #include <aprinter/base/Assert.h>
+#include <aprinter/base/BinaryTools.h>
 #include <aprinter/printer/Configuration.h>
 #include <aprinter/printer/input/InputCommon.h>
+#include <aprinter/printer/input/InputBuffer.h>
 #include <aprinter/printer/ServiceList.h>
 #include <aprinter/printer/utils/GcodeCommand.h>
 #include <aprinter/printer/utils/ModuleUtils.h>
@@ -59,6 +63,7 @@ public:
 private:
     using TimeType = typename Context::Clock::TimeType;
     using TheCommand = typename ThePrinterMain::TheCommand;
+    using FpType = typename ThePrinterMain::FpType;
     
     struct InputReadHandler;
     struct InputClearBufferHandler;
@@ -69,21 +74,14 @@ private:
     
     static const size_t BufferBaseSize = Params::BufferBaseSize;
     static_assert(BufferBaseSize % sizeof(DataWordType) == 0, "Buffer size must be a multiple of data word size");
-    static const size_t BufferBaseSizeWords = BufferBaseSize / sizeof(DataWordType);
     
     static const size_t BlockSize = TheInput::ReadBlockSize;
-    static_assert(BlockSize % sizeof(DataWordType) == 0, "");
-    static_assert(BufferBaseSize % BlockSize == 0, "Buffer size must be a multiple of block size");
-    
     static const size_t MaxCommandSize = Params::MaxCommandSize;
-    static_assert(MaxCommandSize > 0, "");
-    static_assert(BufferBaseSize >= BlockSize + (MaxCommandSize - 1), "");
     
-    static const size_t WrapExtraSize = MaxCommandSize - 1;
-    static const size_t WrapExtraSizeWords = (WrapExtraSize + (sizeof(DataWordType) - 1)) / sizeof(DataWordType);
+    using TheInputBuffer = InputBuffer<DataWordType, BlockSize, BufferBaseSize, MaxCommandSize, TheInput::MaxReadBlocks>;
     
     using ParserSizeType = ChooseIntForMax<MaxCommandSize, false>;
-    using TheGcodeParser = typename Params::TheGcodeParserService::template Parser<Context, ParserSizeType, typename ThePrinterMain::FpType>;
+    using TheGcodeParser = typename Params::TheGcodeParserService::template Parser<Context, ParserSizeType, FpType>;
     
     static TimeType const BaseRetryTimeTicks = 0.5 * Context::Clock::time_freq;
     static int const ReadRetryCount = 5;
@@ -103,6 +101,7 @@ public:
         o->m_state = SDCARD_PAUSED;
         o->m_echo_pending = true;
         o->m_poke_pending = false;
+        o->m_cmd_consumed = false;
         init_buffering(c);
     }
     
@@ -120,9 +119,10 @@ public:
     {
         auto *o = Object::self(c);
         
-        // Cannot issue SD-card commands from the SD-card.
+        // Cannot issue SD-card commands from the SD-card. Segment blocks
+        // on the other hand can only come from the SD-card.
         if (cmd == &o->command_stream) {
-            return true;
+            return SegmentFeature::check_command(c, cmd);
         }
         
         switch (cmd->getCmdNumber(c)) {
@@ -154,7 +154,6 @@ private:
         {
             auto *o = Object::self(c);
             AMBRO_ASSERT(o->m_state == SDCARD_RUNNING)
-            buf_sanity(c);
             AMBRO_ASSERT(!o->m_eof)
             
             if (o->m_poke_pending) {
@@ -173,17 +172,16 @@ private:
             }
             
             AMBRO_ASSERT(!o->gcode_parser.haveCommand(c))
-            AMBRO_ASSERT(o->gcode_parser.getLength(c) <= o->m_length)
             
-            size_t cmd_len = o->gcode_parser.getLength(c);
-            o->m_start = buf_add(o->m_start, cmd_len);
-            o->m_length -= cmd_len;
+            if (o->m_cmd_consumed) {
+                o->m_cmd_consumed = false;
+            } else {
+                o->input_buffer.consume(o->gcode_parser.getLength(c));
+            }
             
             o->m_next_event.prependNowNotAlready(c);
             
-            if (!o->m_reading && can_read(c) && o->m_retry_counter == 0) {
-                start_read(c);
-            }
+            maybe_start_read(c);
         }
         
         void reply_poke_impl (Context c, bool push)
@@ -371,23 +369,14 @@ private:
     {
         auto *o = Object::self(c);
         AMBRO_ASSERT(o->m_state == SDCARD_RUNNING || o->m_state == SDCARD_PAUSING)
-        buf_sanity(c);
         AMBRO_ASSERT(o->m_reading)
-        AMBRO_ASSERT(bytes_read <= BufferBaseSize - o->m_length)
         AMBRO_ASSERT(!o->m_retry_timer.isSet(c))
         AMBRO_ASSERT(o->m_retry_counter <= ReadRetryCount)
         
         o->m_reading = false;
         
         if (!error) {
-            size_t write_offset = buf_add(o->m_start, o->m_length);
-            if (write_offset < WrapExtraSize) {
-                memcpy((char *)o->m_buffer + BufferBaseSize + write_offset, (char *)o->m_buffer + write_offset, MinValue(bytes_read, WrapExtraSize - write_offset));
-            }
-            if (bytes_read > BufferBaseSize - write_offset) {
-                memcpy((char *)o->m_buffer + BufferBaseSize, (char *)o->m_buffer, MinValue(bytes_read - (BufferBaseSize - write_offset), WrapExtraSize));
-            }
-            o->m_length += bytes_read;
+            o->input_buffer.readFinished(o->m_read_blocks, bytes_read);
         }
         
         if (o->m_state == SDCARD_PAUSING) {
@@ -416,6 +405,8 @@ private:
         if (!o->command_stream.hasCommand(c) && !o->m_eof && !o->m_next_event.isSet(c)) {
             o->m_next_event.prependNowNotAlready(c);
         }
+        
+        SegmentFeature::read_finished(c);
     }
     struct InputReadHandler : public AMBRO_WFUNC_TD(&SdCardModule::input_read_handler) {};
     
@@ -440,12 +431,12 @@ private:
     {
         auto *o = Object::self(c);
         AMBRO_ASSERT(o->m_state == SDCARD_RUNNING)
-        buf_sanity(c);
         AMBRO_ASSERT(!o->command_stream.hasCommand(c))
         AMBRO_ASSERT(!o->m_eof)
         
         AMBRO_PGM_P eof_str;
-        ParserSizeType avail;
+        char *cmd_data;
+        size_t avail;
         bool line_buffer_exhausted;
         
         if (o->command_stream.haveError(c)) {
@@ -453,11 +444,13 @@ private:
             goto eof;
         }
         
+        // This also makes the part of the command past the end of the
+        // buffer contiguous, which can grow as more data arrives.
+        cmd_data = o->input_buffer.getCommand(&avail);
         if (!o->gcode_parser.haveCommand(c)) {
-            o->gcode_parser.startCommand(c, (char *)o->m_buffer + o->m_start, 0);
+            o->gcode_parser.startCommand(c, cmd_data, 0);
         }
         
-        avail = MinValue(MaxCommandSize, o->m_length);
         line_buffer_exhausted = (avail == MaxCommandSize);
         
         if (o->gcode_parser.extendCommand(c, avail, line_buffer_exhausted)) {
@@ -506,8 +499,7 @@ private:
         auto *o = Object::self(c);
         
         o->gcode_parser.init(c);
-        o->m_start = 0;
-        o->m_length = 0;
+        o->input_buffer.init();
     }
     
     static void deinit_buffering (Context c)
@@ -519,17 +511,7 @@ private:
     static bool can_read (Context c)
     {
         auto *o = Object::self(c);
-        return (BufferBaseSize - o->m_length >= BlockSize && TheInput::canRead(c));
-    }
-    
-    static size_t buf_add (size_t start, size_t count)
-    {
-        static_assert(BufferBaseSize <= SIZE_MAX / 2, "");
-        size_t x = start + count;
-        if (x >= BufferBaseSize) {
-            x -= BufferBaseSize;
-        }
-        return x;
+        return (o->input_buffer.haveSpaceForRead() && TheInput::canRead(c));
     }
     
     static void start_read (Context c)
@@ -539,16 +521,19 @@ private:
         AMBRO_ASSERT(can_read(c))
         
         o->m_reading = true;
-        size_t write_offset = buf_add(o->m_start, o->m_length);
-        AMBRO_ASSERT(write_offset % BlockSize == 0)
-        TheInput::startRead(c, o->m_buffer + write_offset / sizeof(DataWordType));
+        size_t num_blocks;
+        DataWordType *buf = o->input_buffer.startRead(&num_blocks);
+        o->m_read_blocks = num_blocks;
+        TheInput::startRead(c, buf, num_blocks);
     }
     
-    static void buf_sanity (Context c)
+    static void maybe_start_read (Context c)
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(o->m_start < BufferBaseSize)
-        AMBRO_ASSERT(o->m_length <= BufferBaseSize)
+        
+        if (!o->m_reading && can_read(c) && o->m_retry_counter == 0) {
+            start_read(c);
+        }
     }
     
     static void complete_pause (Context c)
@@ -562,9 +547,231 @@ private:
         o->m_state = SDCARD_PAUSED;
     }
     
+    /*
+     * Segment blocks, for files preprocessed on the host (aprinter_preplan.py).
+     * 
+     * The command "M950 I<channels> S<count>" is followed in the file by count
+     * binary records, which are executed as moves without going through the
+     * G-code parser, the transform or the splitter. The channels are the names
+     * of physical axes and lasers. A record is a little-endian 32-bit float
+     * with the nominal time of the move in seconds (like the T parameter of
+     * G0/G1), then one such float per channel with the absolute position of
+     * the axis or the energy of the laser.
+     * 
+     * The block is executed using a custom planner, so motion stops before
+     * and after it, and the command holds the lock until the end of the block
+     * (also delaying M25).
+     */
+    AMBRO_STRUCT_IF(SegmentFeature, Params::SegmentBlocksEnabled) {
+        friend SdCardModule;
+        
+    public:
+        struct Object;
+        
+    private:
+        static int const NumAxes = ThePrinterMain::NumAxes;
+        static int const MaxChannels = NumAxes + ThePrinterMain::NumLasers;
+        static size_t const ValueSize = 4;
+        static_assert((1 + MaxChannels) * ValueSize <= MaxCommandSize, "MaxCommandSize too small for segment records");
+        
+        template <int AxisIndex>
+        struct AxisChannel {
+            static char const Name = ThePrinterMain::template PhysVirtAxisHelper<AxisIndex>::AxisName;
+            
+            static void add_value (Context c, FpType value)
+            {
+                ThePrinterMain::template move_add_axis<AxisIndex>(c, value);
+            }
+        };
+        using AxisChannelList = IndexElemListCount<NumAxes, AxisChannel>;
+        
+        template <int LaserIndex>
+        struct LaserChannel {
+            static char const Name = ThePrinterMain::template GetLaserName<LaserIndex>::Value;
+            
+            static void add_value (Context c, FpType value)
+            {
+                ThePrinterMain::template move_add_laser<LaserIndex>(c, value);
+            }
+        };
+        using LaserChannelList = IndexElemListCount<ThePrinterMain::NumLasers, LaserChannel>;
+        
+        static bool check_command (Context c, TheCommand *cmd)
+        {
+            if (cmd->getCmdNumber(c) == 950) {
+                handle_segments_command(c, cmd);
+                return false;
+            }
+            return true;
+        }
+        
+        static int find_channel (char name)
+        {
+            int index = 0;
+            if (!ListForBreak<AxisChannelList>([&] APRINTER_TL(channel, if (channel::Name == name) { return false; } index++; return true)) ||
+                !ListForBreak<LaserChannelList>([&] APRINTER_TL(channel, if (channel::Name == name) { return false; } index++; return true))
+            ) {
+                return index;
+            }
+            return -1;
+        }
+        
+        static void handle_segments_command (Context c, TheCommand *cmd)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SdCardModule::Object::self(c);
+            
+            if (!cmd->tryUnplannedCommand(c)) {
+                return;
+            }
+            
+            o->num_channels = 0;
+            for (char const *name = cmd->get_command_param_str(c, 'I', ""); *name != '\0'; name++) {
+                int channel = find_channel(*name);
+                if (channel < 0 || o->num_channels == MaxChannels) {
+                    goto bad_channels;
+                }
+                for (int i = 0; i < o->num_channels; i++) {
+                    if (o->channels[i] == channel) {
+                        goto bad_channels;
+                    }
+                }
+                o->channels[o->num_channels++] = channel;
+            }
+            o->record_size = (1 + o->num_channels) * ValueSize;
+            o->records_left = cmd->get_command_param_uint32(c, 'S', 0);
+            o->waiting = false;
+            o->move_error = false;
+            o->data_error = false;
+            
+            // The records start right after the command.
+            mo->input_buffer.consume(mo->gcode_parser.getLength(c));
+            mo->m_cmd_consumed = true;
+            maybe_start_read(c);
+            
+            ThePrinterMain::custom_planner_init(c, &o->planner_client, false, true);
+            return;
+            
+        bad_channels:
+            cmd->reportError(c, AMBRO_PSTR("BadSegmentChannels"));
+            cmd->finishCommand(c);
+        }
+        
+        static FpType read_value (char const *data)
+        {
+            uint32_t bits = ReadBinaryInt<uint32_t, BinaryLittleEndian>(data);
+            float value;
+            static_assert(sizeof(value) == sizeof(bits), "");
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        
+        static void submit_segment (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SdCardModule::Object::self(c);
+            AMBRO_ASSERT(!o->waiting)
+            
+            if (o->records_left == 0 || o->move_error || o->data_error) {
+                return ThePrinterMain::custom_planner_wait_finished(c);
+            }
+            
+            size_t avail;
+            char const *data = mo->input_buffer.getCommand(&avail);
+            if (avail < o->record_size) {
+                if (!mo->m_reading && (TheInput::eofReached(c) || mo->m_retry_counter > ReadRetryCount)) {
+                    o->data_error = true;
+                    return ThePrinterMain::custom_planner_wait_finished(c);
+                }
+                // Continued from input_read_handler.
+                o->waiting = true;
+                return;
+            }
+            
+            ThePrinterMain::move_begin(c);
+            ThePrinterMain::move_set_nominal_duration(c, read_value(data));
+            for (int i = 0; i < o->num_channels; i++) {
+                FpType value = read_value(data + (1 + i) * ValueSize);
+                int channel = o->channels[i];
+                if (channel < NumAxes) {
+                    ListForOne<AxisChannelList, 0>(channel, [&] APRINTER_TL(ch, ch::add_value(c, value)));
+                } else {
+                    ListForOne<LaserChannelList, NumAxes>(channel, [&] APRINTER_TL(ch, ch::add_value(c, value)));
+                }
+            }
+            
+            mo->input_buffer.consume(o->record_size);
+            o->records_left--;
+            maybe_start_read(c);
+            
+            ThePrinterMain::move_end(c, &mo->command_stream, SegmentFeature::move_end_callback, true);
+        }
+        
+        static void move_end_callback (Context c, bool error)
+        {
+            auto *o = Object::self(c);
+            
+            if (error) {
+                o->move_error = true;
+            }
+        }
+        
+        static void read_finished (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->waiting) {
+                o->waiting = false;
+                submit_segment(c);
+            }
+        }
+        
+        class SegmentPlannerClient : public ThePrinterMain::PlannerClient {
+        private:
+            void pull_handler (Context c)
+            {
+                submit_segment(c);
+            }
+            
+            void finished_handler (Context c, bool aborted)
+            {
+                auto *o = Object::self(c);
+                auto *mo = SdCardModule::Object::self(c);
+                AMBRO_ASSERT(!o->waiting)
+                
+                ThePrinterMain::custom_planner_deinit(c);
+                TheCommand *cmd = &mo->command_stream;
+                if (o->data_error) {
+                    cmd->reportError(c, AMBRO_PSTR("SegmentsTruncated"));
+                } else if (o->move_error || aborted) {
+                    cmd->reportError(c, nullptr);
+                }
+                cmd->finishCommand(c);
+            }
+        };
+        
+    public:
+        struct Object : public ObjBase<SegmentFeature, typename SdCardModule::Object, EmptyTypeList> {
+            SegmentPlannerClient planner_client;
+            uint32_t records_left;
+            uint8_t record_size;
+            uint8_t num_channels;
+            uint8_t channels[MaxChannels];
+            bool waiting : 1;
+            bool move_error : 1;
+            bool data_error : 1;
+        };
+    }
+    AMBRO_STRUCT_ELSE(SegmentFeature) {
+        static bool check_command (Context c, TheCommand *cmd) { return true; }
+        static void read_finished (Context c) {}
+        struct Object {};
+    };
+    
 public:
     struct Object : public ObjBase<SdCardModule, ParentObject, MakeTypeList<
-        TheInput
+        TheInput,
+        SegmentFeature
     >> {
         TheGcodeParser gcode_parser;
         typename ThePrinterMain::CommandStream command_stream;
@@ -578,10 +785,10 @@ public:
         uint8_t m_pausing_on_command : 1;
         uint8_t m_echo_pending : 1;
         uint8_t m_poke_pending : 1;
+        uint8_t m_cmd_consumed : 1;
         uint8_t m_retry_counter;
-        size_t m_start;
-        size_t m_length;
-        DataWordType m_buffer[BufferBaseSizeWords + WrapExtraSizeWords];
+        size_t m_read_blocks;
+        TheInputBuffer input_buffer;
     };
 };
 
@@ -589,7 +796,8 @@ APRINTER_ALIAS_STRUCT_EXT(SdCardModuleService, (
     APRINTER_AS_TYPE(InputService),
     APRINTER_AS_TYPE(TheGcodeParserService),
     APRINTER_AS_VALUE(size_t, BufferBaseSize),
-    APRINTER_AS_VALUE(size_t, MaxCommandSize)
+    APRINTER_AS_VALUE(size_t, MaxCommandSize),
+    APRINTER_AS_VALUE(bool, SegmentBlocksEnabled)
 ), (
     APRINTER_MODULE_TEMPLATE(SdCardModuleService, SdCardModule)
     
@@ -32,6 +32,7 @@
 #include <aprinter/meta/WrapFunction.h>
 #include <aprinter/meta/TypeListUtils.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/StructIf.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/ProgramMemory.h>
 #include <aprinter/base/Assert.h>
@@ -67,6 +68,7 @@ public:
         o->command_stream.init(c, &o->callback, &o->callback);
         o->m_recv_next_error = 0;
         o->m_line_number = 1;
+        WindowFeature::init(c);
     }
     
     static void deinit (Context c)
@@ -110,6 +112,9 @@ private:
             if (is_m110) {
                 return false;
             }
+            if (WindowFeature::check_command(c)) {
+                return false;
+            }
             return true;
         }
         
@@ -118,6 +123,7 @@ private:
             auto *o = Object::self(c);
             AMBRO_ASSERT(o->command_stream.hasCommand(c))
             
+            WindowFeature::command_finished(c, o->gcode_parser.getCmd(c)->have_line_number);
             TheSerial::recvConsume(c, RecvSizeType::import(o->gcode_parser.getLength(c)));
             TheSerial::recvForceEvent(c);
         }
@@ -187,6 +193,17 @@ private:
         if (o->command_stream.hasCommand(c)) {
             return;
         }
+        o->command_stream.beginBatch(c);
+        while (recv_command(c) && o->command_stream.continueBatch(c)) {
+            // The command finished right away, go on with the next one.
+        }
+    }
+    struct SerialRecvHandler : public AMBRO_WFUNC_TD(&SerialModule::serial_recv_handler) {};
+    
+    static bool recv_command (Context c)
+    {
+        auto *o = Object::self(c);
+        
         if (!o->gcode_parser.haveCommand(c)) {
             o->gcode_parser.startCommand(c, TheSerial::recvGetChunkPtr(c), o->m_recv_next_error);
             o->m_recv_next_error = 0;
@@ -194,7 +211,14 @@ private:
         bool overrun;
         RecvSizeType avail = TheSerial::recvQuery(c, &overrun);
         if (o->gcode_parser.extendCommand(c, avail.value())) {
-            return o->command_stream.startCommand(c, &o->gcode_parser);
+            if (!WindowFeature::accept_command(c)) {
+                TheSerial::recvConsume(c, RecvSizeType::import(o->gcode_parser.getLength(c)));
+                TheSerial::recvForceEvent(c);
+                return true;
+            }
+            WindowFeature::command_starting(c);
+            o->command_stream.startCommand(c, &o->gcode_parser);
+            return true;
         }
         if (overrun) {
             TheSerial::recvConsume(c, avail);
@@ -202,19 +226,248 @@ private:
             o->gcode_parser.resetCommand(c);
             o->m_recv_next_error = GCODE_ERROR_RECV_OVERRUN;
         }
+        WindowFeature::flush_replies(c);
+        return false;
     }
-    struct SerialRecvHandler : public AMBRO_WFUNC_TD(&SerialModule::serial_recv_handler) {};
     
     static void serial_send_handler (Context c)
     {
         auto *o = Object::self(c);
+        
+        if (WindowFeature::send_event(c)) {
+            return;
+        }
         o->command_stream.reportSendBufEventDirectly(c);
     }
     struct SerialSendHandler : public AMBRO_WFUNC_TD(&SerialModule::serial_send_handler) {};
     
+    /*
+     * Windowed streaming, enabled with "M940 W<window>" (W0 disables it).
+     * 
+     * The host may send up to the given number of numbered lines without
+     * waiting for replies, as long as they fit into the receive buffer (the
+     * reply to M940 is "W:<window> B:<receive buffer size>"). Instead of an
+     * "ok" for each line, the firmware sends cumulative acknowledgements
+     * "ok N<n>", meaning that all lines up to n have been executed. These are
+     * sent after every half window of lines and whenever no further command
+     * has been received. Unnumbered commands get a plain "ok" as usual.
+     * 
+     * When a line fails its checksum, is lost (a line number is skipped) or
+     * the receive buffer overflows, "Resend: <n>" is sent, and all lines are
+     * ignored until line n arrives, so the host can simply send everything
+     * again from line n. Lines which were already executed are ignored.
+     */
+    AMBRO_STRUCT_IF(WindowFeature, Params::StreamingWindowEnabled) {
+        friend SerialModule;
+        
+    public:
+        struct Object;
+        
+    private:
+        static uint8_t const MaxWindow = 255;
+        static size_t const MaxRepliesLength = 40;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->window = 0;
+            o->unacked = 0;
+            o->ok_pending = false;
+            o->resend_reply_pending = false;
+            o->resending = false;
+            o->waiting_buf = false;
+        }
+        
+        static bool check_command (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SerialModule::Object::self(c);
+            
+            if (!(mo->gcode_parser.getCmdCode(c) == 'M' && mo->gcode_parser.getCmdNumber(c) == 940)) {
+                return false;
+            }
+            
+            // Acknowledge the lines before the M940 in the old mode,
+            // the M940 itself is acknowledged in the new mode.
+            uint32_t window = mo->command_stream.get_command_param_uint32(c, 'W', 0);
+            flush_replies(c);
+            o->window = (window > MaxWindow) ? MaxWindow : window;
+            o->resending = false;
+            mo->command_stream.setAutoOkAndPoke(c, o->window == 0);
+            
+            mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("W:"));
+            mo->command_stream.reply_append_uint32(c, o->window);
+            mo->command_stream.reply_append_pstr(c, AMBRO_PSTR(" B:"));
+            mo->command_stream.reply_append_uint32(c, RecvSizeType::maxIntValue());
+            mo->command_stream.reply_append_ch(c, '\n');
+            return true;
+        }
+        
+        static bool accept_command (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SerialModule::Object::self(c);
+            
+            if (o->window == 0) {
+                return true;
+            }
+            
+            auto *cmd = mo->gcode_parser.getCmd(c);
+            auto num_parts = mo->gcode_parser.getNumParts(c);
+            
+            // M110 sets the line number, let it through anytime.
+            if (num_parts >= 0 && mo->gcode_parser.getCmdCode(c) == 'M' && mo->gcode_parser.getCmdNumber(c) == 110) {
+                o->resending = false;
+                return true;
+            }
+            
+            bool corrupted = (num_parts == GCODE_ERROR_CHECKSUM || num_parts == GCODE_ERROR_RECV_OVERRUN);
+            
+            if (!cmd->have_line_number) {
+                if (corrupted) {
+                    request_resend(c);
+                    return false;
+                }
+                return !o->resending;
+            }
+            
+            int32_t diff = (int32_t)(cmd->line_number - mo->m_line_number);
+            if (diff < 0) {
+                // Already executed, make sure the host learns that.
+                o->unacked++;
+                return false;
+            }
+            if (diff > 0 || corrupted) {
+                if (!o->resending || diff == 0) {
+                    request_resend(c);
+                }
+                return false;
+            }
+            
+            o->resending = false;
+            if (num_parts < 0) {
+                // Any other error is reported without calling start_command_impl,
+                // so count the line here.
+                mo->m_line_number++;
+            }
+            return true;
+        }
+        
+        static void request_resend (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            o->resending = true;
+            o->resend_reply_pending = true;
+            flush_replies(c);
+        }
+        
+        static void command_starting (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            // The command stream needs the send event for itself. Any pending
+            // replies are sent after the command.
+            if (o->waiting_buf) {
+                TheSerial::sendRequestEvent(c, SendSizeType::import(0));
+                o->waiting_buf = false;
+            }
+        }
+        
+        static void command_finished (Context c, bool numbered)
+        {
+            auto *o = Object::self(c);
+            
+            if (o->window == 0) {
+                return;
+            }
+            if (numbered) {
+                o->unacked++;
+                if (o->unacked < (o->window + 1) / 2) {
+                    return;
+                }
+            } else {
+                o->ok_pending = true;
+            }
+            flush_replies(c);
+        }
+        
+        static void flush_replies (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SerialModule::Object::self(c);
+            
+            if (o->unacked == 0 && !o->ok_pending && !o->resend_reply_pending) {
+                return;
+            }
+            
+            if (TheSerial::sendQuery(c).value() < MaxRepliesLength) {
+                // Retry when there is space, unless a command will do it.
+                if (!mo->command_stream.hasCommand(c) && !o->waiting_buf) {
+                    TheSerial::sendRequestEvent(c, SendSizeType::import(MaxRepliesLength));
+                    o->waiting_buf = true;
+                }
+                return;
+            }
+            
+            uint32_t last_line = mo->m_line_number - 1;
+            if (o->unacked > 0) {
+                mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("ok N"));
+                mo->command_stream.reply_append_uint32(c, last_line);
+                mo->command_stream.reply_append_ch(c, '\n');
+            }
+            if (o->ok_pending) {
+                mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("ok\n"));
+            }
+            if (o->resend_reply_pending) {
+                mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("Resend: "));
+                mo->command_stream.reply_append_uint32(c, last_line + 1);
+                mo->command_stream.reply_append_ch(c, '\n');
+            }
+            TheSerial::sendPoke(c);
+            
+            o->unacked = 0;
+            o->ok_pending = false;
+            o->resend_reply_pending = false;
+        }
+        
+        static bool send_event (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (!o->waiting_buf) {
+                return false;
+            }
+            o->waiting_buf = false;
+            flush_replies(c);
+            return true;
+        }
+        
+    public:
+        struct Object : public ObjBase<WindowFeature, typename SerialModule::Object, EmptyTypeList> {
+            uint8_t window;
+            uint8_t unacked;
+            bool ok_pending : 1;
+            bool resend_reply_pending : 1;
+            bool resending : 1;
+            bool waiting_buf : 1;
+        };
+    }
+    AMBRO_STRUCT_ELSE(WindowFeature) {
+        static void init (Context c) {}
+        static bool check_command (Context c) { return false; }
+        static bool accept_command (Context c) { return true; }
+        static void command_starting (Context c) {}
+        static void command_finished (Context c, bool numbered) {}
+        static void flush_replies (Context c) {}
+        static bool send_event (Context c) { return false; }
+        struct Object {};
+    };
+    
 public:
     struct Object : public ObjBase<SerialModule, ParentObject, MakeTypeList<
-        TheSerial
+        TheSerial,
+        WindowFeature
     >> {
         TheGcodeParser gcode_parser;
         typename ThePrinterMain::CommandStream command_stream;
@@ -229,7 +482,8 @@ APRINTER_ALIAS_STRUCT_EXT(SerialModuleService, (
     APRINTER_AS_VALUE(int, RecvBufferSizeExp),
     APRINTER_AS_VALUE(int, SendBufferSizeExp),
     APRINTER_AS_TYPE(TheGcodeParserService),
-    APRINTER_AS_TYPE(SerialService)
+    APRINTER_AS_TYPE(SerialService),
+    APRINTER_AS_VALUE(bool, StreamingWindowEnabled)
 ), (
     APRINTER_MODULE_TEMPLATE(SerialModuleService, SerialModule)
 ))
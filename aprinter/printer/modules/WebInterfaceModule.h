@@ -216,6 +216,12 @@ private:
         AIpStack::MemRef path = request->getPath(c);
         UserClientState *state = request->getUserState(c);
         
+        // An upload aborted on this client is still being truncated.
+        if (state->isAbortingUpload(c)) {
+            request->setResponseStatus(c, HttpStatusCodes::ServiceUnavailable());
+            goto error;
+        }
+        
         if (!strcmp(method, "GET")) {
             if (request->hasRequestBody(c)) {
                 goto bad_request;
@@ -320,7 +326,7 @@ private:
         enum class State : uint8_t {
             NO_CLIENT,
             READ_OPEN, READ_WAIT, READ_READ,
-            WRITE_OPEN, WRITE_WAIT, WRITE_WRITE, WRITE_EOF,
+            WRITE_OPEN, WRITE_WAIT, WRITE_WRITE, WRITE_EOF, WRITE_ABORT,
             JSONRESP_WAITBUF, JSONRESP_CUSTOM_TRY, JSONRESP_CUSTOM,
             GCODE,
             DL_TEST, UL_TEST
@@ -377,6 +383,11 @@ private:
         }
         
     public:
+        bool isAbortingUpload (Context c)
+        {
+            return (m_state == State::WRITE_ABORT);
+        }
+        
         void acceptGetFileRequest (Context c, TheRequestInterface *request, char const *file_path, char const *base_dir)
         {
             accept_request_common(c, request);
@@ -391,9 +402,16 @@ private:
         {
             accept_request_common(c, request);
             
+            // Preallocate the file when the upload size is known.
+            uint64_t body_length;
+            uint32_t preallocate_size = 0;
+            if (request->getRequestBodyLength(c, &body_length) && body_length <= UINT32_MAX) {
+                preallocate_size = body_length;
+            }
+            
             m_state = State::WRITE_OPEN;
             init_file(c);
-            m_buffered_file.startOpen(c, file_path, false, TheBufferedFile::OpenMode::OPEN_WRITE, UploadBasePath());
+            m_buffered_file.startOpen(c, file_path, false, TheBufferedFile::OpenMode::OPEN_WRITE, UploadBasePath(), preallocate_size);
         }
         
         void acceptJsonResponseRequest (Context c, TheRequestInterface *request, AIpStack::MemRef req_type)
@@ -443,6 +461,16 @@ private:
         void requestTerminated (Context c) override
         {
             AMBRO_ASSERT(m_state != State::NO_CLIENT)
+            AMBRO_ASSERT(m_state != State::WRITE_ABORT)
+            
+            // Let the file be truncated after the data received so far, so
+            // that clusters preallocated for the upload are released. Until
+            // this is done, requests on this client are refused.
+            if (m_state == OneOf(State::WRITE_OPEN, State::WRITE_WAIT, State::WRITE_WRITE, State::WRITE_EOF)) {
+                m_state = State::WRITE_ABORT;
+                m_buffered_file.startAbort(c);
+                return;
+            }
             
             reset(c);
         }
@@ -640,6 +668,10 @@ private:
                     m_request->pokeResponseBodyBufferEvent(c);
                 } break;
                 
+                case State::WRITE_ABORT: {
+                    reset(c);
+                } break;
+                
                 case State::WRITE_WRITE:
                 case State::WRITE_EOF: {
                     if (error != TheBufferedFile::Error::NO_ERROR) {
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_INPUT_SHAPER_H
+#define AMBROLIB_INPUT_SHAPER_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/Expr.h>
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/math/FloatTools.h>
+
+namespace APrinter {
+
+/*
+ * Impulse sequences of the supported shapers. Impulse i is at time
+ * Time_i * Td and has relative amplitude Weight_i * K^i, where Td is the
+ * damped period of the vibration being cancelled and
+ * K = exp(-DecayFactor * pi * zeta / sqrt(1 - zeta^2)).
+ */
+
+struct InputShaperZV {
+    static int const NumImpulses = 2;
+    using DecayFactor = APRINTER_FP_CONST_EXPR(1.0);
+    using Weight0 = APRINTER_FP_CONST_EXPR(1.0);
+    using Weight1 = APRINTER_FP_CONST_EXPR(1.0);
+    using Weight2 = APRINTER_FP_CONST_EXPR(0.0);
+    using Time1 = APRINTER_FP_CONST_EXPR(0.5);
+    using Time2 = APRINTER_FP_CONST_EXPR(0.5);
+};
+
+struct InputShaperMZV {
+    static int const NumImpulses = 3;
+    using DecayFactor = APRINTER_FP_CONST_EXPR(0.75);
+    using Weight0 = APRINTER_FP_CONST_EXPR(0.29289321881345248); // 1 - 1/sqrt(2)
+    using Weight1 = APRINTER_FP_CONST_EXPR(0.41421356237309505); // sqrt(2) - 1
+    using Weight2 = APRINTER_FP_CONST_EXPR(0.29289321881345248);
+    using Time1 = APRINTER_FP_CONST_EXPR(0.375);
+    using Time2 = APRINTER_FP_CONST_EXPR(0.75);
+};
+
+// Extra-insensitive shaper for 5% vibration tolerance.
+struct InputShaperEI {
+    static int const NumImpulses = 3;
+    using DecayFactor = APRINTER_FP_CONST_EXPR(1.0);
+    using Weight0 = APRINTER_FP_CONST_EXPR(0.2625);
+    using Weight1 = APRINTER_FP_CONST_EXPR(0.475);
+    using Weight2 = APRINTER_FP_CONST_EXPR(0.2625);
+    using Time1 = APRINTER_FP_CONST_EXPR(0.5);
+    using Time2 = APRINTER_FP_CONST_EXPR(1.0);
+};
+
+/*
+ * Amplitudes (normalized so that all impulses sum to one) and times (in
+ * clock ticks) of the impulses after the first one, which is at time zero.
+ */
+template <typename ShaperType, typename Frequency, typename DampingRatio, typename TimeConversion>
+struct InputShaperImpulseExprs {
+    using One = APRINTER_FP_CONST_EXPR(1.0);
+    using Half = APRINTER_FP_CONST_EXPR(0.5);
+    using Pi = APRINTER_FP_CONST_EXPR(3.14159265358979323846);
+    
+    using DampedFactor = decltype(ExprExp(Half() * ExprLog(One() - DampingRatio() * DampingRatio())));
+    using K = decltype(ExprExp(-(typename ShaperType::DecayFactor() * Pi() * DampingRatio() / DampedFactor())));
+    using Weighted1 = decltype(typename ShaperType::Weight1() * K());
+    using Weighted2 = decltype(typename ShaperType::Weight2() * K() * K());
+    using WeightSum = decltype(typename ShaperType::Weight0() + Weighted1() + Weighted2());
+    using DampedPeriod = decltype(TimeConversion() / (Frequency() * DampedFactor()));
+    
+    using Amplitude1 = decltype(Weighted1() / WeightSum());
+    using Amplitude2 = decltype(Weighted2() / WeightSum());
+    using Time1 = decltype(typename ShaperType::Time1() * DampedPeriod());
+    using Time2 = decltype(typename ShaperType::Time2() * DampedPeriod());
+    using LastTime = If<(ShaperType::NumImpulses == 2), Time1, Time2>;
+};
+
+/*
+ * Convolves a stream of motion pieces with an impulse sequence.
+ * 
+ * Pieces are like AxisDriver commands but signed: d steps in t clock ticks,
+ * with position d * s + a * (s^2 - s) at relative time s. For every piece
+ * pushed, the shaped motion over the same time interval is output, so the
+ * shaped stream stays in sync with the input. The shaped position is exact
+ * at the ends of output pieces, up to rounding to whole steps, and each
+ * output piece is a quadratic fit of the shaped motion in between. Output
+ * pieces are split where the shifted copies of earlier breakpoints fall,
+ * but into no more than MaxOutputPieces.
+ * 
+ * Once the input has been at rest for the time of the last impulse, the
+ * output has arrived at exactly the same position.
+ */
+template <typename FpType, int NumImpulses, int HistorySize>
+class InputShaper {
+    static_assert(NumImpulses >= 2 && NumImpulses <= 3, "");
+    static_assert(HistorySize >= 2, "");
+    
+    static int const MaxBreaks = NumImpulses;
+    static int const NumCandidates = HistorySize * (NumImpulses - 1);
+    
+public:
+    static int const MaxOutputPieces = MaxBreaks + 1;
+    
+    struct Impulses {
+        FpType amplitude[NumImpulses - 1];
+        FpType time[NumImpulses - 1];
+    };
+    
+    // Times and positions are relative to the end of the last input piece.
+    struct Piece {
+        int32_t start;
+        int32_t t;
+        int32_t start_pos;
+        int32_t d;
+        FpType a;
+    };
+    
+    struct State {
+        uint8_t count;
+        int32_t out_pos;
+        Piece history[HistorySize];
+    };
+    
+    static void init (State *s)
+    {
+        s->count = 0;
+        s->out_pos = 0;
+    }
+    
+    template <typename Func>
+    static void push (State *s, Impulses const *imp, int32_t t, int32_t d, FpType a, Func func)
+    {
+        AMBRO_ASSERT(t >= 0)
+        
+        for (int k = 0; k < s->count; k++) {
+            s->history[k].start -= t;
+            s->history[k].start_pos -= d;
+        }
+        s->out_pos -= d;
+        
+        // Drop pieces which are too old to be looked at.
+        int32_t horizon = -t - (int32_t)FloatCeil(imp->time[NumImpulses - 2]);
+        int drop = 0;
+        while (s->count - drop >= 2 && s->history[drop + 1].start <= horizon) {
+            drop++;
+        }
+        if (drop == 0 && s->count == HistorySize) {
+            merge_oldest(s);
+            drop = 1;
+        }
+        if (drop > 0) {
+            for (int k = drop; k < s->count; k++) {
+                s->history[k - drop] = s->history[k];
+            }
+            s->count -= drop;
+        }
+        
+        Piece *p = &s->history[s->count++];
+        p->start = -t;
+        p->t = t;
+        p->start_pos = -d;
+        p->d = d;
+        p->a = a;
+        
+        if (t == 0) {
+            int32_t out_d = (int32_t)FloatRound(eval_shaped(s, imp, 0.0f)) - s->out_pos;
+            s->out_pos += out_d;
+            return func(out_d, 0.0f, 0, true);
+        }
+        
+        // Breakpoints of the shifted copies which fall within this piece.
+        int32_t cand[NumCandidates];
+        int num_cand = 0;
+        for (int k = 0; k < s->count; k++) {
+            for (int i = 0; i < NumImpulses - 1; i++) {
+                int32_t b = s->history[k].start + (int32_t)FloatRound(imp->time[i]);
+                if (b > -t && b < 0) {
+                    int j = num_cand;
+                    while (j > 0 && cand[j - 1] > b) {
+                        cand[j] = cand[j - 1];
+                        j--;
+                    }
+                    if (j > 0 && cand[j - 1] == b) {
+                        for (; j < num_cand; j++) {
+                            cand[j] = cand[j + 1];
+                        }
+                        continue;
+                    }
+                    cand[j] = b;
+                    num_cand++;
+                }
+            }
+        }
+        
+        int num_breaks = (num_cand < MaxBreaks) ? num_cand : MaxBreaks;
+        int32_t u = -t;
+        FpType q_u = eval_shaped(s, imp, u);
+        for (int j = 0; j <= num_breaks; j++) {
+            int32_t w = (j < num_breaks) ? cand[(num_cand == num_breaks) ? j : ((2 * j + 1) * num_cand) / (2 * num_breaks)] : 0;
+            FpType q_w = eval_shaped(s, imp, w);
+            FpType q_mid = eval_shaped(s, imp, 0.5f * (FpType)(u + w));
+            int32_t out_d = (int32_t)FloatRound(q_w) - s->out_pos;
+            s->out_pos += out_d;
+            func(out_d, 2.0f * (q_u + q_w - 2.0f * q_mid), w - u, j == num_breaks);
+            u = w;
+            q_u = q_w;
+        }
+    }
+    
+private:
+    static FpType eval (State const *s, FpType tau)
+    {
+        int k = s->count - 1;
+        while (k > 0 && tau < s->history[k].start) {
+            k--;
+        }
+        Piece const *p = &s->history[k];
+        if (tau <= p->start) {
+            return p->start_pos;
+        }
+        if (tau >= p->start + p->t) {
+            return p->start_pos + p->d;
+        }
+        FpType frac = (tau - p->start) / p->t;
+        return p->start_pos + p->d * frac + p->a * (frac * frac - frac);
+    }
+    
+    static FpType eval_shaped (State const *s, Impulses const *imp, FpType tau)
+    {
+        FpType p = eval(s, tau);
+        FpType q = p;
+        for (int i = 0; i < NumImpulses - 1; i++) {
+            q += imp->amplitude[i] * (eval(s, tau - imp->time[i]) - p);
+        }
+        return q;
+    }
+    
+    static void merge_oldest (State *s)
+    {
+        Piece *p0 = &s->history[0];
+        Piece const *p1 = &s->history[1];
+        int32_t t = p0->t + p1->t;
+        int32_t d = p0->d + p1->d;
+        FpType mid = eval(s, p0->start + 0.5f * t) - p0->start_pos;
+        p0->t = t;
+        p0->d = d;
+        p0->a = 2.0f * (d - 2.0f * mid);
+        for (int k = 2; k < s->count; k++) {
+            s->history[k - 1] = s->history[k];
+        }
+        s->count--;
+    }
+};
+
+}
+
+#endif
@@ -76,6 +76,22 @@ struct LinearPlanner {
         return FloatMin(segment->max_start_v, end_v + segment->a_x);
     }
 
+    // Like push(), for a segment which has already been pushed and has since
+    // had more segments queued after it, so the new end speed cannot be lower
+    // than the one it was pushed with. If the end speed is unchanged, returns
+    // false without doing anything; the start speeds of this and all preceding
+    // segments are then unchanged too, so the backward pass may stop here.
+    static bool repush (SegmentData *segment, SegmentState *s, FpType *v)
+    {
+        AMBRO_ASSERT(*v >= s->end_v)
+        
+        if (*v == s->end_v) {
+            return false;
+        }
+        *v = push(segment, s, *v);
+        return true;
+    }
+    
     static FpType pull (SegmentData *segment, SegmentState *s, FpType start_v, SegmentResult *result)
     {
         AMBRO_ASSERT(s->end_v <= segment->max_v)
@@ -52,6 +52,8 @@
 #include <aprinter/system/InterruptLock.h>
 #include <aprinter/printer/actuators/AxisDriverConsumer.h>
 #include <aprinter/printer/planning/LinearPlanner.h>
+#include <aprinter/printer/planning/InputShaper.h>
+#include <aprinter/printer/planning/SCurve.h>
 #include <aprinter/printer/Configuration.h>
 
 namespace APrinter {
@@ -63,9 +65,35 @@ APRINTER_ALIAS_STRUCT(MotionPlannerAxisSpec, (
     APRINTER_AS_TYPE(CorneringDistance),
     APRINTER_AS_TYPE(MaxSpeedRec),
     APRINTER_AS_TYPE(MaxAccelRec),
+    APRINTER_AS_VALUE(bool, PressureAdvanceEnabled),
+    APRINTER_AS_TYPE(PressureAdvance),
+    APRINTER_AS_TYPE(InputShaper),
+    APRINTER_AS_TYPE(JerkLimit),
     APRINTER_AS_TYPE(PrestepCallback)
 ))
 
+struct MotionPlannerNoInputShaper {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerInputShaper, (
+    APRINTER_AS_TYPE(ShaperType),
+    APRINTER_AS_TYPE(Frequency),
+    APRINTER_AS_TYPE(DampingRatio)
+), (
+    static bool const Enabled = true;
+))
+
+struct MotionPlannerNoJerkLimit {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerJerkLimit, (
+    APRINTER_AS_TYPE(MaxJerkRec)
+), (
+    static bool const Enabled = true;
+))
+
 APRINTER_ALIAS_STRUCT(MotionPlannerChannelSpec, (
     APRINTER_AS_TYPE(Payload),
     APRINTER_AS_TYPE(Callback),
@@ -97,6 +125,8 @@ class MotionPlanner {
     static int const LookaheadCommitCount     = Arg::LookaheadCommitCount;
     using FpType                              = typename Arg::FpType;
     using MaxStepsPerCycle                    = typename Arg::MaxStepsPerCycle;
+    using JunctionDeviationEnabled            = typename Arg::JunctionDeviationEnabled;
+    using JunctionDeviation                   = typename Arg::JunctionDeviation;
     using PullHandler                         = typename Arg::PullHandler;
     using FinishedHandler                     = typename Arg::FinishedHandler;
     using AbortedHandler                      = typename Arg::AbortedHandler;
@@ -119,10 +149,6 @@ private:
     static_assert(NumAxes > 0, "");
     static const int NumChannels = TypeListLength<ParamsChannelsList>::Value;
     using SegmentBufferSizeType = ChooseIntForMax<2 * LookaheadBufferSize, false>; // twice for segments_add()
-    static const size_t StepperCommitBufferSize = 3 * StepperSegmentBufferSize;
-    static const size_t StepperBackupBufferSize = 3 * (LookaheadBufferSize - LookaheadCommitCount);
-    using StepperCommitBufferSizeType = ChooseIntForMax<StepperCommitBufferSize, false>;
-    using StepperBackupBufferSizeType = ChooseIntForMax<2 * StepperBackupBufferSize, false>;
     using StepperFastEvent = typename Context::EventLoop::template FastEventSpec<MotionPlanner>;
     using CallbackFastEvent = typename Context::EventLoop::template FastEventSpec<StepperFastEvent>;
     static const int TypeBits = BitsInInt<NumChannels>::Value;
@@ -133,10 +159,36 @@ private:
     
     using MinSecondsPerStep = decltype(ExprRec(MaxStepsPerCycle() * typename Constants::FCpu()));
     
+    template <typename AxisSpec, typename Accum>
+    using HaveInputShapingHelper = WrapBool<(Accum::Value || AxisSpec::InputShaper::Enabled)>;
+    static bool const HaveInputShaping = TypeListFold<ParamsAxesList, WrapBool<false>, HaveInputShapingHelper>::Value;
+    static int const InputShaperHistorySize = 16;
+    
+    template <typename AxisSpec, typename Accum>
+    using HaveJerkLimitHelper = WrapBool<(Accum::Value || AxisSpec::JerkLimit::Enabled)>;
+    static bool const HaveJerkLimit = TypeListFold<ParamsAxesList, WrapBool<false>, HaveJerkLimitHelper>::Value;
+    static int const SCurveRampPieces = 2;
+    using TheSCurve = SCurve<FpType, SCurveRampPieces>;
+    
     using CMinSegmentTime = decltype(ExprCast<FpType>(typename Constants::TimeConversion() * MinSecondsPerStep()));
+    using CJunctionDeviationEnabled = decltype(ExprCast<bool>(JunctionDeviationEnabled()));
+    using CJunctionDeviation = decltype(ExprCast<FpType>(JunctionDeviation()));
+    
+    // Junction deviation is left out entirely if it is constantly disabled.
+    template <typename TheExpr, bool IsConstexpr = TheExpr::IsConstexpr>
+    struct JunctionDeviationHelper {
+        static bool const MayBeEnabled = true;
+    };
+    template <typename TheExpr>
+    struct JunctionDeviationHelper<TheExpr, true> {
+        static bool const MayBeEnabled = TheExpr::value();
+    };
     
 public:
-    using ConfigExprs = MakeTypeList<CMinSegmentTime>;
+    using ConfigExprs = MakeTypeList<CMinSegmentTime, CJunctionDeviationEnabled, CJunctionDeviation>;
+    
+    // If true, the junction_vec of axes commands must be set (see SplitBufferAxesPart).
+    static bool const JunctionDeviationSupported = JunctionDeviationHelper<CJunctionDeviationEnabled>::MayBeEnabled;
     
 private:
     AMBRO_DECLARE_GET_MEMBER_TYPE_FUNC(GetMemberType_TheCommon, TheCommon)
@@ -175,6 +227,7 @@ public:
     
     struct SplitBufferAxesPart : public SplitBufferAxesHelper, public SplitBufferLasersHelper {
         FpType rel_max_v_rec;
+        FpType junction_vec[3]; // X, Y, Z of the move [mm], if JunctionDeviationSupported
         FpType split_frac; // internal
         uint32_t split_count; // internal
         uint32_t split_pos; // internal
@@ -254,6 +307,15 @@ private:
         using StepperCommandCallbackContext = typename TheStepper::CommandCallbackContext;
         using ComputeState = typename TheAxis::ComputeState;
         
+        // Upper bound of the number of stepper commands generated for one segment,
+        // and for the shaper tail following the last segment (see gen_shaper_tail()).
+        static int const CommandsPerSegment = TheAxis::CommandsPerSegment;
+        static int const TailCommands = HaveInputShaping ? TheAxis::TailCommands : 0;
+        static const size_t StepperCommitBufferSize = CommandsPerSegment * StepperSegmentBufferSize + TailCommands;
+        static const size_t StepperBackupBufferSize = CommandsPerSegment * (LookaheadBufferSize - LookaheadCommitCount) + TailCommands;
+        using StepperCommitBufferSizeType = ChooseIntForMax<StepperCommitBufferSize, false>;
+        using StepperBackupBufferSizeType = ChooseIntForMax<2 * StepperBackupBufferSize, false>;
+        
         static void init (Context c, bool prestep_callback_enabled)
         {
             auto *o = Object::self(c);
@@ -309,7 +371,7 @@ private:
         static bool have_commit_space (bool accum, Context c)
         {
             auto *o = Object::self(c);
-            return (accum && commit_avail(o->m_commit_start, o->m_commit_end) >= 3 * LookaheadCommitCount);
+            return (accum && commit_avail(o->m_commit_start, o->m_commit_end) >= CommandsPerSegment * LookaheadCommitCount + TailCommands);
         }
         
         static void start_commands (Context c)
@@ -335,6 +397,9 @@ private:
                 o->m_new_backup_end++;
             }
             TheStepper::generate_command(args..., cmd);
+#ifdef MOTIONPLANNER_BENCHMARK
+            m->m_bench_stats.stepper_commands++;
+#endif
         }
         
         static void do_commit (Context c)
@@ -445,18 +510,25 @@ public:
         using StepperStepFixedType = typename TheAxisDriver::StepFixedType;
         using TheAxisSegment = AxisSegment<AxisIndex>;
         static const AxisMaskType TheAxisMask = (AxisMaskType)1 << (AxisIndex + TypeBits);
+        static bool const PressureAdvanceEnabled = AxisSpec::PressureAdvanceEnabled;
+        static bool const InputShapingEnabled = AxisSpec::InputShaper::Enabled;
+        static bool const JerkLimitEnabled = AxisSpec::JerkLimit::Enabled;
+        using StepsIntType = ChooseInt<AxisSpec::StepBits + 2, true>;
+        using AccelFixedType = typename TheAxisDriver::AccelFixedType;
         
         struct ComputeState {
             FpType x;
         };
         
-        using StepperCommand = typename TheCommon::StepperCommand;
+        using StepperCommand = typename TheAxisDriver::Command;
         
         static void init_impl (Context c, bool prestep_callback_enabled)
         {
             auto *o = Object::self(c);
             TheAxisDriver::setPrestepCallbackEnabled(c, prestep_callback_enabled);
             o->last_x_by_distance = 0.0f;
+            PressureAdvanceFeature::init(c);
+            InputShaperFeature::init(c);
         }
         
         static void deinit_impl (Context c)
@@ -568,7 +640,7 @@ public:
         }
         
         template <typename TheMinTimeType>
-        static void gen_segment_stepper_commands (Context c, Segment *entry, FpType frac_x0, FpType frac_x2, TheMinTimeType t0, TheMinTimeType t2, TheMinTimeType t1, FpType vdiff0_squared, FpType vdiff2_squared)
+        static void gen_segment_stepper_commands (Context c, Segment *entry, FpType frac_x0, FpType frac_x2, TheMinTimeType t0, TheMinTimeType t2, TheMinTimeType t1, FpType vdiff0_squared, FpType vdiff2_squared, FpType ramp0, FpType ramp2, bool end_at_rest)
         {
             TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
             
@@ -598,17 +670,409 @@ public:
             bool dir = entry->dir_and_type & TheAxisMask;
             FpType accel_conversion = entry->axes.lp_seg.a_x_rec * xfp;
             
+            bool have2 = (x2.bitsValue() != 0);
+            
             if (x0.bitsValue() != 0) {
-                TheCommon::gen_stepper_command(c, dir, x0, t0, FixedMin(x0, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff0_squared)));
+                JerkLimitFeature::gen_command(c, dir, x0, t0, FixedMin(x0, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff0_squared)), ramp0, end_at_rest && skip1 && !have2);
             }
             if (!skip1) {
-                TheCommon::gen_stepper_command(c, dir, x1, t1, StepperStepFixedType::importBits(0));
+                InputShaperFeature::gen_command(c, dir, x1, t1, StepperStepFixedType::importBits(0), end_at_rest && !have2);
             }
-            if (x2.bitsValue() != 0) {
-                TheCommon::gen_stepper_command(c, dir, x2, t2, -FixedMin(x2, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff2_squared)));
+            if (have2) {
+                JerkLimitFeature::gen_command(c, dir, x2, t2, -FixedMin(x2, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff2_squared)), ramp2, end_at_rest);
             }
         }
         
+        // Generates a command for a signed motion, as two commands if the
+        // motion changes direction. func(d, as, t, last) is called for each.
+        template <typename TheMinTimeType, typename Func>
+        static void gen_split_command (StepsIntType d, StepsIntType as, TheMinTimeType t, Func func)
+        {
+            // Velocity at the start and end is proportional to d - as and d + as.
+            if ((d - as >= 0 && d + as >= 0) || (d - as <= 0 && d + as <= 0)) {
+                return func(d, as, t, true);
+            }
+            
+            FpType zero_frac = (FpType)(as - d) / (2 * as);
+            auto t1 = TheMinTimeType::importBits(FloatRound(zero_frac * t.bitsValue()));
+            if (t1.bitsValue() == 0 || t1.bitsValue() == t.bitsValue()) {
+                // Not worth splitting, keep the total and just clamp the accel.
+                StepsIntType abs_d = (d >= 0) ? d : -d;
+                return func(d, MaxValue(-abs_d, MinValue(abs_d, as)), t, true);
+            }
+            auto t2 = TheMinTimeType::importBits(t.bitsValue() - t1.bitsValue());
+            
+            // Decelerate to zero, then accelerate from zero the other way.
+            StepsIntType d1 = FloatRound(-(FpType)as * zero_frac * zero_frac);
+            StepsIntType d2 = d - d1;
+            func(d1, -d1, t1, false);
+            func(d2, d2, t2, true);
+        }
+        
+        template <typename TheMinTimeType>
+        static void gen_signed_command (Context c, StepsIntType d, StepsIntType as, TheMinTimeType t)
+        {
+            bool dir = (d >= 0);
+            StepsIntType x = dir ? d : -d;
+            StepsIntType a = dir ? as : -as;
+            TheCommon::gen_stepper_command(c, dir, StepperStepFixedType::importBits(x), t, AccelFixedType::importBits(a));
+        }
+        
+        /**
+         * Pressure advance moves the axis ahead of its planned position by an
+         * amount proportional to its velocity: offset = K * v. The change of the
+         * offset over a command is added to the linear term of the command,
+         * leaving the quadratic term alone. Since the offset is zero at rest,
+         * the total number of steps over any sequence of moves which starts
+         * and ends at rest is unchanged. When the adjusted motion changes
+         * direction within a command, the command is split at the point of
+         * zero velocity.
+         */
+        AMBRO_STRUCT_IF(PressureAdvanceFeature, PressureAdvanceEnabled) {
+            struct Object;
+            
+            static void init (Context c)
+            {
+                auto *o = Object::self(c);
+                o->offset = 0;
+                o->staging_offset = 0;
+            }
+            
+            static void start_commands (Context c)
+            {
+                auto *o = Object::self(c);
+                o->offset = o->staging_offset;
+            }
+            
+            static void reached_commit_point (Context c)
+            {
+                auto *o = Object::self(c);
+                o->new_staging_offset = o->offset;
+            }
+            
+            static void committed (Context c)
+            {
+                auto *o = Object::self(c);
+                o->staging_offset = o->new_staging_offset;
+            }
+            
+            static void underrun (Context c)
+            {
+                // All staged commands were executed, including those past the commit point.
+                auto *o = Object::self(c);
+                o->staging_offset = o->offset;
+            }
+            
+            template <typename TheMinTimeType, typename AccelType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AccelType a, bool end_at_rest)
+            {
+                auto *o = Object::self(c);
+                
+                StepsIntType xs = dir ? (StepsIntType)x.bitsValue() : -(StepsIntType)x.bitsValue();
+                StepsIntType as = dir ? (StepsIntType)a.bitsValue() : -(StepsIntType)a.bitsValue();
+                
+                // Offset wanted at the end of the command, based on the end velocity.
+                // When the planner brings the machine to rest, the end velocity of
+                // the command may be nonzero only due to rounding, so take the target
+                // offset to be exactly zero. Except when coming to rest, the offset
+                // may change no faster than it would if the axis accelerated at its
+                // maximum acceleration. The adjusted command is limited to the
+                // maximum speed of the axis and the step rate the driver can handle,
+                // but is never made slower than the planned command. Any offset not
+                // reached is made up by later commands.
+                StepsIntType adjust = 0;
+                if (AMBRO_LIKELY(t.bitsValue() != 0)) {
+                    FpType t_fp = t.bitsValue();
+                    FpType end_v = end_at_rest ? 0.0f : (FpType)(xs + as) / t_fp;
+                    FpType target_offset = APRINTER_CFG(Config, CPressureAdvanceTicks, c) * end_v;
+                    FpType delta = FloatRound(target_offset - o->offset);
+                    if (!end_at_rest) {
+                        FpType max_delta = FloatRound(APRINTER_CFG(Config, CPressureAdvanceMaxOffsetRate, c) * t_fp) + 1.0f;
+                        delta = FloatMax(-max_delta, FloatMin(max_delta, delta));
+                    }
+                    FpType d = xs + delta;
+                    FpType abs_as = FloatAbs((FpType)as);
+                    FpType max_x = StepperStepFixedType::maxValue().template fpValue<FpType>();
+                    if ((FloatAbs(d) + abs_as) * APRINTER_CFG(Config, CMaxSpeedRec, c) > t_fp || FloatAbs(d) * APRINTER_CFG(Config, CAsyncMinStepTime, c) > t_fp) {
+                        FpType limit_x = FloatMin(t_fp * APRINTER_CFG(Config, CPressureAdvanceMaxSpeed, c) - abs_as, t_fp / APRINTER_CFG(Config, CAsyncMinStepTime, c));
+                        max_x = FloatMin(max_x, FloatMax(FloatAbs((FpType)xs), FloatRound(limit_x)));
+                    }
+                    d = FloatMax(-max_x, FloatMin(max_x, d));
+                    adjust = (StepsIntType)d - xs;
+                }
+                o->offset += adjust;
+                
+                gen_split_command(xs + adjust, as, t, [&](StepsIntType d, StepsIntType as, TheMinTimeType t, bool last) {
+                    gen_signed_command(c, d, as, t);
+                });
+            }
+            
+            using CPressureAdvanceTicks = decltype(ExprCast<FpType>(AxisSpec::PressureAdvance::e() * typename Constants::TimeConversion()));
+            using CPressureAdvanceMaxOffsetRate = decltype(ExprCast<FpType>(AxisSpec::PressureAdvance::e() * typename Constants::TimeConversion() / AxisSpec::MaxAccelRec::e()));
+            using CPressureAdvanceMaxSpeed = decltype(ExprCast<FpType>(ExprRec(AxisSpec::MaxSpeedRec::e())));
+            
+            using ConfigExprs = MakeTypeList<CPressureAdvanceTicks, CPressureAdvanceMaxOffsetRate, CPressureAdvanceMaxSpeed>;
+            
+            struct Object : public ObjBase<PressureAdvanceFeature, typename Axis::Object, EmptyTypeList> {
+                StepsIntType offset;
+                StepsIntType staging_offset;
+                StepsIntType new_staging_offset;
+            };
+        } AMBRO_STRUCT_ELSE(PressureAdvanceFeature) {
+            static void init (Context c) {}
+            static void start_commands (Context c) {}
+            static void reached_commit_point (Context c) {}
+            static void committed (Context c) {}
+            static void underrun (Context c) {}
+            template <typename TheMinTimeType, typename AccelType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AccelType a, bool end_at_rest)
+            {
+                TheCommon::gen_stepper_command(c, dir, x, t, a);
+            }
+            struct Object {};
+        };
+        
+        /**
+         * Input shaping convolves the motion of the axis with a sequence of
+         * impulses which cancels vibration at a given frequency. The commands
+         * for each phase of a segment are replaced by the shaped motion over
+         * the same time, so the axis stays in sync with the others. After the
+         * last segment, the shaped motion continues for the time of the last
+         * impulse; the planner accounts for this in gen_shaper_tail().
+         * The shaper state is saved at the commit point like the rest of the
+         * planner state.
+         */
+        AMBRO_STRUCT_IF(InputShaperFeature, InputShapingEnabled) {
+            struct Object;
+            using ShaperSpec = typename AxisSpec::InputShaper;
+            using ShaperType = typename ShaperSpec::ShaperType;
+            using Shaper = InputShaper<FpType, ShaperType::NumImpulses, InputShaperHistorySize>;
+            using ShaperState = typename Shaper::State;
+            static int const CommandFactor = 2 * Shaper::MaxOutputPieces;
+            
+            static void init (Context c)
+            {
+                auto *o = Object::self(c);
+                Shaper::init(&o->state);
+                o->staging_state = o->state;
+            }
+            
+            static void start_commands (Context c)
+            {
+                auto *o = Object::self(c);
+                o->state = o->staging_state;
+            }
+            
+            static void reached_commit_point (Context c)
+            {
+                auto *o = Object::self(c);
+                o->new_staging_state = o->state;
+            }
+            
+            static void committed (Context c)
+            {
+                auto *o = Object::self(c);
+                o->staging_state = o->new_staging_state;
+            }
+            
+            static void underrun (Context c)
+            {
+                auto *o = Object::self(c);
+                o->staging_state = o->state;
+            }
+            
+            template <typename TheMinTimeType, typename AccelType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AccelType a, bool end_at_rest)
+            {
+                StepsIntType xs = dir ? (StepsIntType)x.bitsValue() : -(StepsIntType)x.bitsValue();
+                StepsIntType as = dir ? (StepsIntType)a.bitsValue() : -(StepsIntType)a.bitsValue();
+                push(c, t, xs, as, false);
+            }
+            
+            template <typename TheMinTimeType>
+            static void gen_tail (Context c, TheMinTimeType t)
+            {
+                push(c, t, 0, 0, true);
+            }
+            
+            static FpType tail_time (FpType accum, Context c)
+            {
+                return FloatMax(accum, APRINTER_CFG(Config, CLastTime, c));
+            }
+            
+            template <typename TheMinTimeType>
+            static void push (Context c, TheMinTimeType t, StepsIntType d, StepsIntType as, bool is_tail)
+            {
+                auto *o = Object::self(c);
+                
+                typename Shaper::Impulses imp;
+                imp.amplitude[0] = APRINTER_CFG(Config, CAmplitude1, c);
+                imp.time[0] = APRINTER_CFG(Config, CTime1, c);
+                if (ShaperType::NumImpulses > 2) {
+                    imp.amplitude[ShaperType::NumImpulses - 2] = APRINTER_CFG(Config, CAmplitude2, c);
+                    imp.time[ShaperType::NumImpulses - 2] = APRINTER_CFG(Config, CTime2, c);
+                }
+                
+                Shaper::push(&o->state, &imp, t.bitsValue(), d, as, [&](int32_t out_d, FpType out_a, int32_t out_t, bool last) {
+                    auto piece_t = TheMinTimeType::importBits(out_t);
+                    gen_split_command(out_d, FloatRound(out_a), piece_t, [&](StepsIntType d, StepsIntType as, TheMinTimeType t, bool split_last) {
+                        bool dir = (d >= 0);
+                        StepsIntType x = dir ? d : -d;
+                        StepsIntType a = dir ? as : -as;
+                        PressureAdvanceFeature::gen_command(c, dir, StepperStepFixedType::importBits(x), t, AccelFixedType::importBits(a), is_tail && last && split_last);
+                    });
+                });
+            }
+            
+            using Exprs = InputShaperImpulseExprs<ShaperType, typename ShaperSpec::Frequency, typename ShaperSpec::DampingRatio, typename Constants::TimeConversion>;
+            using CAmplitude1 = decltype(ExprCast<FpType>(typename Exprs::Amplitude1()));
+            using CAmplitude2 = decltype(ExprCast<FpType>(typename Exprs::Amplitude2()));
+            using CTime1 = decltype(ExprCast<FpType>(typename Exprs::Time1()));
+            using CTime2 = decltype(ExprCast<FpType>(typename Exprs::Time2()));
+            using CLastTime = decltype(ExprCast<FpType>(typename Exprs::LastTime()));
+            
+            using ConfigExprs = MakeTypeList<CAmplitude1, CAmplitude2, CTime1, CTime2, CLastTime>;
+            
+            struct Object : public ObjBase<InputShaperFeature, typename Axis::Object, EmptyTypeList> {
+                ShaperState state;
+                ShaperState staging_state;
+                ShaperState new_staging_state;
+            };
+        } AMBRO_STRUCT_ELSE(InputShaperFeature) {
+            static int const CommandFactor = 1;
+            static void init (Context c) {}
+            static void start_commands (Context c) {}
+            static void reached_commit_point (Context c) {}
+            static void committed (Context c) {}
+            static void underrun (Context c) {}
+            template <typename TheMinTimeType, typename AccelType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AccelType a, bool end_at_rest)
+            {
+                PressureAdvanceFeature::gen_command(c, dir, x, t, a, end_at_rest);
+            }
+            template <typename TheMinTimeType>
+            static void gen_tail (Context c, TheMinTimeType t)
+            {
+                TheCommon::gen_stepper_command(c, false, StepperStepFixedType::importBits(0), t, StepperStepFixedType::importBits(0));
+            }
+            static FpType tail_time (FpType accum, Context c)
+            {
+                return accum;
+            }
+            struct Object {};
+        };
+        
+        /**
+         * With a jerk limit on any axis, the acceleration and deceleration
+         * phases of each segment are executed by all axes as S-curves (see
+         * SCurve), in the same time and over the same distance. The ramp time
+         * of a phase is computed for the whole segment (see
+         * compute_ramp_times()), so all axes follow the same profile and the
+         * tool stays on the line; axes without a jerk limit just follow. Such
+         * segments are planned at half the acceleration, while segments which
+         * do not move a jerk-limited axis keep the full acceleration and
+         * constant acceleration phases. Each ramp of the acceleration is
+         * approximated by SCurveRampPieces commands.
+         */
+        AMBRO_STRUCT_IF(JerkLimitFeature, HaveJerkLimit) {
+            struct Object;
+            static int const CommandFactor = TheSCurve::NumPieces;
+            
+            // Accumulates the largest x * MaxJerkRec over the axes, which sets
+            // the ramp time needed for a velocity change of the segment.
+            template <typename AccumType>
+            static FpType ramp_jerk_rec (AccumType accum, Context c, Segment *entry)
+            {
+                return AxisJerkLimit::ramp_jerk_rec(accum, c, entry);
+            }
+            
+            template <typename TheMinTimeType, typename AccelType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AccelType a, FpType ramp, bool end_at_rest)
+            {
+                FpType t_fp = t.bitsValue();
+                ramp = FloatMin(ramp, 0.5f * t_fp);
+                if (!(ramp >= SCurveRampPieces)) {
+                    return InputShaperFeature::gen_command(c, dir, x, t, a, end_at_rest);
+                }
+                
+                using TimeIntType = typename TheMinTimeType::IntType;
+                using StepIntType = typename StepperStepFixedType::IntType;
+                FpType x_fp = x.bitsValue();
+                FpType a_fp = a.bitsValue();
+                FpType mean_accel = 2.0f * a_fp / (t_fp * t_fp);
+                FpType v = (x_fp - a_fp) / t_fp;
+                FpType pos = 0.0f;
+                TimeIntType prev_time = 0;
+                StepIntType prev_x = 0;
+                
+                for (int k = 0; k < TheSCurve::NumPieces; k++) {
+                    bool last = (k == TheSCurve::NumPieces - 1);
+                    TimeIntType end_time = last ? t.bitsValue() : MinValue(t.bitsValue(), (TimeIntType)FloatRound(TheSCurve::piece_end(k, t_fp, ramp)));
+                    if (end_time <= prev_time) {
+                        continue;
+                    }
+                    FpType h = end_time - prev_time;
+                    FpType piece_accel = TheSCurve::piece_accel(k, t_fp, ramp, mean_accel);
+                    FpType piece_a = 0.5f * piece_accel * h * h;
+                    pos += v * h + piece_a;
+                    v += piece_accel * h;
+                    StepIntType end_x = last ? x.bitsValue() : MaxValue(prev_x, MinValue(x.bitsValue(), (StepIntType)FloatRound(FloatMax((FpType)0.0f, pos))));
+                    StepsIntType d = end_x - prev_x;
+                    StepsIntType as = MaxValue(-d, MinValue(d, (StepsIntType)FloatRound(piece_a)));
+                    InputShaperFeature::gen_command(c, dir, StepperStepFixedType::importBits(d), TheMinTimeType::importBits(end_time - prev_time), AccelFixedType::importBits(as), end_at_rest && last);
+                    prev_time = end_time;
+                    prev_x = end_x;
+                }
+            }
+            
+            AMBRO_STRUCT_IF(AxisJerkLimit, JerkLimitEnabled) {
+                template <typename AccumType>
+                static FpType ramp_jerk_rec (AccumType accum, Context c, Segment *entry)
+                {
+                    TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
+                    return FloatMax(accum, axis_entry->x.template fpValue<FpType>() * APRINTER_CFG(Config, CMaxJerkRec, c));
+                }
+                
+                using CMaxJerkRec = decltype(ExprCast<FpType>(typename AxisSpec::JerkLimit::MaxJerkRec()));
+                
+                using ConfigExprs = MakeTypeList<CMaxJerkRec>;
+                
+                struct Object : public ObjBase<AxisJerkLimit, typename JerkLimitFeature::Object, EmptyTypeList> {};
+            } AMBRO_STRUCT_ELSE(AxisJerkLimit) {
+                template <typename AccumType>
+                static FpType ramp_jerk_rec (AccumType accum, Context c, Segment *entry)
+                {
+                    return accum;
+                }
+                struct Object {};
+            };
+            
+            struct Object : public ObjBase<JerkLimitFeature, typename Axis::Object, MakeTypeList<
+                AxisJerkLimit
+            >> {};
+        } AMBRO_STRUCT_ELSE(JerkLimitFeature) {
+            static int const CommandFactor = 1;
+            template <typename AccumType>
+            static FpType ramp_jerk_rec (AccumType accum, Context c, Segment *entry)
+            {
+                return accum;
+            }
+            template <typename TheMinTimeType, typename AccelType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TheMinTimeType t, AccelType a, FpType ramp, bool end_at_rest)
+            {
+                InputShaperFeature::gen_command(c, dir, x, t, a, end_at_rest);
+            }
+            struct Object {};
+        };
+        
+        // With pressure advance, each command may change direction and need two
+        // commands. The input shaper outputs up to Shaper::MaxOutputPieces pieces
+        // for each command, each of which may also change direction. With a jerk
+        // limit, the first and last phase become TheSCurve::NumPieces commands.
+        static int const PressureAdvanceFactor = PressureAdvanceEnabled ? 2 : 1;
+        static int const CommandsPerSegment = (2 * JerkLimitFeature::CommandFactor + 1) * InputShaperFeature::CommandFactor * PressureAdvanceFactor;
+        static int const TailCommands = InputShapingEnabled ? InputShaperFeature::CommandFactor * PressureAdvanceFactor : 1;
+        
         static void start_stepping_impl (Context c, TimeType start_time, StepperCommand *cmd)
         {
             TheAxisDriver::template start<TheAxisDriverConsumer<AxisIndex>>(c, start_time, cmd);
@@ -658,10 +1122,10 @@ public:
                 StepperStepFixedType cmd_steps = TheAxisDriver::getAbortedCmdSteps(c, &dir);
                 add_steps(&steps, cmd_steps, dir);
             }
-            for (StepperCommitBufferSizeType i = co->m_commit_start; i != co->m_commit_end; i = TheCommon::commit_inc(i)) {
+            for (typename TheCommon::StepperCommitBufferSizeType i = co->m_commit_start; i != co->m_commit_end; i = TheCommon::commit_inc(i)) {
                 add_command_steps(c, &steps, &co->m_commit_buffer[i]);
             }
-            for (StepperBackupBufferSizeType i = co->m_backup_start; i < co->m_backup_end; i++) {
+            for (typename TheCommon::StepperBackupBufferSizeType i = co->m_backup_start; i < co->m_backup_end; i++) {
                 add_command_steps(c, &steps, &co->m_backup_buffer[i]);
             }
             for (SegmentBufferSizeType i = m->m_segments_staging_length; i < m->m_segments_length; i++) {
@@ -704,7 +1168,11 @@ public:
         
         using ConfigExprs = MakeTypeList<CDistanceFactor, CCorneringSpeedComputationFactor, CMaxSpeedRec, CMaxAccelRec, CSyncMinStepTime, CAsyncMinStepTime>;
         
-        struct Object : public ObjBase<Axis, typename TheCommon::Object, EmptyTypeList> {
+        struct Object : public ObjBase<Axis, typename TheCommon::Object, MakeTypeList<
+            PressureAdvanceFeature,
+            InputShaperFeature,
+            JerkLimitFeature
+        >> {
             FpType last_x_by_distance;
         };
     };
@@ -725,6 +1193,8 @@ public:
         using TheCommon = AxisCommon<Laser>;
         using TheStepper = TheLaserDriver;
         static bool const IsFirst = false;
+        static int const CommandsPerSegment = 3;
+        static int const TailCommands = 1;
         using TheLaserSegment = LaserSegment<LaserIndex>;
         static TimeType const AdjustmentIntervalTicks = LaserSpec::TheLaserDriverService::AdjustmentInterval::value() / Clock::time_unit;
         
@@ -834,6 +1304,12 @@ public:
             }
         }
         
+        template <typename TheTheMinTimeType>
+        static void gen_rest_command (Context c, TheTheMinTimeType t)
+        {
+            TheCommon::gen_stepper_command(c, t, 0.0f, 0.0f);
+        }
+        
         static void start_stepping_impl (Context c, TimeType start_time, StepperCommand *cmd)
         {
             TheLaserDriver::start(c, start_time, cmd);
@@ -1071,10 +1547,12 @@ public:
         o->m_segments_start = 0;
         o->m_segments_staging_length = 0;
         o->m_segments_length = 0;
+        o->m_segments_pushed_length = 0;
         o->m_staging_time = 0;
         o->m_staging_v_squared = 0.0f;
         o->m_staging_v = 0.0f;
         o->m_last_max_v = 0.0f;
+        JunctionDeviationFeature::init(c);
         o->m_last_dir_and_type = 0;
         o->m_split_buffer.type = 0xFF;
         o->m_state = STATE_BUFFERING;
@@ -1085,6 +1563,9 @@ public:
 #ifdef AMBROLIB_ASSERTIONS
         o->m_pulling = false;
         o->m_planned = false;
+#endif
+#ifdef MOTIONPLANNER_BENCHMARK
+        o->m_bench_stats = BenchStats();
 #endif
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::init(c, prestep_callback_enabled)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::init(c)));
@@ -1132,6 +1613,7 @@ public:
             o->m_split_buffer.axes.split_count = FloatCeil(ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::compute_split_count(accum, c))));
             o->m_split_buffer.axes.split_frac = (FpType)1.0 / o->m_split_buffer.axes.split_count;
             o->m_split_buffer.axes.rel_max_v_rec *= o->m_split_buffer.axes.split_frac;
+            JunctionDeviationFeature::fixup_split(c);
             ListFor<LasersList>([&] APRINTER_TL(laser, laser::fixup_split(c)));
         }
         
@@ -1190,6 +1672,22 @@ public:
     }
 #endif
     
+#ifdef MOTIONPLANNER_BENCHMARK
+    struct BenchStats {
+        uint32_t segments;
+        uint32_t plans;
+        uint32_t push_steps;
+        uint32_t stepper_commands;
+        uint32_t jerk_limit_misses;
+    };
+    
+    static BenchStats getBenchStats (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->m_bench_stats;
+    }
+#endif
+    
     template <int ChannelIndex>
     using GetChannelTimer = typename Channel<ChannelIndex>::TheTimer;
     
@@ -1230,31 +1728,54 @@ private:
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) { AMBRO_ASSERT(planner_have_commit_space(c)) }
 #endif
         
+#ifdef MOTIONPLANNER_BENCHMARK
+        o->m_bench_stats.plans++;
+#endif
+        
+        // Backward pass. Segments below m_segments_pushed_length were pushed by
+        // a previous plan() and their end speeds can only have increased since.
+        // Once one of them comes out unchanged, so would all preceding ones.
         SegmentBufferSizeType i = o->m_segments_length;
         FpType v = 0.0f;
         do {
             i--;
-            Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
+            SegmentBufferSizeType pos = segments_add(o->m_segments_start, i);
+            Segment *entry = &o->m_segments[pos];
             if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
-                v = TheLinearPlanner::push(&entry->axes.lp_seg, &o->m_segment_state[i], v);
+                if (i < o->m_segments_pushed_length) {
+                    if (!TheLinearPlanner::repush(&entry->axes.lp_seg, &o->m_segment_state[pos], &v)) {
+                        break;
+                    }
+                } else {
+                    v = TheLinearPlanner::push(&entry->axes.lp_seg, &o->m_segment_state[pos], v);
+                }
+#ifdef MOTIONPLANNER_BENCHMARK
+                o->m_bench_stats.push_steps++;
+#endif
             }
         } while (i != 0);
         
+        o->m_segments_pushed_length = o->m_segments_length;
+        
         SegmentBufferSizeType commit_count = MinValue(o->m_segments_length, (SegmentBufferSizeType)LookaheadCommitCount);
         
         o->m_new_to_backup = false;
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::start_commands(c)));
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::PressureAdvanceFeature::start_commands(c)));
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::InputShaperFeature::start_commands(c)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::start_commands(c)));
         
         TimeType time = o->m_staging_time;
         v = o->m_staging_v_squared;
         FpType v_start = o->m_staging_v;
         
+        i = 0;
         do {
-            Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
+            SegmentBufferSizeType pos = segments_add(o->m_segments_start, i);
+            Segment *entry = &o->m_segments[pos];
             if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
                 typename TheLinearPlanner::SegmentResult result;
-                v = TheLinearPlanner::pull(&entry->axes.lp_seg, &o->m_segment_state[i], v, &result);
+                v = TheLinearPlanner::pull(&entry->axes.lp_seg, &o->m_segment_state[pos], v, &result);
                 FpType v_end = FloatSqrt(v);
                 FpType v_const = FloatSqrt(result.const_v);
                 FpType vdiff0 = v_const - v_start;
@@ -1275,9 +1796,14 @@ private:
                     t1.m_bits.m_int -= t2.bitsValue();
                 }
                 time += t_sum.bitsValue();
+                FpType ramp0 = 0.0f;
+                FpType ramp2 = 0.0f;
+                if (HaveJerkLimit) {
+                    compute_ramp_times(c, entry, t0.bitsValue(), t2.bitsValue(), vdiff0, vdiff2, &ramp0, &ramp2);
+                }
                 ListFor<AxesList>([&] APRINTER_TL(axis, axis::gen_segment_stepper_commands(c, entry,
                                     result.const_start, result.const_end, t0, t2, t1,
-                                    vdiff0 * vdiff0, vdiff2 * vdiff2)));
+                                    vdiff0 * vdiff0, vdiff2 * vdiff2, ramp0, ramp2, v == 0.0f)));
                 ListFor<LasersList>([&] APRINTER_TL(laser, laser::gen_segment_stepper_commands(c, entry,
                     t0, t2, t1, v_start, v_end, v_const)));
                 v_start = v_end;
@@ -1285,6 +1811,9 @@ private:
                 ListForOne<ChannelsList, 1>((entry->dir_and_type & TypeMask), [&] APRINTER_TL(channel, channel::gen_command(c, entry, time)));
             }
             i++;
+            if (HaveInputShaping && AMBRO_UNLIKELY(i == o->m_segments_length)) {
+                gen_shaper_tail(c, &time);
+            }
             if (AMBRO_UNLIKELY(i == commit_count)) {
                 // It's safe to update these here before committing the new plan,
                 // since in case of commit failure (loss of sync), plan() will
@@ -1293,6 +1822,8 @@ private:
                 o->m_staging_time = time;
                 o->m_staging_v_squared = v;
                 o->m_staging_v = v_start;
+                ListFor<AxesList>([&] APRINTER_TL(axis, axis::PressureAdvanceFeature::reached_commit_point(c)));
+                ListFor<AxesList>([&] APRINTER_TL(axis, axis::InputShaperFeature::reached_commit_point(c)));
             }
         } while (i != o->m_segments_length);
         
@@ -1314,9 +1845,12 @@ private:
         }
         
         if (AMBRO_LIKELY(ok)) {
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::PressureAdvanceFeature::committed(c)));
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::InputShaperFeature::committed(c)));
             o->m_segments_start = segments_add(o->m_segments_start, commit_count);
             o->m_segments_length -= commit_count;
             o->m_segments_staging_length = o->m_segments_length;
+            o->m_segments_pushed_length = o->m_segments_length;
 #ifdef AMBROLIB_ASSERTIONS
             o->m_planned = true;
 #endif
@@ -1324,6 +1858,44 @@ private:
         return ok;
     }
     
+    // Computes the S-curve ramp times of the acceleration and deceleration
+    // phase of a segment, common to all axes. The velocity of an axis is
+    // v * x / distance, and distance_rec = 2 * a_x_rec / max_accel_rec, so
+    // the axis with the largest x * MaxJerkRec needs the longest ramp.
+    static void compute_ramp_times (Context c, Segment *entry, FpType t0, FpType t2, FpType vdiff0, FpType vdiff2, FpType *ramp0, FpType *ramp2)
+    {
+        FpType jerk_rec = ListForFold<AxesList>(0.0f, [&] APRINTER_TLA(axis, (FpType accum), return axis::JerkLimitFeature::ramp_jerk_rec(accum, c, entry)));
+        jerk_rec *= 2.0f * entry->axes.lp_seg.a_x_rec / entry->axes.max_accel_rec;
+        *ramp0 = phase_ramp_time(c, t0, vdiff0, jerk_rec);
+        *ramp2 = phase_ramp_time(c, t2, vdiff2, jerk_rec);
+    }
+    
+    // If the phase is too short to keep within the jerk limit, the ramp is
+    // t/2, the longest possible; the planner does not lengthen phases for
+    // that (the benchmark counts these as jerk_limit_misses).
+    static FpType phase_ramp_time (Context c, FpType t, FpType vdiff, FpType jerk_rec)
+    {
+#ifdef MOTIONPLANNER_BENCHMARK
+        auto *o = Object::self(c);
+        if (vdiff > 0.0f && !TheSCurve::jerk_limit_possible(t, vdiff, jerk_rec)) {
+            o->m_bench_stats.jerk_limit_misses++;
+        }
+#endif
+        return TheSCurve::ramp_time(t, vdiff, jerk_rec);
+    }
+    
+    // With input shaping, the shaped axes keep moving for a while after the
+    // planned motion comes to rest. All axes and lasers get commands for this
+    // time, so they stay in sync when the following segments are planned.
+    static void gen_shaper_tail (Context c, TimeType *time)
+    {
+        FpType tail_time = ListForFold<AxesList>(0.0f, [&] APRINTER_TLA(axis, (FpType accum), return axis::InputShaperFeature::tail_time(accum, c)));
+        MinTimeType t = MinTimeType::importFpSaturatedRound(FloatCeil(tail_time));
+        *time += t.bitsValue();
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::InputShaperFeature::gen_tail(c, t)));
+        ListFor<LasersList>([&] APRINTER_TL(laser, laser::gen_rest_command(c, t)));
+    }
+    
     static void planner_start_stepping (Context c)
     {
         auto *o = Object::self(c);
@@ -1472,10 +2044,13 @@ private:
         o->m_state = STATE_BUFFERING;
         o->m_segments_start = segments_add(o->m_segments_start, o->m_segments_staging_length);
         o->m_segments_length -= o->m_segments_staging_length;
+        o->m_segments_pushed_length -= o->m_segments_staging_length;
         o->m_segments_staging_length = 0;
         o->m_staging_time = 0;
         o->m_staging_v_squared = 0.0f;
         o->m_staging_v = 0.0f;
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::PressureAdvanceFeature::underrun(c)));
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::InputShaperFeature::underrun(c)));
 #ifdef AMBROLIB_ASSERTIONS
         o->m_planned = false;
 #endif
@@ -1493,6 +2068,9 @@ private:
         entry->dir_and_type = o->m_split_buffer.type;
         
         if (AMBRO_LIKELY(o->m_split_buffer.type == 0)) {
+#ifdef MOTIONPLANNER_BENCHMARK
+            o->m_bench_stats.segments++;
+#endif
             o->m_split_buffer.axes.split_pos++;
             ListFor<AxesList>([&] APRINTER_TL(axis, axis::write_segment_buffer_entry(c, entry)));
             
@@ -1515,15 +2093,23 @@ private:
             ListFor<LasersList>([&] APRINTER_TL(laser, laser::write_segment_buffer_entry_extra(c, entry, distance_rec)));
             
             FpType rel_max_accel_rec = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::compute_segment_buffer_entry_accel(accum, c, &cst)));
-            entry->axes.max_accel_rec = rel_max_accel_rec * distance_rec;
-            FpType half_rel_max_accel = 0.5f / rel_max_accel_rec;
+            // When a jerk-limited axis moves, the phases are S-curves for all
+            // axes, so plan at half the acceleration to keep the peak within
+            // the limit (see SCurve). Otherwise there is no ramp and the
+            // acceleration is not reduced.
+            FpType segment_jerk_rec = ListForFold<AxesList>(0.0f, [&] APRINTER_TLA(axis, (FpType accum), return axis::JerkLimitFeature::ramp_jerk_rec(accum, c, entry)));
+            FpType rel_plan_accel_rec = (segment_jerk_rec > 0.0f) ? 2.0f * rel_max_accel_rec : rel_max_accel_rec;
+            entry->axes.max_accel_rec = rel_plan_accel_rec * distance_rec;
+            FpType half_rel_max_accel = 0.5f / rel_plan_accel_rec;
             
             FpType distance_rec_for_junction = AMBRO_UNLIKELY(degenerate) ? NAN : distance_rec;
             FpType junction_max_v_rec = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::do_junction_limit(accum, c, entry, distance_rec_for_junction, &cst)));
-            FpType junction_max_start_v = AMBRO_UNLIKELY(FloatIsNan(junction_max_v_rec)) ? 0.0f : (1.0f / junction_max_v_rec);
             o->m_last_dir_and_type = entry->dir_and_type;
             
             FpType distance_squared = distance * distance;
+            FpType junction_max_start_v = AMBRO_UNLIKELY(FloatIsNan(junction_max_v_rec)) ? 0.0f : (1.0f / junction_max_v_rec);
+            junction_max_start_v = JunctionDeviationFeature::limit(c, junction_max_start_v, distance_squared, rel_max_accel_rec);
+            
             FpType max_v = distance_squared / (entry->axes.rel_max_speed_rec * entry->axes.rel_max_speed_rec);
             FpType a_x = FloatLdexp(half_rel_max_accel * distance_squared, 2);
             TheLinearPlanner::initSegment(&entry->axes.lp_seg, o->m_last_max_v, junction_max_start_v, max_v, a_x);
@@ -1544,6 +2130,85 @@ private:
         }
     }
     
+    /**
+     * Junction deviation cornering: the junction speed is that of a circular
+     * arc tangent to both segments which deviates from the corner point by
+     * JunctionDeviation, traversed at the acceleration limit of the new
+     * segment. The direction vectors are the X, Y and Z motion given with
+     * each axes command (junction_vec), so on a delta these are the virtual
+     * axes, and extruders do not take part. Where either segment has no X, Y
+     * or Z motion (e.g. a retraction), the per-axis limit is used.
+     * 
+     * If JunctionDeviationEnabled is constantly false, this is left out. If
+     * it is disabled at runtime, nothing is computed and the first junction
+     * after enabling it uses the per-axis limit.
+     */
+    AMBRO_STRUCT_IF(JunctionDeviationFeature, JunctionDeviationSupported) {
+        struct Object;
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->last_len_squared = 0.0f;
+        }
+        
+        static void fixup_split (Context c)
+        {
+            auto *m = MotionPlanner::Object::self(c);
+            for (int i = 0; i < 3; i++) {
+                m->m_split_buffer.axes.junction_vec[i] *= m->m_split_buffer.axes.split_frac;
+            }
+        }
+        
+        static FpType limit (Context c, FpType per_axis_max_start_v, FpType distance_squared, FpType rel_max_accel_rec)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            
+            if (!APRINTER_CFG(Config, CJunctionDeviationEnabled, c)) {
+                o->last_len_squared = 0.0f;
+                return per_axis_max_start_v;
+            }
+            
+            FpType const *vec = m->m_split_buffer.axes.junction_vec;
+            FpType dot = 0.0f;
+            FpType len_squared = 0.0f;
+            for (int i = 0; i < 3; i++) {
+                dot += vec[i] * o->last_vec[i];
+                len_squared += vec[i] * vec[i];
+                o->last_vec[i] = vec[i];
+            }
+            FpType len_product_squared = o->last_len_squared * len_squared;
+            o->last_len_squared = len_squared;
+            if (AMBRO_UNLIKELY(!(len_product_squared > 0.0f))) {
+                return per_axis_max_start_v;
+            }
+            
+            // The result is converted from mm to the planner's per-segment
+            // distance units.
+            FpType cos_dir = dot / FloatSqrt(len_product_squared);
+            FpType sin_half_theta = FloatSqrt(FloatMax((FpType)0.0f, (FpType)0.5f * ((FpType)1.0f + cos_dir)));
+            if (AMBRO_UNLIKELY(sin_half_theta >= 1.0f)) {
+                return INFINITY;
+            }
+            return (APRINTER_CFG(Config, CJunctionDeviation, c) * sin_half_theta * distance_squared) /
+                   ((1.0f - sin_half_theta) * rel_max_accel_rec * FloatSqrt(len_squared));
+        }
+        
+        struct Object : public ObjBase<JunctionDeviationFeature, typename MotionPlanner::Object, EmptyTypeList> {
+            FpType last_vec[3];
+            FpType last_len_squared;
+        };
+    } AMBRO_STRUCT_ELSE(JunctionDeviationFeature) {
+        static void init (Context c) {}
+        static void fixup_split (Context c) {}
+        static FpType limit (Context c, FpType per_axis_max_start_v, FpType distance_squared, FpType rel_max_accel_rec)
+        {
+            return per_axis_max_start_v;
+        }
+        struct Object {};
+    };
+    
     static SegmentBufferSizeType segments_add (SegmentBufferSizeType i, SegmentBufferSizeType j)
     {
         SegmentBufferSizeType res = i + j;
@@ -1556,11 +2221,13 @@ private:
 public:
     struct Object : public ObjBase<MotionPlanner, ParentObject, JoinTypeLists<
         AxisCommonList,
-        ChannelsList
+        ChannelsList,
+        MakeTypeList<JunctionDeviationFeature>
     >> {
         SegmentBufferSizeType m_segments_start;
         SegmentBufferSizeType m_segments_staging_length;
         SegmentBufferSizeType m_segments_length;
+        SegmentBufferSizeType m_segments_pushed_length;
         TimeType m_staging_time;
         FpType m_staging_v_squared;
         FpType m_staging_v;
@@ -1575,6 +2242,9 @@ public:
 #ifdef AMBROLIB_ASSERTIONS
         bool m_pulling;
         bool m_planned;
+#endif
+#ifdef MOTIONPLANNER_BENCHMARK
+        BenchStats m_bench_stats;
 #endif
         SplitBuffer m_split_buffer;
         Segment m_segments[LookaheadBufferSize];
@@ -1592,6 +2262,8 @@ APRINTER_ALIAS_STRUCT_EXT(MotionPlannerArg, (
     APRINTER_AS_VALUE(int, LookaheadCommitCount),
     APRINTER_AS_TYPE(FpType),
     APRINTER_AS_TYPE(MaxStepsPerCycle),
+    APRINTER_AS_TYPE(JunctionDeviationEnabled),
+    APRINTER_AS_TYPE(JunctionDeviation),
     APRINTER_AS_TYPE(PullHandler),
     APRINTER_AS_TYPE(FinishedHandler),
     APRINTER_AS_TYPE(AbortedHandler),
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_SCURVE_H
+#define AMBROLIB_SCURVE_H
+
+#include <aprinter/math/FloatTools.h>
+
+namespace APrinter {
+
+/*
+ * Jerk-limited (S-curve) version of a constant acceleration phase.
+ * 
+ * The phase keeps its duration t and velocity change, but the acceleration
+ * ramps up from zero over the ramp time, stays at its peak, then ramps back
+ * down to zero. Since the profile is symmetric, the distance is unchanged
+ * too. The peak acceleration is mean_accel * t / (t - ramp), so with the
+ * longest ramp of t/2 it is twice the mean. A phase planned at half the
+ * acceleration limit therefore never exceeds the limit.
+ * 
+ * For execution as constant acceleration commands, each ramp is divided into
+ * RampPieces pieces, using the mean acceleration of the ramp over each piece
+ * so that the velocity at piece boundaries is exact. Pieces are numbered
+ * from 0 to NumPieces-1, with the constant part in the middle.
+ */
+template <typename FpType, int RampPieces>
+struct SCurve {
+    static_assert(RampPieces >= 1, "");
+    
+    static int const NumPieces = 2 * RampPieces + 1;
+    
+    // Whether the velocity change can be made in time t with the jerk at
+    // or below 1/jerk_rec. The shortest such time is 2 * sqrt(vdiff * jerk_rec).
+    static bool jerk_limit_possible (FpType t, FpType vdiff, FpType jerk_rec)
+    {
+        return t * t >= 4.0f * vdiff * jerk_rec;
+    }
+    
+    // Ramp time which keeps the jerk at or below 1/jerk_rec, or t/2 if
+    // that is not possible (see jerk_limit_possible()).
+    static FpType ramp_time (FpType t, FpType vdiff, FpType jerk_rec)
+    {
+        // The peak acceleration vdiff / (t - ramp) is reached after the ramp
+        // time, so the jerk is vdiff / ((t - ramp) * ramp).
+        FpType disc = t * t - 4.0f * vdiff * jerk_rec;
+        if (!(disc > 0.0f)) {
+            return 0.5f * t;
+        }
+        return 0.5f * (t - FloatSqrt(disc));
+    }
+    
+    static FpType piece_end (int k, FpType t, FpType ramp)
+    {
+        if (k < RampPieces) {
+            return (k + 1) * (ramp / RampPieces);
+        }
+        return (t - ramp) + (k - RampPieces) * (ramp / RampPieces);
+    }
+    
+    static FpType piece_accel (int k, FpType t, FpType ramp, FpType mean_accel)
+    {
+        FpType peak = mean_accel * t / (t - ramp);
+        int j = (k <= RampPieces) ? k : (NumPieces - 1 - k);
+        if (j == RampPieces) {
+            return peak;
+        }
+        return peak * ((FpType)(2 * j + 1) / (2 * RampPieces));
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_ADAPTIVE_SPLITTER_H
+#define AMBROLIB_ADAPTIVE_SPLITTER_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/PowerOfTwo.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/printer/Configuration.h>
+
+namespace APrinter {
+
+/**
+ * Splitter which chooses the number of segments from the deviation of the
+ * actual path (with physical axes moving linearly within a segment) from the
+ * straight line in virtual space, instead of only from the move distance.
+ * 
+ * The deviation is measured for each quarter of the move. Since it is
+ * proportional to the square of the segment length for a given curvature,
+ * this gives the number of segments needed to stay within MaxDeviation. The
+ * measured deviation is doubled to allow for the curvature varying within a
+ * quarter. The count is further bounded so that segments are no longer than
+ * MaxSplitLength and no shorter than MinSplitLength. If the deviation cannot
+ * be determined, the move is split into segments of MinSplitLength.
+ */
+template <typename Arg>
+class AdaptiveSplitter {
+    using Context      = typename Arg::Context;
+    using ParentObject = typename Arg::ParentObject;
+    using Config       = typename Arg::Config;
+    using FpType       = typename Arg::FpType;
+    using Params       = typename Arg::Params;
+    
+public:
+    struct Object;
+    
+private:
+    using CMinSplitLengthRec = decltype(ExprCast<FpType>(ExprRec(Config::e(Params::MinSplitLength::i()))));
+    using CMaxSplitLengthRec = decltype(ExprCast<FpType>(ExprRec(Config::e(Params::MaxSplitLength::i()))));
+    using CMaxDeviationRec = decltype(ExprCast<FpType>(ExprRec(Config::e(Params::MaxDeviation::i()))));
+    
+    static int const NumProbes = 4;
+    
+public:
+    class Splitter {
+    public:
+        template <typename DeviationFunc>
+        void start (Context c, FpType distance, FpType base_max_v_rec, FpType time_freq_by_max_speed, DeviationFunc deviation_func)
+        {
+            FpType min_fpcount = distance * APRINTER_CFG(Config, CMaxSplitLengthRec, c);
+            FpType max_fpcount = distance * APRINTER_CFG(Config, CMinSplitLengthRec, c);
+            
+            FpType fpcount = max_fpcount;
+            if (min_fpcount < max_fpcount) {
+                FpType max_deviation = 0.0f;
+                bool deviation_known = true;
+                for (int i = 0; i < NumProbes; i++) {
+                    FpType deviation;
+                    if (!deviation_func((FpType)i / NumProbes, (FpType)(i + 1) / NumProbes, &deviation)) {
+                        deviation_known = false;
+                        break;
+                    }
+                    max_deviation = FloatMax(max_deviation, deviation);
+                }
+                if (deviation_known) {
+                    FpType deviation_fpcount = NumProbes * FloatSqrt(2.0f * max_deviation * APRINTER_CFG(Config, CMaxDeviationRec, c));
+                    if (deviation_fpcount < max_fpcount) {
+                        fpcount = FloatMax(min_fpcount, deviation_fpcount);
+                    }
+                }
+            }
+            
+            if (fpcount >= FloatLdexp(FpType(1.0f), 31)) {
+                m_count = PowerOfTwo<uint32_t, 31>::Value;
+            } else {
+                m_count = 1 + (uint32_t)fpcount;
+            }
+            m_pos = 1;
+            m_max_v_rec = base_max_v_rec / m_count;
+        }
+        
+        bool pull (Context c, FpType *out_rel_max_v_rec, FpType *out_frac)
+        {
+            *out_rel_max_v_rec = m_max_v_rec;
+            if (m_pos == m_count) {
+                return false;
+            }
+            *out_frac = (FpType)m_pos / m_count;
+            m_pos++;
+            return true;
+        }
+    
+    private:
+        uint32_t m_count;
+        uint32_t m_pos;
+        FpType m_max_v_rec;
+    };
+    
+public:
+    using ConfigExprs = MakeTypeList<CMinSplitLengthRec, CMaxSplitLengthRec, CMaxDeviationRec>;
+    
+    struct Object : public ObjBase<AdaptiveSplitter, ParentObject, EmptyTypeList> {};
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AdaptiveSplitterService, (
+    APRINTER_AS_TYPE(MinSplitLength),
+    APRINTER_AS_TYPE(MaxSplitLength),
+    APRINTER_AS_TYPE(MaxDeviation)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Splitter, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(Config),
+        APRINTER_AS_TYPE(FpType)
+    ), (
+        using Params = AdaptiveSplitterService;
+        APRINTER_DEF_INSTANCE(Splitter, AdaptiveSplitter)
+    ))
+))
+
+}
+
+#endif
@@ -56,7 +56,8 @@ private:
 public:
     class Splitter {
     public:
-        void start (Context c, FpType distance, FpType base_max_v_rec, FpType time_freq_by_max_speed)
+        template <typename DeviationFunc>
+        void start (Context c, FpType distance, FpType base_max_v_rec, FpType time_freq_by_max_speed, DeviationFunc deviation_func)
         {
             FpType base_segments_by_distance = APRINTER_CFG(Config, CSegmentsPerSecondTimeUnit, c) * time_freq_by_max_speed;
             FpType fpcount = distance * FloatMin(APRINTER_CFG(Config, CMinSplitLengthRec, c), FloatMax(APRINTER_CFG(Config, CMaxSplitLengthRec, c), base_segments_by_distance));
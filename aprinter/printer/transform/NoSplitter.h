@@ -37,7 +37,8 @@ class NoSplitter {
 public:
     class Splitter {
     public:
-        void start (Context c, FpType distance, FpType base_max_v_rec, FpType time_freq_by_max_speed)
+        template <typename DeviationFunc>
+        void start (Context c, FpType distance, FpType base_max_v_rec, FpType time_freq_by_max_speed, DeviationFunc deviation_func)
         {
             m_max_v_rec = base_max_v_rec;
         }
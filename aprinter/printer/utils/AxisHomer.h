@@ -118,10 +118,13 @@ private:
     using PlannerMaxAccelRec = decltype(ExprRec(MaxAccel() * AccelConversion()));
     using PlannerDistanceFactor = APRINTER_FP_CONST_EXPR(1.0);
     using PlannerCorneringDistance = APRINTER_FP_CONST_EXPR(1.0);
+    using PlannerJunctionDeviationEnabled = decltype(ExprBoolConst<false>());
+    using PlannerJunctionDeviation = APRINTER_FP_CONST_EXPR(0.0);
+    using PlannerPressureAdvance = APRINTER_FP_CONST_EXPR(0.0);
     
-    struct PlannerAxisSpec : public MotionPlannerAxisSpec<TheAxisDriver, PlannerStepBits, PlannerDistanceFactor, PlannerCorneringDistance, PlannerMaxSpeedRec, PlannerMaxAccelRec, PlannerPrestepCallback> {};
+    struct PlannerAxisSpec : public MotionPlannerAxisSpec<TheAxisDriver, PlannerStepBits, PlannerDistanceFactor, PlannerCorneringDistance, PlannerMaxSpeedRec, PlannerMaxAccelRec, false, PlannerPressureAdvance, MotionPlannerNoInputShaper, MotionPlannerNoJerkLimit, PlannerPrestepCallback> {};
     using PlannerAxes = MakeTypeList<PlannerAxisSpec>;
-    APRINTER_MAKE_INSTANCE(Planner, (MotionPlannerArg<Context, Object, Config, PlannerAxes, StepperSegmentBufferSize, LookaheadBufferSize, LookaheadCommitCount, FpType, MaxStepsPerCycle, PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback, EmptyTypeList, EmptyTypeList>))
+    APRINTER_MAKE_INSTANCE(Planner, (MotionPlannerArg<Context, Object, Config, PlannerAxes, StepperSegmentBufferSize, LookaheadBufferSize, LookaheadCommitCount, FpType, MaxStepsPerCycle, PlannerJunctionDeviationEnabled, PlannerJunctionDeviation, PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback, EmptyTypeList, EmptyTypeList>))
     using PlannerCommand = typename Planner::SplitBuffer;
     
     using TheDebugObject = DebugObject<Context, Object>;
@@ -35,6 +35,7 @@
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/Hints.h>
 #include <aprinter/base/LoopUtils.h>
+#include <aprinter/math/FastStrToFloat.h>
 #include <aprinter/printer/utils/GcodeCommand.h>
 
 namespace APrinter {
@@ -45,11 +46,14 @@ class BinaryGcodeParser
   private SimpleDebugObject<Context>
 {
     static_assert(Params::MaxParts <= 14, "");
+    static_assert(Params::MaxMoveAxes >= 0 && Params::MaxMoveAxes <= 7, "");
     
     enum {
         CMD_TYPE_G0 = 1,
         CMD_TYPE_G1 = 2,
         CMD_TYPE_G92 = 3,
+        CMD_TYPE_MOVE_AXES = 4,
+        CMD_TYPE_MOVES = 5,
         CMD_TYPE_EOF = 14,
         CMD_TYPE_LONG = 15,
     };
@@ -59,9 +63,19 @@ class BinaryGcodeParser
         DATA_TYPE_DOUBLE = 2,
         DATA_TYPE_UINT32 = 3,
         DATA_TYPE_UINT64 = 4,
-        DATA_TYPE_VOID = 5
+        DATA_TYPE_VOID = 5,
+        // Not in the encoding, used for parts decoded from move records.
+        DATA_TYPE_FIXED = 8
     };
     
+    // Move records (see encoding.txt) give each axis as a varint delta of an
+    // integer value in units of 10^-decimals. The decoder keeps the current
+    // value of each axis, and the parts only refer to the result, so the
+    // values are converted only if and when they are requested.
+    static int const MoveAxesArraySize = (Params::MaxMoveAxes > 0) ? Params::MaxMoveAxes : 1;
+    static uint8_t const MoveRepeatFeedBit = 0x80;
+    static int const MaxVarintBytes = 5;
+    
 public:
     using BufferSizeType = TBufferSizeType;
     using PartsSizeType = int8_t;
@@ -73,13 +87,25 @@ private:
         uint8_t data_type;
         char code;
         uint8_t data_size;
-        uint8_t *data;
+        uint8_t axis;
+        union {
+            uint8_t *data;
+            uint32_t fixed_value;
+        };
+    };
+    
+    struct MoveAxis {
+        char code;
+        uint8_t decimals;
+        uint32_t value;
     };
     
 public:
     void init (Context c)
     {
         m_state = STATE_NOCMD;
+        m_num_axes = 0;
+        m_batch_remaining = 0;
         
         this->debugInit(c);
     }
@@ -122,17 +148,30 @@ public:
                     if (m_num_parts < 0) {
                         goto finish;
                     }
+                    if (m_batch_remaining > 0) {
+                        m_state = STATE_RECORD;
+                        break;
+                    }
                     if (avail < 1) {
                         return false;
                     }
                     m_length = 1;
+                    uint8_t cmd_type = m_buffer[0] >> 4;
+                    if (cmd_type == CMD_TYPE_MOVE_AXES || cmd_type == CMD_TYPE_MOVES) {
+                        if (Params::MaxMoveAxes == 0) {
+                            m_num_parts = GCODE_ERROR_INVALID_PART;
+                            goto finish;
+                        }
+                        m_state = (cmd_type == CMD_TYPE_MOVE_AXES) ? STATE_MOVE_AXES : STATE_MOVES;
+                        break;
+                    }
                     m_num_parts = m_buffer[0] & 0x0f;
                     if (m_num_parts > Params::MaxParts) {
                         m_num_parts = GCODE_ERROR_TOO_MANY_PARTS;
                         goto finish;
                     }
                     m_state = STATE_INDEX;
-                    switch (m_buffer[0] >> 4) {
+                    switch (cmd_type) {
                         case CMD_TYPE_G0: {
                             m_cmd_code = 'G';
                             m_cmd_num = 0;
@@ -209,6 +248,125 @@ public:
                     m_length = m_total_size;
                     goto finish;
                 } break;
+                
+                case STATE_MOVE_AXES: {
+                    AMBRO_ASSERT(m_length == 1)
+                    uint8_t num_axes = m_buffer[0] & 0x0f;
+                    if (num_axes > Params::MaxMoveAxes) {
+                        m_num_parts = GCODE_ERROR_TOO_MANY_PARTS;
+                        goto finish;
+                    }
+                    if (avail - m_length < num_axes) {
+                        return false;
+                    }
+                    for (auto i : LoopRange<uint8_t>(num_axes)) {
+                        uint8_t axis_byte = m_buffer[1 + i];
+                        m_axes[i].code = 'A' + (axis_byte & 0x1f);
+                        m_axes[i].decimals = axis_byte >> 5;
+                        m_axes[i].value = 0;
+                    }
+                    m_num_axes = num_axes;
+                    m_length += num_axes;
+                    m_num_parts = GCODE_ERROR_NO_PARTS;
+                    goto finish;
+                } break;
+                
+                case STATE_MOVES: {
+                    AMBRO_ASSERT(m_length == 1)
+                    if (avail < 2) {
+                        return false;
+                    }
+                    switch (m_buffer[0] & 0x0f) {
+                        case 0: m_cmd_num = 0; break;
+                        case 1: m_cmd_num = 1; break;
+                        case 2: m_cmd_num = 92; break;
+                        default:
+                            m_num_parts = GCODE_ERROR_INVALID_PART;
+                            goto finish;
+                    }
+                    if (m_buffer[1] == 0) {
+                        m_num_parts = GCODE_ERROR_INVALID_PART;
+                        goto finish;
+                    }
+                    m_cmd_code = 'G';
+                    m_length = 2;
+                    m_state = STATE_RECORD;
+                } break;
+                
+                case STATE_RECORD: {
+                    // The record follows the batch header or is a continuation
+                    // of the batch. Nothing is stored in m_axes until the whole
+                    // record is available, so it can be decoded again.
+                    AMBRO_ASSERT(m_length == 0 || m_length == 2)
+                    BufferSizeType offset = m_length;
+                    if (avail - offset < 1) {
+                        return false;
+                    }
+                    uint8_t mask = m_buffer[offset++];
+                    PartsSizeType num_parts = 0;
+                    bool repeated_feed = false;
+                    if ((uint8_t)(mask & ~MoveRepeatFeedBit) >> m_num_axes) {
+                        m_num_parts = GCODE_ERROR_INVALID_PART;
+                        goto record_error;
+                    }
+                    for (auto i : LoopRange<uint8_t>(m_num_axes)) {
+                        bool repeat = (mask & MoveRepeatFeedBit) && m_axes[i].code == 'F';
+                        if (!(mask & (1 << i)) && !repeat) {
+                            continue;
+                        }
+                        if (num_parts == Params::MaxParts) {
+                            m_num_parts = GCODE_ERROR_TOO_MANY_PARTS;
+                            goto record_error;
+                        }
+                        uint32_t value = m_axes[i].value;
+                        if (repeat) {
+                            if ((mask & (1 << i))) {
+                                m_num_parts = GCODE_ERROR_INVALID_PART;
+                                goto record_error;
+                            }
+                            repeated_feed = true;
+                        } else {
+                            uint32_t zigzag = 0;
+                            for (int shift = 0;; shift += 7) {
+                                if (shift == 7 * MaxVarintBytes) {
+                                    m_num_parts = GCODE_ERROR_INVALID_PART;
+                                    goto record_error;
+                                }
+                                if (offset == avail) {
+                                    return false;
+                                }
+                                uint8_t byte = m_buffer[offset++];
+                                zigzag |= (uint32_t)(byte & 0x7f) << shift;
+                                if (!(byte & 0x80)) {
+                                    break;
+                                }
+                            }
+                            value += (zigzag >> 1) ^ -(zigzag & 1);
+                        }
+                        m_parts[num_parts].data_type = DATA_TYPE_FIXED;
+                        m_parts[num_parts].code = m_axes[i].code;
+                        m_parts[num_parts].data_size = 0;
+                        m_parts[num_parts].axis = i;
+                        m_parts[num_parts].fixed_value = value;
+                        num_parts++;
+                    }
+                    if ((mask & MoveRepeatFeedBit) && !repeated_feed) {
+                        m_num_parts = GCODE_ERROR_INVALID_PART;
+                        goto record_error;
+                    }
+                    for (auto i : LoopRange<PartsSizeType>(num_parts)) {
+                        m_axes[m_parts[i].axis].value = m_parts[i].fixed_value;
+                    }
+                    m_batch_remaining = ((m_length == 0) ? m_batch_remaining : m_buffer[1]) - 1;
+                    m_length = offset;
+                    m_num_parts = num_parts;
+                    goto finish;
+                    
+                record_error:
+                    m_batch_remaining = 0;
+                    m_length = offset;
+                    goto finish;
+                } break;
             }
         }
         
@@ -300,6 +458,10 @@ public:
                 return val;
             } break;
             
+            case DATA_TYPE_FIXED: {
+                return fixed_fp_value(cast_part_ref(part));
+            } break;
+            
             default:
                 return 0.0f;
         }
@@ -319,6 +481,18 @@ public:
                 return val;
             } break;
             
+            case DATA_TYPE_FIXED: {
+                // Like StrToUint32 on the decimal text: the integer part,
+                // negated for negative values.
+                uint32_t val = cast_part_ref(part)->fixed_value;
+                bool negative = (int32_t)val < 0;
+                uint32_t mag = negative ? -val : val;
+                for (uint8_t i = 0; i < m_axes[cast_part_ref(part)->axis].decimals; i++) {
+                    mag /= 10;
+                }
+                return negative ? -mag : mag;
+            } break;
+            
             default:
                 return 0;
         }
@@ -334,13 +508,41 @@ public:
     }
     
 private:
-    enum {STATE_NOCMD, STATE_HEADER, STATE_HEADER_LONG, STATE_INDEX, STATE_PAYLOAD};
+    enum {STATE_NOCMD, STATE_HEADER, STATE_HEADER_LONG, STATE_INDEX, STATE_PAYLOAD, STATE_MOVE_AXES, STATE_MOVES, STATE_RECORD};
     
     static Part * cast_part_ref (PartRef part_ref)
     {
         return (Part *)part_ref.ptr;
     }
     
+    // Gives the same result as parsing the value written out in decimal.
+    // The direct computation covers all values up to 2^24 and with double
+    // arithmetic all others too, except for rare float rounding ties.
+    FpType fixed_fp_value (Part *part)
+    {
+        uint32_t val = part->fixed_value;
+        bool negative = (int32_t)val < 0;
+        uint32_t mag = negative ? -val : val;
+        uint8_t decimals = m_axes[part->axis].decimals;
+        
+        FpType result;
+        if (AMBRO_UNLIKELY(!FastStrToFloatPrivate::Helper<FpType>::compute(mag, decimals, &result))) {
+            char str[13];
+            char *end = str + sizeof(str);
+            char *p = end;
+            *--p = '\0';
+            for (int digit = 0; digit <= decimals || mag > 0; digit++) {
+                if (digit == decimals && decimals > 0) {
+                    *--p = '.';
+                }
+                *--p = '0' + mag % 10;
+                mag /= 10;
+            }
+            result = FastStrToFloat<FpType>(p);
+        }
+        return negative ? -result : result;
+    }
+    
     uint8_t m_state;
     uint8_t *m_buffer;
     BufferSizeType m_length;
@@ -348,11 +550,15 @@ private:
     uint16_t m_cmd_num;
     PartsSizeType m_num_parts;
     BufferSizeType m_total_size;
+    uint8_t m_num_axes;
+    uint8_t m_batch_remaining;
     Part m_parts[Params::MaxParts];
+    MoveAxis m_axes[MoveAxesArraySize];
 };
 
 APRINTER_ALIAS_STRUCT_EXT(BinaryGcodeParserService, (
-    APRINTER_AS_VALUE(int, MaxParts)
+    APRINTER_AS_VALUE(int, MaxParts),
+    APRINTER_AS_VALUE(int, MaxMoveAxes)
 ), (
     template <typename Context, typename TBufferSizeType, typename FpType>
     using Parser = BinaryGcodeParser<Context, TBufferSizeType, FpType, BinaryGcodeParserService>;
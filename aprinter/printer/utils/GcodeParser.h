@@ -31,6 +31,8 @@
 
 #include <aprinter/meta/ServiceUtils.h>
 #include <aprinter/math/FloatTools.h>
+#include <aprinter/math/FastStrToFloat.h>
+#include <aprinter/misc/WordScan.h>
 #include <aprinter/base/DebugObject.h>
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/Hints.h>
@@ -51,15 +53,36 @@ struct GcodeParserExtraMembers<GcodeParserTypeSerial> {
     uint8_t m_checksum;
 };
 
-template <typename Context, typename TBufferSizeType, typename FpType, typename ParserType, typename Params>
+template <bool PreParseNumbers>
+struct GcodeParserNumberMembers {};
+
+template <>
+struct GcodeParserNumberMembers<true> {
+    uint64_t m_num_mantissa;
+    uint32_t m_num_uint;
+    int8_t m_num_digits;
+    int8_t m_num_decimals;
+    uint8_t m_num_flags;
+};
+
+/*
+ * With ScanWords, the characters which the parser only skips over up to the
+ * end of the line (comments, checksums and the rest of a line with an error)
+ * are searched for the newline a word at a time using WordScan. The results
+ * are the same either way.
+ */
+template <typename Context, typename TBufferSizeType, typename FpType, typename ParserType, typename Params, bool ScanWords = WordScanEnabled>
 class GcodeParser
 : public GcodeCommand<Context, FpType>,
   private SimpleDebugObject<Context>,
-  private GcodeParserExtraMembers<ParserType>
+  private GcodeParserExtraMembers<ParserType>,
+  private GcodeParserNumberMembers<Params::PreParseNumbers>
 {
     static_assert(Params::MaxParts > 0, "");
     static_assert(Params::MaxParts <= 127, "");
     
+    static bool const PreParseNumbers = Params::PreParseNumbers;
+    
 public:
     using BufferSizeType = TBufferSizeType;
     using PartsSizeType = int8_t;
@@ -69,7 +92,10 @@ public:
     template <typename TheParserType, typename Dummy = void>
     struct CommandExtra {};
     
-    struct CommandPart {
+    template <bool ThePreParseNumbers, typename Dummy = void>
+    struct CommandPartExtra {};
+    
+    struct CommandPart : public CommandPartExtra<PreParseNumbers> {
         char code;
         char *data;
     };
@@ -87,6 +113,16 @@ public:
         uint32_t line_number;
     };
     
+    // With PreParseNumbers, the numeric values of a part are computed while
+    // the part is being scanned. If have_values is false (the part is not a
+    // plain [+-]digits[.digits] number), they are parsed from data on demand.
+    template <typename Dummy>
+    struct CommandPartExtra<true, Dummy> {
+        bool have_values;
+        FpType fp_value;
+        uint32_t uint32_value;
+    };
+    
     void init (Context c)
     {
         m_state = STATE_NOCMD;
@@ -128,6 +164,13 @@ public:
         AMBRO_ASSERT(avail >= m_command.length)
         
         for (; m_command.length < avail; m_command.length++) {
+            if (PreParseNumbers && m_state == STATE_INSIDE && m_command.num_parts >= 0) {
+                NumberScanner<PreParseNumbers>::scan_part(c, this, avail);
+                if (m_command.length == avail) {
+                    break;
+                }
+            }
+            
             char ch = m_buffer[m_command.length];
             
             if (AMBRO_UNLIKELY(ch == '\n')) {
@@ -142,7 +185,7 @@ public:
                             m_command.num_parts = GCODE_ERROR_NO_PARTS;
                         } else {
                             m_command.num_parts--;
-                            m_command.cmd_number = atoi(m_command.parts[0].data);
+                            m_command.cmd_number = part_uint32_value(&m_command.parts[0]);
                         }
                     }
                 }
@@ -153,6 +196,7 @@ public:
             }
             
             if (AMBRO_UNLIKELY(m_command.num_parts < 0 || (TheTypeHelper::ChecksumEnabled && m_state == STATE_CHECKSUM))) {
+                skip_to_newline(avail);
                 continue;
             }
             
@@ -169,6 +213,7 @@ public:
             
             if (TheTypeHelper::CommentsEnabled) {
                 if (AMBRO_UNLIKELY(m_state == STATE_COMMENT)) {
+                    skip_to_newline(avail);
                     continue;
                 }
                 if (AMBRO_UNLIKELY(ch == ';')) {
@@ -195,11 +240,15 @@ public:
                     }
                     m_temp = m_command.length;
                     m_state = STATE_INSIDE;
+                    m_part_escaped = false;
+                    NumberScanner<PreParseNumbers>::start(this);
                 }
             } else {
                 if (AMBRO_UNLIKELY(is_space(ch))) {
                     finish_part(c);
                     m_state = STATE_OUTSIDE;
+                } else if (AMBRO_UNLIKELY(ch == '\\')) {
+                    m_part_escaped = true;
                 }
             }
         }
@@ -281,7 +330,7 @@ public:
         AMBRO_ASSERT(m_state == STATE_NOCMD)
         AMBRO_ASSERT(m_command.num_parts >= 0)
         
-        return StrToFloat<FpType>(cast_part_ref(part)->data, NULL);
+        return part_fp_value(cast_part_ref(part));
     }
     
     uint32_t getPartUint32Value (Context c, PartRef part)
@@ -290,7 +339,7 @@ public:
         AMBRO_ASSERT(m_state == STATE_NOCMD)
         AMBRO_ASSERT(m_command.num_parts >= 0)
         
-        return strtoul(cast_part_ref(part)->data, NULL, 10);
+        return part_uint32_value(cast_part_ref(part));
     }
     
     char const * getPartStringValue (Context c, PartRef part)
@@ -344,7 +393,7 @@ private:
         {
             if (AMBRO_UNLIKELY(!o->m_command.have_line_number && o->m_command.num_parts == 0 && code == 'N')) {
                 o->m_command.have_line_number = true;
-                o->m_command.line_number = strtoul(o->m_buffer + (o->m_temp + 1), NULL, 10);
+                o->m_command.line_number = StrToUint32(o->m_buffer + (o->m_temp + 1));
                 return true;
             }
             return false;
@@ -461,6 +510,17 @@ private:
         return (received_len == 0);
     }
     
+    // Called from extendCommand() for a character which is skipped. Advances the
+    // position such that the loop increment brings it to the next newline or to avail.
+    AMBRO_ALWAYS_INLINE
+    void skip_to_newline (BufferSizeType avail)
+    {
+        if (ScanWords) {
+            BufferSizeType next = m_command.length + 1;
+            m_command.length = next + WordScanFind<'\n'>(m_buffer + next, avail - next) - 1;
+        }
+    }
+    
     void finish_part (Context c)
     {
         AMBRO_ASSERT(m_command.num_parts >= 0)
@@ -477,6 +537,12 @@ private:
         BufferSizeType in_pos = m_temp + 1;
         BufferSizeType out_pos = in_pos;
         
+        // Without escapes, the part text is already in place.
+        if (AMBRO_LIKELY(!m_part_escaped)) {
+            in_pos = m_command.length;
+            out_pos = m_command.length;
+        }
+        
         while (in_pos < m_command.length) {
             char ch = m_buffer[in_pos++];
             if (ch == '\\' && m_command.num_parts > 0) {
@@ -503,11 +569,175 @@ private:
             return;
         }
         
-        m_command.parts[m_command.num_parts].code = code;
-        m_command.parts[m_command.num_parts].data = m_buffer + (m_temp + 1);
+        CommandPart *part = &m_command.parts[m_command.num_parts];
+        part->code = code;
+        part->data = m_buffer + (m_temp + 1);
+        NumberScanner<PreParseNumbers>::finish(this, part);
         m_command.num_parts++;
     }
     
+    template <bool ThePreParseNumbers, typename Dummy = void>
+    struct NumberScanner {
+        static void start (GcodeParser *o) {}
+        static void scan_part (Context c, GcodeParser *o, BufferSizeType avail) {}
+        static void finish (GcodeParser *o, CommandPart *part) {}
+        
+        static FpType fp_value (CommandPart *part)
+        {
+            return FastStrToFloat<FpType>(part->data);
+        }
+        
+        static uint32_t uint32_value (CommandPart *part)
+        {
+            return StrToUint32(part->data);
+        }
+    };
+    
+    template <typename Dummy>
+    struct NumberScanner<true, Dummy> {
+        // Accumulates the same values as FastStrToFloat and StrToUint32 would
+        // compute from the part text, or flags the part for parsing the text.
+        enum : uint8_t {
+            FLAG_NOT_FIRST = 1 << 0,
+            FLAG_NEGATIVE = 1 << 1,
+            FLAG_DOT = 1 << 2,
+            FLAG_INT_ENDED = 1 << 3,
+            FLAG_ENDED = 1 << 4,
+            FLAG_HAVE_DIGITS = 1 << 5,
+            FLAG_FALLBACK = 1 << 6
+        };
+        
+        static int const MaxDigits = 19;
+        
+        // Leading zeros after the dot add decimals but not digits, so the
+        // decimals are limited separately. Helper::compute() handles no more
+        // than this anyway.
+        static int const MaxDecimals = 22;
+        
+        AMBRO_ALWAYS_INLINE
+        static void start (GcodeParser *o)
+        {
+            o->m_num_mantissa = 0;
+            o->m_num_uint = 0;
+            o->m_num_digits = 0;
+            o->m_num_decimals = 0;
+            o->m_num_flags = 0;
+        }
+        
+        // Consumes the characters of the current part up to the character which
+        // ends it (or avail), accumulating its value in local variables.
+        static void scan_part (Context c, GcodeParser *o, BufferSizeType avail)
+        {
+            char const *buffer = o->m_buffer;
+            BufferSizeType pos = o->m_command.length;
+            uint64_t mantissa = o->m_num_mantissa;
+            uint32_t uint_value = o->m_num_uint;
+            int8_t num_digits = o->m_num_digits;
+            int8_t decimals = o->m_num_decimals;
+            uint8_t flags = o->m_num_flags;
+            
+            for (; pos < avail; pos++) {
+                char ch = buffer[pos];
+                uint8_t digit = (unsigned char)(ch - '0');
+                
+                if (AMBRO_LIKELY(digit < 10 && !(flags & FLAG_ENDED))) {
+                    if (!(flags & FLAG_INT_ENDED)) {
+                        uint_value = 10 * uint_value + digit;
+                    }
+                    if (AMBRO_LIKELY(num_digits < MaxDigits)) {
+                        mantissa = 10 * mantissa + digit;
+                        num_digits += (mantissa != 0);
+                        decimals += ((flags & FLAG_DOT) != 0);
+                        if (AMBRO_UNLIKELY(decimals > MaxDecimals)) {
+                            decimals = MaxDecimals;
+                            flags |= FLAG_FALLBACK;
+                        }
+                    } else {
+                        flags |= FLAG_FALLBACK;
+                    }
+                    flags |= FLAG_NOT_FIRST | FLAG_HAVE_DIGITS;
+                } else {
+                    if (ch == '\n' || is_space(ch) ||
+                        (TheTypeHelper::ChecksumEnabled && ch == '*') ||
+                        (TheTypeHelper::CommentsEnabled && ch == ';'))
+                    {
+                        break;
+                    }
+                    if (AMBRO_UNLIKELY(ch == '\\')) {
+                        o->m_part_escaped = true;
+                    }
+                    flags = add_other_char(flags, ch);
+                }
+                
+                TheTypeHelper::checksum_add_hook(c, o, ch);
+            }
+            
+            o->m_command.length = pos;
+            o->m_num_mantissa = mantissa;
+            o->m_num_uint = uint_value;
+            o->m_num_digits = num_digits;
+            o->m_num_decimals = decimals;
+            o->m_num_flags = flags;
+        }
+        
+        static uint8_t add_other_char (uint8_t flags, char ch)
+        {
+            if (!(flags & FLAG_ENDED)) {
+                if ((ch == '-' || ch == '+') && !(flags & FLAG_NOT_FIRST)) {
+                    flags |= (ch == '-') ? FLAG_NEGATIVE : 0;
+                } else {
+                    flags |= FLAG_INT_ENDED;
+                    if (!(ch == '.' && !(flags & FLAG_DOT))) {
+                        flags |= FLAG_ENDED;
+                        if (ch == 'e' || ch == 'E' || ch == 'x' || ch == 'X') {
+                            flags |= FLAG_FALLBACK;
+                        }
+                    }
+                    flags |= (ch == '.') ? FLAG_DOT : 0;
+                }
+                flags |= FLAG_NOT_FIRST;
+            }
+            if (ch == '\\') {
+                // Escapes are decoded by finish_part(), parse the result from the text.
+                flags |= FLAG_FALLBACK;
+            }
+            return flags;
+        }
+        
+        static void finish (GcodeParser *o, CommandPart *part)
+        {
+            uint8_t flags = o->m_num_flags;
+            bool negative = (flags & FLAG_NEGATIVE);
+            
+            part->have_values = (flags & FLAG_HAVE_DIGITS) && !(flags & FLAG_FALLBACK) &&
+                FastStrToFloatPrivate::Helper<FpType>::compute(o->m_num_mantissa, o->m_num_decimals, &part->fp_value);
+            if (part->have_values) {
+                part->fp_value = negative ? -part->fp_value : part->fp_value;
+                part->uint32_value = negative ? -o->m_num_uint : o->m_num_uint;
+            }
+        }
+        
+        static FpType fp_value (CommandPart *part)
+        {
+            return AMBRO_LIKELY(part->have_values) ? part->fp_value : FastStrToFloat<FpType>(part->data);
+        }
+        
+        static uint32_t uint32_value (CommandPart *part)
+        {
+            return AMBRO_LIKELY(part->have_values) ? part->uint32_value : StrToUint32(part->data);
+        }
+    };
+    
+    static FpType part_fp_value (CommandPart *part)
+    {
+        return NumberScanner<PreParseNumbers>::fp_value(part);
+    }
+    
+    static uint32_t part_uint32_value (CommandPart *part)
+    {
+        return NumberScanner<PreParseNumbers>::uint32_value(part);
+    }
+    
     static int read_hex_digit (char ch)
     {
         return
@@ -519,20 +749,23 @@ private:
     
 private:
     uint8_t m_state;
+    bool m_part_escaped;
     char *m_buffer;
     BufferSizeType m_temp;
     Command m_command;
 };
 
 APRINTER_ALIAS_STRUCT_EXT(SerialGcodeParserService, (
-    APRINTER_AS_VALUE(int, MaxParts)
+    APRINTER_AS_VALUE(int, MaxParts),
+    APRINTER_AS_VALUE(bool, PreParseNumbers)
 ), (
     template <typename Context, typename TBufferSizeType, typename FpType>
     using Parser = GcodeParser<Context, TBufferSizeType, FpType, GcodeParserTypeSerial, SerialGcodeParserService>;
 ))
 
 APRINTER_ALIAS_STRUCT_EXT(FileGcodeParserService, (
-    APRINTER_AS_VALUE(int, MaxParts)
+    APRINTER_AS_VALUE(int, MaxParts),
+    APRINTER_AS_VALUE(bool, PreParseNumbers)
 ), (
     template <typename Context, typename TBufferSizeType, typename FpType>
     using Parser = GcodeParser<Context, TBufferSizeType, FpType, GcodeParserTypeFile, FileGcodeParserService>;
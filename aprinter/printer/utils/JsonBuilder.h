@@ -36,7 +36,9 @@
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/MemRef.h>
 #include <aprinter/base/LoopUtils.h>
+#include <aprinter/meta/MinMax.h>
 #include <aprinter/math/FloatTools.h>
+#include <aprinter/math/PrintFloat.h>
 
 namespace APrinter {
 
@@ -108,9 +110,9 @@ public:
             add_token("-1e1024");
         }
         else {
-            char *end = get_end();
-            snprintf(end, get_rem()+1, "%.6g", val.val);
-            m_length += strlen(end);
+            char buf[PrintFloatMaxChars];
+            int len = PrintFloatPrecision<double>(val.val, 6, buf);
+            add_chars(buf, len);
         }
     }
     
@@ -287,6 +289,13 @@ private:
         }
     }
     
+    void add_chars (char const *chars, size_t len)
+    {
+        size_t copy_len = MinValue(len, get_rem());
+        memcpy(get_end(), chars, copy_len);
+        m_length += copy_len;
+    }
+    
     void add_token (char const *token)
     {
         while (*token != '\0') {
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_SIM_EVENT_LOOP_H
+#define APRINTER_SIM_EVENT_LOOP_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Lock.h>
+#include <aprinter/base/Hints.h>
+#include <aprinter/system/InterruptLock.h>
+#include <aprinter/system/BusyEventLoop.h>
+
+namespace APrinter {
+
+/**
+ * Event loop for host-side simulations using SimClock.
+ * 
+ * It dispatches events just like BusyEventLoop (and reuses its event
+ * classes and BusyEventLoopExtra), but instead of spinning it charges
+ * the host time of each handler to the virtual clock and jumps over
+ * idle periods directly to the next interrupt timer or timed event.
+ * 
+ * Note that interrupts are only dispatched between handlers, so an
+ * interrupt which would have preempted a long handler sees the effects
+ * of the whole handler.
+ */
+template <typename Arg>
+class SimEventLoop {
+    using ParentObject = typename Arg::ParentObject;
+    using ExtraDelay   = typename Arg::ExtraDelay;
+    
+    template <typename> friend class BusyEventLoopQueuedEvent;
+    template <typename> friend class BusyEventLoopTimedEvent;
+    
+public:
+    struct Object;
+    using Context = typename Arg::Context;
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    using TheClockUtils = ClockUtils<Context>;
+    using QueuedEvent = BusyEventLoopQueuedEvent<SimEventLoop>;
+    using TimedEventNew = BusyEventLoopTimedEvent<SimEventLoop>;
+    using TimedEvent = TimedEventCompat<TimedEventNew>;
+    using FastHandlerType = void (*) (Context);
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        o->m_queued_event_list.init();
+        o->m_timed_event_list.init();
+        Delay::extra(c)->m_fast_event_pos = 0;
+        for (typename Delay::Extra::FastEventSizeType i = 0; i < Delay::Extra::NumFastEvents; i++) {
+            Delay::extra(c)->m_fast_events[i].not_triggered = true;
+        }
+        o->m_now = Clock::getTime(c);
+        o->m_stop = false;
+        o->m_fast_host_time = 0;
+        o->m_other_host_time = 0;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::deinit(c);
+        AMBRO_ASSERT(o->m_queued_event_list.isEmpty())
+        AMBRO_ASSERT(o->m_timed_event_list.isEmpty())
+    }
+    
+    // Returns after stop() is called from a handler.
+    static void run (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        while (!o->m_stop) {
+            Clock::dispatchTimers(c);
+            
+            if (dispatch_fast_event(c) || dispatch_timed_event(c)) {
+                continue;
+            }
+            
+            TimeType next_time;
+            bool have_next = Clock::getFirstTimerTime(c, &next_time);
+            for (TimedEventNew *tev = o->m_timed_event_list.first(); tev; tev = o->m_timed_event_list.next(*tev)) {
+                if (!have_next || !TheClockUtils::timeGreaterOrEqual(tev->m_time, next_time)) {
+                    have_next = true;
+                    next_time = tev->m_time;
+                }
+            }
+            AMBRO_ASSERT_FORCE_MSG(have_next, "SimEventLoop deadlock")
+            
+            Clock::advanceTo(c, next_time);
+        }
+    }
+    
+    static void stop (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        o->m_stop = true;
+    }
+    
+    // Host time spent in fast event handlers, which is where the
+    // MotionPlanner does all of its work.
+    static uint64_t getFastEventHostTime (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->m_fast_host_time;
+    }
+    
+    static uint64_t getOtherEventHostTime (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->m_other_host_time;
+    }
+    
+    inline static TimeType getEventTime (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->m_now;
+    }
+    
+    template <typename Id>
+    struct FastEventSpec {};
+    
+    template <typename EventSpec>
+    static void initFastEvent (Context c, FastHandlerType handler)
+    {
+        TheDebugObject::access(c);
+        
+        Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()].handler = handler;
+    }
+    
+    template <typename EventSpec>
+    static void resetFastEvent (Context c)
+    {
+        TheDebugObject::access(c);
+        
+        Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()].not_triggered = true;
+    }
+    
+    template <typename EventSpec, typename ThisContext>
+    AMBRO_ALWAYS_INLINE
+    static void triggerFastEvent (ThisContext c)
+    {
+        TheDebugObject::access(c);
+        
+        Delay::extra(c)->m_fast_events[Delay::Extra::template get_event_index<EventSpec>()].not_triggered = false;
+    }
+    
+private:
+    using QueuedEventList = LinkedList<APRINTER_MEMBER_ACCESSOR_TN(&QueuedEvent::m_list_node),
+                                       PointerLinkModel<QueuedEvent>, true>;
+    
+    using TimedEventList = LinkedList<APRINTER_MEMBER_ACCESSOR_TN(&TimedEventNew::m_list_node),
+                                      PointerLinkModel<TimedEventNew>, true>;
+    
+    struct Delay {
+        using Extra = typename ExtraDelay::Type;
+        static typename Extra::Object * extra (Context c) { return Extra::Object::self(c); }
+    };
+    
+    template <typename Func>
+    static void dispatch_measured (Context c, uint64_t *host_time, Func func)
+    {
+        uint64_t start_ns = Clock::getHostNanoseconds();
+        func();
+        dispatch_queued_events(c);
+        c.check();
+        uint64_t elapsed_ns = Clock::getHostNanoseconds() - start_ns;
+        *host_time += elapsed_ns;
+        Clock::chargeHostTime(c, elapsed_ns);
+    }
+    
+    static bool dispatch_fast_event (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        for (typename Delay::Extra::FastEventSizeType i = 0; i < Delay::Extra::NumFastEvents; i++) {
+            Delay::extra(c)->m_fast_event_pos++;
+            if (AMBRO_UNLIKELY(Delay::extra(c)->m_fast_event_pos == Delay::Extra::NumFastEvents)) {
+                Delay::extra(c)->m_fast_event_pos = 0;
+            }
+            auto *ev = &Delay::extra(c)->m_fast_events[Delay::extra(c)->m_fast_event_pos];
+            if (!ev->not_triggered) {
+                ev->not_triggered = true;
+                dispatch_measured(c, &o->m_fast_host_time, [&] { ev->handler(c); });
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static bool dispatch_timed_event (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->m_now = Clock::getTime(c);
+        
+        for (TimedEventNew *tev = o->m_timed_event_list.first(); tev; tev = o->m_timed_event_list.next(*tev)) {
+            tev->debugAccess(c);
+            AMBRO_ASSERT(!TimedEventList::isRemoved(*tev))
+            
+            if (TheClockUtils::timeGreaterOrEqual(o->m_now, tev->m_time)) {
+                o->m_timed_event_list.remove(*tev);
+                TimedEventList::markRemoved(*tev);
+                dispatch_measured(c, &o->m_other_host_time, [&] { tev->handleTimerExpired(c); });
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static void dispatch_queued_events (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        while (QueuedEvent *qev = o->m_queued_event_list.first()) {
+            qev->debugAccess(c);
+            AMBRO_ASSERT(qev->m_handler)
+            AMBRO_ASSERT(!QueuedEventList::isRemoved(*qev))
+            
+            o->m_queued_event_list.removeFirst();
+            QueuedEventList::markRemoved(*qev);
+            
+            qev->m_handler(c);
+        }
+    }
+    
+public:
+    struct Object : public ObjBase<SimEventLoop, ParentObject, MakeTypeList<TheDebugObject>> {
+        QueuedEventList m_queued_event_list;
+        TimedEventList m_timed_event_list;
+        TimeType m_now;
+        bool m_stop;
+        uint64_t m_fast_host_time;
+        uint64_t m_other_host_time;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SimEventLoopArg, (
+    APRINTER_AS_TYPE(Context),
+    APRINTER_AS_TYPE(ParentObject),
+    APRINTER_AS_TYPE(ExtraDelay)
+), (
+    APRINTER_DEF_INSTANCE(SimEventLoopArg, SimEventLoop)
+))
+
+}
+
+#endif
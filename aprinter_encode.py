@@ -24,6 +24,7 @@
 from __future__ import print_function
 from __future__ import with_statement
 import struct
+import decimal
 
 class GcodeSyntaxError(Exception):
     pass
@@ -98,20 +99,112 @@ def encode_line(line):
     packet = packet_header + packet_index + packet_payload
     return packet
 
+DefaultMoveAxes = 'X3,Y3,Z3,E5,F3'
+
+def parse_move_axes(spec):
+    axes = []
+    for elem in spec.split(','):
+        if not (len(elem) == 2 and _letter_ok(elem[0]) and elem[1].isdigit() and int(elem[1]) <= 7):
+            raise ValueError('invalid move axis: {}'.format(elem))
+        axes.append((elem[0], int(elem[1])))
+    if not (1 <= len(axes) <= 7) or len(set(letter for (letter, decimals) in axes)) != len(axes):
+        raise ValueError('invalid move axes')
+    return axes
+
+class MoveEncoder(object):
+    def __init__(self, axes):
+        self._axes = axes
+        self._axis_index = dict((letter, i) for (i, (letter, decimals)) in enumerate(axes))
+        self._values = [0] * len(axes)
+        self._batch_kind = None
+        self._batch = []
+
+    def axes_packet(self):
+        packet = chr((4 << 4) + len(self._axes))
+        for (letter, decimals) in self._axes:
+            packet += chr((decimals << 5) + (ord(letter) - ord('A')))
+        return packet
+
+    def encode_line(self, line):
+        record = self._make_record(line)
+        if record is None:
+            return self.flush() + encode_line(line)
+        kind, record = record
+        data = ''
+        if kind != self._batch_kind or len(self._batch) == 255:
+            data = self.flush()
+            self._batch_kind = kind
+        self._batch.append(record)
+        return data
+
+    def flush(self):
+        if len(self._batch) == 0:
+            return ''
+        data = chr((5 << 4) + self._batch_kind) + chr(len(self._batch)) + ''.join(self._batch)
+        self._batch_kind = None
+        self._batch = []
+        return data
+
+    def _make_record(self, line):
+        comment_index = line.find(';')
+        if comment_index >= 0:
+            line = line[:comment_index]
+        parts = line.split()
+        if len(parts) == 0 or parts[0] not in _MoveCommands:
+            return None
+        values = {}
+        for part in parts[1:]:
+            letter = part[0]
+            if letter not in self._axis_index or letter in values:
+                return None
+            decimals = self._axes[self._axis_index[letter]][1]
+            try:
+                value = decimal.Decimal(part[1:]).scaleb(decimals)
+            except decimal.InvalidOperation:
+                return None
+            if not value.is_finite() or value != value.to_integral_value() or not (-2**31 < value < 2**31):
+                return None
+            values[letter] = int(value)
+        mask = 0
+        payload = ''
+        for (i, (letter, decimals)) in enumerate(self._axes):
+            if letter not in values:
+                continue
+            delta = (values[letter] - self._values[i]) & 0xFFFFFFFF
+            self._values[i] = values[letter]
+            if letter == 'F' and delta == 0:
+                mask |= 0x80
+                continue
+            mask |= 1 << i
+            zigzag = ((delta << 1) ^ (0xFFFFFFFF if delta >= 2**31 else 0)) & 0xFFFFFFFF
+            while zigzag >= 0x80:
+                payload += chr(0x80 + (zigzag & 0x7F))
+                zigzag >>= 7
+            payload += chr(zigzag)
+        return (_MoveCommands[parts[0]], chr(mask) + payload)
+
 EncodeFileErrors = (IOError, GcodeSyntaxError)
 
-def encode_file(input_file_name, output_file_name):
+def encode_file(input_file_name, output_file_name, move_axes=None):
     line_num = 0
+    move_encoder = MoveEncoder(move_axes) if move_axes is not None else None
     with open(input_file_name, "r") as input_file:
         with open(output_file_name, "w") as output_file:
+            if move_encoder is not None:
+                output_file.write(move_encoder.axes_packet())
             for line in input_file:
                 line_num += 1
                 try:
-                    encoded_data = encode_line(line)
+                    if move_encoder is not None:
+                        encoded_data = move_encoder.encode_line(line)
+                    else:
+                        encoded_data = encode_line(line)
                 except GcodeSyntaxError as e:
                     e.args = ('line {}: {}'.format(line_num, e.args[0]),)
                     raise
                 output_file.write(encoded_data)
+            if move_encoder is not None:
+                output_file.write(move_encoder.flush())
             output_file.write(chr(0xE0))
 
 _SmallCommands = {
@@ -120,6 +213,12 @@ _SmallCommands = {
     ('G', 92) : 3
 }
 
+_MoveCommands = {
+    'G0' : 0,
+    'G1' : 1,
+    'G92' : 2
+}
+
 def _letter_ok(ch):
     return (ord(ch) >= ord('A') and ord(ch) <= ord('Z'))
 
@@ -128,8 +227,16 @@ def main():
     parser = argparse.ArgumentParser(description='G-code packet for APrinter firmware.')
     parser.add_argument('--input', required=True)
     parser.add_argument('--output', required=True)
+    parser.add_argument('--moves', action='store_true', help='Use move records for G0/G1/G92 (needs MaxMoveAxes in the firmware).')
+    parser.add_argument('--move-axes', default=DefaultMoveAxes, help='Letters and decimals of move record axes (default {}).'.format(DefaultMoveAxes))
     args = parser.parse_args()
-    encode_file(args.input, args.output)
+    move_axes = None
+    if args.moves:
+        try:
+            move_axes = parse_move_axes(args.move_axes)
+        except ValueError as e:
+            parser.error(str(e))
+    encode_file(args.input, args.output, move_axes)
 
 if __name__ == '__main__':
     main()
@@ -0,0 +1,375 @@
+#!/usr/bin/env python2.7
+# Copyright (c) 2017 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Converts runs of G0/G1 moves into segment blocks (M950) for printing from
+# the SD card, doing the coordinate transform and the splitting of moves
+# here instead of on the device. The machine is described by the same JSON
+# configuration which the firmware is generated from.
+# 
+# A move can only be converted when the positions of all axes are known,
+# that is after they have been set by G92 or by an absolute move. Moves
+# before that, and all other commands, are passed through unchanged. Any
+# G-command which is not understood (e.g. G28) makes the positions unknown.
+# Comments of converted moves, and comment lines and blank lines between
+# them, are kept on their own lines just before the block.
+
+from __future__ import print_function
+from __future__ import with_statement
+from __future__ import division
+import struct
+import math
+import json
+
+class PreplanError(Exception):
+    pass
+
+class DeltaTransform(object):
+    def __init__(self, transform):
+        rod = float(transform['DiagnalRod'])
+        radius = float(transform['SmoothRodOffset']) - float(transform['EffectorOffset']) - float(transform['CarriageOffset'])
+        self._rod2 = rod * rod
+        self._limit_radius2 = float(transform['LimitRadius']) ** 2
+        self._towers = [
+            (radius * -0.8660254037844386, radius * -0.5),
+            (radius * 0.8660254037844386, radius * -0.5),
+            (radius * 0.0, radius * 1.0),
+        ]
+
+    def virt_to_phys(self, virt):
+        x, y, z = virt
+        if not (x*x + y*y <= self._limit_radius2):
+            return None
+        phys = []
+        for (tx, ty) in self._towers:
+            h2 = self._rod2 - (tx - x) ** 2 - (ty - y) ** 2
+            if h2 < 0:
+                return None
+            phys.append(math.sqrt(h2) + z)
+        return phys
+
+    def phys_to_virt(self, phys):
+        p1, p2, p3 = [_Vec(tx, ty, h) for ((tx, ty), h) in zip(self._towers, phys)]
+        normal = (p1 - p2).cross(p2 - p3)
+        k = 1.0 / normal.norm()
+        q = 0.5 * k
+        a = q * (p2 - p3).norm() * (p1 - p2).dot(p1 - p3)
+        b = q * (p1 - p3).norm() * (p2 - p1).dot(p2 - p3)
+        c = q * (p1 - p2).norm() * (p3 - p1).dot(p3 - p2)
+        pc = p1 * a + p2 * b + p3 * c
+        r2 = 0.25 * k * (p1 - p2).norm() * (p2 - p3).norm() * (p3 - p1).norm()
+        ps = pc - normal * math.sqrt(k * (self._rod2 - r2))
+        return [ps.x, ps.y, ps.z]
+
+class _Vec(object):
+    def __init__(self, x, y, z):
+        self.x, self.y, self.z = x, y, z
+
+    def __add__(self, o):
+        return _Vec(self.x + o.x, self.y + o.y, self.z + o.z)
+
+    def __sub__(self, o):
+        return _Vec(self.x - o.x, self.y - o.y, self.z - o.z)
+
+    def __mul__(self, s):
+        return _Vec(self.x * s, self.y * s, self.z * s)
+
+    def dot(self, o):
+        return self.x * o.x + self.y * o.y + self.z * o.z
+
+    def cross(self, o):
+        return _Vec(self.y * o.z - self.z * o.y, self.z * o.x - self.x * o.z, self.x * o.y - self.y * o.x)
+
+    # Squared length, like Vector3::norm in the firmware.
+    def norm(self):
+        return self.dot(self)
+
+class Machine(object):
+    def __init__(self, config):
+        self.steppers = [(s['Name'], bool(s['EnableCartesianSpeedLimit'])) for s in config['steppers']]
+        self.extruders = set(s['Name'] for s in config['steppers'] if s.get('IsExtruder', False))
+        self.lasers = [(l['Name'], l['DensityName']) for l in config.get('lasers', [])]
+        self.transform = None
+        self.virt_axes = []
+        self.transform_steppers = []
+        self.splitter = None
+        transform = config['transform']
+        transform_type = transform['_compoundName']
+        if transform_type == 'Delta':
+            if len(transform.get('IdentityAxes', [])) > 0:
+                raise PreplanError('IdentityAxes are not supported')
+            self.transform = DeltaTransform(transform)
+            axes = transform['CartesianAxes']
+            for i in range(3):
+                axis = axes['VirtualAxis{}'.format(i)]
+                self.virt_axes.append((axis['Name'], float(axis['MinPos']), float(axis['MaxPos']), float(axis['MaxSpeed'])))
+                self.transform_steppers.append(transform['Steppers']['TransformStepper{}'.format(i)]['StepperName'])
+            splitter = transform['Splitter']
+            if splitter['_compoundName'] == 'DistanceSplitter':
+                self.splitter = (float(splitter['MinSplitLength']), float(splitter['MaxSplitLength']), float(splitter['SegmentsPerSecond']))
+            elif splitter['_compoundName'] != 'NoSplitter':
+                raise PreplanError('Splitter {} is not supported'.format(splitter['_compoundName']))
+        elif transform_type != 'NoTransform':
+            raise PreplanError('Transform {} is not supported'.format(transform_type))
+        # Axes which are given directly in the records, in channel order.
+        self.other_axes = [(name, cartesian) for (name, cartesian) in self.steppers if name not in self.transform_steppers]
+        self.channels = ''.join(self.transform_steppers) + ''.join(name for (name, cartesian) in self.other_axes) + ''.join(name for (name, density_name) in self.lasers)
+        self.move_axes = [axis[0] for axis in self.virt_axes] + [name for (name, cartesian) in self.other_axes]
+
+    def split_count(self, distance, max_v_rec):
+        if self.splitter is None:
+            return 1
+        min_length, max_length, segments_per_second = self.splitter
+        fpcount = distance * min(1.0 / min_length, max(1.0 / max_length, segments_per_second * max_v_rec))
+        return 1 + int(min(fpcount, 2**31))
+
+class Preplanner(object):
+    def __init__(self, machine, max_block_records):
+        self._m = machine
+        self._max_block_records = max_block_records
+        self._pos = dict((name, None) for name in machine.move_axes)
+        self._relative = dict((name, False) for name in machine.move_axes)
+        self._density = dict((name, 0.0) for (name, density_name) in machine.lasers)
+        self._max_v_rec = 0.0
+        self._records = []
+        self._comments = []
+
+    def process_line(self, line):
+        comment_index = line.find(';')
+        code_line = line if comment_index < 0 else line[:comment_index]
+        parts = code_line.split()
+        if len(parts) == 0:
+            # Comments and blank lines cannot go between the records, so
+            # those within a block are written just before it.
+            if len(self._records) > 0:
+                self._comments.append(line)
+                return ''
+            return line
+        cmd = parts[0].upper()
+        params = []
+        for part in parts[1:]:
+            try:
+                params.append((part[0].upper(), float(part[1:]) if len(part) > 1 else None))
+            except ValueError:
+                params.append((part[0].upper(), None))
+        if cmd in ('G0', 'G1'):
+            records = self._make_move(cmd == 'G0', params)
+            if records is not None:
+                data = ''
+                if len(self._records) + len(records) > self._max_block_records:
+                    data = self.flush()
+                self._records.extend(records)
+                if comment_index >= 0:
+                    self._comments.append(line[comment_index:])
+                return data
+            self._passed_move(params)
+        else:
+            self._handle_other(cmd, params)
+        return self.flush() + line
+
+    def flush(self):
+        if len(self._records) == 0:
+            return ''
+        data = ''.join(self._comments) + 'M950 I{} S{}\n'.format(self._m.channels, len(self._records)) + ''.join(self._records)
+        self._records = []
+        self._comments = []
+        return data
+
+    def _handle_other(self, cmd, params):
+        m = self._m
+        if cmd in ('G90', 'G91', 'M82', 'M83'):
+            for name in m.move_axes:
+                if cmd[0] == 'G' or name in m.extruders:
+                    self._relative[name] = cmd in ('G91', 'M83')
+        elif cmd == 'G92':
+            self._set_position(params)
+        elif cmd[0] == 'G' and cmd != 'G4':
+            for name in m.move_axes:
+                self._pos[name] = None
+
+    def _set_position(self, params):
+        m = self._m
+        values = dict((letter, value) for (letter, value) in params if value is not None)
+        if len(values) == 0:
+            for name in m.move_axes:
+                self._pos[name] = None
+            return
+        for name in m.move_axes:
+            if name in values:
+                self._pos[name] = values[name]
+        if any(name in values for name in m.transform_steppers):
+            if all(name in values for name in m.transform_steppers):
+                virt = m.transform.phys_to_virt([values[name] for name in m.transform_steppers])
+                for (axis, value) in zip(m.virt_axes, virt):
+                    self._pos[axis[0]] = value
+            else:
+                for axis in m.virt_axes:
+                    self._pos[axis[0]] = None
+
+    # A move which is passed through still determines the positions of the
+    # axes given absolutely, but not of the axes given relatively unless
+    # their position was already known.
+    def _passed_move(self, params):
+        m = self._m
+        if any(letter == 'R' for (letter, value) in params):
+            for name in m.move_axes:
+                self._pos[name] = None
+            return
+        for (letter, value) in params:
+            if letter in self._pos:
+                if value is None:
+                    self._pos[letter] = None
+                elif self._relative[letter]:
+                    if self._pos[letter] is not None:
+                        self._pos[letter] += value
+                else:
+                    self._pos[letter] = value
+            elif letter == 'F' and value is not None and value > 0:
+                self._max_v_rec = 60.0 / value
+        for axis in m.virt_axes:
+            if self._pos[axis[0]] is not None:
+                self._pos[axis[0]] = min(axis[2], max(axis[1], self._pos[axis[0]]))
+
+    def _make_move(self, is_rapid, params):
+        m = self._m
+        if any(self._pos[name] is None for name in m.move_axes):
+            return None
+        target = dict(self._pos)
+        energy = dict((name, None) for (name, density_name) in m.lasers)
+        density = dict(self._density)
+        max_v_rec = self._max_v_rec
+        nominal_time = None
+        for (letter, value) in params:
+            if value is None:
+                return None
+            if letter in target:
+                target[letter] = (self._pos[letter] + value) if self._relative[letter] else value
+            elif letter == 'F':
+                max_v_rec = 60.0 / value if value > 0 else float('inf')
+            elif letter == 'T':
+                nominal_time = value
+            else:
+                for (name, density_name) in m.lasers:
+                    if letter == name:
+                        energy[name] = value
+                        break
+                    if letter == density_name:
+                        density[name] = value
+                        break
+                else:
+                    return None
+        for axis in m.virt_axes:
+            target[axis[0]] = min(axis[2], max(axis[1], target[axis[0]]))
+
+        start_phys = None
+        end_phys = None
+        if m.transform is not None:
+            start_phys = m.transform.virt_to_phys([self._pos[axis[0]] for axis in m.virt_axes])
+            end_phys = m.transform.virt_to_phys([target[axis[0]] for axis in m.virt_axes])
+            if start_phys is None or end_phys is None:
+                return None
+
+        deltas = dict((name, target[name] - self._pos[name]) for name in m.move_axes)
+        cartesian = [axis[0] for axis in m.virt_axes] + [name for (name, is_cartesian) in m.other_axes if is_cartesian]
+        distance = math.sqrt(sum(deltas[name] ** 2 for name in cartesian))
+        for (name, density_name) in m.lasers:
+            if energy[name] is None:
+                energy[name] = density[name] * distance if (not is_rapid and distance > 0) else 0.0
+
+        # Nominal time of the whole move, following how the firmware limits
+        # the speed of a move.
+        if nominal_time is None:
+            if distance > 0 or m.transform is not None:
+                time = distance * max_v_rec
+            else:
+                time = max([abs(deltas[name]) for name in m.move_axes] + [0.0]) * max_v_rec
+            for axis in m.virt_axes:
+                time = max(time, abs(deltas[axis[0]]) / axis[3])
+            if math.isinf(time):
+                time = 0.0
+        else:
+            time = nominal_time
+
+        count = m.split_count(distance, time / distance if distance > 0 else max_v_rec) if m.transform is not None else 1
+        records = []
+        for i in range(1, count + 1):
+            frac = i / count
+            values = [time / count]
+            if m.transform is not None:
+                if i == count:
+                    phys = end_phys
+                else:
+                    phys = m.transform.virt_to_phys([self._pos[axis[0]] + frac * deltas[axis[0]] for axis in m.virt_axes])
+                    if phys is None:
+                        return None
+                values.extend(phys)
+            values.extend(self._pos[name] + frac * deltas[name] for (name, cartesian) in m.other_axes)
+            values.extend(energy[name] / count for (name, density_name) in m.lasers)
+            records.append(struct.pack('<{}f'.format(len(values)), *values))
+
+        self._pos = target
+        self._density = density
+        if any(letter == 'F' for (letter, value) in params):
+            self._max_v_rec = max_v_rec
+        return records
+
+PreplanFileErrors = (IOError, ValueError, KeyError, PreplanError)
+
+def load_machine(config_file_name, cfg_name=None):
+    with open(config_file_name, 'r') as config_file:
+        config_root = json.load(config_file)
+    if cfg_name is None:
+        cfg_name = config_root['selected_config']
+    for config in config_root['configurations']:
+        if config['name'] == cfg_name:
+            return Machine(config)
+    raise PreplanError('Configuration {} not found'.format(cfg_name))
+
+def preplan_file(machine, input_file_name, output_file_name, max_block_records):
+    preplanner = Preplanner(machine, max_block_records)
+    with open(input_file_name, 'r') as input_file:
+        with open(output_file_name, 'wb') as output_file:
+            for line in input_file:
+                if not line.endswith('\n'):
+                    line += '\n'
+                output_file.write(preplanner.process_line(line))
+            output_file.write(preplanner.flush())
+
+def main():
+    import argparse
+    parser = argparse.ArgumentParser(description='Pre-plan G-code moves into segment blocks for APrinter firmware.')
+    parser.add_argument('--config', required=True, help='Firmware configuration (JSON, as saved by the configuration editor).')
+    parser.add_argument('--cfg-name', help='Name of the configuration (default is the selected one).')
+    parser.add_argument('--input', required=True)
+    parser.add_argument('--output', required=True)
+    parser.add_argument('--max-block-records', type=int, default=10000, help='Maximum number of records in one block (default 10000).')
+    args = parser.parse_args()
+    if args.max_block_records < 1:
+        parser.error('invalid --max-block-records')
+    try:
+        machine = load_machine(args.config, args.cfg_name)
+        preplan_file(machine, args.input, args.output, args.max_block_records)
+    except PreplanFileErrors as e:
+        parser.exit(1, 'Error: {}\n'.format(e))
+
+if __name__ == '__main__':
+    main()
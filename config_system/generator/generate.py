@@ -1602,14 +1602,19 @@ def generate(config_root_data, cfg_name, main_template):
                     serial_module = gen.add_module()
                     serial_user = 'MyPrinter::GetModule<{}>::GetSerial'.format(serial_module.index)
                     
+                    serial_preparse = serial.get_bool_constant('GcodePreParseNumbers') if serial.has('GcodePreParseNumbers') else 'false'
+                    serial_window = serial.get_bool_constant('StreamingWindow') if serial.has('StreamingWindow') else 'false'
+                    
                     serial_module.set_expr(TemplateExpr('SerialModuleService', [
                         'UINT32_C({})'.format(serial.get_int_constant('BaudRate')),
                         serial.get_int_constant('RecvBufferSizeExp'),
                         serial.get_int_constant('SendBufferSizeExp'),
                         TemplateExpr('SerialGcodeParserService', [
                             serial.get_int_constant('GcodeMaxParts'),
+                            serial_preparse,
                         ]),
                         use_serial(gen, serial, 'Service', serial_user),
+                        serial_window,
                     ]))
                 
                 sdcard_sel = selection.Selection()
@@ -1632,13 +1637,18 @@ def generate(config_root_data, cfg_name, main_template):
                         gen.add_aprinter_include('printer/utils/GcodeParser.h')
                         return TemplateExpr('FileGcodeParserService', [
                             parser.get_int('MaxParts'),
+                            parser.get_bool_constant('PreParseNumbers') if parser.has('PreParseNumbers') else 'false',
                         ])
                     
                     @gcode_parser_sel.option('BinaryGcodeParser')
                     def option(parser):
                         gen.add_aprinter_include('printer/utils/BinaryGcodeParser.h')
+                        max_move_axes = parser.get_int('MaxMoveAxes') if parser.has('MaxMoveAxes') else 0
+                        if not (0 <= max_move_axes <= 7):
+                            parser.key_path('MaxMoveAxes').error('Bad value.')
                         return TemplateExpr('BinaryGcodeParserService', [
                             parser.get_int('MaxParts'),
+                            max_move_axes,
                         ])
                     
                     fs_sel = selection.Selection()
@@ -1656,14 +1666,27 @@ def generate(config_root_data, cfg_name, main_template):
                         if not (12 <= max_filename_size <= 1024):
                             fs_config.key_path('MaxFileNameSize').error('Bad value.')
                         
+                        cache_indexed_lookup = fs_config.get_bool('CacheIndexedLookup') if fs_config.has('CacheIndexedLookup') else False
+                        
                         num_cache_entries = fs_config.get_int('NumCacheEntries')
-                        if not (1 <= num_cache_entries <= 64):
+                        if not (1 <= num_cache_entries <= (1024 if cache_indexed_lookup else 64)):
                             fs_config.key_path('NumCacheEntries').error('Bad value.')
                         
                         max_io_blocks = fs_config.get_int('MaxIoBlocks')
                         if not (1 <= max_io_blocks <= num_cache_entries):
                             fs_config.key_path('MaxIoBlocks').error('Bad value.')
                         
+                        read_ahead_max_blocks = fs_config.get_int('ReadAheadMaxBlocks') if fs_config.has('ReadAheadMaxBlocks') else 0
+                        if read_ahead_max_blocks < 0:
+                            fs_config.key_path('ReadAheadMaxBlocks').error('Bad value.')
+                        if read_ahead_max_blocks == 0:
+                            read_ahead_max_blocks = max(1, num_cache_entries // 2)
+                        read_ahead_max_blocks = min(read_ahead_max_blocks, num_cache_entries)
+                        
+                        free_summary_slots = fs_config.get_int('FreeSummarySlots') if fs_config.has('FreeSummarySlots') else 0
+                        if not (0 <= free_summary_slots <= 65536):
+                            fs_config.key_path('FreeSummarySlots').error('Bad value.')
+                        
                         gen.add_aprinter_include('printer/input/SdFatInput.h')
                         gen.add_aprinter_include('fs/FatFs.h')
                         
@@ -1703,6 +1726,9 @@ def generate(config_root_data, cfg_name, main_template):
                                 fs_config.get_bool_constant('CaseInsensFileName'),
                                 fs_config.get_bool_constant('FsWritable'),
                                 fs_config.get_bool_constant('EnableReadHinting'),
+                                'true' if cache_indexed_lookup else 'false',
+                                read_ahead_max_blocks,
+                                free_summary_slots,
                             ]),
                             fs_config.get_bool_constant('HaveAccessInterface'),
                         ])
@@ -1712,6 +1738,7 @@ def generate(config_root_data, cfg_name, main_template):
                         sdcard.do_selection('GcodeParser', gcode_parser_sel),
                         sdcard.get_int('BufferBaseSize'),
                         sdcard.get_int('MaxCommandSize'),
+                        sdcard.get_bool_constant('SegmentBlocks') if sdcard.has('SegmentBlocks') else 'false',
                     ]))
                 
                 board_data.get_config('sdcard_config').do_selection('sdcard', sdcard_sel)
@@ -1777,6 +1804,7 @@ def generate(config_root_data, cfg_name, main_template):
                             tcp_console_module.set_expr(TemplateExpr('TcpConsoleModuleService', [
                                 TemplateExpr('SerialGcodeParserService', [
                                     console_max_parts,
+                                    'false',
                                 ]),
                                 console_port,
                                 console_max_clients,
@@ -1873,6 +1901,7 @@ def generate(config_root_data, cfg_name, main_template):
                                 webif_config.get_int('NumGcodeSlots'),
                                 TemplateExpr('SerialGcodeParserService', [
                                     webif_config.get_int('MaxGcodeParts'),
+                                    'false',
                                 ]),
                                 webif_config.get_int('MaxGcodeCommandSize'),
                                 gen.add_float_constant('WebInterfaceGcodeSendBufTimeout', webif_config.get_float('GcodeSendBufTimeout')),
@@ -2010,10 +2039,76 @@ def generate(config_root_data, cfg_name, main_template):
                         gen.add_float_constant('{}StepLowTime'.format(name), delay_config.get_float('StepLowTime')),
                     ])
                 
+                burst_sel = selection.Selection()
+                
+                @burst_sel.option('NoBurst')
+                def option(burst_config):
+                    return 'AxisDriverNoBurstParams'
+                
+                @burst_sel.option('Burst')
+                def option(burst_config):
+                    if stepper.get_config('delay').get_string('_compoundName') != 'Delay':
+                        stepper.key_path('burst').error('Burst requires step signals timing with delays (the step low time within a burst).')
+                    return TemplateExpr('AxisDriverBurstParams', [
+                        burst_config.get_int('MaxSteps'),
+                        gen.add_float_constant('{}BurstThreshold'.format(name), burst_config.get_float('Threshold')),
+                    ])
+                
+                if stepper.has('burst'):
+                    burst_expr = stepper.do_selection('burst', burst_sel)
+                else:
+                    burst_expr = 'AxisDriverNoBurstParams'
+                
                 first_stepper_port = stepper_ports_for_axis[0]
                 if first_stepper_port.get_config('StepperTimer').get_string('_compoundName') != 'interrupt_timer':
                     first_stepper_port.key_path('StepperTimer').error('Stepper port of first stepper in axis must have a timer unit defined.')
                 
+                if stepper.get_bool('IsExtruder'):
+                    pressure_advance = stepper.get_float('PressureAdvance') if stepper.has('PressureAdvance') else 0.0
+                    pressure_advance_expr = gen.add_float_config('{}PressureAdvance'.format(name), pressure_advance)
+                else:
+                    pressure_advance_expr = gen.add_float_config('{}PressureAdvance'.format(name), 0.0, is_constant=True)
+                
+                input_shaper_sel = selection.Selection()
+                
+                @input_shaper_sel.option('NoInputShaper')
+                def option(input_shaper_config):
+                    return 'PrinterMainNoInputShaperParams'
+                
+                def input_shaper_option(shaper_type):
+                    @input_shaper_sel.option(shaper_type)
+                    def option(input_shaper_config):
+                        return TemplateExpr('PrinterMainInputShaperParams', [
+                            'InputShaper{}'.format(shaper_type),
+                            gen.add_float_config('{}InputShaperFrequency'.format(name), input_shaper_config.get_float('Frequency')),
+                            gen.add_float_config('{}InputShaperDampingRatio'.format(name), input_shaper_config.get_float('DampingRatio')),
+                        ])
+                
+                for shaper_type in ['ZV', 'MZV', 'EI']:
+                    input_shaper_option(shaper_type)
+                
+                if stepper.has('input_shaper'):
+                    input_shaper_expr = stepper.do_selection('input_shaper', input_shaper_sel)
+                else:
+                    input_shaper_expr = 'PrinterMainNoInputShaperParams'
+                
+                jerk_limit_sel = selection.Selection()
+                
+                @jerk_limit_sel.option('NoJerkLimit')
+                def option(jerk_limit_config):
+                    return 'PrinterMainNoJerkLimitParams'
+                
+                @jerk_limit_sel.option('JerkLimit')
+                def option(jerk_limit_config):
+                    return TemplateExpr('PrinterMainJerkLimitParams', [
+                        gen.add_float_config('{}MaxJerk'.format(name), jerk_limit_config.get_float('MaxJerk')),
+                    ])
+                
+                if stepper.has('jerk_limit'):
+                    jerk_limit_expr = stepper.do_selection('jerk_limit', jerk_limit_sel)
+                else:
+                    jerk_limit_expr = 'PrinterMainNoJerkLimitParams'
+                
                 return TemplateExpr('PrinterMainAxisParams', [
                     TemplateChar(name),
                     gen.add_float_config('{}StepsPerUnit'.format(name), stepper.get_float('StepsPerUnit')),
@@ -2023,6 +2118,9 @@ def generate(config_root_data, cfg_name, main_template):
                     gen.add_float_config('{}MaxAccel'.format(name), stepper.get_float('MaxAccel')),
                     gen.add_float_config('{}DistanceFactor'.format(name), stepper.get_float('DistanceFactor')),
                     gen.add_float_config('{}CorneringDistance'.format(name), stepper.get_float('CorneringDistance')),
+                    pressure_advance_expr,
+                    input_shaper_expr,
+                    jerk_limit_expr,
                     stepper.do_selection('homing', homing_sel),
                     stepper.get_bool('EnableCartesianSpeedLimit'),
                     stepper.get_bool('IsExtruder'),
@@ -2032,6 +2130,7 @@ def generate(config_root_data, cfg_name, main_template):
                         'TheAxisDriverPrecisionParams',
                         stepper.get_bool('PreloadCommands'),
                         stepper.do_selection('delay', delay_sel),
+                        burst_expr,
                     ]),
                     slave_steppers_expr,
                 ])
@@ -2255,6 +2354,15 @@ def generate(config_root_data, cfg_name, main_template):
                         gen.add_float_config('{}SegmentsPerSecond'.format(transform_prefix), splitter.get_float('SegmentsPerSecond')),
                     ])
                 
+                @splitter_sel.option('AdaptiveSplitter')
+                def option(splitter):
+                    gen.add_aprinter_include('printer/transform/AdaptiveSplitter.h')
+                    return TemplateExpr('AdaptiveSplitterService', [
+                        gen.add_float_config('{}MinSplitLength'.format(transform_prefix), splitter.get_float('MinSplitLength')),
+                        gen.add_float_config('{}MaxSplitLength'.format(transform_prefix), splitter.get_float('MaxSplitLength')),
+                        gen.add_float_config('{}MaxSplitDeviation'.format(transform_prefix), splitter.get_float('MaxDeviation')),
+                    ])
+                
                 splitter_expr = transform.do_selection('Splitter', splitter_sel)
                 
                 max_dimensions = 10
@@ -2533,6 +2641,18 @@ def generate(config_root_data, cfg_name, main_template):
                 millisecond_clock_module = gen.add_module()
                 millisecond_clock_module.set_expr('MillisecondClockInfoModuleService')
             
+            if config.has('ArcEnabled') and config.get_bool('ArcEnabled'):
+                arc_expr = TemplateExpr('PrinterMainArcParams', [
+                    gen.add_float_config('ArcTolerance', config.get_float('ArcTolerance')),
+                    gen.add_float_config('ArcMinSegmentTime', config.get_float('ArcMinSegmentTime')),
+                ])
+            else:
+                arc_expr = 'PrinterMainNoArcParams'
+            
+            command_batch_max_commands = performance.get_int('CommandBatchMaxCommands') if performance.has('CommandBatchMaxCommands') else 1
+            if not 1 <= command_batch_max_commands <= 255:
+                performance.key_path('CommandBatchMaxCommands').error('Value out of range.')
+            
             printer_params = TemplateExpr('PrinterMainParams', [
                 led_pin_expr,
                 'LedBlinkInterval',
@@ -2545,7 +2665,11 @@ def generate(config_root_data, cfg_name, main_template):
                 performance.get_int_constant('StepperSegmentBufferSize'),
                 performance.get_int_constant('LookaheadBufferSize'),
                 performance.get_int_constant('LookaheadCommitCount'),
+                gen.add_bool_config('JunctionDeviationEnabled', config.get_bool('JunctionDeviationEnabled') if config.has('JunctionDeviationEnabled') else False),
+                gen.add_float_config('JunctionDeviation', config.get_float('JunctionDeviation') if config.has('JunctionDeviation') else 0.05),
                 'ForceTimeout',
+                command_batch_max_commands,
+                gen.add_float_constant('CommandBatchMaxTime', performance.get_float('CommandBatchMaxTime') if performance.has('CommandBatchMaxTime') else 0.001),
                 performance.get_identifier('FpType', lambda x: x in ('float', 'double')),
                 setup_watchdog(gen, platform, 'watchdog', 'MyPrinter::GetWatchdog'),
                 watchdog_debug_mode,
@@ -2553,6 +2677,7 @@ def generate(config_root_data, cfg_name, main_template):
                 'ConfigList',
                 steppers_expr,
                 transform_expr,
+                arc_expr,
                 lasers_expr,
                 TemplateList(gen._modules_exprs),
             ])
@@ -383,6 +383,11 @@ def make_transform_type(transform_type, transform_title, stepper_defs, axis_defs
                     ce.Float(key='MaxSplitLength', title='Maximum segment length [mm]', default=4.0),
                     ce.Float(key='SegmentsPerSecond', title='Segments per second', default=100.0),
                 ]),
+                ce.Compound('AdaptiveSplitter', title='Adaptive (by path deviation)', attrs=[
+                    ce.Float(key='MinSplitLength', title='Minimum segment length [mm]', default=0.1),
+                    ce.Float(key='MaxSplitLength', title='Maximum segment length [mm]', default=50.0),
+                    ce.Float(key='MaxDeviation', title='Maximum deviation from the straight path [mm]', default=0.01),
+                ]),
                 ce.Compound('NoSplitter', title='Disabled', attrs=[]),
             ]),
         ] +
@@ -486,6 +491,11 @@ def editor():
             ce.Float(key='InactiveTime', title='Disable steppers after [s]', default=480),
             ce.Float(key='WaitTimeout', title='Timeout when waiting for heater temperatures (M116) [s]', default=500),
             ce.Float(key='WaitReportPeriod', title='Period of temperature reports when waiting for heaters [s]', default=1),
+            ce.Boolean(key='JunctionDeviationEnabled', title='Cornering model', default=False, false_title='Per-axis cornering distance', true_title='Junction deviation'),
+            ce.Float(key='JunctionDeviation', title='Junction deviation (when that cornering model is used) [mm]', default=0.05),
+            ce.Boolean(key='ArcEnabled', title='Arc moves (G2/G3)', default=False),
+            ce.Float(key='ArcTolerance', title='Arc tolerance (max. deviation of segments from the arc) [mm]', default=0.01),
+            ce.Float(key='ArcMinSegmentTime', title='Arc min. segment time (limits the segment rate at high speed) [s]', default=0.005),
             ce.Compound('advanced', key='advanced', title='Advanced parameters', collapsable=True, attrs=[
                 ce.Float(key='LedBlinkInterval', title='LED blink interval [s]', default=0.5),
                 ce.Float(key='ForceTimeout', title='Force motion timeout [s]', default=0.1),
@@ -507,8 +517,28 @@ def editor():
                 ce.Float(key='CorneringDistance', title='Cornering distance (greater values allow greater change of speed at corners) [step]', default=40),
                 ce.Boolean(key='EnableCartesianSpeedLimit', title='Is cartesian (Yes for X/Y/Z, No for extruders)', default=True),
                 ce.Boolean(key='IsExtruder', title='Is an extruder (e.g. subject to M82/M83)', default=False),
-                stepper_homing_params(key='homing'),
-                ce.Boolean(key='PreloadCommands', title='Command loading mode', default=False, false_title='At first step', true_title='At last step of previous command (use when direction-ahead-of-step-time is large)'),
+                ce.Float(key='PressureAdvance', title='Pressure advance (extruders only, extra extrusion per unit of speed) [s]', default=0),
+                ce.OneOf(key='input_shaper', title='Input shaping (vibration cancellation)', choices=[
+                    ce.Compound('NoInputShaper', title='Disabled', attrs=[]),
+                    ce.Compound('ZV', title='ZV (shortest delay)', attrs=[
+                        ce.Float(key='Frequency', title='Resonance frequency [Hz]', default=40),
+                        ce.Float(key='DampingRatio', title='Damping ratio [1]', default=0.1),
+                    ]),
+                    ce.Compound('MZV', title='MZV', attrs=[
+                        ce.Float(key='Frequency', title='Resonance frequency [Hz]', default=40),
+                        ce.Float(key='DampingRatio', title='Damping ratio [1]', default=0.1),
+                    ]),
+                    ce.Compound('EI', title='EI (most robust to frequency error)', attrs=[
+                        ce.Float(key='Frequency', title='Resonance frequency [Hz]', default=40),
+                        ce.Float(key='DampingRatio', title='Damping ratio [1]', default=0.1),
+                    ]),
+                ]),
+                ce.OneOf(key='jerk_limit', title='Acceleration profile', choices=[
+                    ce.Compound('NoJerkLimit', title='Trapezoidal (constant acceleration)', attrs=[]),
+                    ce.Compound('JerkLimit', title='S-curve (jerk limited; moves of this axis get half the acceleration on all axes)', attrs=[
+                        ce.Float(key='MaxJerk', title='Maximum jerk [mm/s^3]', default=100000),
+                    ]),
+                ]),
                 ce.OneOf(key='delay', title='Step signals timing', choices=[
                     ce.Compound('NoDelay', title='No special delays', attrs=[]),
                     ce.Compound('Delay', title='Use delays to ensure required timing', attrs=[
@@ -517,6 +547,13 @@ def editor():
                         ce.Float(key='StepLowTime', title='Minimum step low time [us]', default=1.0),
                     ]),
                 ]),
+                ce.OneOf(key='burst', title='Steps per timer interrupt', choices=[
+                    ce.Compound('NoBurst', title='One step per interrupt', attrs=[]),
+                    ce.Compound('Burst', title='Emit closely spaced steps in bursts (requires delays)', attrs=[
+                        ce.Integer(key='MaxSteps', title='Maximum steps per interrupt', default=4),
+                        ce.Float(key='Threshold', title='Maximum early emission of a step [us]', default=5.0),
+                    ]),
+                ]),
             ])),
             ce.OneOf(key='transform', title='Coordinate transformation', choices=[
                 ce.Compound('NoTransform', title='None (cartesian)', attrs=[]),
@@ -769,6 +806,8 @@ def editor():
                 ce.Integer(key='RecvBufferSizeExp', title='Receive buffer size (power of two exponent)'),
                 ce.Integer(key='SendBufferSizeExp', title='Send buffer size (power of two exponent)'),
                 ce.Integer(key='GcodeMaxParts', title='Max parts in GCode command'),
+                ce.Boolean(key='GcodePreParseNumbers', title='Convert G-code numbers while receiving', default=False),
+                ce.Boolean(key='StreamingWindow', title='Windowed streaming with cumulative acks (M940)', default=False),
                 ce.OneOf(key='Service', title='Backend', choices=[
                     ce.Compound('AsfUsbSerial', title='AT91 USB', attrs=[]),
                     ce.Compound('At91Sam3xSerial', title='AT91 UART', attrs=[
@@ -796,6 +835,9 @@ def editor():
                                 ce.Boolean(key='CaseInsensFileName', title='Case-insensitive filename matching', default=True),
                                 ce.Boolean(key='FsWritable', title='Writable filesystem', default=False),
                                 ce.Boolean(key='EnableReadHinting', title='Enable read-ahead hinting', default=False),
+                                ce.Integer(key='ReadAheadMaxBlocks', title='Maximum read-ahead window (in blocks, 0 for half the block cache, limited to the block cache size)', default=0),
+                                ce.Boolean(key='CacheIndexedLookup', title='Hashed block cache lookup (for caches above 64 blocks)', default=False),
+                                ce.Integer(key='FreeSummarySlots', title='Free cluster summary size (0 to disable, needs writable filesystem)', default=0),
                                 ce.Boolean(key='HaveAccessInterface', title='Enable internal FS access interface', default=False),
                                 ce.Boolean(key='EnableFsTest', title='Enable FS test module', default=False),
                                 ce.OneOf(key='GcodeUpload', title='G-code upload', choices=[
@@ -808,12 +850,15 @@ def editor():
                         ]),
                         ce.Integer(key='BufferBaseSize', title='Buffer size'),
                         ce.Integer(key='MaxCommandSize', title='Maximum command size'),
+                        ce.Boolean(key='SegmentBlocks', title='Enable pre-planned segment blocks (M950)', default=False),
                         ce.OneOf(key='GcodeParser', title='G-code parser', choices=[
                             ce.Compound('TextGcodeParser', title='Text G-code parser', attrs=[
-                                ce.Integer(key='MaxParts', title='Maximum number of command parts')
+                                ce.Integer(key='MaxParts', title='Maximum number of command parts'),
+                                ce.Boolean(key='PreParseNumbers', title='Convert numbers while reading', default=False)
                             ]),
                             ce.Compound('BinaryGcodeParser', title='Binary G-code parser', attrs=[
-                                ce.Integer(key='MaxParts', title='Maximum number of command parts')
+                                ce.Integer(key='MaxParts', title='Maximum number of command parts'),
+                                ce.Integer(key='MaxMoveAxes', title='Maximum number of move record axes (0-7, 0 to disable)', default=5)
                             ])
                         ]),
                         ce.OneOf(key='SdCardService', title='Driver', choices=[
@@ -911,6 +956,8 @@ def editor():
                 ce.Integer(key='EventChannelBufferSize', title='Event channel buffer size'),
                 ce.Integer(key='LookaheadBufferSize', title='Lookahead buffer size'),
                 ce.Integer(key='LookaheadCommitCount', title='Lookahead commit count'),
+                ce.Integer(key='CommandBatchMaxCommands', title='Maximum commands executed per event (1 to disable batching)', default=8),
+                ce.Float(key='CommandBatchMaxTime', title='Maximum time for executing commands per event [s]', default=0.001),
                 ce.String(key='FpType', enum=['float', 'double']),
                 ce.String(key='AxisDriverPrecisionParams', title='Stepping precision parameters', enum=['AxisDriverAvrPrecisionParams', 'AxisDriverDuePrecisionParams']),
                 ce.Float(key='EventChannelTimerClearance', title='Event channel timer clearance'),
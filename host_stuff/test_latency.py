@@ -18,6 +18,7 @@ class Program (littlevent.close.Obj):
             parser.add_argument('--port', required=True, help='Serial port device.')
             parser.add_argument('--baud', type=int, required=True, help='Baud rate.')
             parser.add_argument('--count', type=int, default=5000, help='Number of commands.')
+            parser.add_argument('--window', type=int, default=0, help='Use windowed streaming (M940) with this many lines in flight.')
             args = parser.parse_args()
             print(args.port)
             print(args.baud)
@@ -33,8 +34,20 @@ class Program (littlevent.close.Obj):
             self.start_time = time.time()
             self.frame = ''
             
+            self.window = args.window
+            self.streaming = False
+            self.recv_buffer = 0
+            self.line_lengths = {}
+            self.next_line = 2
+            self.acked_line = 0
+            self.resend_count = 0
+            
             self._read()
-            self._write()
+            if self.window > 0:
+                self.serial.write_io().write_start(self._numbered(0, 'M110') + self._numbered(1, 'M940 W{}'.format(self.window)))
+                self.writing = True
+            else:
+                self._write()
             
         except littlevent.error.Error as e:
             self.close()
@@ -60,6 +73,10 @@ class Program (littlevent.close.Obj):
             data = data[(newline_pos + 1):]
             if len(response) > 0 and response[-1] == '\r':
                 response = response[:-1]
+            if self.window > 0:
+                if not self._window_response(response):
+                    return
+                continue
             if not response.startswith('ok'):
                 print('Unknown line received: >{}<'.format(response))
             else:
@@ -77,6 +94,8 @@ class Program (littlevent.close.Obj):
             print('ERROR: write error: {}'.format(err))
             return self._quit()
         self.writing = False
+        if self.streaming:
+            self._window_write()
     
     def _read (self):
         self.serial.read_io().read_start(512)
@@ -87,6 +106,58 @@ class Program (littlevent.close.Obj):
         self.serial.write_io().write_start(msg)
         self.writing = True
     
+    def _numbered (self, line, cmd):
+        data = 'N{} {}'.format(line, cmd)
+        checksum = 0
+        for ch in data:
+            checksum ^= ord(ch)
+        return '{}*{}\n'.format(data, checksum)
+    
+    def _window_response (self, response):
+        if response.startswith('W:'):
+            parts = dict((x[0], int(x[2:])) for x in response.split(' '))
+            if parts['W'] == 0:
+                print('ERROR: windowed streaming not supported')
+                self._quit()
+                return False
+            self.window = parts['W']
+            self.recv_buffer = parts['B']
+            self.streaming = True
+            self.start_time = time.time()
+        elif response.startswith('ok N'):
+            self.acked_line = max(self.acked_line, int(response[4:]))
+            self.done_count = max(0, self.acked_line - 1)
+            if self.done_count >= self.want_count:
+                self._finished()
+                return False
+        elif response.startswith('Resend: '):
+            self.next_line = int(response[8:])
+            self.resend_count += 1
+        elif response != 'ok':
+            print('Unknown line received: >{}<'.format(response))
+        if self.streaming:
+            self._window_write()
+        return True
+    
+    def _window_write (self):
+        # Send as many lines as the window and the receive buffer allow,
+        # going back to the requested line after a resend.
+        if self.writing:
+            return
+        in_flight = sum(self.line_lengths.get(n, 0) for n in range(self.acked_line + 1, self.next_line))
+        msg = ''
+        while self.next_line <= self.want_count + 1 and self.next_line - self.acked_line <= self.window:
+            line = self._numbered(self.next_line, 'G1')
+            if in_flight + len(line) > self.recv_buffer:
+                break
+            self.line_lengths[self.next_line] = len(line)
+            in_flight += len(line)
+            msg += line
+            self.next_line += 1
+        if len(msg) > 0:
+            self.serial.write_io().write_start(msg)
+            self.writing = True
+    
     def _quit (self):
         print('Quitting.')
         self.loop.quit(1)
@@ -95,6 +166,8 @@ class Program (littlevent.close.Obj):
         total_time = time.time() - self.start_time
         print('Done {} requests in {} seconds.'.format(self.done_count, total_time))
         print('Average request time is {} seconds.'.format(total_time / self.done_count))
+        if self.window > 0:
+            print('{} lines per second, {} resends.'.format(self.done_count / total_time, self.resend_count))
         self.loop.quit(0)
     
 p = Program()
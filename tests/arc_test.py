@@ -0,0 +1,200 @@
+# Copyright (c) 2017 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+# Checks G2/G3 arcs on the cartesian machine of the segment_blocks_sim
+# program. Each arc is printed on its own, starting with G92 at its start
+# point, and followed by M114. For full circles, quarter and major arcs
+# (I/J and R forms), tiny arcs and a helix, in both directions:
+# - The position reported by M114 and the final step positions must be the
+#   target of the arc, that is the last segment must end exactly there.
+# - The chord error of the planned segments (the sagitta of the angle of one
+#   segment) must be within ArcTolerance, or within that of the longer chord
+#   covered in ArcMinSegmentTime at a high feed rate, and there must not be
+#   more segments than needed for that.
+# - Every sampled step position must be within the same error of the circle,
+#   allowing for one step of rounding on each axis.
+#
+# Usage: python2 arc_test.py [path_to_segment_blocks_sim]
+
+from __future__ import print_function
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+# The configuration of segment_blocks_sim.
+arc_tolerance = 0.01
+arc_min_segment_time = 0.005
+steps_per_unit = [80.0, 80.0, 4000.0]
+
+class Arc(object):
+    def __init__(self, name, clockwise, start, target, offset=None, radius=None, z=0.0, feed=600.0):
+        self.name = name
+        self.clockwise = clockwise
+        self.start = start
+        self.target = target
+        self.offset = offset
+        self.radius = radius
+        self.z = z
+        self.feed = feed
+    
+    def gcode(self):
+        cmd = 'G2' if self.clockwise else 'G3'
+        args = 'X{} Y{}'.format(self.target[0], self.target[1])
+        if self.z != 0.0:
+            args += ' Z{}'.format(self.z)
+        if self.offset is not None:
+            args += ' I{} J{}'.format(self.offset[0], self.offset[1])
+        else:
+            args += ' R{}'.format(self.radius)
+        return 'G90\nG92 X{} Y{} Z0 E0\n{} {} F{}\nM114\n'.format(self.start[0], self.start[1], cmd, args, self.feed)
+    
+    def geometry(self):
+        (sx, sy) = self.start
+        dx = self.target[0] - sx
+        dy = self.target[1] - sy
+        if self.offset is not None:
+            (ox, oy) = self.offset
+        else:
+            # As in the firmware: the center is on the perpendicular bisector
+            # of the chord, a negative radius selects the major arc.
+            chord_squared = dx * dx + dy * dy
+            h_by_chord = math.sqrt(max(0.0, 4.0 * self.radius ** 2 - chord_squared)) / math.sqrt(chord_squared)
+            if self.clockwise == (self.radius < 0.0):
+                h_by_chord = -h_by_chord
+            ox = 0.5 * (dx + dy * h_by_chord)
+            oy = 0.5 * (dy - dx * h_by_chord)
+        center = (sx + ox, sy + oy)
+        r = math.hypot(ox, oy)
+        start_angle = math.atan2(-oy, -ox)
+        end_angle = math.atan2(self.target[1] - center[1], self.target[0] - center[0])
+        sweep = end_angle - start_angle
+        if self.clockwise and sweep >= -1e-6:
+            sweep -= 2.0 * math.pi
+        if not self.clockwise and sweep <= 1e-6:
+            sweep += 2.0 * math.pi
+        return center, r, sweep
+
+arcs = [
+    Arc('full_circle_cw', True, (10.0, 0.0), (10.0, 0.0), offset=(-10.0, 0.0)),
+    Arc('full_circle_ccw', False, (10.0, 0.0), (10.0, 0.0), offset=(-10.0, 0.0)),
+    Arc('full_circle_fast_ccw', False, (0.0, 5.0), (0.0, 5.0), offset=(0.0, -5.0), feed=9000.0),
+    Arc('quarter_cw', True, (0.0, 0.0), (10.0, 10.0), radius=10.0),
+    Arc('quarter_ccw', False, (0.0, 0.0), (10.0, 10.0), radius=10.0),
+    Arc('major_cw', True, (0.0, 0.0), (10.0, 10.0), radius=-10.0),
+    Arc('major_ccw', False, (0.0, 0.0), (7.5, -2.5), radius=-6.0),
+    Arc('tiny_cw', True, (0.0, 0.0), (0.1, 0.0), offset=(0.05, 0.0)),
+    Arc('tiny_ccw', False, (0.0, 0.0), (0.1, 0.0), offset=(0.05, 0.0)),
+    Arc('tiny_below_tolerance', True, (1.0, 1.0), (1.01, 1.0), offset=(0.005, 0.0)),
+    Arc('helix_cw', True, (10.0, 0.0), (10.0, 0.0), offset=(-10.0, 0.0), z=1.5),
+]
+
+def run_sim(sim, data):
+    fd, path = tempfile.mkstemp(suffix='.gcode')
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            f.write(data)
+        output = subprocess.check_output([sim, path]).decode('latin-1')
+    finally:
+        os.remove(path)
+    res = {'samples': [], 'replies': []}
+    for line in output.splitlines():
+        key, value = line.split(' ', 1)
+        if key == 'sample':
+            res['samples'].append([int(x) for x in value.split()[1:]])
+        elif key == 'reply':
+            res['replies'].append(value)
+        else:
+            res[key] = value
+    return res
+
+def reported_position(res):
+    for reply in res['replies']:
+        if reply.startswith('//SdEcho X:'):
+            return dict((part[0], float(part[2:])) for part in reply[len('//SdEcho '):].split())
+    return None
+
+def check(name, ok, details):
+    print('{} {} {}'.format(name, details, 'OK' if ok else 'FAILED'))
+    return ok
+
+def check_arc(sim, arc):
+    ok = True
+    res = run_sim(sim, arc.gcode().encode())
+    center, r, sweep = arc.geometry()
+    
+    errors = [reply for reply in res['replies'] if 'Error' in reply]
+    ok &= check('{}_errors'.format(arc.name), not errors, errors)
+    
+    target = [arc.target[0], arc.target[1], arc.z]
+    reported = reported_position(res)
+    ok &= check('{}_reported_end'.format(arc.name),
+        reported is not None and all(abs(reported[axis] - value) <= 1e-5 * max(1.0, abs(value)) for (axis, value) in zip('XYZ', target)),
+        'reported {} target {}'.format(reported, target))
+    
+    start = [arc.start[0], arc.start[1], 0.0]
+    expected_steps = [int(round(t * spu)) - int(round(s * spu)) for (t, s, spu) in zip(target, start, steps_per_unit)]
+    steps = [int(res['axis{}_position'.format(i)]) for i in range(3)]
+    ok &= check('{}_step_end'.format(arc.name), steps == expected_steps, 'steps {} expected {}'.format(steps, expected_steps))
+    
+    # The chord for the tolerance, unless ArcMinSegmentTime at the feed rate
+    # makes it longer, and the chord error which that allows.
+    tolerance = min(arc_tolerance, r)
+    chord = 2.0 * math.sqrt(tolerance * (2.0 * r - tolerance))
+    chord = max(chord, arc_min_segment_time * arc.feed / 60.0)
+    allowed_error = r - math.sqrt(max(0.0, r * r - chord * chord / 4.0))
+    
+    # Segments are of equal angle, so the chord error is the sagitta of one.
+    num_segments = int(res['segments'])
+    chord_error = r * (1.0 - math.cos(abs(sweep) / (2.0 * num_segments)))
+    ok &= check('{}_chord_error'.format(arc.name), chord_error <= allowed_error * 1.0001,
+        'segments {} radius {:.4f} error {:.6f} allowed {:.6f}'.format(num_segments, r, chord_error, allowed_error))
+    
+    needed_segments = max(1, int(math.ceil(abs(sweep) * r / chord)))
+    ok &= check('{}_num_segments'.format(arc.name), num_segments <= needed_segments + 1,
+        'segments {} needed {}'.format(num_segments, needed_segments))
+    
+    step_size = math.hypot(1.0 / steps_per_unit[0], 1.0 / steps_per_unit[1])
+    max_deviation = 0.0
+    for sample in res['samples']:
+        x = arc.start[0] + sample[0] / steps_per_unit[0]
+        y = arc.start[1] + sample[1] / steps_per_unit[1]
+        max_deviation = max(max_deviation, abs(math.hypot(x - center[0], y - center[1]) - r))
+    ok &= check('{}_path_deviation'.format(arc.name), max_deviation <= allowed_error + step_size,
+        '{:.4f} samples {}'.format(max_deviation, len(res['samples'])))
+    
+    return ok
+
+def main():
+    sim = sys.argv[1] if len(sys.argv) > 1 else './segment_blocks_sim'
+    
+    ok = True
+    for arc in arcs:
+        ok &= check_arc(sim, arc)
+    
+    if not ok:
+        sys.exit(1)
+
+main()
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host-side AxisDriver benchmark.
+ * 
+ * Runs two AxisDrivers on a simulated clock, one taking a single step per
+ * timer interrupt and one in burst mode (AxisDriverBurstParams), and feeds
+ * both the same trapezoidal moves at a range of step rates. The timer
+ * interrupts are dispatched directly from a loop, so the measured host time
+ * is the time spent in the driver's timer handler plus the small cost of
+ * dispatching an interrupt. The step times of the burst driver are compared
+ * against those of the single-step driver to report how early burst steps
+ * are emitted. Both drivers use step pulse delays (AxisDriverDelayParams),
+ * which burst mode requires, and the shortest step low time of the burst
+ * driver is reported too.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. axisdriver_bench.cpp -o axisdriver_bench
+ * The burst parameters can be overridden with -DBENCH_BURST_MAX_STEPS=...
+ * and -DBENCH_BURST_THRESHOLD=... (in microseconds).
+ * 
+ * Usage:
+ *   ./axisdriver_bench [steps_per_rate]
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#ifndef BENCH_BURST_MAX_STEPS
+#define BENCH_BURST_MAX_STEPS 8
+#endif
+#ifndef BENCH_BURST_THRESHOLD
+#define BENCH_BURST_THRESHOLD 20.0
+#endif
+
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/hal/sim/SimClock.h>
+#include <aprinter/printer/actuators/AxisDriver.h>
+#include <aprinter/printer/actuators/AxisDriverConsumer.h>
+
+using namespace APrinter;
+
+static int const NumDrivers = 2;
+static size_t const MaxRecordedSteps = (size_t)1 << 22;
+static int const MaxBenchCommands = 4096;
+static uint32_t const StepsPerCommand = 1000;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+APRINTER_MAKE_INSTANCE(MyClock, (SimClockService<20, NumDrivers>::Clock<Context, Program, MakeTypeList<void>>))
+
+using ClockTimeType = typename MyClock::TimeType;
+
+/*
+ * Fast clock for the step pulse delays. The simulated clock does not advance
+ * within a timer handler, so this one also advances by one tick each time it
+ * is read, like a hardware clock polled in a busy-wait.
+ */
+struct BenchFastClock {
+    using TimeType = uint32_t;
+    static constexpr double time_freq = MyClock::time_freq;
+    static constexpr double time_unit = 1.0 / time_freq;
+    
+    static TimeType reads;
+    
+    template <typename ThisContext>
+    static TimeType getTime (ThisContext c)
+    {
+        return MyClock::getTime(c) + ++reads;
+    }
+};
+
+BenchFastClock::TimeType BenchFastClock::reads;
+
+static ClockTimeType *bench_step_times[NumDrivers];
+static size_t bench_num_steps[NumDrivers];
+static uint32_t bench_num_interrupts[NumDrivers];
+static BenchFastClock::TimeType bench_step_off_time[NumDrivers];
+static BenchFastClock::TimeType bench_min_low_ticks[NumDrivers];
+
+/*
+ * Stepper which records the time of each step instead of driving pins.
+ */
+template <int Index>
+struct BenchStepper {
+    template <typename ThisContext>
+    static void setDir (ThisContext c, bool dir) {}
+    
+    template <typename ThisContext>
+    static void stepOn (ThisContext c)
+    {
+        size_t n = bench_num_steps[Index];
+        if (n < MaxRecordedSteps) {
+            bench_step_times[Index][n] = MyClock::getTime(c);
+        }
+        if (n > 0) {
+            BenchFastClock::TimeType low_ticks = BenchFastClock::getTime(c) - bench_step_off_time[Index];
+            if (low_ticks < bench_min_low_ticks[Index]) {
+                bench_min_low_ticks[Index] = low_ticks;
+            }
+        }
+        bench_num_steps[Index] = n + 1;
+    }
+    
+    template <typename ThisContext>
+    static void stepOff (ThisContext c)
+    {
+        bench_step_off_time[Index] = BenchFastClock::getTime(c);
+    }
+};
+
+template <typename Command>
+struct BenchCommandStore {
+    static Command commands[MaxBenchCommands];
+    static int count;
+    static int pos;
+};
+
+template <typename Command>
+Command BenchCommandStore<Command>::commands[MaxBenchCommands];
+
+template <typename Command>
+int BenchCommandStore<Command>::count;
+
+template <typename Command>
+int BenchCommandStore<Command>::pos;
+
+template <int Index>
+struct BenchCommandCallback {
+    template <typename ThisContext, typename Command>
+    static bool call (ThisContext c, Command **command)
+    {
+        using Store = BenchCommandStore<Command>;
+        if (Store::pos == Store::count) {
+            return false;
+        }
+        *command = &Store::commands[Store::pos++];
+        return true;
+    }
+};
+
+struct BenchPrestepCallback {
+    template <typename ThisContext>
+    static bool call (ThisContext c) { return false; }
+};
+
+template <int Index>
+using BenchConsumer = AxisDriverConsumer<BenchCommandCallback<Index>, BenchPrestepCallback>;
+
+template <int Index>
+struct BenchConsumersList {
+    using List = MakeTypeList<BenchConsumer<Index>>;
+};
+
+using BurstThreshold = AMBRO_WRAP_DOUBLE(BENCH_BURST_THRESHOLD);
+using DirSetTime = AMBRO_WRAP_DOUBLE(0.2);
+using StepHighTime = AMBRO_WRAP_DOUBLE(1.0);
+using StepLowTime = AMBRO_WRAP_DOUBLE(1.0);
+using BenchDelayParams = AxisDriverDelayParams<DirSetTime, StepHighTime, StepLowTime>;
+
+using SingleDriverService = AxisDriverService<
+    SimClockInterruptTimerService<0>,
+    AxisDriverDuePrecisionParams,
+    false,
+    BenchDelayParams,
+    AxisDriverNoBurstParams
+>;
+
+using BurstDriverService = AxisDriverService<
+    SimClockInterruptTimerService<1>,
+    AxisDriverDuePrecisionParams,
+    false,
+    BenchDelayParams,
+    AxisDriverBurstParams<BENCH_BURST_MAX_STEPS, BurstThreshold>
+>;
+
+APRINTER_MAKE_INSTANCE(SingleDriver, (SingleDriverService::Driver<Context, Program, BenchStepper<0>, BenchConsumersList<0>>))
+APRINTER_MAKE_INSTANCE(BurstDriver, (BurstDriverService::Driver<Context, Program, BenchStepper<1>, BenchConsumersList<1>>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = ::MyClock;
+    using FastClock = BenchFastClock;
+    void check () const {}
+};
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    SingleDriver,
+    BurstDriver
+>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+/*
+ * Fills the command buffer of the driver with moves of StepsPerCommand
+ * steps each: an acceleration from zero to the step rate, constant-rate
+ * commands, and a deceleration back to zero, in alternating directions.
+ */
+template <typename Driver>
+static void make_commands (double step_rate, uint32_t total_steps)
+{
+    using Store = BenchCommandStore<typename Driver::Command>;
+    using StepFixedType = typename Driver::StepFixedType;
+    using TimeFixedType = typename Driver::TimeFixedType;
+    using AccelFixedType = typename Driver::AccelFixedType;
+    
+    uint32_t const_ticks = StepsPerCommand / step_rate * MyClock::time_freq;
+    int num_const = total_steps / StepsPerCommand;
+    num_const = (num_const < 3) ? 1 : (num_const - 2);
+    
+    // The first command is passed to start(), the rest are pulled.
+    Store::count = 0;
+    Store::pos = 1;
+    for (int i = 0; i < num_const + 2 && Store::count < MaxBenchCommands; i++) {
+        bool dir = (i / 64) % 2;
+        uint32_t ticks = const_ticks;
+        int32_t accel = 0;
+        if (i == 0) {
+            ticks = 2 * const_ticks;
+            accel = -(int32_t)StepsPerCommand;
+        } else if (i == num_const + 1) {
+            ticks = 2 * const_ticks;
+            accel = StepsPerCommand;
+        }
+        Driver::generate_command(dir, StepFixedType::importBits(StepsPerCommand), TimeFixedType::importBits(ticks), AccelFixedType::importBits(accel), &Store::commands[Store::count++]);
+    }
+}
+
+template <typename Driver, int Index>
+static uint64_t run_driver (Context c, double step_rate, uint32_t total_steps)
+{
+    make_commands<Driver>(step_rate, total_steps);
+    bench_num_steps[Index] = 0;
+    bench_num_interrupts[Index] = 0;
+    bench_min_low_ticks[Index] = UINT32_MAX;
+    
+    uint64_t start_ns = MyClock::getHostNanoseconds();
+    
+    Driver::template start<BenchConsumer<Index>>(c, MyClock::getTime(c) + 1000, &BenchCommandStore<typename Driver::Command>::commands[0]);
+    
+    ClockTimeType first_time;
+    while (MyClock::getFirstTimerTime(c, &first_time)) {
+        MyClock::advanceTo(c, first_time);
+        MyClock::dispatchTimers(c);
+        bench_num_interrupts[Index]++;
+    }
+    
+    uint64_t host_ns = MyClock::getHostNanoseconds() - start_ns;
+    
+    Driver::stop(c);
+    return host_ns;
+}
+
+int main (int argc, char *argv[])
+{
+    uint32_t total_steps = (argc > 1) ? atol(argv[1]) : 1000000;
+    if (argc > 2 || total_steps < 3 * StepsPerCommand || total_steps > MaxRecordedSteps) {
+        fprintf(stderr, "Usage: %s [steps_per_rate]\n", argv[0]);
+        return 1;
+    }
+    
+    for (int i = 0; i < NumDrivers; i++) {
+        bench_step_times[i] = (ClockTimeType *)malloc(MaxRecordedSteps * sizeof(ClockTimeType));
+        AMBRO_ASSERT_FORCE(bench_step_times[i])
+    }
+    
+    Context c;
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    MyClock::init(c);
+    MyClock::setCpuFactor(c, 0.0);
+    SingleDriver::init(c);
+    BurstDriver::init(c);
+    
+    static double const rates[] = {10000.0, 25000.0, 50000.0, 100000.0, 200000.0, 400000.0};
+    
+    printf("burst_max_steps %d\n", BENCH_BURST_MAX_STEPS);
+    printf("burst_threshold_us %g\n", (double)BENCH_BURST_THRESHOLD);
+    printf("step_low_time_us %g\n", StepLowTime::value());
+    printf("%10s %10s %14s %14s %14s %14s %14s %14s\n", "step_rate", "steps",
+           "single_ns", "burst_ns", "single_irq", "burst_irq", "max_early_us", "burst_low_us");
+    
+    for (double rate : rates) {
+        // Time the second run of each driver, so that both are measured warm.
+        uint64_t single_ns = 0;
+        uint64_t burst_ns = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            single_ns = run_driver<SingleDriver, 0>(c, rate, total_steps);
+            burst_ns = run_driver<BurstDriver, 1>(c, rate, total_steps);
+        }
+        
+        size_t steps = bench_num_steps[0];
+        AMBRO_ASSERT_FORCE(bench_num_steps[1] == steps)
+        
+        // Both drivers start 1000 ticks after the clock time at their start,
+        // so compare step times relative to the first step.
+        ClockTimeType max_early = 0;
+        for (size_t i = 0; i < steps; i++) {
+            ClockTimeType single_rel = bench_step_times[0][i] - bench_step_times[0][0];
+            ClockTimeType burst_rel = bench_step_times[1][i] - bench_step_times[1][0];
+            ClockTimeType early = single_rel - burst_rel;
+            if ((int32_t)early > (int32_t)max_early) {
+                max_early = early;
+            }
+        }
+        
+        printf("%10.0f %10zu %14.2f %14.2f %14.3f %14.3f %14.2f %14.2f\n", rate, steps,
+               (double)single_ns / steps, (double)burst_ns / steps,
+               (double)bench_num_interrupts[0] / steps, (double)bench_num_interrupts[1] / steps,
+               max_early * MyClock::time_unit * 1e6, bench_min_low_ticks[1] * BenchFastClock::time_unit * 1e6);
+        AMBRO_ASSERT_FORCE(bench_min_low_ticks[1] * BenchFastClock::time_unit >= 1e-6 * StepLowTime::value())
+    }
+    
+    BurstDriver::deinit(c);
+    SingleDriver::deinit(c);
+    MyClock::deinit(c);
+    MyDebugObjectGroup::deinit(c);
+    
+    return 0;
+}
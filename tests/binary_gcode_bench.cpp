@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks and benchmarks the move records of BinaryGcodeParser.
+ * 
+ * Random axes packets, batches of move records and ordinary packets are
+ * encoded together with the equivalent text G-code. The binary form is given
+ * to BinaryGcodeParser in random chunks like SdCardModule does, and the text
+ * to the file GcodeParser, and all commands and part values (float bits and
+ * uint32) must be identical.
+ * With files, a G-code file and its encodings by aprinter_encode.py without
+ * and with --moves are parsed, the commands compared in the same way (float
+ * values only), and
+ * the sizes and the commands per second of each are reported. A slicer-like
+ * file can be generated with --gen.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. binary_gcode_bench.cpp -o binary_gcode_bench
+ * 
+ * Usage:
+ *   ./binary_gcode_bench [fuzz_count]
+ *   ./binary_gcode_bench --gen file.gcode
+ *   python2 ../aprinter_encode.py --input file.gcode --output file.bin
+ *   python2 ../aprinter_encode.py --moves --input file.gcode --output file_moves.bin
+ *   ./binary_gcode_bench file.gcode file.bin file_moves.bin [passes]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+#include <aprinter/printer/utils/BinaryGcodeParser.h>
+
+using namespace APrinter;
+
+struct Context {
+    void check () const {}
+};
+
+using FpType = float;
+
+using TextParser = GcodeParser<Context, size_t, FpType, GcodeParserTypeFile, FileGcodeParserService<16, false>>;
+using BinaryParser = BinaryGcodeParser<Context, size_t, FpType, BinaryGcodeParserService<14, 7>>;
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_state;
+
+static uint64_t rand_u64 ()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static void append_fixed (std::string *out, int32_t value, int decimals)
+{
+    uint32_t mag = (value < 0) ? -(uint32_t)value : value;
+    char digits[16];
+    int n = snprintf(digits, sizeof(digits), "%0*u", decimals + 1, (unsigned)mag);
+    if (value < 0) {
+        *out += '-';
+    }
+    out->append(digits, n - decimals);
+    if (decimals > 0) {
+        *out += '.';
+        out->append(digits + n - decimals, decimals);
+    }
+}
+
+static void append_varint (std::string *out, uint32_t value)
+{
+    while (value >= 0x80) {
+        *out += (char)(0x80 | (value & 0x7F));
+        value >>= 7;
+    }
+    *out += (char)value;
+}
+
+struct Axis {
+    char code;
+    int decimals;
+    int32_t value;
+};
+
+// Encodes random commands both as binary, with move records, and as text.
+static void random_input (std::string *binary, std::string *text)
+{
+    static char const letters[] = "XYZEFAB";
+    static char const *const move_cmds[] = {"G0", "G1", "G92"};
+    
+    Axis axes[7];
+    int num_axes = 0;
+    int num_packets = 1 + rand_u64() % 8;
+    for (int packet = 0; packet < num_packets; packet++) {
+        int kind = rand_u64() % 8;
+        if (packet == 0 || kind == 0) {
+            // Axes packet, in random order, possibly without F.
+            num_axes = 1 + rand_u64() % 7;
+            char order[8];
+            memcpy(order, letters, sizeof(order));
+            for (int i = 6; i > 0; i--) {
+                int j = rand_u64() % (i + 1);
+                char tmp = order[i];
+                order[i] = order[j];
+                order[j] = tmp;
+            }
+            *binary += (char)(0x40 | num_axes);
+            for (int i = 0; i < num_axes; i++) {
+                axes[i] = Axis{order[i], (int)(rand_u64() % 8), 0};
+                *binary += (char)((axes[i].decimals << 5) | (axes[i].code - 'A'));
+            }
+        } else if (kind == 1) {
+            *binary += (char)0xF0;
+            *binary += (char)((('M' - 'A') << 3) | 0);
+            *binary += (char)105;
+            *text += "M105\n";
+        } else {
+            int cmd = rand_u64() % 3;
+            int count = 1 + rand_u64() % ((rand_u64() % 4 == 0) ? 255 : 10);
+            *binary += (char)(0x50 | cmd);
+            *binary += (char)count;
+            for (int record = 0; record < count; record++) {
+                std::string payload;
+                uint8_t mask = 0;
+                *text += move_cmds[cmd];
+                for (int i = 0; i < num_axes; i++) {
+                    if (rand_u64() % 3 == 0) {
+                        continue;
+                    }
+                    int32_t value = axes[i].value;
+                    switch (rand_u64() % 4) {
+                        case 0: break;
+                        case 1: value = (int32_t)(uint32_t)rand_u64(); break;
+                        default: value += (int32_t)(rand_u64() % 20001) - 10000; break;
+                    }
+                    if (value == INT32_MIN) {
+                        value++;
+                    }
+                    uint32_t delta = (uint32_t)value - (uint32_t)axes[i].value;
+                    axes[i].value = value;
+                    if (axes[i].code == 'F' && delta == 0) {
+                        mask |= 0x80;
+                    } else {
+                        mask |= 1 << i;
+                        append_varint(&payload, (delta << 1) ^ -(delta >> 31));
+                    }
+                    *text += ' ';
+                    *text += axes[i].code;
+                    append_fixed(text, value, axes[i].decimals);
+                }
+                *binary += (char)mask;
+                *binary += payload;
+                *text += '\n';
+            }
+        }
+    }
+    *binary += (char)0xE0;
+}
+
+// Parts are sorted because move records give them in the order of the axes.
+// The uint32 values are only included if requested, since packets encode
+// numbers with decimals as float and then give zero as the uint32 value.
+template <typename TheParser>
+static void record_command (Context c, TheParser *parser, bool uint32_values, std::string *trace)
+{
+    char buf[64];
+    auto num_parts = parser->getNumParts(c);
+    if (num_parts == GCODE_ERROR_NO_PARTS || num_parts == GCODE_ERROR_EOF) {
+        return;
+    }
+    sprintf(buf, "parts=%d", (int)num_parts);
+    *trace += buf;
+    if (num_parts >= 0) {
+        sprintf(buf, " cmd=%c%u", parser->getCmdCode(c), (unsigned)parser->getCmdNumber(c));
+        *trace += buf;
+        std::vector<std::string> parts;
+        for (int i = 0; i < num_parts; i++) {
+            auto part = parser->getPart(c, i);
+            FpType fp = parser->getPartFpValue(c, part);
+            uint32_t bits;
+            memcpy(&bits, &fp, sizeof(bits));
+            unsigned uint32_value = uint32_values ? parser->getPartUint32Value(c, part) : 0;
+            sprintf(buf, " %c[%.9g/%08x,%u]", parser->getPartCode(c, part), fp, (unsigned)bits, uint32_value);
+            parts.push_back(buf);
+        }
+        std::sort(parts.begin(), parts.end());
+        for (std::string const &part : parts) {
+            *trace += part;
+        }
+    }
+    *trace += '\n';
+}
+
+// Feeds the input to the parser like SdCardModule does, with random chunks
+// (or all at once with max_chunk 0), and returns a trace of the commands.
+template <typename TheParser>
+static std::string run_parser (std::string const &input, size_t max_chunk, bool uint32_values)
+{
+    Context c;
+    TheParser parser;
+    parser.init(c);
+    
+    static size_t const MaxCommandSize = 128;
+    std::string buffer = input;
+    std::string trace;
+    size_t pos = 0;
+    
+    while (pos < buffer.size()) {
+        parser.startCommand(c, &buffer[pos], 0);
+        size_t remaining = buffer.size() - pos;
+        size_t avail = 0;
+        while (true) {
+            avail += (max_chunk == 0) ? remaining : 1 + rand_u64() % max_chunk;
+            avail = (avail < MaxCommandSize) ? avail : MaxCommandSize;
+            avail = (avail < remaining) ? avail : remaining;
+            bool exhausted = (avail == MaxCommandSize);
+            if (parser.extendCommand(c, avail, exhausted)) {
+                record_command(c, &parser, uint32_values, &trace);
+                pos += parser.getLength(c);
+                break;
+            }
+            if (exhausted || avail == remaining) {
+                parser.resetCommand(c);
+                trace += "incomplete\n";
+                pos = buffer.size();
+                break;
+            }
+        }
+    }
+    
+    parser.deinit(c);
+    return trace;
+}
+
+static bool check_random (int count)
+{
+    int mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        rand_state = 0x9E3779B97F4A7C15ull * (i + 1);
+        std::string binary;
+        std::string text;
+        random_input(&binary, &text);
+        
+        std::string text_trace = run_parser<TextParser>(text, 0, true);
+        std::string binary_trace = run_parser<BinaryParser>(binary, (rand_u64() % 2) ? 4 : 40, true);
+        if (text_trace != binary_trace) {
+            if (mismatches++ < 3) {
+                printf("mismatch for input:\n%s\n--- text:\n%s\n--- binary:\n%s\n", text.c_str(), text_trace.c_str(), binary_trace.c_str());
+            }
+        }
+    }
+    
+    printf("random_mismatches %d\n", mismatches);
+    return mismatches == 0;
+}
+
+// Slicer-like moves, similar to gcode_scan_bench.
+static void generate_file (FILE *f)
+{
+    float e = 0.0f;
+    fprintf(f, "; generated by binary_gcode_bench\nG28\nM104 S210\nG92 E0\n");
+    for (int layer = 0; layer < 400; layer++) {
+        fprintf(f, ";LAYER:%d\nG0 F9000 X%.3f Y%.3f Z%.2f\nG1 F1800\n", layer, 90.0f + layer % 7, 80.0f, 0.2f * (layer + 1));
+        float x = 100.0f;
+        float y = 100.0f;
+        for (int i = 0; i < 250; i++) {
+            x += (int)(rand_u64() % 8001 - 4000) / 1000.0f;
+            y += (int)(rand_u64() % 8001 - 4000) / 1000.0f;
+            e += 0.0312f;
+            fprintf(f, "G1 X%.3f Y%.3f E%.5f\n", x, y, e);
+            if (i % 50 == 49) {
+                fprintf(f, "G0 F9000 X%.3f Y%.3f\nG1 F1800\n", x + 5.0f, y);
+            }
+        }
+    }
+    fprintf(f, "M104 S0\n");
+}
+
+template <typename TheParser>
+static void bench (char const *name, std::string const &input, int passes)
+{
+    Context c;
+    TheParser parser;
+    parser.init(c);
+    
+    std::string buffer;
+    uint64_t best_ns = UINT64_MAX;
+    uint32_t commands = 0;
+    FpType sum = 0.0f;
+    for (int pass = 0; pass < passes; pass++) {
+        // The text parser modifies the buffer, so start each pass with a fresh copy.
+        buffer = input;
+        commands = 0;
+        sum = 0.0f;
+        size_t pos = 0;
+        uint64_t start_ns = get_ns();
+        while (pos < buffer.size()) {
+            parser.startCommand(c, &buffer[pos], 0);
+            if (!parser.extendCommand(c, buffer.size() - pos)) {
+                parser.resetCommand(c);
+                break;
+            }
+            pos += parser.getLength(c);
+            auto num_parts = parser.getNumParts(c);
+            if (num_parts == GCODE_ERROR_EOF) {
+                break;
+            }
+            if (num_parts >= 0) {
+                commands++;
+                for (int i = 0; i < num_parts; i++) {
+                    sum += parser.getPartFpValue(c, parser.getPart(c, i));
+                }
+            }
+        }
+        uint64_t ns = get_ns() - start_ns;
+        best_ns = (ns < best_ns) ? ns : best_ns;
+    }
+    
+    parser.deinit(c);
+    
+    printf("%s_bytes %zu\n", name, input.size());
+    printf("%s_commands %u\n", name, (unsigned)commands);
+    printf("%s_value_sum %.6g\n", name, sum);
+    printf("%s_commands_per_s %.0f\n", name, commands / (best_ns * 1e-9));
+}
+
+static bool read_file (char const *path, std::string *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out->append(buf, len);
+    }
+    fclose(f);
+    return true;
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc == 3 && !strcmp(argv[1], "--gen")) {
+        FILE *f = fopen(argv[2], "w");
+        if (!f) {
+            fprintf(stderr, "Failed to open %s\n", argv[2]);
+            return 1;
+        }
+        rand_state = 88172645463325252ull;
+        generate_file(f);
+        fclose(f);
+        return 0;
+    }
+    
+    if (argc > 5 || argc == 3) {
+        fprintf(stderr, "Usage: %s [fuzz_count] | --gen file.gcode | file.gcode file.bin file_moves.bin [passes]\n", argv[0]);
+        return 1;
+    }
+    
+    if (argc <= 2) {
+        int fuzz_count = (argc > 1) ? atoi(argv[1]) : 20000;
+        return check_random(fuzz_count) ? 0 : 1;
+    }
+    
+    std::string inputs[3];
+    for (int i = 0; i < 3; i++) {
+        if (!read_file(argv[1 + i], &inputs[i])) {
+            fprintf(stderr, "Failed to read %s\n", argv[1 + i]);
+            return 1;
+        }
+    }
+    // Make sure the last text command is terminated.
+    inputs[0] += '\n';
+    int passes = (argc > 4) ? atoi(argv[4]) : 10;
+    
+    std::string text_trace = run_parser<TextParser>(inputs[0], 0, false);
+    bool ok = true;
+    for (int i = 1; i < 3; i++) {
+        std::string trace = run_parser<BinaryParser>(inputs[i], 0, false);
+        if (trace != text_trace) {
+            printf("%s does not match %s\n", argv[1 + i], argv[1]);
+            ok = false;
+        }
+    }
+    if (!ok) {
+        return 1;
+    }
+    
+    bench<TextParser>("text", inputs[0], passes);
+    bench<BinaryParser>("binary", inputs[1], passes);
+    bench<BinaryParser>("moves", inputs[2], passes);
+    printf("moves_size_ratio_text %.2f\n", inputs[0].size() / (double)inputs[2].size());
+    printf("moves_size_ratio_binary %.2f\n", inputs[1].size() / (double)inputs[2].size());
+    return 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark of BlockCache lookups on the Linux platform, sweeping the
+ * cache size, with and without IndexedLookup.
+ * 
+ * A device of NumDeviceBlocks blocks is written to sdcard.bin in the current
+ * directory, with the index of each block stored at its start. Blocks are
+ * then requested one after another through a CacheRef on top of BlockAccess
+ * and LinuxSdCard, with a skewed random distribution (low blocks are much
+ * more likely), so the hit rate grows with the cache size. In the writable
+ * variants every eighth block is also marked dirty, so that evictions have
+ * to write. Each block is checked to contain its index.
+ * 
+ * Requests which did not need a read are hits; for these the time is mostly
+ * that of finding the entry (plus one event loop iteration). The hit rate
+ * and the average time for hits and misses are reported.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. block_cache_bench.cpp ../aprinter/platform/linux/linux_support.cpp -o block_cache_bench -lpthread
+ * 
+ * Usage:
+ *   ./block_cache_bench [num_requests]
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <aprinter/platform/linux/linux_support.h>
+
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/MemberType.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/base/TransferVector.h>
+#include <aprinter/structure/LinkedHeap.h>
+#include <aprinter/system/LinuxEventLoop.h>
+#include <aprinter/hal/linux/LinuxClock.h>
+#include <aprinter/hal/linux/LinuxSdCard.h>
+#include <aprinter/fs/BlockAccess.h>
+#include <aprinter/fs/BlockCache.h>
+
+using namespace APrinter;
+
+static size_t const BlockSize = 512;
+static int const NumDeviceBlocksBits = 12;
+static uint32_t const NumDeviceBlocks = (uint32_t)1 << NumDeviceBlocksBits;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+using MyClockService = LinuxClockService<16, 4>;
+APRINTER_MAKE_INSTANCE(MyClock, (MyClockService::Clock<Context, Program, EmptyTypeList>))
+
+struct MyLoopExtraDelay;
+APRINTER_MAKE_INSTANCE(MyLoop, (LinuxEventLoopArg<Context, Program, MyLoopExtraDelay, LinkedHeapService>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = MyClock;
+    using EventLoop = MyLoop;
+    
+    void check () const {}
+};
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_u64 ()
+{
+    static uint64_t state = 88172645463325252ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static size_t num_requests = 100000;
+static size_t num_reads;
+static size_t num_writes;
+
+// LinuxSdCard, counting the reads and writes.
+template <typename Arg>
+class CountingSdCard {
+    APRINTER_USE_TYPES1(Arg, (Context, ParentObject, InitHandler, CommandHandler))
+
+public:
+    struct Object;
+
+private:
+    APRINTER_MAKE_INSTANCE(TheSd, (LinuxSdCardService<BlockSize, 1, 1>::SdCard<Context, Object, InitHandler, CommandHandler>))
+
+public:
+    using BlockIndexType = typename TheSd::BlockIndexType;
+    static size_t const BlockSize = TheSd::BlockSize;
+    using DataWordType = typename TheSd::DataWordType;
+    static size_t const MaxIoBlocks = TheSd::MaxIoBlocks;
+    static int const MaxIoDescriptors = TheSd::MaxIoDescriptors;
+    
+    static void init (Context c) { TheSd::init(c); }
+    static void deinit (Context c) { TheSd::deinit(c); }
+    static void activate (Context c) { TheSd::activate(c); }
+    static void deactivate (Context c) { TheSd::deactivate(c); }
+    static BlockIndexType getCapacityBlocks (Context c) { return TheSd::getCapacityBlocks(c); }
+    static bool isWritable (Context c) { return TheSd::isWritable(c); }
+    
+    static void startReadOrWrite (Context c, bool is_write, BlockIndexType block, size_t num_blocks, TransferVector<DataWordType> data_vector)
+    {
+        (is_write ? num_writes : num_reads)++;
+        TheSd::startReadOrWrite(c, is_write, block, num_blocks, data_vector);
+    }
+
+public:
+    struct Object : public ObjBase<CountingSdCard, ParentObject, MakeTypeList<
+        TheSd
+    >> {};
+};
+
+struct CountingSdCardService {
+    template <typename TContext, typename TParentObject, typename TInitHandler, typename TCommandHandler>
+    struct SdCard {
+        using Context = TContext;
+        using ParentObject = TParentObject;
+        using InitHandler = TInitHandler;
+        using CommandHandler = TCommandHandler;
+        
+        template <typename Self=SdCard>
+        using Instance = CountingSdCard<Self>;
+    };
+};
+
+static void bench_done (Context c);
+
+template <int NumCacheEntries, bool IndexedLookup, bool Writable, typename ParentObject>
+class Bench {
+public:
+    struct Object;
+
+private:
+    struct ActivateHandler;
+    APRINTER_MAKE_INSTANCE(TheBlockAccess, (BlockAccessService<CountingSdCardService>::Access<Context, Object, ActivateHandler>))
+    APRINTER_MAKE_INSTANCE(TheBlockCache, (BlockCacheArg<Context, Object, TheBlockAccess, NumCacheEntries, 1, 1, Writable, IndexedLookup>))
+    using CacheRef = typename TheBlockCache::CacheRef;
+
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        TheBlockAccess::init(c);
+        TheBlockCache::init(c);
+        o->ref.init(c, APRINTER_CB_STATFUNC_T(&Bench::ref_handler));
+        o->next_event.init(c, APRINTER_CB_STATFUNC_T(&Bench::next_event_handler));
+    }
+    
+    static void start (Context c)
+    {
+        TheBlockAccess::activate(c);
+    }
+
+private:
+    static void activate_handler (Context c, uint8_t error_code)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT_FORCE(error_code == 0)
+        
+        o->num_done = 0;
+        o->num_hits = 0;
+        o->hit_ns = 0;
+        o->miss_ns = 0;
+        num_reads = 0;
+        num_writes = 0;
+        
+        next_event_handler(c);
+    }
+    struct ActivateHandler : public AMBRO_WFUNC_TD(&Bench::activate_handler) {};
+    
+    static void next_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->num_done == num_requests) {
+            return finish(c);
+        }
+        
+        // Below a random power of two, so each doubling of the cache adds
+        // about the same number of hits.
+        o->block = (uint32_t)(rand_u64() % ((uint32_t)2 << (rand_u64() % NumDeviceBlocksBits)));
+        o->start_reads = num_reads;
+        o->start_ns = get_ns();
+        
+        if (o->ref.requestBlock(c, o->block, 0, 1, 0)) {
+            ref_handler(c, false);
+        }
+    }
+    
+    static void ref_handler (Context c, bool error)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT_FORCE(!error)
+        
+        uint32_t stored;
+        memcpy(&stored, o->ref.getData(c, WrapBool<false>()), sizeof(stored));
+        AMBRO_ASSERT_FORCE(stored == o->block)
+        
+        if (Writable && o->num_done % 8 == 0) {
+            mark_dirty(c);
+        }
+        
+        uint64_t time_ns = get_ns() - o->start_ns;
+        if (num_reads == o->start_reads) {
+            o->num_hits++;
+            o->hit_ns += time_ns;
+        } else {
+            o->miss_ns += time_ns;
+        }
+        o->num_done++;
+        
+        o->ref.reset(c);
+        o->next_event.prependNowNotAlready(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(Writable, static, void, mark_dirty (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        char *data = o->ref.getData(c, WrapBool<true>());
+        memcpy(data, &o->block, sizeof(o->block));
+        o->ref.markDirty(c);
+    }
+    
+    static void finish (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        size_t num_misses = o->num_done - o->num_hits;
+        printf("entries=%d indexed=%d writable=%d hit_rate=%.3f ns_per_hit=%.0f ns_per_miss=%.0f reads=%zu writes=%zu\n",
+               NumCacheEntries, (int)IndexedLookup, (int)Writable, (double)o->num_hits / o->num_done,
+               o->num_hits ? (double)o->hit_ns / o->num_hits : 0.0, num_misses ? (double)o->miss_ns / num_misses : 0.0,
+               num_reads, num_writes);
+        
+        bench_done(c);
+    }
+
+public:
+    struct Object : public ObjBase<Bench, ParentObject, MakeTypeList<
+        TheBlockAccess,
+        TheBlockCache
+    >> {
+        CacheRef ref;
+        typename Context::EventLoop::QueuedEvent next_event;
+        uint32_t block;
+        size_t start_reads;
+        uint64_t start_ns;
+        size_t num_done;
+        size_t num_hits;
+        uint64_t hit_ns;
+        uint64_t miss_ns;
+    };
+};
+
+using Bench1 = Bench<16, false, false, Program>;
+using Bench2 = Bench<64, false, false, Program>;
+using Bench3 = Bench<16, true, false, Program>;
+using Bench4 = Bench<64, true, false, Program>;
+using Bench5 = Bench<256, true, false, Program>;
+using Bench6 = Bench<1024, true, false, Program>;
+using Bench7 = Bench<16, false, true, Program>;
+using Bench8 = Bench<64, false, true, Program>;
+using Bench9 = Bench<16, true, true, Program>;
+using Bench10 = Bench<64, true, true, Program>;
+using Bench11 = Bench<256, true, true, Program>;
+using Bench12 = Bench<1024, true, true, Program>;
+
+using BenchList = MakeTypeList<Bench1, Bench2, Bench3, Bench4, Bench5, Bench6, Bench7, Bench8, Bench9, Bench10, Bench11, Bench12>;
+
+APRINTER_DEFINE_MEMBER_TYPE(MemberType_EventLoopFastEvents, EventLoopFastEvents)
+APRINTER_MAKE_INSTANCE(MyLoopExtra, (LinuxEventLoopExtraArg<Program, MyLoop, ObjCollect<BenchList, MemberType_EventLoopFastEvents>>))
+struct MyLoopExtraDelay : public WrapType<MyLoopExtra> {};
+
+struct Program : public ObjBase<void, void, JoinTypeLists<MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    MyLoop,
+    MyLoopExtra
+>, BenchList>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+static void (*const bench_starts[]) (Context c) = {
+    Bench1::start, Bench2::start, Bench3::start, Bench4::start, Bench5::start, Bench6::start,
+    Bench7::start, Bench8::start, Bench9::start, Bench10::start, Bench11::start, Bench12::start
+};
+static size_t const NumBenches = sizeof(bench_starts) / sizeof(bench_starts[0]);
+static size_t current_bench;
+
+static void bench_done (Context c)
+{
+    if (++current_bench == NumBenches) {
+        exit(0);
+    }
+    bench_starts[current_bench](c);
+}
+
+static bool write_sdcard ()
+{
+    FILE *f = fopen("sdcard.bin", "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = true;
+    char block_data[BlockSize] = {};
+    for (uint32_t block = 0; block < NumDeviceBlocks; block++) {
+        memcpy(block_data, &block, sizeof(block));
+        ok = ok && fwrite(block_data, 1, BlockSize, f) == BlockSize;
+    }
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [num_requests]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 1) {
+        num_requests = strtoul(argv[1], nullptr, 10);
+    }
+    
+    if (!write_sdcard()) {
+        fprintf(stderr, "Failed to write sdcard.bin\n");
+        return 1;
+    }
+    
+    platform_init(1, argv);
+    
+    Context c;
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    MyClock::init(c);
+    MyLoop::init(c);
+    Bench1::init(c);
+    Bench2::init(c);
+    Bench3::init(c);
+    Bench4::init(c);
+    Bench5::init(c);
+    Bench6::init(c);
+    Bench7::init(c);
+    Bench8::init(c);
+    Bench9::init(c);
+    Bench10::init(c);
+    Bench11::init(c);
+    Bench12::init(c);
+    
+    bench_starts[0](c);
+    
+    MyLoop::run(c);
+}
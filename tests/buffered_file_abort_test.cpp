@@ -0,0 +1,565 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Test of aborting preallocated uploads with BufferedFile on FatFs, on the
+ * Linux platform.
+ * 
+ * A small FAT32 file system containing one empty file is written to
+ * sdcard.bin in the current directory and mounted writable. The file is then
+ * uploaded repeatedly: it is opened for writing with UploadSize bytes
+ * preallocated, and written in chunks. The first upload is completed, and
+ * gives the number of block device I/Os of an upload. The second is aborted
+ * right after starting to open the file. Each further upload is aborted with
+ * startAbort while its N-th I/O is in progress, for each N, which covers
+ * aborting while opening, preallocating, writing and truncating.
+ * 
+ * After each upload, the FAT, the FSInfo sector and the directory entry are
+ * read back from sdcard.bin. The chain of the file must be just long enough
+ * for its size, the file must contain the start of the uploaded data, and
+ * all other clusters except that of the root directory must be free, both
+ * as counted in the FAT and as stated in the FSInfo sector.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -fno-access-control -DAMBROLIB_ASSERTIONS -I.. buffered_file_abort_test.cpp ../aprinter/platform/linux/linux_support.cpp -o buffered_file_abort_test -lpthread
+ * 
+ * Usage:
+ *   ./buffered_file_abort_test
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aprinter/platform/linux/linux_support.h>
+
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/MemberType.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/base/TransferVector.h>
+#include <aprinter/base/BinaryTools.h>
+#include <aprinter/structure/LinkedHeap.h>
+#include <aprinter/system/LinuxEventLoop.h>
+#include <aprinter/hal/linux/LinuxClock.h>
+#include <aprinter/hal/linux/LinuxSdCard.h>
+#include <aprinter/fs/BlockAccess.h>
+#include <aprinter/fs/BlockRange.h>
+#include <aprinter/fs/FatFs.h>
+#include <aprinter/fs/BufferedFile.h>
+
+using namespace APrinter;
+
+// One block per cluster, so that each cluster of the upload needs its own
+// FAT entry. The FAT has room for more entries than there are clusters.
+static size_t const BlockSize = 512;
+static uint32_t const NumDeviceBlocks = 4096;
+static uint32_t const NumReservedSectors = 32;
+static uint32_t const SectorsPerFat = 32;
+static uint32_t const NumClusters = NumDeviceBlocks - NumReservedSectors - 2 * SectorsPerFat;
+static uint32_t const RootCluster = 2;
+static char const FileName[] = "UPLOAD.TXT";
+
+static uint32_t const UploadSize = 40000;
+static size_t const ChunkSize = 700;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+using MyClockService = LinuxClockService<16, 4>;
+APRINTER_MAKE_INSTANCE(MyClock, (MyClockService::Clock<Context, Program, EmptyTypeList>))
+
+struct MyLoopExtraDelay;
+APRINTER_MAKE_INSTANCE(MyLoop, (LinuxEventLoopArg<Context, Program, MyLoopExtraDelay, LinkedHeapService>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = MyClock;
+    using EventLoop = MyLoop;
+    
+    void check () const {}
+};
+
+static char upload_byte (uint32_t pos)
+{
+    return 'A' + (pos * 7 + pos / 512) % 26;
+}
+
+static size_t num_ios;
+static size_t abort_at_io;
+static void io_started (Context c);
+
+// LinuxSdCard, counting the I/Os and reporting the one to abort at.
+template <typename Arg>
+class CountingSdCard {
+    APRINTER_USE_TYPES1(Arg, (Context, ParentObject, InitHandler, CommandHandler))
+
+public:
+    struct Object;
+
+private:
+    APRINTER_MAKE_INSTANCE(TheSd, (LinuxSdCardService<BlockSize, 1, 1>::SdCard<Context, Object, InitHandler, CommandHandler>))
+
+public:
+    using BlockIndexType = typename TheSd::BlockIndexType;
+    static size_t const BlockSize = TheSd::BlockSize;
+    using DataWordType = typename TheSd::DataWordType;
+    static size_t const MaxIoBlocks = TheSd::MaxIoBlocks;
+    static int const MaxIoDescriptors = TheSd::MaxIoDescriptors;
+    
+    static void init (Context c) { TheSd::init(c); }
+    static void deinit (Context c) { TheSd::deinit(c); }
+    static void activate (Context c) { TheSd::activate(c); }
+    static void deactivate (Context c) { TheSd::deactivate(c); }
+    static BlockIndexType getCapacityBlocks (Context c) { return TheSd::getCapacityBlocks(c); }
+    static bool isWritable (Context c) { return TheSd::isWritable(c); }
+    
+    static void startReadOrWrite (Context c, bool is_write, BlockIndexType block, size_t num_blocks, TransferVector<DataWordType> data_vector)
+    {
+        TheSd::startReadOrWrite(c, is_write, block, num_blocks, data_vector);
+        if (++num_ios == abort_at_io) {
+            io_started(c);
+        }
+    }
+
+public:
+    struct Object : public ObjBase<CountingSdCard, ParentObject, MakeTypeList<
+        TheSd
+    >> {};
+};
+
+struct CountingSdCardService {
+    template <typename TContext, typename TParentObject, typename TInitHandler, typename TCommandHandler>
+    struct SdCard {
+        using Context = TContext;
+        using ParentObject = TParentObject;
+        using InitHandler = TInitHandler;
+        using CommandHandler = TCommandHandler;
+        
+        template <typename Self=SdCard>
+        using Instance = CountingSdCard<Self>;
+    };
+};
+
+// File system access for BufferedFile, which is always granted at once.
+template <typename TheFs>
+struct TestFsAccess {
+    using TheFileSystem = TheFs;
+    
+    class Client {
+    public:
+        using ClientHandler = Callback<void(Context c, bool error)>;
+        
+        void init (Context c, ClientHandler handler)
+        {
+            m_event.init(c, APRINTER_CB_OBJFUNC_T(&Client::event_handler, this));
+            m_handler = handler;
+        }
+        
+        void deinit (Context c)
+        {
+            m_event.deinit(c);
+        }
+        
+        void reset (Context c)
+        {
+            m_event.unset(c);
+        }
+        
+        void requestAccess (Context c, bool writable)
+        {
+            m_event.prependNowNotAlready(c);
+        }
+        
+        typename TheFs::FsEntry getCurrentDirectory (Context c)
+        {
+            return TheFs::getRootEntry(c);
+        }
+    
+    private:
+        void event_handler (Context c)
+        {
+            return m_handler(c, false);
+        }
+        
+        typename Context::EventLoop::QueuedEvent m_event;
+        ClientHandler m_handler;
+    };
+};
+
+class Test {
+public:
+    struct Object;
+
+private:
+    struct ActivateHandler;
+    struct FsInitHandler;
+    struct FsWriteMountHandler;
+    APRINTER_MAKE_INSTANCE(TheBlockAccess, (BlockAccessService<CountingSdCardService>::Access<Context, Object, ActivateHandler>))
+    using TheFsService = FatFsService<32, 4, 1, 1, true, true, false, false, 1, 0>;
+    APRINTER_MAKE_INSTANCE(TheFs, (TheFsService::Fs<Context, Object, TheBlockAccess, FsInitHandler, FsWriteMountHandler>))
+    using TheBufferedFile = BufferedFile<Context, TestFsAccess<TheFs>>;
+    
+    enum class State {IDLE, OPENING, WRITING, CLOSING, ABORTING};
+
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        TheBlockAccess::init(c);
+        o->file.init(c, APRINTER_CB_STATFUNC_T(&Test::file_handler));
+        o->abort_event.init(c, APRINTER_CB_STATFUNC_T(&Test::abort_event_handler));
+        o->state = State::IDLE;
+        o->upload_index = 0;
+        o->num_failed = 0;
+        for (uint32_t i = 0; i < ChunkSize; i++) {
+            o->chunk[i] = 0;
+        }
+    }
+    
+    static void start (Context c)
+    {
+        TheBlockAccess::activate(c);
+    }
+    
+    static void abortAtIo (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->abort_event.prependNow(c);
+    }
+
+private:
+    static void activate_handler (Context c, uint8_t error_code)
+    {
+        AMBRO_ASSERT_FORCE(error_code == 0)
+        
+        TheFs::init(c, BlockRange<typename TheBlockAccess::BlockIndexType>{0, TheBlockAccess::getCapacityBlocks(c)});
+    }
+    struct ActivateHandler : public AMBRO_WFUNC_TD(&Test::activate_handler) {};
+    
+    static void fs_init_handler (Context c, uint8_t error_code)
+    {
+        AMBRO_ASSERT_FORCE(error_code == 0)
+        
+        TheFs::startWriteMount(c);
+    }
+    struct FsInitHandler : public AMBRO_WFUNC_TD(&Test::fs_init_handler) {};
+    
+    static void fs_write_mount_handler (Context c, bool error)
+    {
+        AMBRO_ASSERT_FORCE(!error)
+        
+        start_upload(c);
+    }
+    struct FsWriteMountHandler : public AMBRO_WFUNC_TD(&Test::fs_write_mount_handler) {};
+    
+    static void start_upload (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        num_ios = 0;
+        abort_at_io = (o->upload_index >= 2) ? o->upload_index - 1 : 0;
+        o->upload_pos = 0;
+        o->state = State::OPENING;
+        o->file.startOpen(c, FileName, false, TheBufferedFile::OpenMode::OPEN_WRITE, nullptr, UploadSize);
+        
+        if (o->upload_index == 1) {
+            o->state = State::ABORTING;
+            o->file.startAbort(c);
+        }
+    }
+    
+    static void abort_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        // The I/O may be a write-back by the cache after the upload.
+        if (o->state == State::IDLE) {
+            return;
+        }
+        if (o->state != State::ABORTING) {
+            o->state = State::ABORTING;
+            o->file.startAbort(c);
+        }
+    }
+    
+    static void file_handler (Context c, typename TheBufferedFile::Error error, size_t read_length)
+    {
+        auto *o = Object::self(c);
+        
+        if (error != TheBufferedFile::Error::NO_ERROR) {
+            printf("upload %zu: error %d\n", o->upload_index, (int)error);
+            o->num_failed++;
+            return finish_upload(c);
+        }
+        
+        switch (o->state) {
+            case State::OPENING:
+            case State::WRITING: {
+                if (o->upload_pos == UploadSize) {
+                    o->state = State::CLOSING;
+                    o->file.startWriteEof(c);
+                    return;
+                }
+                size_t amount = MinValue((size_t)(UploadSize - o->upload_pos), ChunkSize);
+                for (size_t i = 0; i < amount; i++) {
+                    o->chunk[i] = upload_byte(o->upload_pos + i);
+                }
+                o->upload_pos += amount;
+                o->state = State::WRITING;
+                o->file.startWriteData(c, o->chunk, amount);
+            } break;
+            
+            case State::CLOSING:
+            case State::ABORTING: {
+                finish_upload(c);
+            } break;
+            
+            default: AMBRO_ASSERT_FORCE(false);
+        }
+    }
+    
+    static void finish_upload (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        bool aborted = (o->state == State::ABORTING);
+        o->state = State::IDLE;
+        
+        if (o->upload_index == 0) {
+            o->num_upload_ios = num_ios;
+        }
+        
+        if (!check_image(o->upload_index, aborted, o->upload_pos)) {
+            o->num_failed++;
+        }
+        
+        if (++o->upload_index > o->num_upload_ios + 1) {
+            printf("%zu uploads, %zu failed\n", o->upload_index, o->num_failed);
+            exit(o->num_failed == 0 ? 0 : 1);
+        }
+        
+        start_upload(c);
+    }
+    
+    static uint32_t read_fat_entry (FILE *f, uint32_t cluster)
+    {
+        char buf[4];
+        fseek(f, NumReservedSectors * BlockSize + 4 * cluster, SEEK_SET);
+        AMBRO_ASSERT_FORCE(fread(buf, 1, 4, f) == 4)
+        return ReadBinaryInt<uint32_t, BinaryLittleEndian>(buf) & UINT32_C(0x0FFFFFFF);
+    }
+    
+    static uint32_t cluster_offset (uint32_t cluster)
+    {
+        return (NumReservedSectors + 2 * SectorsPerFat + (cluster - 2)) * BlockSize;
+    }
+    
+    static bool check_image (size_t upload_index, bool aborted, uint32_t written)
+    {
+        FILE *f = fopen("sdcard.bin", "rb");
+        AMBRO_ASSERT_FORCE(f)
+        
+        char entry[32];
+        fseek(f, cluster_offset(RootCluster), SEEK_SET);
+        AMBRO_ASSERT_FORCE(fread(entry, 1, 32, f) == 32)
+        uint32_t first_cluster = (uint32_t)ReadBinaryInt<uint16_t, BinaryLittleEndian>(entry + 0x14) << 16 |
+                                 ReadBinaryInt<uint16_t, BinaryLittleEndian>(entry + 0x1A);
+        uint32_t file_size = ReadBinaryInt<uint32_t, BinaryLittleEndian>(entry + 0x1C);
+        
+        bool data_ok = true;
+        uint32_t chain_length = 0;
+        uint32_t cluster = first_cluster;
+        while (cluster >= 2 && cluster < 2 + NumClusters && chain_length <= NumClusters) {
+            char block[BlockSize];
+            fseek(f, cluster_offset(cluster), SEEK_SET);
+            AMBRO_ASSERT_FORCE(fread(block, 1, BlockSize, f) == BlockSize)
+            for (uint32_t i = 0; i < BlockSize; i++) {
+                uint32_t pos = chain_length * BlockSize + i;
+                if (pos < file_size && block[i] != upload_byte(pos)) {
+                    data_ok = false;
+                }
+            }
+            chain_length++;
+            cluster = read_fat_entry(f, cluster);
+        }
+        
+        uint32_t num_free = 0;
+        for (uint32_t cluster = 2; cluster < 2 + NumClusters; cluster++) {
+            if (read_fat_entry(f, cluster) == 0) {
+                num_free++;
+            }
+        }
+        
+        char fs_info[BlockSize];
+        fseek(f, 1 * BlockSize, SEEK_SET);
+        AMBRO_ASSERT_FORCE(fread(fs_info, 1, BlockSize, f) == BlockSize)
+        uint32_t fs_info_free = ReadBinaryInt<uint32_t, BinaryLittleEndian>(fs_info + 0x1E8);
+        
+        fclose(f);
+        
+        uint32_t needed_clusters = file_size / BlockSize + (file_size % BlockSize != 0);
+        bool ok = data_ok &&
+                  (aborted || file_size == UploadSize) &&
+                  chain_length == needed_clusters &&
+                  num_free == NumClusters - 1 - chain_length &&
+                  fs_info_free == num_free;
+        
+        printf("upload %zu: %s abort_at_io=%zu size=%" PRIu32 " chain=%" PRIu32 " free=%" PRIu32 " fsinfo_free=%" PRIu32 " %s\n",
+               upload_index, aborted ? "aborted" : "completed", abort_at_io, file_size, chain_length,
+               num_free, fs_info_free, ok ? "OK" : "FAIL");
+        return ok;
+    }
+
+public:
+    struct Object : public ObjBase<Test, Program, MakeTypeList<
+        TheBlockAccess,
+        TheFs
+    >> {
+        TheBufferedFile file;
+        typename Context::EventLoop::QueuedEvent abort_event;
+        State state;
+        size_t upload_index;
+        size_t num_upload_ios;
+        size_t num_failed;
+        uint32_t upload_pos;
+        char chunk[ChunkSize];
+    };
+};
+
+static void io_started (Context c)
+{
+    Test::abortAtIo(c);
+}
+
+APRINTER_DEFINE_MEMBER_TYPE(MemberType_EventLoopFastEvents, EventLoopFastEvents)
+APRINTER_MAKE_INSTANCE(MyLoopExtra, (LinuxEventLoopExtraArg<Program, MyLoop, ObjCollect<MakeTypeList<Test>, MemberType_EventLoopFastEvents>>))
+struct MyLoopExtraDelay : public WrapType<MyLoopExtra> {};
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    MyLoop,
+    MyLoopExtra,
+    Test
+>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+static void set_fat_entry (char *image, uint32_t cluster, uint32_t value)
+{
+    for (int fat = 0; fat < 2; fat++) {
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(value, image + (NumReservedSectors + fat * SectorsPerFat) * BlockSize + 4 * cluster);
+    }
+}
+
+// Writes a FAT32 file system without a partition table, with an empty
+// file in the root directory.
+static bool write_sdcard ()
+{
+    static char image[NumDeviceBlocks * BlockSize];
+    
+    char *boot = image;
+    memcpy(boot + 0x3, "APRINTER", 8);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(BlockSize, boot + 0xB);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(1, boot + 0xD);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(NumReservedSectors, boot + 0xE);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(2, boot + 0x10);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(0xF8, boot + 0x15);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(NumDeviceBlocks, boot + 0x20);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(SectorsPerFat, boot + 0x24);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(RootCluster, boot + 0x2C);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(1, boot + 0x30);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(0x29, boot + 0x42);
+    memcpy(boot + 0x52, "FAT32   ", 8);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(0xAA55, boot + 0x1FE);
+    
+    char *fs_info = image + BlockSize;
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0x41615252), fs_info + 0x0);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0x61417272), fs_info + 0x1E4);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(NumClusters - 1, fs_info + 0x1E8);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(RootCluster, fs_info + 0x1EC);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0xAA550000), fs_info + 0x1FC);
+    
+    set_fat_entry(image, 0, UINT32_C(0x0FFFFFF8));
+    set_fat_entry(image, 1, UINT32_C(0x0FFFFFFF));
+    set_fat_entry(image, RootCluster, UINT32_C(0x0FFFFFFF));
+    
+    char *entry = image + (NumReservedSectors + 2 * SectorsPerFat) * BlockSize;
+    memcpy(entry, "UPLOAD  TXT", 11);
+    WriteBinaryInt<uint8_t, BinaryLittleEndian>(0x20, entry + 0xB);
+    
+    FILE *f = fopen("sdcard.bin", "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(image, 1, sizeof(image), f) == sizeof(image);
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+int main (int argc, char *argv[])
+{
+    if (!write_sdcard()) {
+        fprintf(stderr, "Failed to write sdcard.bin\n");
+        return 1;
+    }
+    
+    platform_init(1, argv);
+    
+    Context c;
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    MyClock::init(c);
+    MyLoop::init(c);
+    Test::init(c);
+    
+    Test::start(c);
+    
+    MyLoop::run(c);
+}
@@ -0,0 +1,117 @@
+# Copyright (c) 2017 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Compares the total planned move time of the per-axis cornering distance
+# model and the junction deviation model on randomly generated curved paths
+# (arcs, spirals and sine waves cut into short segments), using the
+# motionplanner_bench program. The time reported is the virtual time it takes
+# the simulated machine to execute all the moves.
+#
+# Usage: python cornering_bench.py [path_to_motionplanner_bench] [junction_deviation]
+
+from __future__ import print_function
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+num_paths = 200
+min_seg_len = 0.1
+max_seg_len = 2.0
+min_speed = 20.0
+max_speed = 200.0
+center = 100.0
+max_radius = 80.0
+
+def gen_curve():
+    kind = random.choice(['arc', 'spiral', 'sine'])
+    seg_len = random.uniform(min_seg_len, max_seg_len)
+    radius = random.uniform(5.0, max_radius)
+    angle0 = random.uniform(0.0, 2.0 * math.pi)
+    points = []
+    if kind == 'arc':
+        sweep = random.uniform(0.5, 2.0) * math.pi
+        count = max(2, int(abs(sweep) * radius / seg_len))
+        for i in range(count + 1):
+            a = angle0 + sweep * i / count
+            points.append((radius * math.cos(a), radius * math.sin(a)))
+    elif kind == 'spiral':
+        turns = random.uniform(1.0, 3.0)
+        count = max(2, int(turns * math.pi * radius / seg_len))
+        for i in range(count + 1):
+            f = float(i) / count
+            a = angle0 + 2.0 * math.pi * turns * f
+            r = radius * (1.0 - 0.8 * f)
+            points.append((r * math.cos(a), r * math.sin(a)))
+    else:
+        amplitude = random.uniform(1.0, 20.0)
+        wavelength = random.uniform(5.0, 50.0)
+        length = 2.0 * radius
+        count = max(2, int(length / seg_len))
+        for i in range(count + 1):
+            x = -radius + length * i / count
+            y = amplitude * math.sin(2.0 * math.pi * x / wavelength)
+            points.append((x * math.cos(angle0) - y * math.sin(angle0), x * math.sin(angle0) + y * math.cos(angle0)))
+    return points
+
+def gen_gcode(junction_deviation):
+    lines = ['G21', 'G90', 'M83']
+    if junction_deviation is not None:
+        lines.append('M926 IJunctionDeviationEnabled V1')
+        lines.append('M926 IJunctionDeviation V{}'.format(junction_deviation))
+        lines.append('M930')
+    for _ in range(num_paths):
+        points = gen_curve()
+        feedrate = 60.0 * random.uniform(min_speed, max_speed)
+        x, y = points[0]
+        lines.append('G0 X{:.4f} Y{:.4f} F{:.1f}'.format(center + x, center + y, 60.0 * max_speed))
+        for (x, y) in points[1:]:
+            lines.append('G1 X{:.4f} Y{:.4f} E0.01 F{:.1f}'.format(center + x, center + y, feedrate))
+    return '\n'.join(lines) + '\n'
+
+def run_bench(bench, gcode):
+    fd, path = tempfile.mkstemp(suffix='.gcode')
+    try:
+        with os.fdopen(fd, 'w') as f:
+            f.write(gcode)
+        output = subprocess.check_output([bench, path]).decode()
+    finally:
+        os.remove(path)
+    return dict(line.split(' ', 1) for line in output.splitlines())
+
+def main():
+    bench = sys.argv[1] if len(sys.argv) > 1 else './motionplanner_bench'
+    junction_deviation = float(sys.argv[2]) if len(sys.argv) > 2 else 0.05
+    
+    seed = random.randrange(1 << 32)
+    results = []
+    for model, jd in [('cornering_distance', None), ('junction_deviation', junction_deviation)]:
+        random.seed(seed)
+        res = run_bench(bench, gen_gcode(jd))
+        results.append(float(res['virtual_time_s']))
+        print('{} segments {} move_time_s {}'.format(model, res['segments'], res['virtual_time_s']))
+    
+    print('speedup {:.3f}'.format(results[0] / results[1]))
+
+main()
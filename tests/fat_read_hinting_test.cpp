@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Test of read hinting (read-ahead) of FatFs files read through the block
+ * cache, on the Linux platform.
+ * 
+ * A small FAT32 file system is written to sdcard.bin in the current
+ * directory, with several blocks per cluster and one file whose cluster
+ * chain is fragmented, so that read-ahead has to follow the chain across
+ * cluster boundaries and gaps. The file system is mounted writable and the
+ * file is read block by block with a FatFs File in FS_BUFFER mode:
+ * - the whole file,
+ * - part of the file, then after a rewind the whole file,
+ * - up to the middle of a cluster, after which some blocks are written over
+ *   a cluster boundary and the rest of the file is read,
+ * - after a rewind, the whole file again.
+ * The data of each block is checked, and after unmounting, the file data
+ * in sdcard.bin is checked too.
+ * 
+ * This is done once with read hinting disabled and once with it enabled.
+ * For the passes over the whole file, the number of device reads and the
+ * average number of blocks per read (as counted by the block cache), and
+ * the number of stalls (blocks which were not yet in the cache when the
+ * reader requested them) are reported.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -fno-access-control -DAMBROLIB_ASSERTIONS -I.. fat_read_hinting_test.cpp ../aprinter/platform/linux/linux_support.cpp -o fat_read_hinting_test -lpthread
+ * 
+ * Usage:
+ *   ./fat_read_hinting_test
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aprinter/platform/linux/linux_support.h>
+
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/MemberType.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/base/BinaryTools.h>
+#include <aprinter/structure/LinkedHeap.h>
+#include <aprinter/system/LinuxEventLoop.h>
+#include <aprinter/hal/linux/LinuxClock.h>
+#include <aprinter/hal/linux/LinuxSdCard.h>
+#include <aprinter/fs/BlockAccess.h>
+#include <aprinter/fs/BlockRange.h>
+#include <aprinter/fs/FatFs.h>
+
+using namespace APrinter;
+
+static size_t const BlockSize = 512;
+static uint32_t const NumDeviceBlocks = 4096;
+static uint32_t const NumReservedSectors = 32;
+static uint32_t const SectorsPerFat = 32;
+static uint32_t const BlocksPerCluster = 4;
+static uint32_t const NumClusters = (NumDeviceBlocks - NumReservedSectors - 2 * SectorsPerFat) / BlocksPerCluster;
+static uint32_t const RootCluster = 2;
+static char const FileName[] = "DATA.TXT";
+
+// The file ends within its last block. Its clusters are in runs of four
+// with two free clusters after each run.
+static uint32_t const FileClusters = 48;
+static uint32_t const FileSize = FileClusters * BlocksPerCluster * BlockSize - 300;
+static uint32_t const FileBlocks = FileSize / BlockSize + (FileSize % BlockSize != 0);
+
+// Block at which the second pass rewinds, and the blocks written over by
+// the third pass, which start in the middle of a cluster.
+static uint32_t const RewindBlock = 45;
+static uint32_t const WriteStartBlock = 70;
+static uint32_t const WriteEndBlock = 75;
+
+// Read-ahead of up to 8 blocks, with room in the cache for the FAT and
+// directory blocks, and reads of up to 8 blocks.
+static int const NumCacheEntries = 16;
+static int const MaxIoBlocks = 8;
+static int const ReadAheadMaxBlocks = 8;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+using MyClockService = LinuxClockService<16, 4>;
+APRINTER_MAKE_INSTANCE(MyClock, (MyClockService::Clock<Context, Program, EmptyTypeList>))
+
+struct MyLoopExtraDelay;
+APRINTER_MAKE_INSTANCE(MyLoop, (LinuxEventLoopArg<Context, Program, MyLoopExtraDelay, LinkedHeapService>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = MyClock;
+    using EventLoop = MyLoop;
+    
+    void check () const {}
+};
+
+static uint32_t file_cluster (uint32_t cluster_in_file)
+{
+    return 3 + cluster_in_file + (cluster_in_file / 4) * 2;
+}
+
+static uint32_t cluster_first_block (uint32_t cluster)
+{
+    return NumReservedSectors + 2 * SectorsPerFat + (cluster - 2) * BlocksPerCluster;
+}
+
+static uint32_t file_block_abs_index (uint32_t file_block)
+{
+    return cluster_first_block(file_cluster(file_block / BlocksPerCluster)) + file_block % BlocksPerCluster;
+}
+
+// Contents of the file after the blocks have been written over or not.
+static char file_byte (uint32_t pos, bool written)
+{
+    uint32_t block = pos / BlockSize;
+    if (written && block >= WriteStartBlock && block < WriteEndBlock) {
+        return 'a' + (pos * 5 + block) % 26;
+    }
+    return 'A' + (pos * 7 + block) % 26;
+}
+
+static bool write_sdcard ();
+static bool check_image ();
+
+template <bool ReadHinting, typename DoneHandler, typename ParentObject>
+class Test {
+public:
+    struct Object;
+
+private:
+    struct ActivateHandler;
+    struct FsInitHandler;
+    struct FsWriteMountHandler;
+    using TheSdCardService = LinuxSdCardService<BlockSize, MaxIoBlocks, MaxIoBlocks>;
+    APRINTER_MAKE_INSTANCE(TheBlockAccess, (BlockAccessService<TheSdCardService>::Access<Context, Object, ActivateHandler>))
+    using TheFsService = FatFsService<32, NumCacheEntries, 1, MaxIoBlocks, true, true, ReadHinting, false, ReadAheadMaxBlocks, 0>;
+    APRINTER_MAKE_INSTANCE(TheFs, (TheFsService::Fs<Context, Object, TheBlockAccess, FsInitHandler, FsWriteMountHandler>))
+    using TheOpener = typename TheFs::Opener;
+    using TheFile = typename TheFs::template File<true>;
+    
+    enum class State {
+        IDLE, MOUNTING, OPENING,
+        READ_FULL1, READ_PARTIAL, READ_FULL2,
+        READ_BEFORE_WRITE, OPENWR, WRITE, READ_AFTER_WRITE, READ_FULL3,
+        UNMOUNTING
+    };
+
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        TheBlockAccess::init(c);
+        o->state = State::IDLE;
+        o->num_failed = 0;
+    }
+    
+    static void start (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->state == State::IDLE)
+        
+        if (!write_sdcard()) {
+            fprintf(stderr, "Failed to write sdcard.bin\n");
+            exit(1);
+        }
+        
+        o->state = State::MOUNTING;
+        TheBlockAccess::activate(c);
+    }
+    
+    static size_t getNumFailed (Context c)
+    {
+        return Object::self(c)->num_failed;
+    }
+
+private:
+    static char const * name ()
+    {
+        return ReadHinting ? "hinting" : "no_hinting";
+    }
+    
+    static void activate_handler (Context c, uint8_t error_code)
+    {
+        AMBRO_ASSERT_FORCE(error_code == 0)
+        
+        TheFs::init(c, BlockRange<typename TheBlockAccess::BlockIndexType>{0, TheBlockAccess::getCapacityBlocks(c)});
+    }
+    struct ActivateHandler : public AMBRO_WFUNC_TD(&Test::activate_handler) {};
+    
+    static void fs_init_handler (Context c, uint8_t error_code)
+    {
+        AMBRO_ASSERT_FORCE(error_code == 0)
+        
+        TheFs::startWriteMount(c);
+    }
+    struct FsInitHandler : public AMBRO_WFUNC_TD(&Test::fs_init_handler) {};
+    
+    static void fs_write_mount_handler (Context c, bool error)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT_FORCE(!error)
+        
+        if (o->state == State::MOUNTING) {
+            o->state = State::OPENING;
+            o->opener.init(c, TheFs::getRootEntry(c), TheFs::EntryType::FILE_TYPE, FileName, APRINTER_CB_STATFUNC_T(&Test::opener_handler));
+            return;
+        }
+        
+        AMBRO_ASSERT_FORCE(o->state == State::UNMOUNTING)
+        o->state = State::IDLE;
+        if (!check_image()) {
+            printf("%s: data in sdcard.bin FAIL\n", name());
+            o->num_failed++;
+        }
+        return DoneHandler::call(c);
+    }
+    struct FsWriteMountHandler : public AMBRO_WFUNC_TD(&Test::fs_write_mount_handler) {};
+    
+    static void opener_handler (Context c, typename TheOpener::OpenerStatus status, typename TheFs::FsEntry entry)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT_FORCE(o->state == State::OPENING)
+        AMBRO_ASSERT_FORCE(status == TheOpener::OpenerStatus::SUCCESS)
+        AMBRO_ASSERT_FORCE(entry.file_size == FileSize)
+        
+        o->opener.deinit(c);
+        o->file.init(c, entry, APRINTER_CB_STATFUNC_T(&Test::file_handler), TheFile::IoMode::FS_BUFFER);
+        o->written = false;
+        
+        start_pass(c, State::READ_FULL1);
+    }
+    
+    static void start_pass (Context c, State state)
+    {
+        auto *o = Object::self(c);
+        
+        o->file.rewind(c);
+        o->block = 0;
+        o->stalls = 0;
+        TheFs::resetCacheIoStats(c);
+        o->state = state;
+        start_read(c);
+    }
+    
+    static void start_read (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->block < FileBlocks && !TheFs::TheBlockCache::isBlockCached(c, file_block_abs_index(o->block))) {
+            o->stalls++;
+        }
+        o->file.startRead(c);
+    }
+    
+    static void file_handler (Context c, bool error, size_t length)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT_FORCE(!error)
+        
+        switch (o->state) {
+            case State::READ_FULL1:
+            case State::READ_PARTIAL:
+            case State::READ_FULL2:
+            case State::READ_BEFORE_WRITE:
+            case State::READ_AFTER_WRITE:
+            case State::READ_FULL3: {
+                if (length == 0) {
+                    AMBRO_ASSERT_FORCE(o->block == FileBlocks)
+                    return pass_done(c);
+                }
+                
+                uint32_t pos = o->block * BlockSize;
+                AMBRO_ASSERT_FORCE(length == MinValue((uint32_t)BlockSize, FileSize - pos))
+                char const *data = o->file.getReadPointer(c);
+                bool data_ok = true;
+                for (size_t i = 0; i < length; i++) {
+                    if (data[i] != file_byte(pos + i, o->written)) {
+                        data_ok = false;
+                    }
+                }
+                o->file.finishRead(c);
+                if (!data_ok) {
+                    printf("%s: data of block %" PRIu32 " FAIL\n", name(), o->block);
+                    o->num_failed++;
+                }
+                o->block++;
+                
+                if (o->state == State::READ_PARTIAL && o->block == RewindBlock) {
+                    return start_pass(c, State::READ_FULL2);
+                }
+                if (o->state == State::READ_BEFORE_WRITE && o->block == WriteStartBlock) {
+                    o->state = State::OPENWR;
+                    o->file.startOpenWritable(c);
+                    return;
+                }
+                start_read(c);
+            } break;
+            
+            case State::OPENWR:
+            case State::WRITE: {
+                if (o->state == State::WRITE) {
+                    uint32_t pos = o->block * BlockSize;
+                    char *data = o->file.getWritePointer(c);
+                    for (size_t i = 0; i < BlockSize; i++) {
+                        data[i] = file_byte(pos + i, true);
+                    }
+                    o->file.finishWrite(c, BlockSize);
+                    o->block++;
+                }
+                o->written = true;
+                
+                if (o->block == WriteEndBlock) {
+                    o->state = State::READ_AFTER_WRITE;
+                    return start_read(c);
+                }
+                o->state = State::WRITE;
+                o->file.startWrite(c, true);
+            } break;
+            
+            default: AMBRO_ASSERT_FORCE(false);
+        }
+    }
+    
+    static void pass_done (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        switch (o->state) {
+            case State::READ_FULL1: {
+                report_pass(c, "read");
+                start_pass(c, State::READ_PARTIAL);
+            } break;
+            
+            case State::READ_FULL2: {
+                report_pass(c, "read_after_rewind");
+                start_pass(c, State::READ_BEFORE_WRITE);
+            } break;
+            
+            case State::READ_AFTER_WRITE: {
+                o->file.closeWritable(c);
+                start_pass(c, State::READ_FULL3);
+            } break;
+            
+            case State::READ_FULL3: {
+                report_pass(c, "read_after_write");
+                o->file.deinit(c);
+                o->state = State::UNMOUNTING;
+                TheFs::startWriteUnmount(c);
+            } break;
+            
+            default: AMBRO_ASSERT_FORCE(false);
+        }
+    }
+    
+    static void report_pass (Context c, char const *pass_name)
+    {
+        auto *o = Object::self(c);
+        
+        auto stats = TheFs::getCacheIoStats(c);
+        printf("%s_%s_blocks %" PRIu32 "\n", name(), pass_name, FileBlocks);
+        printf("%s_%s_reads %" PRIu32 "\n", name(), pass_name, stats.read_ios);
+        printf("%s_%s_blocks_per_read %.2f\n", name(), pass_name, (double)stats.read_blocks / stats.read_ios);
+        printf("%s_%s_stalls %" PRIu32 "\n", name(), pass_name, o->stalls);
+    }
+
+public:
+    struct Object : public ObjBase<Test, ParentObject, MakeTypeList<
+        TheBlockAccess,
+        TheFs
+    >> {
+        TheOpener opener;
+        TheFile file;
+        State state;
+        bool written;
+        uint32_t block;
+        uint32_t stalls;
+        size_t num_failed;
+    };
+};
+
+struct NoHintingDoneHandler;
+struct HintingDoneHandler;
+
+using NoHintingTest = Test<false, NoHintingDoneHandler, Program>;
+using HintingTest = Test<true, HintingDoneHandler, Program>;
+
+APRINTER_DEFINE_MEMBER_TYPE(MemberType_EventLoopFastEvents, EventLoopFastEvents)
+APRINTER_MAKE_INSTANCE(MyLoopExtra, (LinuxEventLoopExtraArg<Program, MyLoop, ObjCollect<MakeTypeList<NoHintingTest, HintingTest>, MemberType_EventLoopFastEvents>>))
+struct MyLoopExtraDelay : public WrapType<MyLoopExtra> {};
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    MyLoop,
+    MyLoopExtra,
+    NoHintingTest,
+    HintingTest
+>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+static void no_hinting_done_handler (Context c)
+{
+    HintingTest::start(c);
+}
+struct NoHintingDoneHandler : public AMBRO_WFUNC_TD(&no_hinting_done_handler) {};
+
+static void hinting_done_handler (Context c)
+{
+    size_t num_failed = NoHintingTest::getNumFailed(c) + HintingTest::getNumFailed(c);
+    printf("%s\n", num_failed == 0 ? "OK" : "FAIL");
+    exit(num_failed == 0 ? 0 : 1);
+}
+struct HintingDoneHandler : public AMBRO_WFUNC_TD(&hinting_done_handler) {};
+
+static void set_fat_entry (char *image, uint32_t cluster, uint32_t value)
+{
+    for (int fat = 0; fat < 2; fat++) {
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(value, image + (NumReservedSectors + fat * SectorsPerFat) * BlockSize + 4 * cluster);
+    }
+}
+
+// Writes a FAT32 file system without a partition table, with the file
+// in the root directory.
+static bool write_sdcard ()
+{
+    static char image[NumDeviceBlocks * BlockSize];
+    memset(image, 0, sizeof(image));
+    
+    char *boot = image;
+    memcpy(boot + 0x3, "APRINTER", 8);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(BlockSize, boot + 0xB);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(BlocksPerCluster, boot + 0xD);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(NumReservedSectors, boot + 0xE);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(2, boot + 0x10);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(0xF8, boot + 0x15);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(NumDeviceBlocks, boot + 0x20);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(SectorsPerFat, boot + 0x24);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(RootCluster, boot + 0x2C);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(1, boot + 0x30);
+    WriteBinaryInt<uint8_t,  BinaryLittleEndian>(0x29, boot + 0x42);
+    memcpy(boot + 0x52, "FAT32   ", 8);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(0xAA55, boot + 0x1FE);
+    
+    char *fs_info = image + BlockSize;
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0x41615252), fs_info + 0x0);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0x61417272), fs_info + 0x1E4);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(NumClusters - 1 - FileClusters, fs_info + 0x1E8);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(RootCluster, fs_info + 0x1EC);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0xAA550000), fs_info + 0x1FC);
+    
+    set_fat_entry(image, 0, UINT32_C(0x0FFFFFF8));
+    set_fat_entry(image, 1, UINT32_C(0x0FFFFFFF));
+    set_fat_entry(image, RootCluster, UINT32_C(0x0FFFFFFF));
+    for (uint32_t i = 0; i < FileClusters; i++) {
+        uint32_t next = (i + 1 < FileClusters) ? file_cluster(i + 1) : UINT32_C(0x0FFFFFFF);
+        set_fat_entry(image, file_cluster(i), next);
+    }
+    
+    char *entry = image + cluster_first_block(RootCluster) * BlockSize;
+    memcpy(entry, "DATA    TXT", 11);
+    WriteBinaryInt<uint8_t, BinaryLittleEndian>(0x20, entry + 0xB);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(file_cluster(0) >> 16, entry + 0x14);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(file_cluster(0) & 0xFFFF, entry + 0x1A);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(FileSize, entry + 0x1C);
+    
+    for (uint32_t pos = 0; pos < FileSize; pos++) {
+        image[file_block_abs_index(pos / BlockSize) * BlockSize + pos % BlockSize] = file_byte(pos, false);
+    }
+    
+    FILE *f = fopen("sdcard.bin", "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(image, 1, sizeof(image), f) == sizeof(image);
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+// Checks that the written blocks reached sdcard.bin and nothing else in
+// the file was changed.
+static bool check_image ()
+{
+    FILE *f = fopen("sdcard.bin", "rb");
+    AMBRO_ASSERT_FORCE(f)
+    
+    bool ok = true;
+    for (uint32_t block = 0; block < FileBlocks; block++) {
+        char data[BlockSize];
+        fseek(f, file_block_abs_index(block) * BlockSize, SEEK_SET);
+        AMBRO_ASSERT_FORCE(fread(data, 1, BlockSize, f) == BlockSize)
+        for (uint32_t i = 0; i < BlockSize && block * BlockSize + i < FileSize; i++) {
+            if (data[i] != file_byte(block * BlockSize + i, true)) {
+                ok = false;
+            }
+        }
+    }
+    
+    fclose(f);
+    return ok;
+}
+
+int main (int argc, char *argv[])
+{
+    platform_init(1, argv);
+    
+    Context c;
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    MyClock::init(c);
+    MyLoop::init(c);
+    NoHintingTest::init(c);
+    HintingTest::init(c);
+    
+    NoHintingTest::start(c);
+    
+    MyLoop::run(c);
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks and benchmarks FastStrToFloat/StrToUint32, the number parsing
+ * used by GcodeParser.
+ * 
+ * First, random numbers in the forms found in G-code and longer ones
+ * (9 significant digits for float, 17 for double) are parsed with both
+ * FastStrToFloat and strtof/strtod, and the results must be bitwise equal.
+ * Random commands are parsed with GcodeParser with and without
+ * PreParseNumbers, and all part values must be the same.
+ * Then the G-code file is parsed several times, converting all parts to
+ * numbers with strtof/atoi on the part strings (libc), with the parser
+ * converting the part text (fast), and with the values computed while
+ * scanning (preparse), and the commands per second of each are reported.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. gcode_number_bench.cpp -o gcode_number_bench
+ * 
+ * Usage:
+ *   ./gcode_number_bench file.gcode [passes]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/math/FastStrToFloat.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+
+using namespace APrinter;
+
+struct Context {
+    void check () const {}
+};
+
+using FpType = float;
+using TextParser = typename FileGcodeParserService<16, false>::template Parser<Context, size_t, FpType>;
+using PreParseParser = typename FileGcodeParserService<16, true>::template Parser<Context, size_t, FpType>;
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_u64 ()
+{
+    static uint64_t state = 88172645463325252ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static int format_random_number (char *buf)
+{
+    int kind = rand_u64() % 4;
+    char const *sign = (rand_u64() % 4 == 0) ? "-" : "";
+    int int_digits;
+    int frac_digits;
+    switch (kind) {
+        case 0: int_digits = rand_u64() % 4; frac_digits = rand_u64() % 6; break;
+        case 1: int_digits = 1 + rand_u64() % 8; frac_digits = 9 - int_digits; break;
+        case 2: int_digits = rand_u64() % 18; frac_digits = 17 - int_digits; break;
+        default: int_digits = rand_u64() % 12; frac_digits = rand_u64() % 24; break;
+    }
+    int len = sprintf(buf, "%s", sign);
+    for (int i = 0; i < int_digits; i++) {
+        buf[len++] = '0' + (i == 0 && int_digits > 1 ? 1 + rand_u64() % 9 : rand_u64() % 10);
+    }
+    if (int_digits == 0) {
+        buf[len++] = '0';
+    }
+    if (frac_digits > 0) {
+        buf[len++] = '.';
+        for (int i = 0; i < frac_digits; i++) {
+            buf[len++] = '0' + rand_u64() % 10;
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static bool check_exactness (int count)
+{
+    int float_mismatches = 0;
+    int double_mismatches = 0;
+    char buf[64];
+    
+    for (int i = 0; i < count; i++) {
+        int len = format_random_number(buf);
+        
+        char const *end;
+        float f_fast = FastStrToFloat<float>(buf, &end);
+        float f_libc = strtof(buf, nullptr);
+        if (memcmp(&f_fast, &f_libc, sizeof(float)) || end != buf + len) {
+            if (float_mismatches++ < 10) {
+                printf("float mismatch: %s -> %.9g, expected %.9g\n", buf, f_fast, f_libc);
+            }
+        }
+        
+        double d_fast = FastStrToFloat<double>(buf, &end);
+        double d_libc = strtod(buf, nullptr);
+        if (memcmp(&d_fast, &d_libc, sizeof(double)) || end != buf + len) {
+            if (double_mismatches++ < 10) {
+                printf("double mismatch: %s -> %.17g, expected %.17g\n", buf, d_fast, d_libc);
+            }
+        }
+        
+        uint32_t u_fast = StrToUint32(buf + (buf[0] == '-'));
+        uint32_t u_libc = strtoul(buf + (buf[0] == '-'), nullptr, 10);
+        if (len < 9 && u_fast != u_libc) {
+            printf("uint32 mismatch: %s -> %u, expected %u\n", buf, (unsigned)u_fast, (unsigned)u_libc);
+            return false;
+        }
+    }
+    
+    printf("exactness_samples %d\n", count);
+    printf("float_mismatches %d\n", float_mismatches);
+    printf("double_mismatches %d\n", double_mismatches);
+    return float_mismatches == 0 && double_mismatches == 0;
+}
+
+#define ZEROS10 "0000000000"
+
+static void format_random_part (char *buf, int *len)
+{
+    // Includes fractions with more leading zeros than the parser keeps decimals for.
+    static char const *const odd_values[] = {
+        "", "-", "+", ".", "-.5", "+7", "1.2.3", "12abc", "abc", "1e3", "2E-2", "0x1A", "+-1",
+        "inf", "-nan", "\\41\\42", "4\\32", "00012", "-0", "4294967296", "99999999999999999999999",
+        "0.0000000000000000000001", "0.00000000000000000000001",
+        "0." ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 "0000000" "1",
+        "0." ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 ZEROS10 "15"
+    };
+    
+    buf[(*len)++] = "GMTXYZEFSPIR"[rand_u64() % 12];
+    if (rand_u64() % 4 == 0) {
+        *len += sprintf(buf + *len, "%s", odd_values[rand_u64() % (sizeof(odd_values) / sizeof(odd_values[0]))]);
+    } else {
+        *len += format_random_number(buf + *len);
+    }
+}
+
+// Parses random commands with both the text and the pre-parsing parser,
+// and checks that they give the same values for all parts.
+static bool check_preparse (int count)
+{
+    Context c;
+    TextParser text_parser;
+    PreParseParser pre_parser;
+    text_parser.init(c);
+    pre_parser.init(c);
+    
+    char line[512];
+    char text_buf[512];
+    char pre_buf[512];
+    int mismatches = 0;
+    
+    for (int i = 0; i < count; i++) {
+        int len = 0;
+        int num_parts = 1 + rand_u64() % 6;
+        for (int j = 0; j < num_parts; j++) {
+            format_random_part(line, &len);
+            line[len++] = (rand_u64() % 8 == 0) ? '\t' : ' ';
+        }
+        if (rand_u64() % 8 == 0) {
+            len += sprintf(line + len, ";comment X1");
+        }
+        line[len++] = '\n';
+        
+        memcpy(text_buf, line, len);
+        memcpy(pre_buf, line, len);
+        text_parser.startCommand(c, text_buf, 0);
+        pre_parser.startCommand(c, pre_buf, 0);
+        AMBRO_ASSERT_FORCE(text_parser.extendCommand(c, len))
+        AMBRO_ASSERT_FORCE(pre_parser.extendCommand(c, len))
+        
+        bool ok = text_parser.getNumParts(c) == pre_parser.getNumParts(c);
+        if (ok && text_parser.getNumParts(c) >= 0) {
+            ok = text_parser.getCmdNumber(c) == pre_parser.getCmdNumber(c);
+            for (int j = 0; ok && j < text_parser.getNumParts(c); j++) {
+                auto text_part = text_parser.getPart(c, j);
+                auto pre_part = pre_parser.getPart(c, j);
+                FpType text_fp = text_parser.getPartFpValue(c, text_part);
+                FpType pre_fp = pre_parser.getPartFpValue(c, pre_part);
+                ok = text_parser.getPartCode(c, text_part) == pre_parser.getPartCode(c, pre_part) &&
+                     !memcmp(&text_fp, &pre_fp, sizeof(FpType)) &&
+                     text_parser.getPartUint32Value(c, text_part) == pre_parser.getPartUint32Value(c, pre_part) &&
+                     !strcmp(text_parser.getPartStringValue(c, text_part), pre_parser.getPartStringValue(c, pre_part));
+            }
+        }
+        if (!ok && mismatches++ < 10) {
+            line[len - 1] = '\0';
+            printf("preparse mismatch: %s\n", line);
+        }
+    }
+    
+    pre_parser.deinit(c);
+    text_parser.deinit(c);
+    
+    printf("preparse_samples %d\n", count);
+    printf("preparse_mismatches %d\n", mismatches);
+    return mismatches == 0;
+}
+
+static char * read_file (char const *path, size_t *out_length)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return nullptr;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = (char *)malloc(size + 1);
+    AMBRO_ASSERT_FORCE(data)
+    size_t length = fread(data, 1, size, f);
+    fclose(f);
+    // Make sure the last command is terminated.
+    data[length++] = '\n';
+    *out_length = length;
+    return data;
+}
+
+struct ParseResult {
+    uint32_t commands;
+    double checksum;
+};
+
+template <bool UseLibc, typename TheParser>
+static ParseResult parse_file (TheParser *parser, char *buffer, size_t length)
+{
+    Context c;
+    ParseResult res = {0, 0.0};
+    size_t pos = 0;
+    
+    while (pos < length) {
+        parser->startCommand(c, buffer + pos, 0);
+        if (!parser->extendCommand(c, length - pos)) {
+            parser->resetCommand(c);
+            break;
+        }
+        pos += parser->getLength(c);
+        
+        auto num_parts = parser->getNumParts(c);
+        if (num_parts < 0) {
+            continue;
+        }
+        res.commands++;
+        
+        if (UseLibc) {
+            res.checksum += atoi(parser->getCmd(c)->parts[0].data);
+        } else {
+            res.checksum += parser->getCmdNumber(c);
+        }
+        for (int i = 0; i < num_parts; i++) {
+            auto part = parser->getPart(c, i);
+            if (UseLibc) {
+                res.checksum += StrToFloat<FpType>(parser->getPartStringValue(c, part), nullptr);
+            } else {
+                res.checksum += parser->getPartFpValue(c, part);
+            }
+        }
+    }
+    
+    return res;
+}
+
+template <bool UseLibc, typename TheParser>
+static void bench_file (char const *name, char const *data, size_t length, int passes)
+{
+    char *buffer = (char *)malloc(length);
+    AMBRO_ASSERT_FORCE(buffer)
+    
+    Context c;
+    TheParser parser;
+    parser.init(c);
+    
+    uint64_t best_ns = UINT64_MAX;
+    ParseResult res = {0, 0.0};
+    for (int pass = 0; pass < passes; pass++) {
+        // The parser modifies the buffer, so start each pass with a fresh copy.
+        memcpy(buffer, data, length);
+        uint64_t start_ns = get_ns();
+        res = parse_file<UseLibc>(&parser, buffer, length);
+        uint64_t ns = get_ns() - start_ns;
+        best_ns = (ns < best_ns) ? ns : best_ns;
+    }
+    
+    parser.deinit(c);
+    free(buffer);
+    
+    printf("%s_commands %u\n", name, (unsigned)res.commands);
+    printf("%s_checksum %.6f\n", name, res.checksum);
+    printf("%s_commands_per_s %.0f\n", name, res.commands / (best_ns * 1e-9));
+    printf("%s_ns_per_byte %.3f\n", name, (double)best_ns / length);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s file.gcode [passes]\n", argv[0]);
+        return 1;
+    }
+    int passes = (argc > 2) ? atoi(argv[2]) : 10;
+    
+    if (!check_exactness(1000000) || !check_preparse(200000)) {
+        return 1;
+    }
+    
+    size_t length;
+    char *data = read_file(argv[1], &length);
+    if (!data) {
+        fprintf(stderr, "Failed to read %s\n", argv[1]);
+        return 1;
+    }
+    
+    printf("input_bytes %zu\n", length);
+    bench_file<true, TextParser>("libc", data, length, passes);
+    bench_file<false, TextParser>("fast", data, length, passes);
+    bench_file<false, PreParseParser>("preparse", data, length, passes);
+    
+    free(data);
+    return 0;
+}
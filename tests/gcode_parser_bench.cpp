@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark of all the G-code parsers, for tracking regressions.
+ * 
+ * Each corpus is parsed in the ways the firmware does it:
+ * - file, file_preparse: GcodeParser<GcodeParserTypeFile> without and with
+ *   PreParseNumbers, reading through InputBuffer in blocks like SdCardModule.
+ * - binary: BinaryGcodeParser on the corpus encoded like aprinter_encode.py
+ *   does without --moves, reading in the same way.
+ * - serial: GcodeParser<GcodeParserTypeSerial> on the corpus with line
+ *   numbers and checksums, with the data arriving 64 bytes at a time and the
+ *   command extended after each arrival, like SerialModule with a USB serial.
+ * - tcp: the same parser on the corpus without comments, with the data
+ *   arriving in 1460-byte segments, like TcpConsoleModule.
+ * All of them must see the same number of commands. The values of all the
+ * parts are read, as the printer would do.
+ * 
+ * Without files, generated corpora are used: fdm (slicer output with moves,
+ * retractions and feature comments), laser (raster engraving with a power
+ * value on every move), arcs (G2/G3 with I/J) and comments (every line
+ * commented, and a configuration dump at the end). Files are named by their
+ * base name.
+ * 
+ * For each corpus and parser, the best of the passes is reported as MB/s,
+ * commands/s, ns/command and (on x86, using the TSC) cycles/command. The
+ * output is one "<corpus>_<parser>_<metric> <value>" line per metric, or
+ * with --json one JSON object per line.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. gcode_parser_bench.cpp -o gcode_parser_bench
+ * 
+ * Usage:
+ *   ./gcode_parser_bench [--json] [--passes N] [file.gcode ...]
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+#include <aprinter/printer/utils/BinaryGcodeParser.h>
+#include <aprinter/printer/input/InputBuffer.h>
+
+using namespace APrinter;
+
+struct Context {
+    void check () const {}
+};
+
+using FpType = float;
+
+using FileParser = GcodeParser<Context, size_t, FpType, GcodeParserTypeFile, FileGcodeParserService<16, false>>;
+using FilePreParser = GcodeParser<Context, size_t, FpType, GcodeParserTypeFile, FileGcodeParserService<16, true>>;
+using SerialParser = GcodeParser<Context, size_t, FpType, GcodeParserTypeSerial, SerialGcodeParserService<16, false>>;
+using BinaryParser = BinaryGcodeParser<Context, size_t, FpType, BinaryGcodeParserService<14, 7>>;
+
+// As the configuration defaults for an SD card with a 4-block read size.
+static size_t const BlockSize = 512;
+static size_t const BufferBaseSize = 4096;
+static size_t const MaxCommandSize = 128;
+static size_t const MaxReadBlocks = 4;
+
+using TheInputBuffer = InputBuffer<uint32_t, BlockSize, BufferBaseSize, MaxCommandSize, MaxReadBlocks>;
+
+static size_t const SerialChunk = 64;
+static size_t const TcpChunk = 1460;
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool const HaveCycles = true;
+
+static uint64_t get_cycles ()
+{
+    return __rdtsc();
+}
+#else
+static bool const HaveCycles = false;
+
+static uint64_t get_cycles ()
+{
+    return 0;
+}
+#endif
+
+static uint64_t rand_state;
+
+static uint64_t rand_u64 ()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static float rand_coord (float base, float range)
+{
+    return base + (rand_u64() % (uint64_t)(range * 1000.0f)) / 1000.0f;
+}
+
+static void appendf (std::string *out, char const *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf (std::string *out, char const *fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    out->append(buf, n);
+}
+
+static std::string generate_fdm ()
+{
+    std::string out = "; generated by gcode_parser_bench\n;FLAVOR:RepRap\nM140 S60\nM104 S210\nG28\nG92 E0\nM82\n";
+    float e = 0.0f;
+    for (int layer = 0; layer < 300; layer++) {
+        appendf(&out, ";LAYER:%d\nG1 E%.5f F2400\nG0 F9000 X%.3f Y%.3f Z%.2f\nG1 E%.5f F2400\n", layer, e - 1.0f, rand_coord(90.0f, 10.0f), 80.0f, 0.2f * (layer + 1), e);
+        if (layer == 2) {
+            out += "M106 S255\n";
+        }
+        static char const *const types[] = {";TYPE:WALL-OUTER", ";TYPE:WALL-INNER", ";TYPE:SKIN", ";TYPE:FILL"};
+        for (int feature = 0; feature < 4; feature++) {
+            appendf(&out, "%s\nG1 F%d\n", types[feature], 1200 + 600 * feature);
+            for (int i = 0; i < 80; i++) {
+                e += 0.0312f;
+                appendf(&out, "G1 X%.3f Y%.3f E%.5f\n", rand_coord(100.0f, 40.0f), rand_coord(100.0f, 40.0f), e);
+            }
+        }
+    }
+    out += "M104 S0\nM140 S0\nM84\n";
+    return out;
+}
+
+static std::string generate_laser ()
+{
+    std::string out = "; generated by gcode_parser_bench\n; raster engraving\nG21\nG90\nM3 S0\n";
+    for (int row = 0; row < 600; row++) {
+        bool reverse = (row % 2 == 1);
+        appendf(&out, "G0 X%.2f Y%.2f\nG1 F6000\n", reverse ? 60.0f : 0.0f, 0.1f * row);
+        for (int col = 0; col < 120; col++) {
+            float x = reverse ? 60.0f - 0.5f * (col + 1) : 0.5f * (col + 1);
+            appendf(&out, "G1 X%.2f S%d\n", x, (int)(rand_u64() % 256));
+        }
+    }
+    out += "M5\nG0 X0 Y0\n";
+    return out;
+}
+
+static std::string generate_arcs ()
+{
+    std::string out = "; generated by gcode_parser_bench\n; arc fitted output\nG90\nM83\nG0 X100 Y100 Z0.3 F9000\n";
+    for (int i = 0; i < 60000; i++) {
+        if (i % 8 == 0) {
+            appendf(&out, "G1 X%.3f Y%.3f E%.5f F1800\n", rand_coord(80.0f, 40.0f), rand_coord(80.0f, 40.0f), rand_coord(0.0f, 0.5f));
+        } else {
+            appendf(&out, "G%d X%.3f Y%.3f I%.3f J%.3f E%.5f\n", 2 + (int)(rand_u64() % 2), rand_coord(80.0f, 40.0f), rand_coord(80.0f, 40.0f), rand_coord(-5.0f, 10.0f), rand_coord(-5.0f, 10.0f), rand_coord(0.0f, 0.5f));
+        }
+    }
+    return out;
+}
+
+static std::string generate_comments ()
+{
+    std::string out = "; generated by gcode_parser_bench\n; verbose output\n";
+    float e = 0.0f;
+    for (int i = 0; i < 60000; i++) {
+        e += 0.0312f;
+        appendf(&out, "G1 X%.3f Y%.3f E%.5f ; perimeter\n", rand_coord(100.0f, 40.0f), rand_coord(100.0f, 40.0f), e);
+        if (i % 50 == 0) {
+            out += ";TYPE:FILL ; infill pattern lines, speed and extrusion width unchanged\n";
+        }
+    }
+    for (int i = 0; i < 20000; i++) {
+        appendf(&out, "; setting_%d = 0.4,0.4,0.4,0.4 ; some longer value text here\n", i);
+    }
+    return out;
+}
+
+static std::string strip_line (std::string const &line)
+{
+    std::string code = line.substr(0, line.find(';'));
+    size_t start = code.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    size_t end = code.find_last_not_of(" \t\r");
+    return code.substr(start, end + 1 - start);
+}
+
+template <typename Func>
+static void for_each_line (std::string const &text, Func func)
+{
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        end = (end == std::string::npos) ? text.size() : end;
+        func(text.substr(pos, end - pos));
+        pos = end + 1;
+    }
+}
+
+// Without comments and empty lines, as a host sends it. With checksums,
+// also with line numbers.
+static std::string to_stream (std::string const &text, bool checksums)
+{
+    std::string out;
+    uint32_t line_number = 1;
+    for_each_line(text, [&](std::string const &line) {
+        std::string code = strip_line(line);
+        if (code.empty()) {
+            return;
+        }
+        if (!checksums) {
+            out += code;
+            out += '\n';
+            return;
+        }
+        size_t line_start = out.size();
+        appendf(&out, "N%u %s", (unsigned)line_number++, code.c_str());
+        uint8_t checksum = 0;
+        for (size_t i = line_start; i < out.size(); i++) {
+            checksum ^= (unsigned char)out[i];
+        }
+        appendf(&out, "*%d\n", (int)checksum);
+    });
+    return out;
+}
+
+static bool is_letter (char ch)
+{
+    return ch >= 'A' && ch <= 'Z';
+}
+
+// Like encode_line() of aprinter_encode.py. Lines which it would reject
+// are counted and left out.
+static std::string to_binary (std::string const &text, int *out_skipped)
+{
+    std::string out;
+    *out_skipped = 0;
+    for_each_line(text, [&](std::string const &line) {
+        std::string code = strip_line(line);
+        if (code.empty()) {
+            return;
+        }
+        std::vector<std::string> words;
+        size_t pos = 0;
+        while ((pos = code.find_first_not_of(" \t\r", pos)) != std::string::npos) {
+            size_t end = code.find_first_of(" \t\r", pos);
+            end = (end == std::string::npos) ? code.size() : end;
+            words.push_back(code.substr(pos, end - pos));
+            pos = end;
+        }
+        char *endptr;
+        unsigned long cmd_number = strtoul(words[0].c_str() + 1, &endptr, 10);
+        if (!is_letter(words[0][0]) || words[0].size() < 2 || *endptr != '\0' || cmd_number >= 2048 || words.size() > 15) {
+            (*out_skipped)++;
+            return;
+        }
+        std::string index;
+        std::string payload;
+        for (size_t i = 1; i < words.size(); i++) {
+            std::string const &word = words[i];
+            char const *value = word.c_str() + 1;
+            int type_code;
+            if (!is_letter(word[0])) {
+                (*out_skipped)++;
+                return;
+            }
+            if (*value == '\0') {
+                type_code = 5;
+            } else {
+                unsigned long long int_value = strtoull(value, &endptr, 10);
+                if (*value != '-' && *value != '+' && *endptr == '\0') {
+                    if (int_value <= UINT32_MAX) {
+                        type_code = 3;
+                        uint32_t v = int_value;
+                        payload.append((char const *)&v, 4);
+                    } else {
+                        type_code = 4;
+                        uint64_t v = int_value;
+                        payload.append((char const *)&v, 8);
+                    }
+                } else {
+                    float fp_value = strtof(value, &endptr);
+                    if (*endptr != '\0') {
+                        (*out_skipped)++;
+                        return;
+                    }
+                    type_code = 1;
+                    payload.append((char const *)&fp_value, 4);
+                }
+            }
+            index += (char)((type_code << 5) + (word[0] - 'A'));
+        }
+        int command_type_code = 15;
+        if (words[0] == "G0") {
+            command_type_code = 1;
+        } else if (words[0] == "G1") {
+            command_type_code = 2;
+        } else if (words[0] == "G92") {
+            command_type_code = 3;
+        }
+        out += (char)((command_type_code << 4) + (int)(words.size() - 1));
+        if (command_type_code == 15) {
+            out += (char)(((words[0][0] - 'A') << 3) + (cmd_number >> 8));
+            out += (char)(cmd_number & 0xFF);
+        }
+        out += index;
+        out += payload;
+    });
+    out += (char)0xE0;
+    return out;
+}
+
+struct RunResult {
+    uint32_t commands;
+    FpType value_sum;
+    bool complete;
+};
+
+template <typename TheParser>
+static void handle_command (Context c, TheParser *parser, RunResult *result)
+{
+    auto num_parts = parser->getNumParts(c);
+    if (num_parts >= 0) {
+        result->commands++;
+        result->value_sum += parser->getCmdNumber(c);
+        for (int i = 0; i < num_parts; i++) {
+            result->value_sum += parser->getPartFpValue(c, parser->getPart(c, i));
+        }
+    }
+}
+
+// Reads complete immediately, as soon as the buffer has space for them.
+template <typename TheParser>
+static RunResult run_blocks (Context c, TheParser *parser, TheInputBuffer *buffer, std::string const &input)
+{
+    RunResult result = {0, 0.0f, false};
+    buffer->init();
+    size_t read_pos = 0;
+    
+    while (true) {
+        while (read_pos < input.size() && buffer->haveSpaceForRead()) {
+            size_t num_blocks;
+            char *dst = (char *)buffer->startRead(&num_blocks);
+            size_t length = num_blocks * BlockSize;
+            length = (length < input.size() - read_pos) ? length : input.size() - read_pos;
+            memcpy(dst, input.data() + read_pos, length);
+            read_pos += length;
+            buffer->readFinished(num_blocks, length);
+        }
+        
+        size_t avail;
+        char *cmd_data = buffer->getCommand(&avail);
+        if (!parser->haveCommand(c)) {
+            parser->startCommand(c, cmd_data, 0);
+        }
+        bool line_buffer_exhausted = (avail == MaxCommandSize);
+        
+        if (!parser->extendCommand(c, avail, line_buffer_exhausted)) {
+            parser->resetCommand(c);
+            result.complete = (read_pos == input.size() && avail == 0);
+            return result;
+        }
+        if (parser->getNumParts(c) == GCODE_ERROR_EOF) {
+            result.complete = true;
+            return result;
+        }
+        handle_command(c, parser, &result);
+        buffer->consume(parser->getLength(c));
+    }
+}
+
+// The input arrives chunk bytes at a time into a contiguous buffer, and the
+// command is extended after each arrival.
+template <typename TheParser>
+static RunResult run_stream (Context c, TheParser *parser, std::string *buffer, size_t chunk)
+{
+    RunResult result = {0, 0.0f, false};
+    size_t pos = 0;
+    size_t received = 0;
+    
+    while (true) {
+        if (!parser->haveCommand(c)) {
+            parser->startCommand(c, &(*buffer)[pos], 0);
+        }
+        size_t avail = received - pos;
+        avail = (avail < MaxCommandSize) ? avail : MaxCommandSize;
+        bool line_buffer_exhausted = (avail == MaxCommandSize);
+        
+        if (parser->extendCommand(c, avail, line_buffer_exhausted)) {
+            handle_command(c, parser, &result);
+            pos += parser->getLength(c);
+            continue;
+        }
+        if (line_buffer_exhausted || received == buffer->size()) {
+            parser->resetCommand(c);
+            result.complete = (pos == buffer->size());
+            return result;
+        }
+        received += chunk;
+        received = (received < buffer->size()) ? received : buffer->size();
+    }
+}
+
+static bool json_output;
+
+static void report_metric (char const *corpus, char const *parser, char const *metric, char const *fmt, double value, bool *first)
+{
+    if (json_output) {
+        printf(*first ? "{\"corpus\": \"%s\", \"parser\": \"%s\"" : "", corpus, parser);
+        printf(", \"%s\": ", metric);
+    } else {
+        printf("%s_%s_%s ", corpus, parser, metric);
+    }
+    printf(fmt, value);
+    if (!json_output) {
+        printf("\n");
+    }
+    *first = false;
+}
+
+template <typename TheParser, typename RunFunc>
+static uint32_t bench (char const *corpus, char const *name, std::string const &input, int passes, RunFunc run_func)
+{
+    Context c;
+    TheParser parser;
+    parser.init(c);
+    
+    std::string buffer;
+    uint64_t best_ns = UINT64_MAX;
+    uint64_t best_cycles = 0;
+    RunResult result;
+    for (int pass = 0; pass < passes; pass++) {
+        // The text parsers modify the buffer, so start each pass with a fresh copy.
+        buffer = input;
+        uint64_t start_cycles = get_cycles();
+        uint64_t start_ns = get_ns();
+        result = run_func(c, &parser, &buffer);
+        uint64_t ns = get_ns() - start_ns;
+        uint64_t cycles = get_cycles() - start_cycles;
+        if (ns < best_ns) {
+            best_ns = ns;
+            best_cycles = cycles;
+        }
+    }
+    
+    parser.deinit(c);
+    
+    uint32_t commands = result.commands;
+    double per_command = (commands > 0) ? 1.0 / commands : 0.0;
+    bool first = true;
+    report_metric(corpus, name, "bytes", "%.0f", input.size(), &first);
+    report_metric(corpus, name, "commands", "%.0f", commands, &first);
+    report_metric(corpus, name, "complete", "%.0f", result.complete, &first);
+    report_metric(corpus, name, "value_sum", "%.6g", result.value_sum, &first);
+    report_metric(corpus, name, "mb_per_s", "%.2f", input.size() / (best_ns * 1e-3), &first);
+    report_metric(corpus, name, "commands_per_s", "%.0f", commands / (best_ns * 1e-9), &first);
+    report_metric(corpus, name, "ns_per_command", "%.2f", best_ns * per_command, &first);
+    if (HaveCycles) {
+        report_metric(corpus, name, "cycles_per_command", "%.1f", best_cycles * per_command, &first);
+    }
+    if (json_output) {
+        printf("}\n");
+    }
+    
+    return result.complete ? commands : UINT32_MAX;
+}
+
+static bool bench_corpus (char const *corpus, std::string const &text, int passes)
+{
+    int binary_skipped;
+    std::string binary = to_binary(text, &binary_skipped);
+    std::string serial = to_stream(text, true);
+    std::string tcp = to_stream(text, false);
+    if (binary_skipped > 0) {
+        fprintf(stderr, "%s: %d lines cannot be encoded and are left out of the binary form\n", corpus, binary_skipped);
+    }
+    
+    TheInputBuffer input_buffer;
+    auto blocks = [&](Context c, auto *parser, std::string *buffer) {
+        return run_blocks(c, parser, &input_buffer, *buffer);
+    };
+    auto serial_stream = [&](Context c, auto *parser, std::string *buffer) {
+        return run_stream(c, parser, buffer, SerialChunk);
+    };
+    auto tcp_stream = [&](Context c, auto *parser, std::string *buffer) {
+        return run_stream(c, parser, buffer, TcpChunk);
+    };
+    
+    uint32_t counts[5];
+    counts[0] = bench<FileParser>(corpus, "file", text, passes, blocks);
+    counts[1] = bench<FilePreParser>(corpus, "file_preparse", text, passes, blocks);
+    counts[2] = bench<BinaryParser>(corpus, "binary", binary, passes, blocks);
+    counts[3] = bench<SerialParser>(corpus, "serial", serial, passes, serial_stream);
+    counts[4] = bench<SerialParser>(corpus, "tcp", tcp, passes, tcp_stream);
+    
+    bool ok = true;
+    for (int i = 0; i < 5; i++) {
+        if (i == 2 && binary_skipped > 0) {
+            continue;
+        }
+        if (counts[i] != counts[0]) {
+            fprintf(stderr, "%s: parsers disagree on the number of commands (or a line is too long)\n", corpus);
+            ok = false;
+            break;
+        }
+    }
+    return ok;
+}
+
+static bool read_file (char const *path, std::string *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out->append(buf, len);
+    }
+    fclose(f);
+    // Make sure the last command is terminated.
+    *out += '\n';
+    return true;
+}
+
+static std::string corpus_name (char const *path)
+{
+    char const *base = strrchr(path, '/');
+    std::string name = base ? base + 1 : path;
+    name = name.substr(0, name.find('.'));
+    for (char &ch : name) {
+        if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'))) {
+            ch = '_';
+        }
+    }
+    return name;
+}
+
+int main (int argc, char *argv[])
+{
+    int passes = 10;
+    std::vector<char const *> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json_output = true;
+        } else if (!strcmp(argv[i], "--passes") && i + 1 < argc) {
+            passes = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--json] [--passes N] [file.gcode ...]\n", argv[0]);
+            return 1;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (passes < 1) {
+        passes = 1;
+    }
+    
+    bool ok = true;
+    if (files.empty()) {
+        rand_state = 88172645463325252ull;
+        ok = bench_corpus("fdm", generate_fdm(), passes) && ok;
+        ok = bench_corpus("laser", generate_laser(), passes) && ok;
+        ok = bench_corpus("arcs", generate_arcs(), passes) && ok;
+        ok = bench_corpus("comments", generate_comments(), passes) && ok;
+    } else {
+        for (char const *path : files) {
+            std::string text;
+            if (!read_file(path, &text)) {
+                fprintf(stderr, "Failed to read %s\n", path);
+                return 1;
+            }
+            ok = bench_corpus(corpus_name(path).c_str(), text, passes) && ok;
+        }
+    }
+    
+    return ok ? 0 : 1;
+}
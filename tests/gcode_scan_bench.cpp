@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks and benchmarks the word scanning in GcodeParser (ScanWords).
+ * 
+ * Random input with comments, checksums, escapes, errors and long lines is
+ * parsed by the serial and file parsers, with and without PreParseNumbers,
+ * once going byte by byte and once with word scanning. The input is given
+ * to extendCommand() in random chunks with a limited line length, like
+ * SdCardModule does. The results of every extendCommand() call, the parsed
+ * commands and the buffer contents must be identical.
+ * Then the G-code file is parsed by both variants of the file parser, and
+ * also converted to serial form with line numbers and checksums for the
+ * serial parser, and the GB/s of each are reported. Without a file, this
+ * is done for generated slicer-like moves, and for the same moves with a
+ * comment on each line and a configuration dump at the end.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. gcode_scan_bench.cpp -o gcode_scan_bench
+ * 
+ * Usage:
+ *   ./gcode_scan_bench [file.gcode [passes]]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+
+using namespace APrinter;
+
+struct Context {
+    void check () const {}
+};
+
+using FpType = float;
+
+template <typename Service, typename ParserType, bool ScanWords>
+using ParserFor = GcodeParser<Context, size_t, FpType, ParserType, Service, ScanWords>;
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_state;
+
+static uint64_t rand_u64 ()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static void append_checksum (std::string *out, size_t line_start, bool corrupt)
+{
+    uint8_t checksum = 0;
+    for (size_t i = line_start; i < out->size(); i++) {
+        checksum ^= (unsigned char)(*out)[i];
+    }
+    char buf[8];
+    sprintf(buf, "*%d", (int)(uint8_t)(checksum + corrupt));
+    *out += buf;
+}
+
+static std::string random_input (int num_lines)
+{
+    static char const *const words[] = {
+        "G1", "X12.5", "Y-3", "E0.0421", "F3000", "M105", "N17", "S\\41x", "T\\4", "1abc", "Z",
+        "G", "M117", "Hello\\20World", "E", "X.", "+5"
+    };
+    static char const *const comments[] = {
+        ";", "; layer 3", ";TYPE:WALL-OUTER", "; G1 X1 * ; \\ \t", ";;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;"
+    };
+    std::string out;
+    for (int i = 0; i < num_lines; i++) {
+        size_t line_start = out.size();
+        int kind = rand_u64() % 16;
+        if (kind == 0) {
+            out += comments[rand_u64() % 5];
+        } else if (kind == 1) {
+            // Long line, may exceed the line buffer.
+            int n = rand_u64() % 300;
+            for (int j = 0; j < n; j++) {
+                out += (rand_u64() % 8 == 0) ? ' ' : (char)('A' + rand_u64() % 26);
+            }
+        } else if (kind == 2) {
+            // Random bytes including control characters.
+            int n = rand_u64() % 40;
+            for (int j = 0; j < n; j++) {
+                char ch = (char)(rand_u64() % 256);
+                out += (ch == '\n') ? ' ' : ch;
+            }
+        } else {
+            int num_words = rand_u64() % 8;
+            for (int j = 0; j < num_words; j++) {
+                if (j > 0 || rand_u64() % 8 == 0) {
+                    out += " \t\r "[rand_u64() % 4];
+                }
+                out += words[rand_u64() % (sizeof(words) / sizeof(words[0]))];
+            }
+            if (rand_u64() % 4 == 0) {
+                append_checksum(&out, line_start, rand_u64() % 8 == 0);
+                if (rand_u64() % 4 == 0) {
+                    out += "  ";
+                }
+            }
+            if (rand_u64() % 4 == 0) {
+                out += comments[rand_u64() % 5];
+            }
+        }
+        if (rand_u64() % 64 != 0) {
+            out += '\n';
+        }
+    }
+    if (rand_u64() % 8 == 0) {
+        out += "E\n";
+    }
+    return out;
+}
+
+template <typename TheParser>
+static void record_command (Context c, TheParser *parser, std::string *trace)
+{
+    char buf[64];
+    auto num_parts = parser->getNumParts(c);
+    sprintf(buf, "len=%zu parts=%d", parser->getLength(c), (int)num_parts);
+    *trace += buf;
+    if (num_parts >= 0) {
+        sprintf(buf, " cmd=%c%u", parser->getCmdCode(c), (unsigned)parser->getCmdNumber(c));
+        *trace += buf;
+        for (int i = 0; i < num_parts; i++) {
+            auto part = parser->getPart(c, i);
+            FpType fp = parser->getPartFpValue(c, part);
+            sprintf(buf, " %c[%.9g,%u]", parser->getPartCode(c, part), fp, (unsigned)parser->getPartUint32Value(c, part));
+            *trace += buf;
+            *trace += parser->getPartStringValue(c, part);
+        }
+    }
+    *trace += '\n';
+}
+
+// Feeds the input to the parser like SdCardModule does, with random chunks,
+// and returns a trace of the results and the final buffer contents.
+template <typename TheParser>
+static std::string run_parser (std::string const &input, uint64_t seed, size_t max_command_size)
+{
+    Context c;
+    TheParser parser;
+    parser.init(c);
+    rand_state = seed;
+    
+    std::string buffer = input;
+    std::string trace;
+    size_t pos = 0;
+    
+    while (pos < buffer.size()) {
+        parser.startCommand(c, &buffer[pos], 0);
+        size_t avail = 0;
+        while (true) {
+            size_t chunk = 1 + rand_u64() % ((rand_u64() % 2) ? 8 : 200);
+            avail = avail + chunk;
+            avail = (avail < max_command_size) ? avail : max_command_size;
+            avail = (avail < buffer.size() - pos) ? avail : buffer.size() - pos;
+            bool exhausted = (avail == max_command_size);
+            if (parser.extendCommand(c, avail, exhausted)) {
+                record_command(c, &parser, &trace);
+                pos += parser.getLength(c);
+                break;
+            }
+            trace += "more\n";
+            if (exhausted || avail == buffer.size() - pos) {
+                parser.resetCommand(c);
+                trace += "stop\n";
+                pos = buffer.size();
+                break;
+            }
+        }
+    }
+    
+    parser.deinit(c);
+    trace += buffer;
+    return trace;
+}
+
+template <typename Service, typename ParserType>
+static bool check_equivalence (char const *name, int count)
+{
+    using ScalarParser = ParserFor<Service, ParserType, false>;
+    using WordParser = ParserFor<Service, ParserType, true>;
+    
+    int mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        rand_state = 0x9E3779B97F4A7C15ull * (i + 1);
+        std::string input = random_input(1 + rand_u64() % 30);
+        uint64_t seed = rand_u64();
+        size_t max_command_size = 20 + rand_u64() % 200;
+        
+        std::string scalar_trace = run_parser<ScalarParser>(input, seed, max_command_size);
+        std::string word_trace = run_parser<WordParser>(input, seed, max_command_size);
+        if (scalar_trace != word_trace) {
+            if (mismatches++ < 3) {
+                printf("%s mismatch for input:\n%s\n--- scalar:\n%s\n--- words:\n%s\n", name, input.c_str(), scalar_trace.c_str(), word_trace.c_str());
+            }
+        }
+    }
+    
+    printf("%s_equivalence_mismatches %d\n", name, mismatches);
+    return mismatches == 0;
+}
+
+// Slicer-like moves. With verbose, every move has a comment (like Slic3r's
+// verbose mode) and a configuration dump follows, as written by PrusaSlicer.
+static std::string generate_corpus (bool verbose)
+{
+    std::string out = "; generated by gcode_scan_bench\n;FLAVOR:RepRap\n";
+    char buf[128];
+    float e = 0.0f;
+    for (int layer = 0; layer < 400; layer++) {
+        sprintf(buf, ";LAYER:%d\n;TYPE:WALL-OUTER\nG0 F9000 X%.3f Y%.3f Z%.2f\n", layer, 90.0f + layer % 7, 80.0f, 0.2f * (layer + 1));
+        out += buf;
+        for (int i = 0; i < 250; i++) {
+            e += 0.0312f;
+            sprintf(buf, "G1 X%.3f Y%.3f E%.5f", 100.0f + (rand_u64() % 40000) / 1000.0f, 100.0f + (rand_u64() % 40000) / 1000.0f, e);
+            out += buf;
+            out += verbose ? " ; perimeter\n" : "\n";
+            if (i % 50 == 0) {
+                out += ";TYPE:FILL ; infill pattern lines, speed and extrusion width unchanged\n";
+            }
+        }
+    }
+    if (verbose) {
+        for (int i = 0; i < 20000; i++) {
+            sprintf(buf, "; setting_%d = 0.4,0.4,0.4,0.4 ; some longer value text here\n", i);
+            out += buf;
+        }
+    }
+    return out;
+}
+
+static std::string to_serial (std::string const &file)
+{
+    std::string out;
+    uint32_t line_number = 1;
+    size_t pos = 0;
+    while (pos < file.size()) {
+        size_t end = file.find('\n', pos);
+        end = (end == std::string::npos) ? file.size() : end;
+        std::string line = file.substr(pos, end - pos);
+        line = line.substr(0, line.find(';'));
+        pos = end + 1;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        size_t line_start = out.size();
+        char buf[16];
+        sprintf(buf, "N%u ", (unsigned)line_number++);
+        out += buf;
+        out += line;
+        append_checksum(&out, line_start, false);
+        out += '\n';
+    }
+    return out;
+}
+
+template <typename TheParser>
+static void bench (char const *name, std::string const &input, int passes)
+{
+    Context c;
+    TheParser parser;
+    parser.init(c);
+    
+    std::string buffer;
+    uint64_t best_ns = UINT64_MAX;
+    uint32_t commands = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        // The parser modifies the buffer, so start each pass with a fresh copy.
+        buffer = input;
+        commands = 0;
+        size_t pos = 0;
+        uint64_t start_ns = get_ns();
+        while (pos < buffer.size()) {
+            parser.startCommand(c, &buffer[pos], 0);
+            if (!parser.extendCommand(c, buffer.size() - pos)) {
+                parser.resetCommand(c);
+                break;
+            }
+            pos += parser.getLength(c);
+            commands += (parser.getNumParts(c) >= 0);
+        }
+        uint64_t ns = get_ns() - start_ns;
+        best_ns = (ns < best_ns) ? ns : best_ns;
+    }
+    
+    parser.deinit(c);
+    
+    printf("%s_commands %u\n", name, (unsigned)commands);
+    printf("%s_gb_per_s %.3f\n", name, input.size() / (double)best_ns);
+    printf("%s_commands_per_s %.0f\n", name, commands / (best_ns * 1e-9));
+}
+
+static bool read_file (char const *path, std::string *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out->append(buf, len);
+    }
+    fclose(f);
+    // Make sure the last command is terminated.
+    *out += '\n';
+    return true;
+}
+
+static void bench_input (char const *name, std::string const &file_input, int passes)
+{
+    using FileService = FileGcodeParserService<16, false>;
+    using FilePreService = FileGcodeParserService<16, true>;
+    using SerialService = SerialGcodeParserService<16, false>;
+    
+    std::string serial_input = to_serial(file_input);
+    std::string prefix = name;
+    
+    printf("%s_file_bytes %zu\n", name, file_input.size());
+    printf("%s_serial_bytes %zu\n", name, serial_input.size());
+    bench<ParserFor<FileService, GcodeParserTypeFile, false>>((prefix + "_file_scalar").c_str(), file_input, passes);
+    bench<ParserFor<FileService, GcodeParserTypeFile, true>>((prefix + "_file_words").c_str(), file_input, passes);
+    bench<ParserFor<FilePreService, GcodeParserTypeFile, false>>((prefix + "_file_preparse_scalar").c_str(), file_input, passes);
+    bench<ParserFor<FilePreService, GcodeParserTypeFile, true>>((prefix + "_file_preparse_words").c_str(), file_input, passes);
+    bench<ParserFor<SerialService, GcodeParserTypeSerial, false>>((prefix + "_serial_scalar").c_str(), serial_input, passes);
+    bench<ParserFor<SerialService, GcodeParserTypeSerial, true>>((prefix + "_serial_words").c_str(), serial_input, passes);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [file.gcode [passes]]\n", argv[0]);
+        return 1;
+    }
+    int passes = (argc > 2) ? atoi(argv[2]) : 10;
+    
+    using SerialService = SerialGcodeParserService<16, false>;
+    using SerialPreService = SerialGcodeParserService<16, true>;
+    using FileService = FileGcodeParserService<16, false>;
+    using FilePreService = FileGcodeParserService<16, true>;
+    
+    bool ok = check_equivalence<SerialService, GcodeParserTypeSerial>("serial", 20000);
+    ok = check_equivalence<SerialPreService, GcodeParserTypeSerial>("serial_preparse", 20000) && ok;
+    ok = check_equivalence<FileService, GcodeParserTypeFile>("file", 20000) && ok;
+    ok = check_equivalence<FilePreService, GcodeParserTypeFile>("file_preparse", 20000) && ok;
+    if (!ok) {
+        return 1;
+    }
+    
+    if (argc > 1) {
+        std::string file_input;
+        if (!read_file(argv[1], &file_input)) {
+            fprintf(stderr, "Failed to read %s\n", argv[1]);
+            return 1;
+        }
+        bench_input("input", file_input, passes);
+    } else {
+        rand_state = 88172645463325252ull;
+        bench_input("moves", generate_corpus(false), passes);
+        bench_input("verbose", generate_corpus(true), passes);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host simulation of input shaping.
+ * 
+ * A single trapezoidal move is generated as signed stepper commands like the
+ * MotionPlanner does, and passed through InputShaper for each shaper type
+ * (or directly, for "none"). The resulting carriage motion drives a damped
+ * spring-mass model of the toolhead, and the amplitude of the vibration left
+ * over once the carriage has stopped is printed for a range of accelerations,
+ * in columns for gnuplot:
+ * 
+ *   ./input_shaper_sim > out.txt
+ *   gnuplot -p -e "set logscale y; plot for [i=2:5] 'out.txt' using 1:i with lines title columnhead(i)"
+ * 
+ * The shapers are tuned to 40 Hz and a damping ratio of 0.1; the resonance
+ * of the model can be given on the command line to see the effect of a
+ * mistuned shaper. The program also checks that shaping preserves the exact
+ * number of steps and exits with failure if it does not.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -I.. input_shaper_sim.cpp -o input_shaper_sim
+ * 
+ * Usage:
+ *   ./input_shaper_sim [model_frequency [model_damping_ratio]]
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <aprinter/meta/Expr.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/planning/InputShaper.h>
+
+using namespace APrinter;
+
+using FpType = float;
+
+static double const TicksPerSecond = 1000000.0;
+static double const StepsPerMm = 80.0;
+static double const MoveDistance = 50.0;
+static double const MoveSpeed = 150.0;
+static double const SimTicks = 5.0;
+
+static double const ShaperFrequency = 40.0;
+static double const ShaperDampingRatio = 0.1;
+static double model_frequency = ShaperFrequency;
+static double model_damping_ratio = ShaperDampingRatio;
+
+struct ShaperFrequencyFunc { static double call () { return ShaperFrequency; } };
+struct ShaperDampingRatioFunc { static double call () { return ShaperDampingRatio; } };
+using TimeConversion = APRINTER_FP_CONST_EXPR(1000000.0);
+
+static int const HistorySize = 16;
+static int const MaxCommands = 64;
+
+struct Command {
+    int32_t d;
+    FpType a;
+    int32_t t;
+};
+
+struct CommandList {
+    int count;
+    Command cmds[MaxCommands];
+    
+    void add (int32_t d, FpType a, int32_t t)
+    {
+        AMBRO_ASSERT_FORCE(count < MaxCommands)
+        cmds[count++] = Command{d, a, t};
+    }
+};
+
+// Commands for a move from rest to rest, and the rest time after it.
+static void gen_move (CommandList *out, double accel, int32_t rest_time)
+{
+    double speed = fmin(MoveSpeed, sqrt(accel * MoveDistance));
+    double accel_dist = speed * speed / (2.0 * accel);
+    int32_t accel_steps = round(accel_dist * StepsPerMm);
+    int32_t total_steps = round(MoveDistance * StepsPerMm);
+    int32_t const_steps = total_steps - 2 * accel_steps;
+    int32_t accel_time = round(speed / accel * TicksPerSecond);
+    int32_t const_time = round((MoveDistance - 2.0 * accel_dist) / speed * TicksPerSecond);
+    
+    out->count = 0;
+    out->add(accel_steps, accel_steps, accel_time);
+    if (const_steps > 0) {
+        out->add(const_steps, 0.0f, const_time);
+    }
+    out->add(accel_steps, -accel_steps, accel_time);
+    out->add(0, 0.0f, rest_time);
+}
+
+template <typename ShaperType>
+struct ShaperRunner {
+    using Exprs = InputShaperImpulseExprs<ShaperType, VariableExpr<double, ShaperFrequencyFunc>, VariableExpr<double, ShaperDampingRatioFunc>, TimeConversion>;
+    using Shaper = InputShaper<FpType, ShaperType::NumImpulses, HistorySize>;
+    
+    static int32_t last_time ()
+    {
+        return ceil(Exprs::LastTime::eval());
+    }
+    
+    static void run (CommandList const *in, CommandList *out)
+    {
+        typename Shaper::Impulses imp;
+        imp.amplitude[0] = Exprs::Amplitude1::eval();
+        imp.time[0] = Exprs::Time1::eval();
+        if (ShaperType::NumImpulses > 2) {
+            imp.amplitude[ShaperType::NumImpulses - 2] = Exprs::Amplitude2::eval();
+            imp.time[ShaperType::NumImpulses - 2] = Exprs::Time2::eval();
+        }
+        
+        typename Shaper::State state;
+        Shaper::init(&state);
+        out->count = 0;
+        
+        for (int i = 0; i < in->count; i++) {
+            Command const *c = &in->cmds[i];
+            int num_pieces = 0;
+            int32_t total_t = 0;
+            Shaper::push(&state, &imp, c->t, c->d, c->a, [&](int32_t d, FpType a, int32_t t, bool last) {
+                out->add(d, a, t);
+                num_pieces++;
+                total_t += t;
+            });
+            AMBRO_ASSERT_FORCE(num_pieces <= Shaper::MaxOutputPieces)
+            AMBRO_ASSERT_FORCE(total_t == c->t)
+        }
+    }
+};
+
+// Residual vibration [mm] of the toolhead once the carriage has executed
+// the commands, from a damped spring-mass model.
+static double simulate (CommandList const *cmds)
+{
+    double omega = 2.0 * M_PI * model_frequency;
+    double zeta = model_damping_ratio;
+    
+    double pos = 0.0;
+    double x = 0.0;
+    double v = 0.0;
+    
+    for (int i = 0; i < cmds->count; i++) {
+        Command const *c = &cmds->cmds[i];
+        double t = c->t / TicksPerSecond;
+        int n = ceil(c->t / SimTicks);
+        for (int j = 0; j < n; j++) {
+            double s = (j + 0.5) / n;
+            double carriage = pos + (c->d * s + c->a * (s * s - s)) / StepsPerMm;
+            double carriage_v = (c->d + c->a * (2.0 * s - 1.0)) / StepsPerMm / t;
+            double accel = omega * omega * (carriage - x) + 2.0 * zeta * omega * (carriage_v - v);
+            v += accel * (t / n);
+            x += v * (t / n);
+        }
+        pos += c->d / StepsPerMm;
+    }
+    
+    double omega_d = omega * sqrt(1.0 - zeta * zeta);
+    double ev = (v + zeta * omega * (x - pos)) / omega_d;
+    return sqrt((x - pos) * (x - pos) + ev * ev);
+}
+
+static int32_t total_steps (CommandList const *cmds)
+{
+    int32_t total = 0;
+    for (int i = 0; i < cmds->count; i++) {
+        total += cmds->cmds[i].d;
+    }
+    return total;
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc > 1) {
+        model_frequency = atof(argv[1]);
+    }
+    if (argc > 2) {
+        model_damping_ratio = atof(argv[2]);
+    }
+    if (!(model_frequency > 0.0) || !(model_damping_ratio >= 0.0 && model_damping_ratio < 1.0)) {
+        fprintf(stderr, "Bad model parameters\n");
+        return 1;
+    }
+    
+    int32_t rest_time = ShaperRunner<InputShaperEI>::last_time();
+    
+    printf("# shapers at %g Hz, damping %g; model at %g Hz, damping %g\n", ShaperFrequency, ShaperDampingRatio, model_frequency, model_damping_ratio);
+    printf("accel none ZV MZV EI\n");
+    
+    bool ok = true;
+    
+    for (double accel = 500.0; accel <= 20000.0; accel += 500.0) {
+        CommandList move;
+        gen_move(&move, accel, rest_time);
+        
+        CommandList zv;
+        CommandList mzv;
+        CommandList ei;
+        ShaperRunner<InputShaperZV>::run(&move, &zv);
+        ShaperRunner<InputShaperMZV>::run(&move, &mzv);
+        ShaperRunner<InputShaperEI>::run(&move, &ei);
+        
+        int32_t steps = total_steps(&move);
+        if (total_steps(&zv) != steps || total_steps(&mzv) != steps || total_steps(&ei) != steps) {
+            fprintf(stderr, "Step total mismatch at accel %g\n", accel);
+            ok = false;
+        }
+        
+        printf("%g %.4f %.4f %.4f %.4f\n", accel, 1000.0 * simulate(&move), 1000.0 * simulate(&zv), 1000.0 * simulate(&mzv), 1000.0 * simulate(&ei));
+    }
+    
+    return ok ? 0 : 1;
+}
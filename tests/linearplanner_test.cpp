@@ -92,9 +92,106 @@ static void test_path (Path path)
     }
 }
 
+// Comparison mode: feed the path through a sliding lookahead window the way
+// MotionPlanner does, planning after each new segment and committing the
+// oldest ones when the window is full. The backward pass is done both fully
+// and incrementally (stopping at the first unchanged segment as MotionPlanner
+// does), and the resulting velocity profiles must be identical.
+
+TheLinearPlanner::SegmentState lp_ss_inc[max_path_len];
+
+static size_t num_full_pushes;
+static size_t num_inc_pushes;
+
+static void test_path_incremental (Path path, size_t window_size, size_t commit_count)
+{
+    AMBRO_ASSERT_FORCE(path.num_segs <= max_path_len)
+    AMBRO_ASSERT_FORCE(commit_count >= 1)
+    AMBRO_ASSERT_FORCE(commit_count <= window_size)
+    
+    FpType prev_max_v = 0.0f;
+    for (size_t i = 0; i < path.num_segs; i++) {
+        Segment const *seg = &path.segs[i];
+        FpType max_v = seg->max_speed_squared;
+        FpType a_x = seg->two_max_accel * seg->distance;
+        TheLinearPlanner::initSegment(&lp_sd[i], prev_max_v, INFINITY, max_v, a_x);
+        prev_max_v = max_v;
+    }
+    
+    size_t start = 0;
+    size_t end = 0;
+    size_t pushed_end = 0;
+    FpType start_v = 0.0;
+    
+    while (start < path.num_segs) {
+        if (end < path.num_segs) {
+            end++;
+        }
+        
+        FpType v = 0.0;
+        for (size_t j = end; j > start; j--) {
+            v = TheLinearPlanner::push(&lp_sd[j - 1], &lp_ss[j - 1], v);
+            num_full_pushes++;
+        }
+        
+        v = 0.0;
+        for (size_t j = end; j > start; j--) {
+            size_t i = j - 1;
+            if (i < pushed_end) {
+                if (!TheLinearPlanner::repush(&lp_sd[i], &lp_ss_inc[i], &v)) {
+                    break;
+                }
+            } else {
+                v = TheLinearPlanner::push(&lp_sd[i], &lp_ss_inc[i], v);
+            }
+            num_inc_pushes++;
+        }
+        pushed_end = end;
+        
+        size_t commit_end = start;
+        if (end - start == window_size || end == path.num_segs) {
+            commit_end = start + commit_count;
+            if (commit_end > end) {
+                commit_end = end;
+            }
+        }
+        
+        FpType v_full = start_v;
+        FpType v_inc = start_v;
+        for (size_t i = start; i < end; i++) {
+            TheLinearPlanner::SegmentResult result_full;
+            TheLinearPlanner::SegmentResult result_inc;
+            v_full = TheLinearPlanner::pull(&lp_sd[i], &lp_ss[i], v_full, &result_full);
+            v_inc = TheLinearPlanner::pull(&lp_sd[i], &lp_ss_inc[i], v_inc, &result_inc);
+            
+            AMBRO_ASSERT_FORCE(v_inc == v_full)
+            AMBRO_ASSERT_FORCE(result_inc.const_start == result_full.const_start)
+            AMBRO_ASSERT_FORCE(result_inc.const_end == result_full.const_end)
+            AMBRO_ASSERT_FORCE(result_inc.const_v == result_full.const_v)
+            
+            if (i + 1 == commit_end) {
+                start_v = v_full;
+            }
+        }
+        
+        start = commit_end;
+    }
+}
+
 int main ()
 {
     for (size_t i = 0; i < num_paths; i++) {
         test_path(paths[i]);
     }
+    
+    static size_t const windows[][2] = {{1, 1}, {4, 1}, {16, 4}, {32, 8}, {100, 25}};
+    for (auto const &w : windows) {
+        num_full_pushes = 0;
+        num_inc_pushes = 0;
+        for (size_t i = 0; i < num_paths; i++) {
+            test_path_incremental(paths[i], w[0], w[1]);
+        }
+        printf("window %zu commit %zu: full pushes %zu incremental pushes %zu\n",
+               w[0], w[1], num_full_pushes, num_inc_pushes);
+    }
 }
@@ -0,0 +1,625 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host-side MotionPlanner benchmark.
+ * 
+ * Runs a complete PrinterMain (X, Y, Z and E axes, no transform) on a
+ * simulated clock and event loop, and replays a G-code file through the
+ * normal command path (GcodeParser, work_command, move_*). Steps are recorded
+ * by SimPins, so nothing depends on real time except the optional CPU
+ * model: with "-c F", handlers are charged F times their host execution
+ * time in virtual time, modelling a CPU that is F times slower than the host.
+ * Planner underruns at that virtual CPU speed are counted.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -DMOTIONPLANNER_BENCHMARK -I.. motionplanner_bench.cpp -o motionplanner_bench
+ * Buffer sizes and the FP type can be overridden with -DBENCH_STEPPER_SEGMENT_BUFFER_SIZE=...,
+ * -DBENCH_LOOKAHEAD_BUFFER_SIZE=..., -DBENCH_LOOKAHEAD_COMMIT_COUNT=... and -DBENCH_FP_TYPE=...
+ * With -DBENCH_DELTA=1 (DistanceSplitter) or -DBENCH_DELTA=2 (AdaptiveSplitter), the
+ * first three axes are the carriages A/B/C of a delta, and X/Y/Z are virtual.
+ * With -DBENCH_INPUT_SHAPER=1 (ZV), 2 (MZV) or 3 (EI), the first two axes are input shaped.
+ * With -DBENCH_JERK_LIMIT=1, the first three axes have a jerk limit, and all axes
+ * follow S-curve acceleration.
+ * -DBENCH_COMMAND_BATCH_MAX_COMMANDS=... sets how many commands are executed per
+ * event (1 disables batching). With -DBENCH_SERIAL_INPUT=1, the input asks for
+ * the next command with a fast event like SerialModule does, instead of with a
+ * queued event like SdCardModule (the planner host time then includes the input).
+ * 
+ * Usage:
+ *   ./motionplanner_bench [-c cpu_factor] file.gcode
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#ifndef MOTIONPLANNER_BENCHMARK
+#error "MOTIONPLANNER_BENCHMARK must be defined"
+#endif
+
+#ifndef BENCH_STEPPER_SEGMENT_BUFFER_SIZE
+#define BENCH_STEPPER_SEGMENT_BUFFER_SIZE 64
+#endif
+#ifndef BENCH_LOOKAHEAD_BUFFER_SIZE
+#define BENCH_LOOKAHEAD_BUFFER_SIZE 32
+#endif
+#ifndef BENCH_LOOKAHEAD_COMMIT_COUNT
+#define BENCH_LOOKAHEAD_COMMIT_COUNT 8
+#endif
+#ifndef BENCH_FP_TYPE
+#define BENCH_FP_TYPE float
+#endif
+#ifndef BENCH_DELTA
+#define BENCH_DELTA 0
+#endif
+#ifndef BENCH_INPUT_SHAPER
+#define BENCH_INPUT_SHAPER 0
+#endif
+#ifndef BENCH_JERK_LIMIT
+#define BENCH_JERK_LIMIT 0
+#endif
+#ifndef BENCH_COMMAND_BATCH_MAX_COMMANDS
+#define BENCH_COMMAND_BATCH_MAX_COMMANDS 8
+#endif
+#ifndef BENCH_SERIAL_INPUT
+#define BENCH_SERIAL_INPUT 0
+#endif
+
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/MemberType.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/base/ProgramMemory.h>
+#include <aprinter/hal/generic/NullWatchdog.h>
+#include <aprinter/hal/generic/StubPins.h>
+#include <aprinter/hal/sim/SimClock.h>
+#include <aprinter/hal/sim/SimPins.h>
+#include <aprinter/system/SimEventLoop.h>
+#include <aprinter/printer/PrinterMain.h>
+#include <aprinter/printer/actuators/AxisDriver.h>
+#include <aprinter/printer/config_manager/RuntimeConfigManager.h>
+#include <aprinter/printer/transform/DeltaTransform.h>
+#include <aprinter/printer/transform/DistanceSplitter.h>
+#include <aprinter/printer/transform/AdaptiveSplitter.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+#include <aprinter/printer/utils/GcodeCommand.h>
+#include <aprinter/printer/utils/ModuleUtils.h>
+
+using namespace APrinter;
+
+/*
+ * Module which feeds the G-code file from memory into a command stream,
+ * the same way SdCardModule feeds it from its buffer, or SerialModule from
+ * its receive buffer.
+ */
+
+static char const *bench_input_data;
+static size_t bench_input_length;
+static uint32_t bench_num_commands;
+static uint32_t bench_num_underruns;
+static uint64_t bench_reply_bytes;
+
+template <typename ModuleArg>
+class BenchInputModule {
+    APRINTER_UNPACK_MODULE_ARG(ModuleArg)
+    
+public:
+    struct Object;
+    
+private:
+    static size_t const MaxCommandSize = 256;
+    
+    using TheGcodeParser = typename FileGcodeParserService<16, true>::template Parser<Context, size_t, typename ThePrinterMain::FpType>;
+    
+    using NextFastEvent = typename Context::EventLoop::template FastEventSpec<BenchInputModule>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        o->gcode_parser.init(c);
+        o->command_stream.init(c, &o->callback, &o->callback);
+        o->next_event.init(c, APRINTER_CB_STATFUNC_T(&BenchInputModule::next_event_handler));
+        Context::EventLoop::template initFastEvent<NextFastEvent>(c, BenchInputModule::next_event_handler);
+        o->m_pos = 0;
+        o->m_eof = false;
+        set_next_event(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        Context::EventLoop::template resetFastEvent<NextFastEvent>(c);
+        o->next_event.deinit(c);
+        o->command_stream.deinit(c);
+        o->gcode_parser.deinit(c);
+    }
+    
+    static void planner_underrun (Context c)
+    {
+        bench_num_underruns++;
+    }
+    
+    using EventLoopFastEvents = MakeTypeList<NextFastEvent>;
+    
+private:
+    struct StreamCallback : public ThePrinterMain::CommandStreamCallback, ThePrinterMain::SendBufEventCallback {
+        void finish_command_impl (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->command_stream.hasCommand(c))
+            
+            if (o->m_eof) {
+                // The final M400 is done, so all motion has completed.
+                return Context::EventLoop::stop(c);
+            }
+            
+            bench_num_commands++;
+            o->m_pos += o->gcode_parser.getLength(c);
+            set_next_event(c);
+        }
+        
+        void reply_poke_impl (Context c, bool push)
+        {
+        }
+        
+        void reply_append_buffer_impl (Context c, char const *str, size_t length)
+        {
+            bench_reply_bytes += length;
+        }
+        
+        size_t get_send_buf_avail_impl (Context c)
+        {
+            return (size_t)-1 / 2;
+        }
+        
+        bool request_send_buf_event_impl (Context c, size_t length)
+        {
+            return false;
+        }
+        
+        void cancel_send_buf_event_impl (Context c)
+        {
+        }
+    };
+    
+    static void set_next_event (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        if (BENCH_SERIAL_INPUT) {
+            Context::EventLoop::template triggerFastEvent<NextFastEvent>(c);
+        } else {
+            o->next_event.prependNowNotAlready(c);
+        }
+    }
+    
+    static void next_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        if (!BENCH_SERIAL_INPUT) {
+            next_command(c);
+            return;
+        }
+        
+        if (o->command_stream.hasCommand(c) || o->m_eof) {
+            return;
+        }
+        o->command_stream.beginBatch(c);
+        while (next_command(c) && o->command_stream.continueBatch(c)) {
+            // The command finished right away, go on with the next one.
+        }
+    }
+    
+    static bool next_command (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->command_stream.hasCommand(c))
+        AMBRO_ASSERT(!o->m_eof)
+        
+        size_t rem_length = bench_input_length - o->m_pos;
+        size_t avail = MinValue(MaxCommandSize, rem_length);
+        bool line_buffer_exhausted = (avail == MaxCommandSize);
+        
+        if (!o->gcode_parser.haveCommand(c)) {
+            o->gcode_parser.startCommand(c, (char *)bench_input_data + o->m_pos, 0);
+        }
+        
+        if (o->gcode_parser.extendCommand(c, avail, line_buffer_exhausted) && o->gcode_parser.getNumParts(c) != GCODE_ERROR_EOF) {
+            o->command_stream.startCommand(c, &o->gcode_parser);
+            return true;
+        }
+        
+        if (o->gcode_parser.haveCommand(c)) {
+            o->gcode_parser.resetCommand(c);
+        }
+        o->m_eof = true;
+        o->command_stream.startCommand(c, &o->gcode_m400_command);
+        return false;
+    }
+    
+public:
+    struct Object : public ObjBase<BenchInputModule, ParentObject, EmptyTypeList> {
+        TheGcodeParser gcode_parser;
+        GcodeM400Command<Context, typename ThePrinterMain::FpType> gcode_m400_command;
+        typename ThePrinterMain::CommandStream command_stream;
+        StreamCallback callback;
+        typename Context::EventLoop::QueuedEvent next_event;
+        size_t m_pos;
+        bool m_eof;
+    };
+};
+
+struct BenchInputModuleService {
+    APRINTER_MODULE_TEMPLATE(BenchInputModuleService, BenchInputModule)
+};
+
+/*
+ * Printer configuration.
+ */
+
+using LedBlinkInterval = AMBRO_WRAP_DOUBLE(0.5);
+using SpeedLimitMultiply = AMBRO_WRAP_DOUBLE(1.0 / 60.0);
+using CommandBatchMaxTime = AMBRO_WRAP_DOUBLE(0.001);
+
+APRINTER_CONFIG_START
+
+APRINTER_CONFIG_OPTION_DOUBLE(ForceTimeout, 0.1, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(InactiveTime, 480.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(MaxStepsPerCycle, 100000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_SIMPLE(JunctionDeviationEnabled, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(JunctionDeviation, 0.05, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ArcTolerance, 0.01, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ArcMinSegmentTime, 0.005, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(XInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XStepsPerUnit, 80.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMinPos, -1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMaxPos, 1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMaxSpeed, 300.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMaxAccel, 1500.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XCorneringDistance, 40.0, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(YInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YStepsPerUnit, 80.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMinPos, -1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMaxPos, 1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMaxSpeed, 300.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMaxAccel, 1500.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YCorneringDistance, 40.0, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(ZInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZStepsPerUnit, 4000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMinPos, -1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMaxPos, 1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMaxSpeed, 3.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMaxAccel, 30.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZCorneringDistance, 40.0, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(EInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EStepsPerUnit, 928.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMinPos, -40000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMaxPos, 40000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMaxSpeed, 45.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMaxAccel, 250.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ECorneringDistance, 40.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EPressureAdvance, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(CartesianPressureAdvance, 0.0, ConfigProperties<ConfigPropertyConstant>)
+
+#if BENCH_INPUT_SHAPER
+APRINTER_CONFIG_OPTION_DOUBLE(ShaperFrequency, 40.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ShaperDampingRatio, 0.1, ConfigNoProperties)
+using BenchShaperType = If<(BENCH_INPUT_SHAPER == 1), InputShaperZV, If<(BENCH_INPUT_SHAPER == 2), InputShaperMZV, InputShaperEI>>;
+using BenchShapedParams = PrinterMainInputShaperParams<BenchShaperType, ShaperFrequency, ShaperDampingRatio>;
+#else
+using BenchShapedParams = PrinterMainNoInputShaperParams;
+#endif
+
+#if BENCH_JERK_LIMIT
+APRINTER_CONFIG_OPTION_DOUBLE(MaxJerk, 100000.0, ConfigNoProperties)
+using BenchJerkLimitParams = PrinterMainJerkLimitParams<MaxJerk>;
+#else
+using BenchJerkLimitParams = PrinterMainNoJerkLimitParams;
+#endif
+
+#if BENCH_DELTA
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaStepsPerUnit, 87.489, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxSpeed, 250.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxAccel, 4000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaDiagonalRod, 160.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaSmoothRodOffset, 81.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaEffectorOffset, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaCarriageOffset, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaLimitRadius, 75.1, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMinSplitLength, 0.1, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxSplitLength, 3.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaSegmentsPerSecond, 150.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaAdaptiveMaxSplitLength, 50.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxSplitDeviation, 0.01, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtXYMinPos, -100.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtXYMaxPos, 100.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtZMinPos, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtZMaxPos, 155.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtMaxSpeed, 500.0, ConfigNoProperties)
+#endif
+
+APRINTER_CONFIG_END
+
+static int const NumBenchAxes = 4;
+
+template <int Index, typename InvertDir>
+using BenchSteppersList = MakeTypeList<
+    PrinterMainSlaveStepperParams<
+        StepperDef<SimDirPin<Index>, SimStepPin<Index>, StubPin, true, false, InvertDir>
+    >
+>;
+
+template <int Index>
+using BenchAxisDriverService = AxisDriverService<
+    SimClockInterruptTimerService<Index>,
+    AxisDriverDuePrecisionParams,
+    false,
+    AxisDriverNoDelayParams,
+    AxisDriverNoBurstParams
+>;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+APRINTER_MAKE_INSTANCE(MyClock, (SimClockService<20, NumBenchAxes>::Clock<Context, Program, MakeTypeList<void>>))
+
+struct MyLoopExtraDelay;
+APRINTER_MAKE_INSTANCE(MyLoop, (SimEventLoopArg<Context, Program, MyLoopExtraDelay>))
+
+APRINTER_MAKE_INSTANCE(Pins, (SimPinsService<NumBenchAxes>::Pins<Context, Program>))
+
+struct ThePrinterParams : public PrinterMainParams<
+    StubPin, // LedPin
+    LedBlinkInterval,
+    InactiveTime,
+    128, // ExpectedResponseLength
+    512, // ExtraSendBufClearance
+    128, // MaxMsgSize
+    SpeedLimitMultiply,
+    MaxStepsPerCycle,
+    BENCH_STEPPER_SEGMENT_BUFFER_SIZE,
+    BENCH_LOOKAHEAD_BUFFER_SIZE,
+    BENCH_LOOKAHEAD_COMMIT_COUNT,
+    JunctionDeviationEnabled,
+    JunctionDeviation,
+    ForceTimeout,
+    BENCH_COMMAND_BATCH_MAX_COMMANDS,
+    CommandBatchMaxTime,
+    BENCH_FP_TYPE,
+    NullWatchdogService,
+    false, // WatchdogDebugMode
+    RuntimeConfigManagerService<RuntimeConfigManagerNoStoreService>,
+    ConfigList,
+    MakeTypeList<
+#if BENCH_DELTA
+        PrinterMainAxisParams<'A', DeltaStepsPerUnit, XMinPos, XMaxPos, DeltaMaxSpeed, DeltaMaxAccel, XDistanceFactor, XCorneringDistance, CartesianPressureAdvance, BenchShapedParams, BenchJerkLimitParams,
+            PrinterMainNoHomingParams, false, false, 32, BenchAxisDriverService<0>, BenchSteppersList<0, XInvertDir>>,
+        PrinterMainAxisParams<'B', DeltaStepsPerUnit, YMinPos, YMaxPos, DeltaMaxSpeed, DeltaMaxAccel, YDistanceFactor, YCorneringDistance, CartesianPressureAdvance, BenchShapedParams, BenchJerkLimitParams,
+            PrinterMainNoHomingParams, false, false, 32, BenchAxisDriverService<1>, BenchSteppersList<1, YInvertDir>>,
+        PrinterMainAxisParams<'C', DeltaStepsPerUnit, ZMinPos, ZMaxPos, DeltaMaxSpeed, DeltaMaxAccel, ZDistanceFactor, ZCorneringDistance, CartesianPressureAdvance, PrinterMainNoInputShaperParams, BenchJerkLimitParams,
+            PrinterMainNoHomingParams, false, false, 32, BenchAxisDriverService<2>, BenchSteppersList<2, ZInvertDir>>,
+#else
+        PrinterMainAxisParams<'X', XStepsPerUnit, XMinPos, XMaxPos, XMaxSpeed, XMaxAccel, XDistanceFactor, XCorneringDistance, CartesianPressureAdvance, BenchShapedParams, BenchJerkLimitParams,
+            PrinterMainNoHomingParams, true, false, 32, BenchAxisDriverService<0>, BenchSteppersList<0, XInvertDir>>,
+        PrinterMainAxisParams<'Y', YStepsPerUnit, YMinPos, YMaxPos, YMaxSpeed, YMaxAccel, YDistanceFactor, YCorneringDistance, CartesianPressureAdvance, BenchShapedParams, BenchJerkLimitParams,
+            PrinterMainNoHomingParams, true, false, 32, BenchAxisDriverService<1>, BenchSteppersList<1, YInvertDir>>,
+        PrinterMainAxisParams<'Z', ZStepsPerUnit, ZMinPos, ZMaxPos, ZMaxSpeed, ZMaxAccel, ZDistanceFactor, ZCorneringDistance, CartesianPressureAdvance, PrinterMainNoInputShaperParams, BenchJerkLimitParams,
+            PrinterMainNoHomingParams, true, false, 32, BenchAxisDriverService<2>, BenchSteppersList<2, ZInvertDir>>,
+#endif
+        PrinterMainAxisParams<'E', EStepsPerUnit, EMinPos, EMaxPos, EMaxSpeed, EMaxAccel, EDistanceFactor, ECorneringDistance, EPressureAdvance, PrinterMainNoInputShaperParams, PrinterMainNoJerkLimitParams,
+            PrinterMainNoHomingParams, false, true, 32, BenchAxisDriverService<3>, BenchSteppersList<3, EInvertDir>>
+    >,
+#if BENCH_DELTA
+    PrinterMainTransformParams<
+        MakeTypeList<
+            PrinterMainVirtualAxisParams<'X', VirtXYMinPos, VirtXYMaxPos, VirtMaxSpeed>,
+            PrinterMainVirtualAxisParams<'Y', VirtXYMinPos, VirtXYMaxPos, VirtMaxSpeed>,
+            PrinterMainVirtualAxisParams<'Z', VirtZMinPos, VirtZMaxPos, VirtMaxSpeed>
+        >,
+        MakeTypeList<WrapInt<'A'>, WrapInt<'B'>, WrapInt<'C'>>,
+        DeltaTransformService<DeltaDiagonalRod, DeltaSmoothRodOffset, DeltaEffectorOffset, DeltaCarriageOffset, DeltaLimitRadius>,
+#if BENCH_DELTA == 2
+        AdaptiveSplitterService<DeltaMinSplitLength, DeltaAdaptiveMaxSplitLength, DeltaMaxSplitDeviation>
+#else
+        DistanceSplitterService<DeltaMinSplitLength, DeltaMaxSplitLength, DeltaSegmentsPerSecond>
+#endif
+    >,
+#else
+    PrinterMainNoTransformParams,
+#endif
+    PrinterMainArcParams<ArcTolerance, ArcMinSegmentTime>,
+    MakeTypeList<>,
+    MakeTypeList<
+        BenchInputModuleService
+    >
+> {};
+
+APRINTER_MAKE_INSTANCE(MyPrinter, (PrinterMainArg<Context, Program, ThePrinterParams>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = ::MyClock;
+    using EventLoop = ::MyLoop;
+    using Pins = ::Pins;
+    using Printer = ::MyPrinter;
+    void check () const {}
+};
+
+APRINTER_DEFINE_MEMBER_TYPE(MemberType_EventLoopFastEvents, EventLoopFastEvents)
+APRINTER_MAKE_INSTANCE(MyLoopExtra, (BusyEventLoopExtraArg<Program, MyLoop, ObjCollect<MakeTypeList<MyPrinter>, MemberType_EventLoopFastEvents>>))
+struct MyLoopExtraDelay : public WrapType<MyLoopExtra> {};
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    MyLoop,
+    Pins,
+    MyPrinter,
+    MyLoopExtra
+>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+using ThePlanner = typename MyPrinter::ThePlanner;
+
+static char * read_file (char const *path, size_t *out_length)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return nullptr;
+    }
+    size_t capacity = 1 << 20;
+    size_t length = 0;
+    char *data = (char *)malloc(capacity);
+    AMBRO_ASSERT_FORCE(data)
+    while (true) {
+        // Leave room for the newline appended below.
+        if (capacity - length < 2) {
+            capacity *= 2;
+            data = (char *)realloc(data, capacity);
+            AMBRO_ASSERT_FORCE(data)
+        }
+        size_t res = fread(data + length, 1, capacity - length - 1, f);
+        if (res == 0) {
+            break;
+        }
+        length += res;
+    }
+    fclose(f);
+    // Make sure the last command is terminated.
+    data[length++] = '\n';
+    *out_length = length;
+    return data;
+}
+
+int main (int argc, char *argv[])
+{
+    double cpu_factor = 0.0;
+    char const *path = nullptr;
+    
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            cpu_factor = atof(argv[++i]);
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (!path || !(cpu_factor >= 0.0)) {
+        fprintf(stderr, "Usage: %s [-c cpu_factor] file.gcode\n", argv[0]);
+        return 1;
+    }
+    
+    char *data = read_file(path, &bench_input_length);
+    if (!data) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return 1;
+    }
+    bench_input_data = data;
+    
+    Context c;
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    
+    MyClock::init(c);
+    MyClock::setCpuFactor(c, cpu_factor);
+    MyLoop::init(c);
+    Pins::init(c);
+    
+    uint64_t host_start_ns = MyClock::getHostNanoseconds();
+    
+    MyPrinter::init(c);
+    MyLoop::run(c);
+    
+    uint64_t host_ns = MyClock::getHostNanoseconds() - host_start_ns;
+    double planner_seconds = MyLoop::getFastEventHostTime(c) * 1e-9;
+    double host_seconds = host_ns * 1e-9;
+    double virtual_seconds = MyClock::getTotalTicks(c) * MyClock::time_unit;
+    auto stats = ThePlanner::getBenchStats(c);
+    
+    printf("input_bytes %zu\n", bench_input_length);
+    printf("commands %" PRIu32 "\n", bench_num_commands);
+    printf("reply_bytes %" PRIu64 "\n", bench_reply_bytes);
+    printf("stepper_segment_buffer_size %d\n", BENCH_STEPPER_SEGMENT_BUFFER_SIZE);
+    printf("lookahead_buffer_size %d\n", BENCH_LOOKAHEAD_BUFFER_SIZE);
+    printf("lookahead_commit_count %d\n", BENCH_LOOKAHEAD_COMMIT_COUNT);
+    printf("command_batch_max_commands %d\n", BENCH_COMMAND_BATCH_MAX_COMMANDS);
+    printf("cpu_factor %g\n", cpu_factor);
+    printf("virtual_time_s %.6f\n", virtual_seconds);
+    printf("host_time_s %.6f\n", host_seconds);
+    printf("planner_host_time_s %.6f\n", planner_seconds);
+    printf("segments %" PRIu32 "\n", stats.segments);
+    printf("segments_per_s %.1f\n", (planner_seconds > 0.0) ? stats.segments / planner_seconds : 0.0);
+    printf("plans %" PRIu32 "\n", stats.plans);
+    printf("push_steps_per_segment %.3f\n", (stats.segments > 0) ? (double)stats.push_steps / stats.segments : 0.0);
+    printf("planner_ns_per_segment %.1f\n", (stats.segments > 0) ? planner_seconds * 1e9 / stats.segments : 0.0);
+    printf("stepper_commands %" PRIu32 "\n", stats.stepper_commands);
+    printf("jerk_limit_misses %" PRIu32 "\n", stats.jerk_limit_misses);
+    printf("underruns %" PRIu32 "\n", bench_num_underruns);
+    
+    for (int i = 0; i < NumBenchAxes; i++) {
+        SimStepperRecord const *rec = Pins::getStepperRecord(c, i);
+        double min_interval = rec->have_step ? rec->min_step_interval * MyClock::time_unit : 0.0;
+        printf("axis%d_steps %" PRIu32 "\n", i, rec->steps);
+        printf("axis%d_position %" PRId32 "\n", i, rec->position);
+        printf("axis%d_max_step_rate %.1f\n", i, (min_interval > 0.0) ? 1.0 / min_interval : 0.0);
+    }
+    
+    free(data);
+    return 0;
+}
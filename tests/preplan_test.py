@@ -0,0 +1,243 @@
+# Copyright (c) 2017 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+# Checks the segment blocks written by aprinter_preplan.py against the
+# transform and splitter on the device. Small G-code files are printed from
+# the SD card in the segment_blocks_sim program, once as they are (the
+# device transforms and splits the moves) and once pre-planned (the segment
+# records go directly to the planner). The number of planner segments (which
+# follows the number of split moves) and the final step positions must be
+# equal, and the sampled step positions must
+# agree within step_tolerance. This is done for a cartesian machine and for a
+# delta with a DistanceSplitter (segment_blocks_sim built with -DSIM_DELTA=1).
+# A pre-planned file whose block is cut short must fail with
+# SegmentsTruncated, and blocks with unknown or repeated channels must fail
+# with BadSegmentChannels without moving. Comments and blank lines must be
+# kept.
+#
+# Usage: python2 preplan_test.py [path_to_segment_blocks_sim [path_to_segment_blocks_sim_delta]]
+
+from __future__ import print_function
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+import aprinter_preplan
+
+step_tolerance = 2
+
+# The machines of segment_blocks_sim, as in the JSON configuration.
+
+def stepper(name, cartesian, extruder=False):
+    return {'Name': name, 'EnableCartesianSpeedLimit': cartesian, 'IsExtruder': extruder}
+
+cartesian_config = {
+    'steppers': [stepper('X', True), stepper('Y', True), stepper('Z', True), stepper('E', False, True)],
+    'transform': {'_compoundName': 'NoTransform'},
+}
+
+delta_config = {
+    'steppers': [stepper('A', False), stepper('B', False), stepper('C', False), stepper('E', False, True)],
+    'transform': {
+        '_compoundName': 'Delta',
+        'DiagnalRod': 160.0,
+        'SmoothRodOffset': 81.0,
+        'EffectorOffset': 0.0,
+        'CarriageOffset': 0.0,
+        'LimitRadius': 75.1,
+        'CartesianAxes': {
+            'VirtualAxis0': {'Name': 'X', 'MinPos': -100.0, 'MaxPos': 100.0, 'MaxSpeed': 500.0},
+            'VirtualAxis1': {'Name': 'Y', 'MinPos': -100.0, 'MaxPos': 100.0, 'MaxSpeed': 500.0},
+            'VirtualAxis2': {'Name': 'Z', 'MinPos': 0.0, 'MaxPos': 155.0, 'MaxSpeed': 500.0},
+        },
+        'Steppers': {
+            'TransformStepper0': {'StepperName': 'A'},
+            'TransformStepper1': {'StepperName': 'B'},
+            'TransformStepper2': {'StepperName': 'C'},
+        },
+        'Splitter': {'_compoundName': 'DistanceSplitter', 'MinSplitLength': 0.1, 'MaxSplitLength': 3.0, 'SegmentsPerSecond': 150.0},
+    },
+}
+
+cartesian_gcode = '''G90
+M82
+G92 X0 Y0 Z0 E0
+G1 X10 Y5 E0.5 F3000
+G1 X20 Y-3 Z0.2 E1.0
+G1 X35 Y10 E1.8 F6000
+G1 X35 Y10 E0.8 F2400
+G1 X0 Y0 Z0 F9000
+'''
+
+delta_gcode = '''G90
+M83
+G92 X0 Y0 Z10 E0
+G1 X20 Y0 E0.6 F3000
+G1 X20 Y30 Z10.3 E0.9
+G1 X-40 Y-20 E2.0 F6000
+G1 E-1.0 F2400
+G0 X0 Y0 Z10 F9000
+'''
+
+comments_gcode = '''; start
+G90
+
+M82 ; absolute E
+G92 X0 Y0 Z0 E0
+G1 X10 Y5 E0.5 F3000 ; first move
+; between moves
+
+G1 X20 Y-3 Z0.2 E1.0
+G1 X0 Y0 Z0 F9000 ;last move
+M400 ; done
+'''
+
+def run_sim(sim, data):
+    fd, path = tempfile.mkstemp(suffix='.gcode')
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            f.write(data)
+        output = subprocess.check_output([sim, path]).decode('latin-1')
+    finally:
+        os.remove(path)
+    res = {'samples': [], 'replies': []}
+    for line in output.splitlines():
+        key, value = line.split(' ', 1)
+        if key == 'sample':
+            res['samples'].append([int(x) for x in value.split()[1:]])
+        elif key == 'reply':
+            res['replies'].append(value)
+        else:
+            res[key] = value
+    return res
+
+def preplan(config, gcode):
+    machine = aprinter_preplan.Machine(config)
+    tmp_dir = tempfile.mkdtemp()
+    try:
+        input_path = os.path.join(tmp_dir, 'input.gcode')
+        output_path = os.path.join(tmp_dir, 'output.gcode')
+        with open(input_path, 'w') as f:
+            f.write(gcode)
+        aprinter_preplan.preplan_file(machine, input_path, output_path, 10000)
+        with open(output_path, 'rb') as f:
+            return f.read(), machine.channels
+    finally:
+        shutil.rmtree(tmp_dir)
+
+def positions(res):
+    return [int(res['axis{}_position'.format(i)]) for i in range(4)]
+
+def errors(res):
+    return [reply for reply in res['replies'] if 'Error' in reply]
+
+def max_sample_deviation(res1, res2):
+    samples1 = res1['samples']
+    samples2 = res2['samples']
+    # The runs end at about the same time; the missing samples of the shorter
+    # one are its final positions.
+    length = max(len(samples1), len(samples2))
+    samples1 = samples1 + [samples1[-1]] * (length - len(samples1))
+    samples2 = samples2 + [samples2[-1]] * (length - len(samples2))
+    return max(abs(p1 - p2) for (s1, s2) in zip(samples1, samples2) for (p1, p2) in zip(s1, s2))
+
+def check(name, ok, details):
+    print('{} {} {}'.format(name, details, 'OK' if ok else 'FAILED'))
+    return ok
+
+def check_machine(name, sim, config, gcode):
+    ok = True
+    preplanned, channels = preplan(config, gcode)
+    
+    # All the moves form one block.
+    headers = re.findall(br'M950 I(\w*) S(\d+)\n', preplanned)
+    ok &= check('{}_blocks'.format(name), len(headers) == 1 and headers[0][0] == channels.encode(), headers)
+    
+    device = run_sim(sim, gcode.encode())
+    host = run_sim(sim, preplanned)
+    ok &= check('{}_errors'.format(name), not errors(device) and not errors(host), errors(device) + errors(host))
+    ok &= check('{}_segments'.format(name), device['segments'] == host['segments'],
+        'device {} host {} records {}'.format(device['segments'], host['segments'], headers[0][1].decode()))
+    ok &= check('{}_positions'.format(name), positions(device) == positions(host),
+        'device {} host {}'.format(positions(device), positions(host)))
+    deviation = max_sample_deviation(device, host)
+    ok &= check('{}_sample_deviation'.format(name), deviation <= step_tolerance, deviation)
+    
+    # A block with fewer records than its header says. The file ends with
+    # the block, and more records are missing than the padding of the last
+    # SD card block could hold (it would be read as records).
+    record_size = 4 * (1 + len(channels))
+    count = int(headers[0][1])
+    header_start = preplanned.index(b'M950')
+    start = preplanned.index(b'\n', header_start) + 1
+    header = 'M950 I{} S{}\n'.format(channels, count + 512).encode()
+    res = run_sim(sim, preplanned[:header_start] + header + preplanned[start:start + count * record_size])
+    ok &= check('{}_truncated'.format(name), any('SegmentsTruncated' in reply for reply in errors(res)), errors(res))
+    
+    # Unknown and repeated channels.
+    header = b'M950 I' + channels.encode()
+    for bad_channels in [channels + 'Q', channels + channels[0]]:
+        res = run_sim(sim, preplanned.replace(header, b'M950 I' + bad_channels.encode(), 1))
+        ok &= check('{}_bad_channels_{}'.format(name, bad_channels), any('BadSegmentChannels' in reply for reply in errors(res)) and positions(res) == [0] * 4,
+            '{} positions {}'.format(errors(res), positions(res)))
+    
+    return ok
+
+def check_comments(sim, config, gcode):
+    ok = True
+    preplanned, channels = preplan(config, gcode)
+    
+    # Non-move lines pass through unchanged, and the comments of the
+    # converted moves and the lines between them come just before the block.
+    header_start = preplanned.index(b'M950')
+    expected = b'; start\nG90\n\nM82 ; absolute E\nG92 X0 Y0 Z0 E0\n; first move\n; between moves\n\n;last move\n'
+    ok &= check('comments_before_block', preplanned[:header_start] == expected, repr(preplanned[:header_start]))
+    headers = re.findall(br'M950 I(\w*) S(\d+)\n', preplanned)
+    ok &= check('comments_blocks', len(headers) == 1 and headers[0][1] == b'3', headers)
+    ok &= check('comments_after_block', preplanned.endswith(b'M400 ; done\n'), repr(preplanned[-12:]))
+    
+    device = run_sim(sim, gcode.encode())
+    host = run_sim(sim, preplanned)
+    ok &= check('comments_errors', not errors(device) and not errors(host), errors(device) + errors(host))
+    ok &= check('comments_positions', positions(device) == positions(host),
+        'device {} host {}'.format(positions(device), positions(host)))
+    
+    return ok
+
+def main():
+    sim = sys.argv[1] if len(sys.argv) > 1 else './segment_blocks_sim'
+    sim_delta = sys.argv[2] if len(sys.argv) > 2 else './segment_blocks_sim_delta'
+    
+    ok = check_machine('cartesian', sim, cartesian_config, cartesian_gcode)
+    ok &= check_machine('delta', sim_delta, delta_config, delta_gcode)
+    ok &= check_comments(sim, cartesian_config, comments_gcode)
+    
+    if not ok:
+        sys.exit(1)
+
+main()
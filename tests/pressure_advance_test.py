@@ -0,0 +1,109 @@
+# Copyright (c) 2017 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+# Checks that pressure advance does not change the amount of filament extruded.
+# Random extrusion moves with occasional retractions are run through the
+# motionplanner_bench program with pressure advance disabled and with several
+# advance coefficients, and the final extruder position is compared. The total
+# number of extruder steps is reported too, it grows with the coefficient since
+# the extruder moves back and forth around its planned position.
+# The maximum extruder step rate must stay within that of an extruder-only move
+# at the maximum speed of the axis (e_max_speed); pressure advance may not
+# drive the extruder faster than the axis limit.
+#
+# Usage: python pressure_advance_test.py [path_to_motionplanner_bench]
+
+from __future__ import print_function
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+num_moves = 300
+retract_every = 10
+retract_length = 2.0
+coefficients = [0.01, 0.05, 0.2]
+e_max_speed = 45.0
+
+def gen_gcode(pressure_advance):
+    lines = ['G21', 'G90', 'M83']
+    lines.append('M926 IEPressureAdvance V{}'.format(pressure_advance))
+    lines.append('M930')
+    for i in range(num_moves):
+        if i % retract_every == 0:
+            e = -retract_length
+        else:
+            e = random.uniform(-0.5, 2.0)
+        x = random.uniform(10.0, 190.0)
+        y = random.uniform(10.0, 190.0)
+        feedrate = random.choice([600.0, 3000.0, 9000.0])
+        lines.append('G1 X{:.4f} Y{:.4f} E{:.4f} F{:.1f}'.format(x, y, e, feedrate))
+    return '\n'.join(lines) + '\n'
+
+def gen_max_speed_gcode():
+    lines = ['G21', 'G90', 'M83']
+    lines.append('G1 E50 F{:.1f}'.format(e_max_speed * 60.0))
+    return '\n'.join(lines) + '\n'
+
+def run_bench(bench, gcode):
+    fd, path = tempfile.mkstemp(suffix='.gcode')
+    try:
+        with os.fdopen(fd, 'w') as f:
+            f.write(gcode)
+        output = subprocess.check_output([bench, path]).decode()
+    finally:
+        os.remove(path)
+    return dict(line.split(' ', 1) for line in output.splitlines())
+
+def main():
+    bench = sys.argv[1] if len(sys.argv) > 1 else './motionplanner_bench'
+    
+    max_step_rate = float(run_bench(bench, gen_max_speed_gcode())['axis3_max_step_rate'])
+    print('e_max_speed {} e_max_step_rate {}'.format(e_max_speed, max_step_rate))
+    
+    seed = random.randrange(1 << 32)
+    failed = False
+    reference = None
+    for k in [0.0] + coefficients:
+        random.seed(seed)
+        res = run_bench(bench, gen_gcode(k))
+        position = int(res['axis3_position'])
+        step_rate = float(res['axis3_max_step_rate'])
+        if reference is None:
+            reference = position
+        if position != reference:
+            status = 'MISMATCH'
+        elif step_rate > max_step_rate:
+            status = 'TOO_FAST'
+        else:
+            status = 'OK'
+        failed = failed or status != 'OK'
+        print('pressure_advance {} e_position {} e_steps {} e_max_step_rate {} {}'.format(
+            k, position, res['axis3_steps'], res['axis3_max_step_rate'], status))
+    
+    if failed:
+        print('seed {}'.format(seed))
+        sys.exit(1)
+
+main()
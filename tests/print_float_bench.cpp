@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Fuzz test and benchmark for PrintFloatShortest/PrintFloatPrecision, the
+ * number formatting used by OutputStream::reply_append_fp and JsonBuilder.
+ * 
+ * Random float and double bit patterns are formatted with PrintFloatShortest
+ * and parsed back with strtof/strtod, which must give the same bits, and the
+ * number of digits must be the smallest with which "%.<n>g" round-trips.
+ * PrintFloatPrecision must give the same output as snprintf "%.<n>g" for
+ * all precisions (subnormal doubles excepted). Then values typical for
+ * M105/M114 replies and status JSON are formatted with snprintf and with
+ * PrintFloat, and the values per second of each are reported.
+ * 
+ * Build (add -DAPRINTER_PRINT_FLOAT_FULL_TABLES=1 to test the full tables):
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. print_float_bench.cpp -o print_float_bench
+ * 
+ * Usage:
+ *   ./print_float_bench [fuzz_count]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/math/PrintFloat.h>
+
+using namespace APrinter;
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_u64 ()
+{
+    static uint64_t state = 88172645463325252ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+template <typename T>
+struct TypeInfo;
+
+template <>
+struct TypeInfo<float> {
+    using Bits = uint32_t;
+    static char const * name () { return "float"; }
+    static int max_digits () { return 9; }
+    static float parse (char const *str) { return strtof(str, nullptr); }
+    static Bits random_bits () { return (uint32_t)rand_u64(); }
+    static bool is_subnormal (Bits bits) { return ((bits >> 23) & 0xFF) == 0; }
+};
+
+template <>
+struct TypeInfo<double> {
+    using Bits = uint64_t;
+    static char const * name () { return "double"; }
+    static int max_digits () { return 17; }
+    static double parse (char const *str) { return strtod(str, nullptr); }
+    static Bits random_bits () { return rand_u64(); }
+    static bool is_subnormal (Bits bits) { return ((bits >> 52) & 0x7FF) == 0; }
+};
+
+// Significant digits from the first to the last nonzero digit.
+static int count_digits (char const *str)
+{
+    int digits = 0;
+    int nonzero_end = 0;
+    for (; *str != '\0' && *str != 'e'; str++) {
+        if (*str >= '0' && *str <= '9' && (digits > 0 || *str != '0')) {
+            digits++;
+            if (*str != '0') {
+                nonzero_end = digits;
+            }
+        }
+    }
+    return nonzero_end;
+}
+
+template <typename T>
+static int reference_shortest_digits (T x)
+{
+    char buf[64];
+    for (int n = 1; n < TypeInfo<T>::max_digits(); n++) {
+        snprintf(buf, sizeof(buf), "%.*e", n - 1, (double)x);
+        T y = TypeInfo<T>::parse(buf);
+        if (memcmp(&x, &y, sizeof(T)) == 0) {
+            return n;
+        }
+    }
+    return TypeInfo<T>::max_digits();
+}
+
+template <typename T>
+static bool fuzz_shortest (int count)
+{
+    using Info = TypeInfo<T>;
+    int mismatches = 0;
+    int longer = 0;
+    char buf[PrintFloatMaxChars + 1];
+    
+    for (int i = 0; i < count; i++) {
+        typename Info::Bits bits = Info::random_bits();
+        T x;
+        memcpy(&x, &bits, sizeof(T));
+        if (FloatIsNan(x)) {
+            continue;
+        }
+        
+        int len = PrintFloatShortest<T>(x, buf);
+        AMBRO_ASSERT_FORCE(len <= PrintFloatMaxChars)
+        buf[len] = '\0';
+        
+        T y = Info::parse(buf);
+        if (memcmp(&x, &y, sizeof(T))) {
+            if (mismatches++ < 10) {
+                printf("%s round-trip mismatch: %s, expected %.*g\n", Info::name(), buf, Info::max_digits(), (double)x);
+            }
+            continue;
+        }
+        
+        // Checking the length with snprintf is slow, so only do some.
+        if (i % 8 == 0 && x != 0 && count_digits(buf) > reference_shortest_digits(x)) {
+            if (longer++ < 10) {
+                printf("%s not shortest: %s, expected %d digits\n", Info::name(), buf, reference_shortest_digits(x));
+            }
+        }
+    }
+    
+    printf("%s_shortest_mismatches %d\n", Info::name(), mismatches);
+    printf("%s_shortest_not_shortest %d\n", Info::name(), longer);
+    return mismatches == 0 && longer == 0;
+}
+
+template <typename T>
+static bool fuzz_precision (int count)
+{
+    using Info = TypeInfo<T>;
+    int mismatches = 0;
+    char buf[PrintFloatMaxChars + 1];
+    char ref[64];
+    
+    for (int i = 0; i < count; i++) {
+        typename Info::Bits bits = Info::random_bits();
+        T x;
+        memcpy(&x, &bits, sizeof(T));
+        if (FloatIsNan(x) || (sizeof(T) == 8 && Info::is_subnormal(bits))) {
+            continue;
+        }
+        int precision = 1 + i % 17;
+        
+        int len = PrintFloatPrecision<T>(x, precision, buf);
+        AMBRO_ASSERT_FORCE(len <= PrintFloatMaxChars)
+        buf[len] = '\0';
+        
+        snprintf(ref, sizeof(ref), "%.*g", precision, (double)x);
+        if (strcmp(buf, ref)) {
+            if (mismatches++ < 10) {
+                printf("%s precision %d mismatch: %s, expected %s\n", Info::name(), precision, buf, ref);
+            }
+        }
+    }
+    
+    printf("%s_precision_mismatches %d\n", Info::name(), mismatches);
+    return mismatches == 0;
+}
+
+static bool check_cases ()
+{
+    struct Case {
+        float value;
+        char const *expected;
+    };
+    static Case const cases[] = {
+        {0.0f, "0"}, {-0.0f, "-0"}, {1.0f, "1"}, {0.1f, "0.1"}, {-12.5f, "-12.5"},
+        {100000.0f, "100000"}, {1e6f, "1e+06"}, {1234567.0f, "1234567"}, {0.0001f, "0.0001"},
+        {0.00001f, "1e-05"}, {210.3f, "210.3"}, {3.4028235e38f, "3.4028235e+38"},
+        {1e-45f, "1e-45"}, {INFINITY, "inf"}, {-INFINITY, "-inf"},
+    };
+    
+    bool ok = true;
+    char buf[PrintFloatMaxChars + 1];
+    for (Case const &c : cases) {
+        int len = PrintFloatShortest<float>(c.value, buf);
+        buf[len] = '\0';
+        if (strcmp(buf, c.expected)) {
+            printf("case mismatch: %s, expected %s\n", buf, c.expected);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+template <typename T, typename Func>
+static void bench (char const *name, T const *values, int count, int passes, Func func)
+{
+    char buf[64];
+    uint64_t best_ns = UINT64_MAX;
+    size_t total_len = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        total_len = 0;
+        uint64_t start_ns = get_ns();
+        for (int i = 0; i < count; i++) {
+            total_len += func(values[i], buf);
+        }
+        uint64_t ns = get_ns() - start_ns;
+        best_ns = (ns < best_ns) ? ns : best_ns;
+    }
+    
+    printf("%s_chars %zu\n", name, total_len);
+    printf("%s_values_per_s %.0f\n", name, count / (best_ns * 1e-9));
+    printf("%s_ns_per_value %.1f\n", name, (double)best_ns / count);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [fuzz_count]\n", argv[0]);
+        return 1;
+    }
+    int fuzz_count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    
+    bool ok = check_cases();
+    ok = fuzz_shortest<float>(fuzz_count) && ok;
+    ok = fuzz_shortest<double>(fuzz_count) && ok;
+    ok = fuzz_precision<float>(fuzz_count) && ok;
+    ok = fuzz_precision<double>(fuzz_count) && ok;
+    if (!ok) {
+        return 1;
+    }
+    
+    // Positions with up to 3 decimals, temperatures and the like.
+    static int const NumValues = 100000;
+    static int const Passes = 10;
+    float *floats = (float *)malloc(NumValues * sizeof(float));
+    double *doubles = (double *)malloc(NumValues * sizeof(double));
+    AMBRO_ASSERT_FORCE(floats && doubles)
+    for (int i = 0; i < NumValues; i++) {
+        floats[i] = (int)(rand_u64() % 600000 - 300000) / ((i % 2) ? 1000.0f : 10.0f);
+        doubles[i] = floats[i];
+    }
+    
+    bench("snprintf_g", floats, NumValues, Passes, [](float x, char *buf) {
+        return snprintf(buf, 64, "%g", (double)x);
+    });
+    bench("shortest", floats, NumValues, Passes, [](float x, char *buf) {
+        return PrintFloatShortest<float>(x, buf);
+    });
+    bench("snprintf_6g", doubles, NumValues, Passes, [](double x, char *buf) {
+        return snprintf(buf, 64, "%.6g", x);
+    });
+    bench("precision_6", doubles, NumValues, Passes, [](double x, char *buf) {
+        return PrintFloatPrecision<double>(x, 6, buf);
+    });
+    bench("snprintf_17g", doubles, NumValues, Passes, [](double x, char *buf) {
+        return snprintf(buf, 64, "%.17g", x);
+    });
+    bench("shortest_double", doubles, NumValues, Passes, [](double x, char *buf) {
+        return PrintFloatShortest<double>(x, buf);
+    });
+    
+    free(doubles);
+    free(floats);
+    return 0;
+}
@@ -0,0 +1,185 @@
+# Copyright (c) 2017 Ambroz Bizjak
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Generates aprinter/math/PrintFloatTables.h, the power-of-5 tables used by
+# PrintFloat.h.
+#
+# The full double tables hold 5^i and 2^k/5^i truncated to 125 bits (the
+# latter plus one) for every exponent. The small tables hold only every 26th
+# entry (the inverses without the plus one); the others are computed at
+# runtime by multiplying with 5^j (j < 26), and a 2-bit correction per entry
+# (computed here) makes the result bitwise equal to the full table entry.
+#
+# Usage:
+#   python print_float_gen_tables.py > ../aprinter/math/PrintFloatTables.h
+
+from __future__ import print_function
+import sys
+
+FLOAT_POW5_INV_BITCOUNT = 59
+FLOAT_POW5_BITCOUNT = 61
+FLOAT_POW5_INV_TABLE_SIZE = 31
+FLOAT_POW5_TABLE_SIZE = 47
+
+DOUBLE_POW5_INV_BITCOUNT = 125
+DOUBLE_POW5_BITCOUNT = 125
+DOUBLE_POW5_INV_TABLE_SIZE = 342
+DOUBLE_POW5_TABLE_SIZE = 326
+
+SMALL_STEP = 26
+
+MASK64 = (1 << 64) - 1
+
+def pow5bits(e):
+    res = ((e * 1217359) >> 19) + 1
+    assert res == (5**e).bit_length()
+    return res
+
+def pow5_split(i, bitcount):
+    pow5 = 5**i
+    shift = pow5.bit_length() - bitcount
+    return (pow5 >> shift) if shift >= 0 else (pow5 << -shift)
+
+def pow5_inv_split(i, bitcount):
+    pow5 = 5**i
+    j = pow5.bit_length() - 1 + bitcount
+    return (1 << j) // pow5 + 1
+
+def split128(x):
+    assert 0 <= x < (1 << 128)
+    return (x & MASK64, x >> 64)
+
+# Mirrors PrintFloatPrivate::compute_pow5_small, without the correction.
+def small_compute(mul, m, delta):
+    mul_lo, mul_hi = split128(mul)
+    low1 = (m * mul_hi) & MASK64
+    high1 = (m * mul_hi) >> 64
+    low0 = (m * mul_lo) & MASK64
+    high0 = (m * mul_lo) >> 64
+    s = high0 + low1
+    if s > MASK64:
+        s &= MASK64
+        high1 += 1
+    lo = ((s << (64 - delta)) | (low0 >> delta)) & MASK64
+    hi = ((high1 << (64 - delta)) | (s >> delta)) & MASK64
+    assert (high1 >> delta) == 0
+    return (lo, hi)
+
+def small_offsets(full, bases, base_of, extra):
+    offsets = []
+    for i in range(len(full)):
+        base = base_of(i)
+        base2 = base * SMALL_STEP
+        if base2 == i:
+            assert bases[base] + extra == full[i]
+            offsets.append(0)
+            continue
+        m = 5**abs(base2 - i)
+        delta = abs(pow5bits(i) - pow5bits(base2))
+        lo, hi = small_compute(bases[base], m, delta)
+        want_lo, want_hi = split128(full[i])
+        assert want_hi == hi
+        corr = want_lo - lo - extra
+        assert 0 <= corr <= 3
+        offsets.append(corr)
+    packed = []
+    for k in range(0, len(offsets), 16):
+        word = 0
+        for n, c in enumerate(offsets[k:k+16]):
+            word |= c << (2 * n)
+        packed.append(word)
+    return packed
+
+def print_u64_table(name, values):
+    print('    static uint64_t const {}[{}] = {{'.format(name, len(values)))
+    for k in range(0, len(values), 3):
+        print('        ' + ' '.join('UINT64_C(0x{:016x}),'.format(v) for v in values[k:k+3]))
+    print('    };')
+
+def print_u128_table(name, values):
+    print('    static uint64_t const {}[{}][2] = {{'.format(name, len(values)))
+    for v in values:
+        lo, hi = split128(v)
+        print('        {{UINT64_C(0x{:016x}), UINT64_C(0x{:016x})}},'.format(lo, hi))
+    print('    };')
+
+def print_u32_table(name, values):
+    print('    static uint32_t const {}[{}] = {{'.format(name, len(values)))
+    for k in range(0, len(values), 4):
+        print('        ' + ' '.join('UINT32_C(0x{:08x}),'.format(v) for v in values[k:k+4]))
+    print('    };')
+
+def main():
+    float_inv = [pow5_inv_split(i, FLOAT_POW5_INV_BITCOUNT) for i in range(FLOAT_POW5_INV_TABLE_SIZE)]
+    float_pow = [pow5_split(i, FLOAT_POW5_BITCOUNT) for i in range(FLOAT_POW5_TABLE_SIZE)]
+    double_inv = [pow5_inv_split(i, DOUBLE_POW5_INV_BITCOUNT) for i in range(DOUBLE_POW5_INV_TABLE_SIZE)]
+    double_pow = [pow5_split(i, DOUBLE_POW5_BITCOUNT) for i in range(DOUBLE_POW5_TABLE_SIZE)]
+
+    num_inv_bases = (DOUBLE_POW5_INV_TABLE_SIZE - 1 + SMALL_STEP - 1) // SMALL_STEP + 1
+    num_pow_bases = (DOUBLE_POW5_TABLE_SIZE - 1) // SMALL_STEP + 1
+    inv_bases = [pow5_inv_split(k * SMALL_STEP, DOUBLE_POW5_INV_BITCOUNT) - 1 for k in range(num_inv_bases)]
+    pow_bases = [pow5_split(k * SMALL_STEP, DOUBLE_POW5_BITCOUNT) for k in range(num_pow_bases)]
+    inv_offsets = small_offsets(double_inv, inv_bases, lambda i: (i + SMALL_STEP - 1) // SMALL_STEP, 1)
+    pow_offsets = small_offsets(double_pow, pow_bases, lambda i: i // SMALL_STEP, 0)
+
+    print('/* Generated by tests/print_float_gen_tables.py, do not edit. */')
+    print('')
+    print('#ifndef AMBROLIB_PRINT_FLOAT_TABLES_H')
+    print('#define AMBROLIB_PRINT_FLOAT_TABLES_H')
+    print('')
+    print('#include <stdint.h>')
+    print('')
+    print('namespace APrinter {')
+    print('')
+    print('namespace PrintFloatTables {')
+    print('    static int const FloatPow5InvBitcount = {};'.format(FLOAT_POW5_INV_BITCOUNT))
+    print('    static int const FloatPow5Bitcount = {};'.format(FLOAT_POW5_BITCOUNT))
+    print('    static int const DoublePow5InvBitcount = {};'.format(DOUBLE_POW5_INV_BITCOUNT))
+    print('    static int const DoublePow5Bitcount = {};'.format(DOUBLE_POW5_BITCOUNT))
+    print('    static int const DoubleSmallStep = {};'.format(SMALL_STEP))
+    print('    ')
+    print_u64_table('FloatPow5InvSplit', float_inv)
+    print('    ')
+    print_u64_table('FloatPow5Split', float_pow)
+    print('    ')
+    print('#if APRINTER_PRINT_FLOAT_FULL_TABLES')
+    print_u128_table('DoublePow5InvSplit', double_inv)
+    print('    ')
+    print_u128_table('DoublePow5Split', double_pow)
+    print('#else')
+    print_u128_table('DoublePow5InvSplitSmall', inv_bases)
+    print('    ')
+    print_u32_table('DoublePow5InvOffsets', inv_offsets)
+    print('    ')
+    print_u128_table('DoublePow5SplitSmall', pow_bases)
+    print('    ')
+    print_u32_table('DoublePow5Offsets', pow_offsets)
+    print('    ')
+    print_u64_table('DoublePow5Small', [5**j for j in range(SMALL_STEP)])
+    print('#endif')
+    print('}')
+    print('')
+    print('}')
+    print('')
+    print('#endif')
+
+main()
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares trapezoidal and S-curve (jerk-limited) velocity profiles on the
+ * paths used by linearplanner_test. Each path is planned with LinearPlanner,
+ * and the acceleration of each segment is executed as:
+ * - trapezoidal: constant acceleration phases, as without a jerk limit;
+ * - scurve: the same phases as S-curves (SCurve with the piece count used
+ *   by MotionPlanner), taking the same time but with a higher peak
+ *   acceleration;
+ * - scurve_half: S-curves planned at half the acceleration, as MotionPlanner
+ *   does with a jerk limit, which keeps the peak within the limit;
+ * - scurve_peak: S-curves with the planning acceleration of the path
+ *   lowered just enough that the peak acceleration stays within the limits.
+ * 
+ * Reported are the total time over all paths, the largest peak acceleration
+ * relative to the limit of the segment, the peak jerk, both the largest
+ * and the mean over paths, and the number of phases too short to keep
+ * within the jerk limit (jerk_misses). Jerk is measured on the acceleration averaged
+ * over a window, as an accelerometer would see it; otherwise it would be
+ * infinite at any step of acceleration. Phases too short to ramp the
+ * acceleration at the jerk limit dominate the largest peak.
+ * 
+ * Build:
+ *   python linearplanner_gen_paths.py > linearplanner_paths.cpp
+ *   g++ -std=c++14 -O2 -I.. scurve_compare.cpp -o scurve_compare
+ * 
+ * Usage:
+ *   ./scurve_compare [max_jerk [jerk_window]]
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/planning/LinearPlanner.h>
+#include <aprinter/printer/planning/SCurve.h>
+
+using namespace APrinter;
+
+using FpType = double;
+
+struct Segment {
+    FpType distance;
+    FpType max_speed_squared;
+    FpType two_max_accel;
+};
+
+struct Path {
+    Segment const *segs;
+    size_t num_segs;
+};
+
+#include "linearplanner_paths.cpp"
+
+using TheLinearPlanner = LinearPlanner<FpType>;
+using TheSCurve = SCurve<FpType, 2>;
+
+enum {PROFILE_TRAPEZOIDAL, PROFILE_SCURVE, PROFILE_SCURVE_HALF, PROFILE_SCURVE_PEAK, NUM_PROFILES};
+static char const * const profile_names[] = {"trapezoidal", "scurve", "scurve_half", "scurve_peak"};
+
+static FpType max_jerk = 1000.0;
+static FpType jerk_window = 0.01;
+
+TheLinearPlanner::SegmentData lp_sd[max_path_len];
+TheLinearPlanner::SegmentState lp_ss[max_path_len];
+
+// Acceleration as a function of time, constant between breakpoints.
+struct AccelPiece {
+    FpType end_time;
+    FpType accel;
+};
+
+struct Result {
+    FpType time;
+    FpType peak_accel_ratio;
+    FpType peak_jerk;
+    FpType peak_jerk_sum;
+    size_t jerk_misses;
+};
+
+static void add_phase (std::vector<AccelPiece> *pieces, FpType *time, FpType t, FpType accel, bool scurve, FpType accel_limit, Result *res)
+{
+    if (!(t > 0.0)) {
+        return;
+    }
+    if (!scurve || accel == 0.0) {
+        *time += t;
+        pieces->push_back(AccelPiece{*time, accel});
+        res->peak_accel_ratio = fmax(res->peak_accel_ratio, fabs(accel) / accel_limit);
+        return;
+    }
+    if (!TheSCurve::jerk_limit_possible(t, fabs(accel) * t, 1.0 / max_jerk)) {
+        res->jerk_misses++;
+    }
+    FpType ramp = TheSCurve::ramp_time(t, fabs(accel) * t, 1.0 / max_jerk);
+    for (int k = 0; k < TheSCurve::NumPieces; k++) {
+        FpType piece_accel = TheSCurve::piece_accel(k, t, ramp, accel);
+        pieces->push_back(AccelPiece{*time + TheSCurve::piece_end(k, t, ramp), piece_accel});
+        res->peak_accel_ratio = fmax(res->peak_accel_ratio, fabs(piece_accel) / accel_limit);
+    }
+    *time += t;
+}
+
+static FpType accel_at (std::vector<AccelPiece> const &pieces, FpType t)
+{
+    auto it = std::upper_bound(pieces.begin(), pieces.end(), t, [](FpType t, AccelPiece const &p) { return t < p.end_time; });
+    return (it == pieces.end()) ? 0.0 : it->accel;
+}
+
+static FpType peak_jerk (std::vector<AccelPiece> const &pieces)
+{
+    // The averaged acceleration changes by a(t + w) - a(t) over the window
+    // starting at t, which only changes where t or t + w is a breakpoint.
+    FpType const eps = 1e-9;
+    FpType peak = 0.0;
+    FpType prev_end = 0.0;
+    for (AccelPiece const &p : pieces) {
+        FpType points[] = {prev_end, p.end_time - jerk_window};
+        for (FpType b : points) {
+            for (FpType t : {b - eps, b + eps}) {
+                peak = fmax(peak, fabs(accel_at(pieces, t + jerk_window) - accel_at(pieces, t)) / jerk_window);
+            }
+        }
+        prev_end = p.end_time;
+    }
+    return peak;
+}
+
+static Result run_path (Path path, bool scurve, FpType accel_factor)
+{
+    FpType prev_max_v = 0.0;
+    for (size_t i = 0; i < path.num_segs; i++) {
+        Segment const *seg = &path.segs[i];
+        FpType max_v = seg->max_speed_squared;
+        FpType a_x = accel_factor * seg->two_max_accel * seg->distance;
+        TheLinearPlanner::initSegment(&lp_sd[i], prev_max_v, INFINITY, max_v, a_x);
+        prev_max_v = max_v;
+    }
+    
+    FpType v = 0.0;
+    for (size_t j = path.num_segs; j > 0; j--) {
+        v = TheLinearPlanner::push(&lp_sd[j - 1], &lp_ss[j - 1], v);
+    }
+    
+    std::vector<AccelPiece> pieces;
+    Result res = Result{0.0, 0.0, 0.0, 0.0, 0};
+    v = 0.0;
+    
+    for (size_t i = 0; i < path.num_segs; i++) {
+        Segment const *seg = &path.segs[i];
+        FpType accel_limit = 0.5 * seg->two_max_accel;
+        FpType accel = accel_factor * accel_limit;
+        FpType v_start = sqrt(v);
+        TheLinearPlanner::SegmentResult result;
+        v = TheLinearPlanner::pull(&lp_sd[i], &lp_ss[i], v, &result);
+        FpType v_end = sqrt(v);
+        FpType v_const = sqrt(result.const_v);
+        
+        FpType const_dist = (1.0 - result.const_start - result.const_end) * seg->distance;
+        add_phase(&pieces, &res.time, (v_const - v_start) / accel, accel, scurve, accel_limit, &res);
+        add_phase(&pieces, &res.time, (v_const > 0.0 && const_dist > 0.0) ? const_dist / v_const : 0.0, 0.0, scurve, accel_limit, &res);
+        add_phase(&pieces, &res.time, (v_const - v_end) / accel, -accel, scurve, accel_limit, &res);
+    }
+    
+    res.peak_jerk = peak_jerk(pieces);
+    return res;
+}
+
+static Result run_path_peak_limited (Path path)
+{
+    // The peak acceleration is at most twice the planning acceleration.
+    // Lower the planning acceleration until the peak is within the limit.
+    FpType accel_factor = 1.0;
+    for (int iter = 0; iter < 20; iter++) {
+        Result res = run_path(path, true, accel_factor);
+        if (res.peak_accel_ratio <= 1.0 + 1e-9) {
+            return res;
+        }
+        accel_factor /= res.peak_accel_ratio;
+    }
+    return run_path(path, true, 0.5);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc > 1) {
+        max_jerk = atof(argv[1]);
+    }
+    if (argc > 2) {
+        jerk_window = atof(argv[2]);
+    }
+    if (!(max_jerk > 0.0) || !(jerk_window > 0.0)) {
+        fprintf(stderr, "Bad parameters\n");
+        return 1;
+    }
+    
+    Result totals[NUM_PROFILES] = {};
+    
+    for (size_t i = 0; i < num_paths; i++) {
+        Result path_res[NUM_PROFILES];
+        path_res[PROFILE_TRAPEZOIDAL] = run_path(paths[i], false, 1.0);
+        path_res[PROFILE_SCURVE] = run_path(paths[i], true, 1.0);
+        path_res[PROFILE_SCURVE_HALF] = run_path(paths[i], true, 0.5);
+        path_res[PROFILE_SCURVE_PEAK] = run_path_peak_limited(paths[i]);
+        
+        // The S-curve takes the same time as the trapezoid it replaces.
+        AMBRO_ASSERT_FORCE(fabs(path_res[PROFILE_SCURVE].time - path_res[PROFILE_TRAPEZOIDAL].time) <= 1e-6 * path_res[PROFILE_TRAPEZOIDAL].time)
+        
+        for (int p = 0; p < NUM_PROFILES; p++) {
+            totals[p].time += path_res[p].time;
+            totals[p].peak_accel_ratio = fmax(totals[p].peak_accel_ratio, path_res[p].peak_accel_ratio);
+            totals[p].peak_jerk = fmax(totals[p].peak_jerk, path_res[p].peak_jerk);
+            totals[p].peak_jerk_sum += path_res[p].peak_jerk;
+            totals[p].jerk_misses += path_res[p].jerk_misses;
+        }
+    }
+    
+    printf("paths %zu max_jerk %g jerk_window %g\n", num_paths, max_jerk, jerk_window);
+    printf("%-12s %14s %16s %14s %14s %12s\n", "profile", "total_time", "peak_accel_ratio", "peak_jerk", "mean_peak_jerk", "jerk_misses");
+    for (int p = 0; p < NUM_PROFILES; p++) {
+        printf("%-12s %14.4f %16.4f %14.1f %14.1f %12zu\n", profile_names[p], totals[p].time, totals[p].peak_accel_ratio, totals[p].peak_jerk, totals[p].peak_jerk_sum / num_paths, totals[p].jerk_misses);
+    }
+}
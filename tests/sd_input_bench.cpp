@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark of reading G-code from the SD card, as done by SdCardModule,
+ * on the Linux platform.
+ * 
+ * The G-code file (or generated slicer-like moves) is written to sdcard.bin
+ * in the current directory, terminated with the "E" line and padded to
+ * whole blocks. It is then read with SdRawInput on top of LinuxSdCard into
+ * an InputBuffer and parsed in place by the file G-code parser, with the
+ * same steps as SdCardModule: a command is parsed as soon as it is in the
+ * buffer, and a read is started as soon as there is space for it. This is
+ * done once with reads of one block (like before multi-block reads), and
+ * once with LinuxSdCard allowing multi-block reads, which gives reads of
+ * half the buffer. The number of commands per second and the average number
+ * of blocks per read are reported for both.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DNDEBUG -I.. sd_input_bench.cpp ../aprinter/platform/linux/linux_support.cpp -o sd_input_bench -lpthread
+ * Build with -DAMBROLIB_ASSERTIONS instead of -DNDEBUG to check the parser and
+ * buffer invariants.
+ * 
+ * Usage:
+ *   ./sd_input_bench [file.gcode]
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include <aprinter/platform/linux/linux_support.h>
+
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/MemberType.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/structure/LinkedHeap.h>
+#include <aprinter/system/LinuxEventLoop.h>
+#include <aprinter/hal/linux/LinuxClock.h>
+#include <aprinter/hal/linux/LinuxSdCard.h>
+#include <aprinter/printer/input/InputCommon.h>
+#include <aprinter/printer/input/InputBuffer.h>
+#include <aprinter/printer/input/SdRawInput.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+
+using namespace APrinter;
+
+static size_t const BlockSize = 512;
+static size_t const BufferBaseSize = 8192;
+static size_t const MaxCommandSize = 128;
+static size_t const MultiIoBlocks = 64;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+using MyClockService = LinuxClockService<16, 4>;
+APRINTER_MAKE_INSTANCE(MyClock, (MyClockService::Clock<Context, Program, EmptyTypeList>))
+
+struct MyLoopExtraDelay;
+APRINTER_MAKE_INSTANCE(MyLoop, (LinuxEventLoopArg<Context, Program, MyLoopExtraDelay, LinkedHeapService>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = MyClock;
+    using EventLoop = MyLoop;
+    
+    void check () const {}
+};
+
+static uint64_t get_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Just enough of PrinterMain for SdRawInput to handle M21.
+template <typename MountedHandler>
+struct BenchPrinterMain {
+    class TheCommand {
+    public:
+        int getCmdNumber (Context c) { return 21; }
+        bool tryLockedCommand (Context c) { return true; }
+        void reportError (Context c, char const *err) { fprintf(stderr, "%s\n", err); abort(); }
+        void reply_append_pstr (Context c, char const *str) { fputs(str, stderr); }
+        void reply_append_uint32 (Context c, uint32_t x) { fprintf(stderr, "%" PRIu32, x); }
+        void reply_append_ch (Context c, char ch) { fputc(ch, stderr); }
+        void finishCommand (Context c) { MountedHandler::call(c); }
+    };
+    
+    static TheCommand * get_locked (Context c)
+    {
+        static TheCommand cmd;
+        return &cmd;
+    }
+};
+
+using TheGcodeParser = FileGcodeParserService<16, true>::Parser<Context, size_t, float>;
+
+static uint32_t hash_command (Context c, TheGcodeParser *parser, uint32_t hash)
+{
+    for (int i = 0; i < parser->getNumParts(c); i++) {
+        auto part = parser->getPart(c, i);
+        float value = parser->getPartFpValue(c, part);
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        hash = (hash * 31) ^ (uint8_t)parser->getPartCode(c, part) ^ bits;
+    }
+    return hash;
+}
+
+template <size_t MaxIoBlocks, typename DoneHandler, typename ParentObject>
+class Bench {
+public:
+    struct Object;
+    
+private:
+    struct MountedHandler;
+    struct InputReadHandler;
+    struct InputClearBufferHandler;
+    struct InputStartHandler;
+    using ThePrinterMain = BenchPrinterMain<MountedHandler>;
+    using TheSdCardService = LinuxSdCardService<BlockSize, MaxIoBlocks, 1>;
+    APRINTER_MAKE_INSTANCE(TheInput, (SdRawInputService<TheSdCardService>::Input<Context, Object, InputClientParams<ThePrinterMain, InputReadHandler, InputClearBufferHandler, InputStartHandler>>))
+    using TheInputBuffer = InputBuffer<typename TheInput::DataWordType, TheInput::ReadBlockSize, BufferBaseSize, MaxCommandSize, TheInput::MaxReadBlocks>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        TheInput::init(c);
+        o->next_event.init(c, APRINTER_CB_STATFUNC_T(&Bench::next_event_handler));
+    }
+    
+    static void start (Context c)
+    {
+        typename ThePrinterMain::TheCommand cmd;
+        TheInput::checkCommand(c, &cmd);
+    }
+    
+    static uint32_t get_hash (Context c)
+    {
+        return Object::self(c)->hash;
+    }
+    
+    static void print_results (Context c, char const *name)
+    {
+        auto *o = Object::self(c);
+        
+        printf("%s_read_blocks %zu\n", name, TheInput::MaxReadBlocks);
+        printf("%s_commands %zu\n", name, o->num_commands);
+        printf("%s_commands_per_s %.0f\n", name, o->num_commands / ((o->end_ns - o->start_ns) * 1e-9));
+        printf("%s_blocks_per_read %.2f\n", name, (double)o->num_blocks / o->num_reads);
+    }
+    
+private:
+    static void mounted_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        typename ThePrinterMain::TheCommand cmd;
+        AMBRO_ASSERT_FORCE(TheInput::startingIo(c, &cmd))
+        
+        o->input_buffer.init();
+        o->parser.init(c);
+        o->reading = false;
+        o->num_commands = 0;
+        o->num_reads = 0;
+        o->num_blocks = 0;
+        o->hash = 0;
+        o->start_ns = get_ns();
+        
+        start_read(c);
+    }
+    struct MountedHandler : public AMBRO_WFUNC_TD(&Bench::mounted_handler) {};
+    
+    static void start_read (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->reading)
+        
+        size_t num_blocks;
+        auto *buf = o->input_buffer.startRead(&num_blocks);
+        o->read_blocks = num_blocks;
+        o->reading = true;
+        TheInput::startRead(c, buf, num_blocks);
+    }
+    
+    static bool can_read (Context c)
+    {
+        auto *o = Object::self(c);
+        return !o->reading && o->input_buffer.haveSpaceForRead() && TheInput::canRead(c);
+    }
+    
+    static void input_read_handler (Context c, bool error, size_t bytes_read)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT_FORCE(!error)
+        
+        o->reading = false;
+        o->input_buffer.readFinished(o->read_blocks, bytes_read);
+        o->num_reads++;
+        o->num_blocks += bytes_read / BlockSize;
+        
+        if (can_read(c)) {
+            start_read(c);
+        }
+        o->next_event.appendNow(c);
+    }
+    struct InputReadHandler : public AMBRO_WFUNC_TD(&Bench::input_read_handler) {};
+    
+    static void input_clear_buffer_handler (Context c)
+    {
+    }
+    struct InputClearBufferHandler : public AMBRO_WFUNC_TD(&Bench::input_clear_buffer_handler) {};
+    
+    static void input_start_handler (Context c)
+    {
+    }
+    struct InputStartHandler : public AMBRO_WFUNC_TD(&Bench::input_start_handler) {};
+    
+    static void next_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        size_t avail;
+        char *cmd_data = o->input_buffer.getCommand(&avail);
+        if (!o->parser.haveCommand(c)) {
+            o->parser.startCommand(c, cmd_data, 0);
+        }
+        
+        bool line_buffer_exhausted = (avail == MaxCommandSize);
+        if (!o->parser.extendCommand(c, avail, line_buffer_exhausted)) {
+            AMBRO_ASSERT_FORCE_MSG(!line_buffer_exhausted, "line too long")
+            AMBRO_ASSERT_FORCE_MSG(o->reading, "no E line at the end")
+            return;
+        }
+        
+        if (o->parser.getNumParts(c) == GCODE_ERROR_EOF) {
+            // The E line is in the last block, so all reads are done.
+            AMBRO_ASSERT_FORCE(!o->reading)
+            o->end_ns = get_ns();
+            TheInput::pausingIo(c);
+            return DoneHandler::call(c);
+        }
+        
+        o->num_commands++;
+        o->hash = hash_command(c, &o->parser, o->hash);
+        o->input_buffer.consume(o->parser.getLength(c));
+        
+        if (can_read(c)) {
+            start_read(c);
+        }
+        o->next_event.prependNowNotAlready(c);
+    }
+    
+public:
+    struct Object : public ObjBase<Bench, ParentObject, MakeTypeList<
+        TheInput
+    >> {
+        typename Context::EventLoop::QueuedEvent next_event;
+        TheInputBuffer input_buffer;
+        TheGcodeParser parser;
+        bool reading;
+        size_t read_blocks;
+        size_t num_commands;
+        size_t num_reads;
+        size_t num_blocks;
+        uint32_t hash;
+        uint64_t start_ns;
+        uint64_t end_ns;
+    };
+};
+
+static uint32_t reference_hash;
+
+struct SingleDoneHandler;
+struct MultiDoneHandler;
+
+using SingleBench = Bench<1, SingleDoneHandler, Program>;
+using MultiBench = Bench<MultiIoBlocks, MultiDoneHandler, Program>;
+
+APRINTER_DEFINE_MEMBER_TYPE(MemberType_EventLoopFastEvents, EventLoopFastEvents)
+APRINTER_MAKE_INSTANCE(MyLoopExtra, (LinuxEventLoopExtraArg<Program, MyLoop, ObjCollect<MakeTypeList<SingleBench, MultiBench>, MemberType_EventLoopFastEvents>>))
+struct MyLoopExtraDelay : public WrapType<MyLoopExtra> {};
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    MyLoop,
+    MyLoopExtra,
+    SingleBench,
+    MultiBench
+>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+struct SingleDoneHandler {
+    static void call (Context c)
+    {
+        MultiBench::start(c);
+    }
+};
+
+struct MultiDoneHandler {
+    static void call (Context c)
+    {
+        SingleBench::print_results(c, "single");
+        MultiBench::print_results(c, "multi");
+        
+        // The parsed commands must be the same as from contiguous data.
+        bool same = SingleBench::get_hash(c) == reference_hash && MultiBench::get_hash(c) == reference_hash;
+        printf("same_commands %d\n", (int)same);
+        exit(same ? 0 : 1);
+    }
+};
+
+static uint64_t rand_u64 ()
+{
+    static uint64_t state = 88172645463325252ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static std::string generate_moves (int num_lines)
+{
+    std::string out;
+    char line[96];
+    double e = 0.0;
+    for (int i = 0; i < num_lines; i++) {
+        e += (rand_u64() % 1000) / 20000.0;
+        double x = (rand_u64() % 200000) / 1000.0;
+        double y = (rand_u64() % 200000) / 1000.0;
+        snprintf(line, sizeof(line), "G1 X%.3f Y%.3f E%.5f\n", x, y, e);
+        out += line;
+    }
+    return out;
+}
+
+static bool read_file (char const *path, std::string *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out->append(buf, len);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static uint32_t parse_contiguous (Context c, std::string const &data)
+{
+    TheGcodeParser parser;
+    parser.init(c);
+    
+    uint32_t hash = 0;
+    size_t pos = 0;
+    while (true) {
+        size_t avail = MinValue(MaxCommandSize, data.size() - pos);
+        parser.startCommand(c, (char *)data.data() + pos, 0);
+        AMBRO_ASSERT_FORCE(parser.extendCommand(c, avail, avail == MaxCommandSize))
+        if (parser.getNumParts(c) == GCODE_ERROR_EOF) {
+            break;
+        }
+        hash = hash_command(c, &parser, hash);
+        pos += parser.getLength(c);
+    }
+    return hash;
+}
+
+static bool write_sdcard (std::string *data)
+{
+    if (!data->empty() && data->back() != '\n') {
+        *data += '\n';
+    }
+    *data += "E\n";
+    data->resize((data->size() + BlockSize - 1) / BlockSize * BlockSize, '\n');
+    
+    FILE *f = fopen("sdcard.bin", "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(data->data(), 1, data->size(), f) == data->size();
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [file.gcode]\n", argv[0]);
+        return 1;
+    }
+    
+    std::string data;
+    if (argc > 1) {
+        if (!read_file(argv[1], &data)) {
+            fprintf(stderr, "Failed to read %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        data = generate_moves(1000000);
+    }
+    if (!write_sdcard(&data)) {
+        fprintf(stderr, "Failed to write sdcard.bin\n");
+        return 1;
+    }
+    
+    platform_init(1, argv);
+    
+    Context c;
+    reference_hash = parse_contiguous(c, data);
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    MyClock::init(c);
+    MyLoop::init(c);
+    SingleBench::init(c);
+    MultiBench::init(c);
+    
+    SingleBench::start(c);
+    
+    MyLoop::run(c);
+}
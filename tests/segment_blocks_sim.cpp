@@ -0,0 +1,640 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host-side simulation of printing from the SD card, for checking the segment
+ * blocks (M950) written by aprinter_preplan.py.
+ * 
+ * Runs a complete PrinterMain with SdCardModule (segment blocks enabled, raw
+ * SD input) on the simulated clock and event loop used by motionplanner_bench.
+ * The file is put on an in-memory SD card, terminated with the "E" line and
+ * padded to whole blocks, and printed with M21 and M24. A plain G-code file
+ * goes through the transform and the splitter on the device, while segment
+ * blocks go directly to the planner, so printing a file and its pre-planned
+ * version must give the same motion.
+ * 
+ * Printed are the step positions of all steppers, sampled every millisecond
+ * of virtual time ("sample <time_s> <pos>..."), the replies (prefixed with
+ * "reply "), the number of planner segments and the final step positions.
+ * tests/preplan_test.py compares these.
+ * 
+ * Build:
+ *   g++ -std=c++14 -O2 -DMOTIONPLANNER_BENCHMARK -I.. segment_blocks_sim.cpp -o segment_blocks_sim
+ * Add -DAMBROLIB_ASSERTIONS to check parser and planner invariants while running.
+ * With -DSIM_DELTA=1 (build segment_blocks_sim_delta for preplan_test.py), the first
+ * three axes are the carriages A/B/C of a delta with a DistanceSplitter, and X/Y/Z
+ * are virtual (as with -DBENCH_DELTA=1 in motionplanner_bench).
+ * 
+ * Usage:
+ *   ./segment_blocks_sim file.gcode
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include <aprinter/platform/sim/sim_support.h>
+
+#ifndef MOTIONPLANNER_BENCHMARK
+#error "MOTIONPLANNER_BENCHMARK must be defined"
+#endif
+
+#ifndef SIM_DELTA
+#define SIM_DELTA 0
+#endif
+
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/MemberType.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/PlacementNew.h>
+#include <aprinter/base/ProgramMemory.h>
+#include <aprinter/base/TransferVector.h>
+#include <aprinter/hal/generic/NullWatchdog.h>
+#include <aprinter/hal/generic/StubPins.h>
+#include <aprinter/hal/sim/SimClock.h>
+#include <aprinter/hal/sim/SimPins.h>
+#include <aprinter/system/SimEventLoop.h>
+#include <aprinter/printer/PrinterMain.h>
+#include <aprinter/printer/actuators/AxisDriver.h>
+#include <aprinter/printer/config_manager/RuntimeConfigManager.h>
+#include <aprinter/printer/transform/DeltaTransform.h>
+#include <aprinter/printer/transform/DistanceSplitter.h>
+#include <aprinter/printer/input/SdRawInput.h>
+#include <aprinter/printer/modules/SdCardModule.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+#include <aprinter/printer/utils/GcodeCommand.h>
+#include <aprinter/printer/utils/ModuleUtils.h>
+
+using namespace APrinter;
+
+static int const NumSimSteppers = 4;
+static size_t const SdBlockSize = 512;
+
+static std::string sim_sdcard_data;
+static std::string sim_replies;
+
+/*
+ * SD card on top of sim_sdcard_data. Commands complete in a queued event.
+ */
+
+template <typename Arg>
+class SimSdCard {
+    using Context        = typename Arg::Context;
+    using ParentObject   = typename Arg::ParentObject;
+    using InitHandler    = typename Arg::InitHandler;
+    using CommandHandler = typename Arg::CommandHandler;
+    using Params         = typename Arg::Params;
+    
+public:
+    struct Object;
+    using BlockIndexType = uint32_t;
+    static size_t const BlockSize = SdBlockSize;
+    using DataWordType = uint32_t;
+    static size_t const MaxIoBlocks = Params::MaxIoBlocks;
+    
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        o->event.init(c, APRINTER_CB_STATFUNC_T(&SimSdCard::event_handler));
+        o->active = false;
+        o->initing = false;
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        o->event.deinit(c);
+    }
+    
+    static void activate (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->active)
+        AMBRO_ASSERT(!o->event.isSet(c))
+        
+        o->initing = true;
+        o->event.prependNowNotAlready(c);
+    }
+    
+    static void deactivate (Context c)
+    {
+        auto *o = Object::self(c);
+        o->event.unset(c);
+        o->active = false;
+        o->initing = false;
+    }
+    
+    static BlockIndexType getCapacityBlocks (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->active)
+        
+        return sim_sdcard_data.size() / BlockSize;
+    }
+    
+    static void startReadOrWrite (Context c, bool is_write, BlockIndexType block, size_t num_blocks, TransferVector<DataWordType> data_vector)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->active)
+        AMBRO_ASSERT(!o->event.isSet(c))
+        AMBRO_ASSERT(!is_write)
+        AMBRO_ASSERT(num_blocks > 0)
+        AMBRO_ASSERT(num_blocks <= MaxIoBlocks)
+        AMBRO_ASSERT(num_blocks <= getCapacityBlocks(c) - block)
+        AMBRO_ASSERT(CheckTransferVector(data_vector, num_blocks * (BlockSize/sizeof(DataWordType))))
+        
+        char const *src = sim_sdcard_data.data() + (size_t)block * BlockSize;
+        for (int i = 0; i < data_vector.num_descriptors; i++) {
+            size_t bytes = data_vector.descriptors[i].num_words * sizeof(DataWordType);
+            memcpy(data_vector.descriptors[i].buffer_ptr, src, bytes);
+            src += bytes;
+        }
+        o->event.prependNowNotAlready(c);
+    }
+    
+private:
+    static void event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->initing) {
+            o->initing = false;
+            o->active = true;
+            return InitHandler::call(c, 0);
+        }
+        return CommandHandler::call(c, false);
+    }
+    
+public:
+    struct Object : public ObjBase<SimSdCard, ParentObject, EmptyTypeList> {
+        typename Context::EventLoop::QueuedEvent event;
+        bool active;
+        bool initing;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SimSdCardService, (
+    APRINTER_AS_VALUE(size_t, MaxIoBlocks)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(SdCard, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(InitHandler),
+        APRINTER_AS_TYPE(CommandHandler)
+    ), (
+        using Params = SimSdCardService;
+        APRINTER_DEF_INSTANCE(SdCard, SimSdCard)
+    ))
+))
+
+/*
+ * Module which acts as the host: it sends M21 and M24, waits until the SD
+ * printing ends, then sends M400 and stops the simulation when all motion has
+ * completed. It also samples the step positions.
+ */
+
+template <typename ModuleArg>
+class SimHostModule {
+    APRINTER_UNPACK_MODULE_ARG(ModuleArg)
+    
+public:
+    struct Object;
+    
+private:
+    using TimeType = typename Context::Clock::TimeType;
+    using TheGcodeParser = typename FileGcodeParserService<16, false>::template Parser<Context, size_t, typename ThePrinterMain::FpType>;
+    
+    static TimeType const SampleIntervalTicks = 0.001 * Context::Clock::time_freq;
+    static int const NumCommands = 3;
+    
+    static char const * get_command (int index)
+    {
+        static char const *commands[NumCommands] = {"M21\n", "M24\n", "M400\n"};
+        return commands[index];
+    }
+    
+    // Printed by SdCardModule when it stops reading the file.
+    static bool sd_printing_ended ()
+    {
+        static char const *markers[] = {"//SdEof", "//SdEnd", "//SdCmdError", "//SdLnEr", "//SdAbort"};
+        for (char const *marker : markers) {
+            if (sim_replies.find(marker) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        o->gcode_parser.init(c);
+        o->command_stream.init(c, &o->callback, &o->callback);
+        o->next_event.init(c, APRINTER_CB_STATFUNC_T(&SimHostModule::next_event_handler));
+        o->sample_timer.init(c, APRINTER_CB_STATFUNC_T(&SimHostModule::sample_timer_handler));
+        o->command_index = 0;
+        o->sample_count = 0;
+        o->next_event.prependNowNotAlready(c);
+        o->sample_timer.appendAfter(c, SampleIntervalTicks);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        o->sample_timer.deinit(c);
+        o->next_event.deinit(c);
+        o->command_stream.deinit(c);
+        o->gcode_parser.deinit(c);
+    }
+    
+private:
+    struct StreamCallback : public ThePrinterMain::CommandStreamCallback, ThePrinterMain::SendBufEventCallback {
+        void finish_command_impl (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            o->command_index++;
+            if (o->command_index == NumCommands) {
+                return Context::EventLoop::stop(c);
+            }
+            if (o->command_index != NumCommands - 1) {
+                o->next_event.prependNowNotAlready(c);
+            }
+        }
+        
+        void reply_poke_impl (Context c, bool push)
+        {
+        }
+        
+        void reply_append_buffer_impl (Context c, char const *str, size_t length)
+        {
+            sim_replies.append(str, length);
+        }
+        
+        size_t get_send_buf_avail_impl (Context c)
+        {
+            return (size_t)-1 / 2;
+        }
+        
+        bool request_send_buf_event_impl (Context c, size_t length)
+        {
+            return false;
+        }
+        
+        void cancel_send_buf_event_impl (Context c)
+        {
+        }
+    };
+    
+    static void next_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->command_stream.hasCommand(c))
+        AMBRO_ASSERT(o->command_index < NumCommands)
+        
+        // The parser works in place, so the command is copied to a buffer.
+        size_t length = strlen(get_command(o->command_index));
+        memcpy(o->command_buffer, get_command(o->command_index), length);
+        o->gcode_parser.startCommand(c, o->command_buffer, 0);
+        bool complete = o->gcode_parser.extendCommand(c, length, false);
+        AMBRO_ASSERT_FORCE(complete)
+        o->command_stream.startCommand(c, &o->gcode_parser);
+    }
+    
+    static void sample_timer_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->sample_timer.appendAfterPrevious(c, SampleIntervalTicks);
+        o->sample_count++;
+        
+        printf("sample %.3f", o->sample_count * (SampleIntervalTicks * Context::Clock::time_unit));
+        for (int i = 0; i < NumSimSteppers; i++) {
+            printf(" %" PRId32, Context::Pins::getStepperRecord(c, i)->position);
+        }
+        printf("\n");
+        
+        if (o->command_index == NumCommands - 1 && !o->command_stream.hasCommand(c) && !o->next_event.isSet(c) && sd_printing_ended()) {
+            o->next_event.prependNowNotAlready(c);
+        }
+    }
+    
+public:
+    struct Object : public ObjBase<SimHostModule, ParentObject, EmptyTypeList> {
+        TheGcodeParser gcode_parser;
+        typename ThePrinterMain::CommandStream command_stream;
+        StreamCallback callback;
+        typename Context::EventLoop::QueuedEvent next_event;
+        typename Context::EventLoop::TimedEvent sample_timer;
+        char command_buffer[8];
+        int command_index;
+        uint32_t sample_count;
+    };
+};
+
+struct SimHostModuleService {
+    APRINTER_MODULE_TEMPLATE(SimHostModuleService, SimHostModule)
+};
+
+/*
+ * Printer configuration. This is the configuration of motionplanner_bench,
+ * and tests/preplan_test.py describes the same machine to aprinter_preplan.py.
+ */
+
+using LedBlinkInterval = AMBRO_WRAP_DOUBLE(0.5);
+using SpeedLimitMultiply = AMBRO_WRAP_DOUBLE(1.0 / 60.0);
+using CommandBatchMaxTime = AMBRO_WRAP_DOUBLE(0.001);
+
+APRINTER_CONFIG_START
+
+APRINTER_CONFIG_OPTION_DOUBLE(ForceTimeout, 0.1, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(InactiveTime, 480.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(MaxStepsPerCycle, 100000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_SIMPLE(JunctionDeviationEnabled, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(JunctionDeviation, 0.05, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ArcTolerance, 0.01, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ArcMinSegmentTime, 0.005, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(PressureAdvance, 0.0, ConfigProperties<ConfigPropertyConstant>)
+
+APRINTER_CONFIG_OPTION_SIMPLE(XInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XStepsPerUnit, 80.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMinPos, -1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMaxPos, 1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMaxSpeed, 300.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XMaxAccel, 1500.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(XCorneringDistance, 40.0, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(YInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YStepsPerUnit, 80.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMinPos, -1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMaxPos, 1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMaxSpeed, 300.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YMaxAccel, 1500.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(YCorneringDistance, 40.0, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(ZInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZStepsPerUnit, 4000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMinPos, -1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMaxPos, 1000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMaxSpeed, 3.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZMaxAccel, 30.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ZCorneringDistance, 40.0, ConfigNoProperties)
+
+APRINTER_CONFIG_OPTION_SIMPLE(EInvertDir, bool, false, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EStepsPerUnit, 928.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMinPos, -40000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMaxPos, 40000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMaxSpeed, 45.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EMaxAccel, 250.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(EDistanceFactor, 1.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(ECorneringDistance, 40.0, ConfigNoProperties)
+
+#if SIM_DELTA
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaStepsPerUnit, 87.489, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxSpeed, 250.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxAccel, 4000.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaDiagonalRod, 160.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaSmoothRodOffset, 81.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaEffectorOffset, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaCarriageOffset, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaLimitRadius, 75.1, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMinSplitLength, 0.1, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaMaxSplitLength, 3.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(DeltaSegmentsPerSecond, 150.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtXYMinPos, -100.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtXYMaxPos, 100.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtZMinPos, 0.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtZMaxPos, 155.0, ConfigNoProperties)
+APRINTER_CONFIG_OPTION_DOUBLE(VirtMaxSpeed, 500.0, ConfigNoProperties)
+#endif
+
+APRINTER_CONFIG_END
+
+template <int Index, typename InvertDir>
+using SimSteppersList = MakeTypeList<
+    PrinterMainSlaveStepperParams<
+        StepperDef<SimDirPin<Index>, SimStepPin<Index>, StubPin, true, false, InvertDir>
+    >
+>;
+
+template <int Index>
+using SimAxisDriverService = AxisDriverService<
+    SimClockInterruptTimerService<Index>,
+    AxisDriverDuePrecisionParams,
+    false,
+    AxisDriverNoDelayParams,
+    AxisDriverNoBurstParams
+>;
+
+template <char Name, typename StepsPerUnit, typename MinPos, typename MaxPos, typename MaxSpeed, typename MaxAccel, typename DistanceFactor, typename CorneringDistance, bool EnableCartesianSpeedLimit, bool IsExtruder, int Index, typename InvertDir>
+using SimAxisParams = PrinterMainAxisParams<Name, StepsPerUnit, MinPos, MaxPos, MaxSpeed, MaxAccel, DistanceFactor, CorneringDistance, PressureAdvance,
+    PrinterMainNoInputShaperParams, PrinterMainNoJerkLimitParams, PrinterMainNoHomingParams, EnableCartesianSpeedLimit, IsExtruder, 32,
+    SimAxisDriverService<Index>, SimSteppersList<Index, InvertDir>>;
+
+struct Context;
+struct Program;
+
+using MyDebugObjectGroup = DebugObjectGroup<Context, Program>;
+
+APRINTER_MAKE_INSTANCE(MyClock, (SimClockService<20, NumSimSteppers>::Clock<Context, Program, MakeTypeList<void>>))
+
+struct MyLoopExtraDelay;
+APRINTER_MAKE_INSTANCE(MyLoop, (SimEventLoopArg<Context, Program, MyLoopExtraDelay>))
+
+APRINTER_MAKE_INSTANCE(Pins, (SimPinsService<NumSimSteppers>::Pins<Context, Program>))
+
+struct ThePrinterParams : public PrinterMainParams<
+    StubPin, // LedPin
+    LedBlinkInterval,
+    InactiveTime,
+    128, // ExpectedResponseLength
+    512, // ExtraSendBufClearance
+    128, // MaxMsgSize
+    SpeedLimitMultiply,
+    MaxStepsPerCycle,
+    64, // StepperSegmentBufferSize
+    32, // LookaheadBufferSize
+    8, // LookaheadCommitCount
+    JunctionDeviationEnabled,
+    JunctionDeviation,
+    ForceTimeout,
+    8, // CommandBatchMaxCommands
+    CommandBatchMaxTime,
+    float, // FpType
+    NullWatchdogService,
+    false, // WatchdogDebugMode
+    RuntimeConfigManagerService<RuntimeConfigManagerNoStoreService>,
+    ConfigList,
+    MakeTypeList<
+#if SIM_DELTA
+        SimAxisParams<'A', DeltaStepsPerUnit, XMinPos, XMaxPos, DeltaMaxSpeed, DeltaMaxAccel, XDistanceFactor, XCorneringDistance, false, false, 0, XInvertDir>,
+        SimAxisParams<'B', DeltaStepsPerUnit, YMinPos, YMaxPos, DeltaMaxSpeed, DeltaMaxAccel, YDistanceFactor, YCorneringDistance, false, false, 1, YInvertDir>,
+        SimAxisParams<'C', DeltaStepsPerUnit, ZMinPos, ZMaxPos, DeltaMaxSpeed, DeltaMaxAccel, ZDistanceFactor, ZCorneringDistance, false, false, 2, ZInvertDir>,
+#else
+        SimAxisParams<'X', XStepsPerUnit, XMinPos, XMaxPos, XMaxSpeed, XMaxAccel, XDistanceFactor, XCorneringDistance, true, false, 0, XInvertDir>,
+        SimAxisParams<'Y', YStepsPerUnit, YMinPos, YMaxPos, YMaxSpeed, YMaxAccel, YDistanceFactor, YCorneringDistance, true, false, 1, YInvertDir>,
+        SimAxisParams<'Z', ZStepsPerUnit, ZMinPos, ZMaxPos, ZMaxSpeed, ZMaxAccel, ZDistanceFactor, ZCorneringDistance, true, false, 2, ZInvertDir>,
+#endif
+        SimAxisParams<'E', EStepsPerUnit, EMinPos, EMaxPos, EMaxSpeed, EMaxAccel, EDistanceFactor, ECorneringDistance, false, true, 3, EInvertDir>
+    >,
+#if SIM_DELTA
+    PrinterMainTransformParams<
+        MakeTypeList<
+            PrinterMainVirtualAxisParams<'X', VirtXYMinPos, VirtXYMaxPos, VirtMaxSpeed>,
+            PrinterMainVirtualAxisParams<'Y', VirtXYMinPos, VirtXYMaxPos, VirtMaxSpeed>,
+            PrinterMainVirtualAxisParams<'Z', VirtZMinPos, VirtZMaxPos, VirtMaxSpeed>
+        >,
+        MakeTypeList<WrapInt<'A'>, WrapInt<'B'>, WrapInt<'C'>>,
+        DeltaTransformService<DeltaDiagonalRod, DeltaSmoothRodOffset, DeltaEffectorOffset, DeltaCarriageOffset, DeltaLimitRadius>,
+        DistanceSplitterService<DeltaMinSplitLength, DeltaMaxSplitLength, DeltaSegmentsPerSecond>
+    >,
+#else
+    PrinterMainNoTransformParams,
+#endif
+    PrinterMainArcParams<ArcTolerance, ArcMinSegmentTime>,
+    MakeTypeList<>,
+    MakeTypeList<
+        SdCardModuleService<
+            SdRawInputService<SimSdCardService<4>>,
+            FileGcodeParserService<16, false>,
+            2048, // BufferBaseSize
+            128, // MaxCommandSize
+            true // SegmentBlocksEnabled
+        >,
+        SimHostModuleService
+    >
+> {};
+
+APRINTER_MAKE_INSTANCE(MyPrinter, (PrinterMainArg<Context, Program, ThePrinterParams>))
+
+struct Context {
+    using DebugGroup = MyDebugObjectGroup;
+    using Clock = ::MyClock;
+    using EventLoop = ::MyLoop;
+    using Pins = ::Pins;
+    using Printer = ::MyPrinter;
+    void check () const {}
+};
+
+APRINTER_DEFINE_MEMBER_TYPE(MemberType_EventLoopFastEvents, EventLoopFastEvents)
+APRINTER_MAKE_INSTANCE(MyLoopExtra, (BusyEventLoopExtraArg<Program, MyLoop, ObjCollect<MakeTypeList<MyPrinter>, MemberType_EventLoopFastEvents>>))
+struct MyLoopExtraDelay : public WrapType<MyLoopExtra> {};
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    MyDebugObjectGroup,
+    MyClock,
+    MyLoop,
+    Pins,
+    MyPrinter,
+    MyLoopExtra
+>> {
+    static Program * self (Context c);
+};
+
+union ProgramMemory {
+    ProgramMemory () {}
+    ~ProgramMemory () {}
+    
+    Program program;
+} program_memory;
+
+Program * Program::self (Context c) { return &program_memory.program; }
+
+using ThePlanner = typename MyPrinter::ThePlanner;
+
+static bool read_file (char const *path, std::string *data)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    size_t res;
+    while ((res = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data->append(buf, res);
+    }
+    fclose(f);
+    return true;
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s file.gcode\n", argv[0]);
+        return 1;
+    }
+    
+    if (!read_file(argv[1], &sim_sdcard_data)) {
+        fprintf(stderr, "Failed to read %s\n", argv[1]);
+        return 1;
+    }
+    if (!sim_sdcard_data.empty() && sim_sdcard_data.back() != '\n') {
+        sim_sdcard_data += '\n';
+    }
+    sim_sdcard_data += "E\n";
+    sim_sdcard_data.resize((sim_sdcard_data.size() + SdBlockSize - 1) / SdBlockSize * SdBlockSize, '\n');
+    
+    Context c;
+    
+    new(&program_memory.program) Program();
+    
+    MyDebugObjectGroup::init(c);
+    
+    MyClock::init(c);
+    MyLoop::init(c);
+    Pins::init(c);
+    MyPrinter::init(c);
+    MyLoop::run(c);
+    
+    size_t pos = 0;
+    while (pos < sim_replies.size()) {
+        size_t end = sim_replies.find('\n', pos);
+        if (end == std::string::npos) {
+            end = sim_replies.size();
+        }
+        printf("reply %s\n", sim_replies.substr(pos, end - pos).c_str());
+        pos = end + 1;
+    }
+    
+    auto stats = ThePlanner::getBenchStats(c);
+    printf("virtual_time_s %.6f\n", MyClock::getTotalTicks(c) * MyClock::time_unit);
+    printf("segments %" PRIu32 "\n", stats.segments);
+    for (int i = 0; i < NumSimSteppers; i++) {
+        printf("axis%d_position %" PRId32 "\n", i, Pins::getStepperRecord(c, i)->position);
+    }
+    
+    return 0;
+}